@@ -10,6 +10,7 @@ expr
     | expr (MUL | DIV) expr  # BinaryOp
     | expr (ADD | SUB) expr  # BinaryOp
     | CELL  # Cell
+    | SHEET_CELL  # SheetCell
     | NUMBER  # Literal
     ;
 
@@ -26,5 +27,10 @@ ADD: '+' ;
 SUB: '-' ;
 MUL: '*' ;
 DIV: '/' ;
-CELL: [A-Z]+[0-9]+ ;
+// #REF! is a reference to a deleted cell, left by row and column deletion
+CELL: [A-Z]+[0-9]+ | REF ;
+// a reference to a cell of another workbook sheet: Sheet2!A1
+SHEET_CELL: SHEET_NAME '!' ([A-Z]+[0-9]+ | REF) ;
+fragment REF: '#REF!' ;
+fragment SHEET_NAME: [A-Za-z_] [A-Za-z0-9_]* ;
 WS: [ \t\n\r]+ -> skip ; 
\ No newline at end of file
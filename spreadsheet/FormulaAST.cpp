@@ -1,4 +1,5 @@
 #include "FormulaAST.h"
+#include "memory_usage.h"
 
 #include "FormulaBaseListener.h"
 #include "FormulaParser.h"
@@ -73,7 +74,10 @@ public:
     virtual ~Expr() = default;
     virtual void Print(std::ostream& out) const = 0;
     virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-    virtual double Evaluate(const CellLookup& cell_lookup) const = 0;
+    virtual double Evaluate(const CellLookup& cell_lookup, const SheetCellLookup& sheet_cell_lookup) const = 0;
+    virtual void Compile(FormulaProgram& program) const = 0;
+    // memory of the node and its subtree, see EstimateAllocation
+    virtual size_t GetMemoryUsage() const = 0;
 
     // higher is tighter
     virtual ExprPrecedence GetPrecedence() const = 0;
@@ -146,38 +150,38 @@ public:
     }
 
     // При делении на 0 выбрасывается ошибка вычисления FormulaError
-    double Evaluate(const CellLookup& cell_lookup) const override {
+    double Evaluate(const CellLookup& cell_lookup, const SheetCellLookup& sheet_cell_lookup) const override {
         double result = 0.0;
         double left_operand = 0.0;
         double right_operand = 0.0;
         switch (type_) {
             case Add:
-                left_operand = lhs_->Evaluate(cell_lookup);
-                right_operand = rhs_->Evaluate(cell_lookup);
+                left_operand = lhs_->Evaluate(cell_lookup, sheet_cell_lookup);
+                right_operand = rhs_->Evaluate(cell_lookup, sheet_cell_lookup);
                 result = left_operand + right_operand;
                 if (std::isinf(result) || std::isnan(result)) {
                     throw FormulaError{FormulaError::Category::Div0};
                 }
                 return result;
             case Subtract:
-                left_operand = lhs_->Evaluate(cell_lookup);
-                right_operand = rhs_->Evaluate(cell_lookup);
+                left_operand = lhs_->Evaluate(cell_lookup, sheet_cell_lookup);
+                right_operand = rhs_->Evaluate(cell_lookup, sheet_cell_lookup);
                 result = left_operand - right_operand;
                 if (std::isinf(result) || std::isnan(result)) {
                     throw FormulaError{FormulaError::Category::Div0};
                 }
                 return result;
             case Multiply:
-                left_operand = lhs_->Evaluate(cell_lookup);
-                right_operand = rhs_->Evaluate(cell_lookup);
+                left_operand = lhs_->Evaluate(cell_lookup, sheet_cell_lookup);
+                right_operand = rhs_->Evaluate(cell_lookup, sheet_cell_lookup);
                 result = left_operand * right_operand;
                 if (std::isinf(result) || std::isnan(result)) {
                     throw FormulaError{FormulaError::Category::Div0};
                 }
                 return result;
             case Divide:
-                left_operand = lhs_->Evaluate(cell_lookup);
-                right_operand = rhs_->Evaluate(cell_lookup);
+                left_operand = lhs_->Evaluate(cell_lookup, sheet_cell_lookup);
+                right_operand = rhs_->Evaluate(cell_lookup, sheet_cell_lookup);
                 if (std::isfinite(left_operand / right_operand)) {
                     return left_operand / right_operand;
                 }
@@ -191,6 +195,32 @@ public:
         }
     }
 
+    void Compile(FormulaProgram& program) const override {
+        lhs_->Compile(program);
+        rhs_->Compile(program);
+        switch (type_) {
+            case Add:
+                program.push_back({FormulaOp::Add, 0.0, Position{}, {}});
+                break;
+            case Subtract:
+                program.push_back({FormulaOp::Subtract, 0.0, Position{}, {}});
+                break;
+            case Multiply:
+                program.push_back({FormulaOp::Multiply, 0.0, Position{}, {}});
+                break;
+            case Divide:
+                program.push_back({FormulaOp::Divide, 0.0, Position{}, {}});
+                break;
+            default:
+                // have to do this because VC++ has a buggy warning
+                assert(false);
+        }
+    }
+
+    size_t GetMemoryUsage() const override {
+        return EstimateAllocation(sizeof(*this)) + lhs_->GetMemoryUsage() + rhs_->GetMemoryUsage();
+    }
+
 private:
     Type type_;
     std::unique_ptr<Expr> lhs_;
@@ -225,12 +255,12 @@ public:
         return EP_UNARY;
     }
 
-    double Evaluate(const CellLookup& cell_lookup) const override {
+    double Evaluate(const CellLookup& cell_lookup, const SheetCellLookup& sheet_cell_lookup) const override {
         switch (type_) {
             case UnaryPlus:
-                return operand_->Evaluate(cell_lookup);
+                return operand_->Evaluate(cell_lookup, sheet_cell_lookup);
             case UnaryMinus:
-                return -(operand_->Evaluate(cell_lookup));
+                return -(operand_->Evaluate(cell_lookup, sheet_cell_lookup));
             default:
                 // have to do this because VC++ has a buggy warning
                 assert(false);
@@ -238,6 +268,15 @@ public:
         }  
     }
 
+    void Compile(FormulaProgram& program) const override {
+        operand_->Compile(program);
+        program.push_back({type_ == UnaryMinus ? FormulaOp::UnaryMinus : FormulaOp::UnaryPlus, 0.0, Position{}, {}});
+    }
+
+    size_t GetMemoryUsage() const override {
+        return EstimateAllocation(sizeof(*this)) + operand_->GetMemoryUsage();
+    }
+
 private:
     Type type_;
     std::unique_ptr<Expr> operand_;
@@ -253,7 +292,8 @@ public:
         if (!cell_->IsValid()) {
             out << FormulaError::Category::Ref;
         } else {
-            out << cell_->ToString();
+            char buffer[Position::MAX_POSITION_LENGTH];
+            out.write(buffer, cell_->ToChars(buffer, buffer + Position::MAX_POSITION_LENGTH) - buffer);
         }
     }
 
@@ -265,14 +305,64 @@ public:
         return EP_ATOM;
     }
 
-    double Evaluate(const CellLookup& cell_lookup) const override {
+    double Evaluate(const CellLookup& cell_lookup, const SheetCellLookup& /* sheet_cell_lookup */) const override {
         return cell_lookup(*cell_);
     }
 
+    void Compile(FormulaProgram& program) const override {
+        program.push_back({FormulaOp::Cell, 0.0, *cell_, {}});
+    }
+
+    // the referenced cell is stored in the reference list of FormulaAST
+    size_t GetMemoryUsage() const override {
+        return EstimateAllocation(sizeof(*this));
+    }
+
 private:
     const Position* cell_;
 };
 
+class SheetCellExpr final : public Expr {
+public:
+    explicit SheetCellExpr(const SheetReference* reference)
+        : reference_(reference) {
+    }
+
+    void Print(std::ostream& out) const override {
+        out << reference_->sheet << '!';
+        if (!reference_->cell.IsValid()) {
+            out << FormulaError::Category::Ref;
+        } else {
+            char buffer[Position::MAX_POSITION_LENGTH];
+            out.write(buffer, reference_->cell.ToChars(buffer, buffer + Position::MAX_POSITION_LENGTH) - buffer);
+        }
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+        Print(out);
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    double Evaluate(const CellLookup& /* cell_lookup */, const SheetCellLookup& sheet_cell_lookup) const override {
+        return sheet_cell_lookup(reference_->sheet, reference_->cell);
+    }
+
+    void Compile(FormulaProgram& program) const override {
+        program.push_back({FormulaOp::SheetCell, 0.0, reference_->cell, reference_->sheet});
+    }
+
+    // the referenced cell is stored in the reference list of FormulaAST
+    size_t GetMemoryUsage() const override {
+        return EstimateAllocation(sizeof(*this));
+    }
+
+private:
+    const SheetReference* reference_;
+};
+
 class NumberExpr final : public Expr {
 public:
     explicit NumberExpr(double value)
@@ -291,10 +381,18 @@ public:
         return EP_ATOM;
     }
 
-    double Evaluate(const CellLookup& cell_lookup) const override {
+    double Evaluate(const CellLookup& /* cell_lookup */, const SheetCellLookup& /* sheet_cell_lookup */) const override {
         return value_;
     }
 
+    void Compile(FormulaProgram& program) const override {
+        program.push_back({FormulaOp::Number, value_, Position{}, {}});
+    }
+
+    size_t GetMemoryUsage() const override {
+        return EstimateAllocation(sizeof(*this));
+    }
+
 private:
     double value_;
 };
@@ -313,6 +411,10 @@ public:
         return std::move(cells_);
     }
 
+    std::forward_list<SheetReference> MoveSheetCells() {
+        return std::move(sheet_cells_);
+    }
+
 public:
     void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override {
         assert(args_.size() >= 1);
@@ -346,16 +448,29 @@ public:
 
     void exitCell(FormulaParser::CellContext* ctx) override {
         auto value_str = ctx->CELL()->getSymbol()->getText();
-        auto value = Position::FromString(value_str);
-        if (!value.IsValid()) {
+        auto value = ParseReference(value_str);
+        if (!value) {
             throw FormulaException("Invalid position: " + value_str);
         }
 
-        cells_.push_front(value);
+        cells_.push_front(*value);
         auto node = std::make_unique<CellExpr>(&cells_.front());
         args_.push_back(std::move(node));
     }
 
+    void exitSheetCell(FormulaParser::SheetCellContext* ctx) override {
+        auto value_str = ctx->SHEET_CELL()->getSymbol()->getText();
+        auto separator = value_str.find('!');
+        auto value = ParseReference(std::string_view(value_str).substr(separator + 1));
+        if (!value) {
+            throw FormulaException("Invalid position: " + value_str);
+        }
+
+        sheet_cells_.push_front(SheetReference{value_str.substr(0, separator), *value});
+        auto node = std::make_unique<SheetCellExpr>(&sheet_cells_.front());
+        args_.push_back(std::move(node));
+    }
+
     void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override {
         assert(args_.size() >= 2);
 
@@ -385,8 +500,22 @@ public:
     }
 
 private:
+    // #REF! stands for a deleted cell and parses to Position::NONE;
+    // returns nullopt for an invalid position
+    static std::optional<Position> ParseReference(std::string_view str) {
+        if (str == "#REF!") {
+            return Position::NONE;
+        }
+        Position value = Position::FromString(str);
+        if (!value.IsValid()) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
     std::vector<std::unique_ptr<Expr>> args_;
     std::forward_list<Position> cells_;
+    std::forward_list<SheetReference> sheet_cells_;
 };
 
 class BailErrorListener : public antlr4::BaseErrorListener {
@@ -423,7 +552,7 @@ FormulaAST ParseFormulaAST(std::istream& in) {
     ASTImpl::ParseASTListener listener;
     tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+    return FormulaAST(listener.MoveRoot(), listener.MoveCells(), listener.MoveSheetCells());
 }
 
 FormulaAST ParseFormulaAST(const std::string& in_str) {
@@ -435,9 +564,77 @@ FormulaAST ParseFormulaAST(const std::string& in_str) {
     }
 }
 
+FormulaAST ParseFormulaAST(const FormulaProgram& program) {
+    using namespace ASTImpl;
+    std::vector<std::unique_ptr<Expr>> args;
+    std::forward_list<Position> cells;
+    std::forward_list<SheetReference> sheet_cells;
+
+    auto pop_arg = [&args]() {
+        if (args.empty()) {
+            throw FormulaException("Invalid formula program");
+        }
+        auto arg = std::move(args.back());
+        args.pop_back();
+        return arg;
+    };
+
+    for (const FormulaOp& op : program) {
+        switch (op.type) {
+            case FormulaOp::Number:
+                args.push_back(std::make_unique<NumberExpr>(op.value));
+                break;
+            case FormulaOp::Cell:
+                if (!op.cell.IsValid() && !(op.cell == Position::NONE)) {
+                    throw FormulaException("Invalid position in formula program");
+                }
+                cells.push_front(op.cell);
+                args.push_back(std::make_unique<CellExpr>(&cells.front()));
+                break;
+            case FormulaOp::SheetCell:
+                if ((!op.cell.IsValid() && !(op.cell == Position::NONE)) || op.sheet.empty()) {
+                    throw FormulaException("Invalid sheet reference in formula program");
+                }
+                sheet_cells.push_front(SheetReference{op.sheet, op.cell});
+                args.push_back(std::make_unique<SheetCellExpr>(&sheet_cells.front()));
+                break;
+            case FormulaOp::Add:
+            case FormulaOp::Subtract:
+            case FormulaOp::Multiply:
+            case FormulaOp::Divide: {
+                auto rhs = pop_arg();
+                auto lhs = pop_arg();
+                BinaryOpExpr::Type type = op.type == FormulaOp::Add        ? BinaryOpExpr::Add
+                                          : op.type == FormulaOp::Subtract ? BinaryOpExpr::Subtract
+                                          : op.type == FormulaOp::Multiply ? BinaryOpExpr::Multiply
+                                                                           : BinaryOpExpr::Divide;
+                args.push_back(std::make_unique<BinaryOpExpr>(type, std::move(lhs), std::move(rhs)));
+                break;
+            }
+            case FormulaOp::UnaryPlus:
+            case FormulaOp::UnaryMinus: {
+                auto operand = pop_arg();
+                UnaryOpExpr::Type type = op.type == FormulaOp::UnaryPlus ? UnaryOpExpr::UnaryPlus
+                                                                         : UnaryOpExpr::UnaryMinus;
+                args.push_back(std::make_unique<UnaryOpExpr>(type, std::move(operand)));
+                break;
+            }
+            default:
+                throw FormulaException("Invalid formula program");
+        }
+    }
+
+    if (args.size() != 1) {
+        throw FormulaException("Invalid formula program");
+    }
+    return FormulaAST(std::move(args.back()), std::move(cells), std::move(sheet_cells));
+}
+
 void FormulaAST::PrintCells(std::ostream& out) const {
+    char buffer[Position::MAX_POSITION_LENGTH];
     for (auto cell : cells_) {
-        out << cell.ToString() << ' ';
+        out.write(buffer, cell.ToChars(buffer, buffer + Position::MAX_POSITION_LENGTH) - buffer);
+        out << ' ';
     }
 }
 
@@ -449,14 +646,23 @@ void FormulaAST::PrintFormula(std::ostream& out) const {
     root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
 }
 
-double FormulaAST::Execute(const CellLookup& cell_lookup) const {
-    return root_expr_->Evaluate(cell_lookup);
+double FormulaAST::Execute(const CellLookup& cell_lookup, const SheetCellLookup& sheet_cell_lookup) const {
+    return root_expr_->Evaluate(cell_lookup, sheet_cell_lookup);
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
+FormulaProgram FormulaAST::Compile() const {
+    FormulaProgram program;
+    root_expr_->Compile(program);
+    return program;
+}
+
+FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells,
+                       std::forward_list<SheetReference> sheet_cells)
     : root_expr_(std::move(root_expr))
-    , cells_(std::move(cells)) {
+    , cells_(std::move(cells))
+    , sheet_cells_(std::move(sheet_cells)) {
     cells_.sort();  // to avoid sorting in GetReferencedCells
+    sheet_cells_.sort();
 }
 
 FormulaAST::~FormulaAST() = default;
@@ -467,4 +673,25 @@ std::forward_list<Position> FormulaAST::GetReferencedCells() {
 
 const std::forward_list<Position> FormulaAST::GetReferencedCells() const {
     return cells_;
+}
+
+const std::forward_list<SheetReference>& FormulaAST::GetSheetReferences() const {
+    return sheet_cells_;
+}
+
+size_t FormulaAST::GetMemoryUsage() const {
+    size_t usage = root_expr_->GetMemoryUsage() + EstimateForwardListMemory(cells_)
+        + EstimateForwardListMemory(sheet_cells_);
+    for (const SheetReference& reference : sheet_cells_) {
+        usage += EstimateStringMemory(reference.sheet);
+    }
+    return usage;
+}
+
+bool SheetReference::operator==(const SheetReference& rhs) const {
+    return sheet == rhs.sheet && cell == rhs.cell;
+}
+
+bool SheetReference::operator<(const SheetReference& rhs) const {
+    return sheet < rhs.sheet || (sheet == rhs.sheet && cell < rhs.cell);
 }
\ No newline at end of file
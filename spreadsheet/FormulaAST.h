@@ -6,13 +6,52 @@
 #include <forward_list>
 #include <functional>
 #include <stdexcept>
+#include <string>
+#include <vector>
+
+// Ссылка формулы на ячейку другого листа книги: Sheet2!A1.
+struct SheetReference {
+    std::string sheet;
+    Position cell;
+
+    bool operator==(const SheetReference& rhs) const;
+    bool operator<(const SheetReference& rhs) const;
+};
 
 using CellLookup = std::function<double(Position)>;
+using SheetCellLookup = std::function<double(const std::string& sheet, Position)>;
+// New position of a referenced cell; Position::NONE turns the reference into #REF!.
+using CellMove = std::function<Position(Position)>;
+using SheetCellMove = std::function<Position(const std::string& sheet, Position)>;
 
 namespace ASTImpl {
 class Expr;
 }
 
+// Элемент постфиксной записи формулы. Порядок элементов совпадает с порядком
+// вычисления дерева (сначала левый операнд, затем правый, затем операция).
+struct FormulaOp {
+    enum Type : char {
+        Number,
+        Cell,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        UnaryPlus,
+        UnaryMinus,
+        SheetCell,
+    };
+
+    Type type = Number;
+    double value = 0.0;
+    Position cell;
+    //имя листа для SheetCell
+    std::string sheet;
+};
+
+using FormulaProgram = std::vector<FormulaOp>;
+
 class ParsingError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
@@ -20,23 +59,33 @@ class ParsingError : public std::runtime_error {
 class FormulaAST {
     
 public:
-    explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells);
+    explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells,
+                        std::forward_list<SheetReference> sheet_cells = {});
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
 
-    double Execute(const CellLookup& cell_lookup) const;
+    double Execute(const CellLookup& cell_lookup, const SheetCellLookup& sheet_cell_lookup) const;
     void PrintCells(std::ostream &out) const;
     void Print(std::ostream &out) const;
     void PrintFormula(std::ostream& out) const;
+    FormulaProgram Compile() const;
 
     std::forward_list<Position> GetReferencedCells();
     const std::forward_list<Position> GetReferencedCells() const;
+    //ссылки на ячейки других листов, отсортированные по листу и позиции
+    const std::forward_list<SheetReference>& GetSheetReferences() const;
+    //память дерева разбора и списков ссылок, без самого объекта FormulaAST
+    size_t GetMemoryUsage() const;
 
 private:
     std::unique_ptr<ASTImpl::Expr> root_expr_;
     std::forward_list<Position> cells_;
+    std::forward_list<SheetReference> sheet_cells_;
 };
 
 FormulaAST ParseFormulaAST(std::istream& in);
-FormulaAST ParseFormulaAST(const std::string& in_str);
\ No newline at end of file
+FormulaAST ParseFormulaAST(const std::string& in_str);
+// Восстанавливает дерево формулы из постфиксной записи без повторного разбора текста.
+// Ссылка на Position::NONE - ссылка на удалённую ячейку (#REF!).
+FormulaAST ParseFormulaAST(const FormulaProgram& program);
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "async_recalculator.h"
+
+#include <exception>
+
+AsyncRecalculator::AsyncRecalculator(Sheet& sheet, size_t worker_count)
+    : sheet_(sheet) {
+    workers_.reserve(worker_count);
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers_.emplace_back([this]() {
+            Work();
+        });
+    }
+}
+
+AsyncRecalculator::~AsyncRecalculator() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void AsyncRecalculator::SetCell(Position pos, std::string text) {
+    //пересчёт зависимых ячеек откладывается до запроса их значений
+    sheet_.SetCell(pos, std::move(text));
+}
+
+void AsyncRecalculator::ClearCell(Position pos) {
+    sheet_.ClearCell(pos);
+}
+
+std::shared_future<CellInterface::Value> AsyncRecalculator::GetValueAsync(Position pos) {
+    std::lock_guard lock(mutex_);
+    return AddRequest(pos).future;
+}
+
+void AsyncRecalculator::GetValueAsync(Position pos, Callback callback) {
+    std::lock_guard lock(mutex_);
+    AddRequest(pos).callbacks.push_back(std::move(callback));
+}
+
+std::uint64_t AsyncRecalculator::GetCancelledCount() const {
+    std::lock_guard lock(mutex_);
+    return cancelled_count_;
+}
+
+std::uint64_t AsyncRecalculator::GetCallbackErrorCount() const {
+    return callback_error_count_.load();
+}
+
+AsyncRecalculator::Request& AsyncRecalculator::AddRequest(Position pos) {
+    if (!pos.IsValid()) {
+        using namespace std::literals;
+        throw InvalidPositionException("Position is not valid"s);
+    }
+
+    //запрос ячейки, которая уже ожидает в очереди, присоединяется к нему
+    auto [it, is_new] = requests_.try_emplace(pos);
+    if (is_new) {
+        it->second.future = it->second.promise.get_future().share();
+        queue_.push_back(pos);
+        wake_.notify_one();
+    }
+    return it->second;
+}
+
+void AsyncRecalculator::Work() {
+    Tracing::SetThreadName("recalculation worker");
+    std::unique_lock lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this]() {
+            return stop_ || !queue_.empty();
+        });
+        if (stop_) {
+            return;
+        }
+        Position pos = queue_.front();
+        queue_.pop_front();
+        //запросы, сделанные после начала вычисления, ждут следующего
+        auto node = requests_.extract(pos);
+        lock.unlock();
+
+        CellInterface::Value value;
+        std::exception_ptr error;
+        bool is_done = true;
+        try {
+            TraceSpan span("async_evaluate", pos);
+            is_done = Evaluate(pos, value);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        if (is_done) {
+            Complete(node.mapped(), value, error);
+            lock.lock();
+            continue;
+        }
+
+        lock.lock();
+        ++cancelled_count_;
+        auto it = requests_.find(pos);
+        if (it != requests_.end()) {
+            it->second.merged.push_back(std::move(node.mapped()));
+        } else {
+            requests_.insert(std::move(node));
+            queue_.push_back(pos);
+        }
+    }
+}
+
+void AsyncRecalculator::Complete(Request& request, const CellInterface::Value& value, std::exception_ptr error) {
+    if (error) {
+        request.promise.set_exception(error);
+    } else {
+        request.promise.set_value(value);
+    }
+    //исключение callback не должно завершать фоновый поток
+    for (const Callback& callback : request.callbacks) {
+        try {
+            callback(value, error);
+        } catch (...) {
+            ++callback_error_count_;
+        }
+    }
+    for (Request& merged : request.merged) {
+        Complete(merged, value, error);
+    }
+}
+
+bool AsyncRecalculator::Evaluate(Position pos, CellInterface::Value& value) {
+    //вычисление отменяется, если запрошенную ячейку инвалидировали во время её вычисления
+    EvaluationCancellation cancellation([this, pos]() {
+        const Cell* cell_ptr = sheet_.GetCell(pos);
+        return cell_ptr && cell_ptr->IsStale();
+    });
+    try {
+        value = sheet_.ReadValue(pos);
+        return true;
+    } catch (const EvaluationCancelled&) {
+        return false;
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common.h"
+#include "sheet.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Асинхронный пересчёт листа. SetCell и ClearCell проверяют и применяют изменение
+// (разбор формулы, проверка на цикличные ссылки, инвалидация зависимых ячеек) и сразу
+// возвращают управление; значения ячеек вычисляются фоновыми потоками по запросам
+// GetValueAsync. Запросы одной ячейки, ожидающие в очереди, объединяются; запрос,
+// сделанный во время вычисления ячейки, ставится в очередь заново. Если во время
+// вычисления изменилась ячейка, от которой зависит запрошенная, вычисление
+// отменяется и запрос возвращается в очередь, поэтому результат соответствует
+// состоянию листа не раньше момента запроса.
+// Вычисление выполняется в режиме параллельного чтения листа (см. Sheet).
+class AsyncRecalculator {
+public:
+    //получает значение ячейки или, если вычисление завершилось исключением, это
+    //исключение (значение тогда пустое)
+    using Callback = std::function<void(const CellInterface::Value& value, std::exception_ptr error)>;
+
+    static const size_t WORKER_COUNT = 2;
+
+    explicit AsyncRecalculator(Sheet& sheet, size_t worker_count = WORKER_COUNT);
+    //невыполненные запросы отбрасываются: их future получают std::future_error
+    ~AsyncRecalculator();
+
+    AsyncRecalculator(const AsyncRecalculator&) = delete;
+    AsyncRecalculator& operator=(const AsyncRecalculator&) = delete;
+
+    void SetCell(Position pos, std::string text);
+    void ClearCell(Position pos);
+
+    std::shared_future<CellInterface::Value> GetValueAsync(Position pos);
+    //callback вызывается в фоновом потоке; исключение, брошенное callback, не мешает
+    //остальным callback и учитывается в GetCallbackErrorCount()
+    void GetValueAsync(Position pos, Callback callback);
+
+    //число вычислений, отменённых из-за изменения листа
+    std::uint64_t GetCancelledCount() const;
+    //число callback, завершившихся исключением
+    std::uint64_t GetCallbackErrorCount() const;
+
+private:
+    struct Request {
+        std::promise<CellInterface::Value> promise;
+        std::shared_future<CellInterface::Value> future;
+        std::vector<Callback> callbacks;
+        //отменённые запросы, присоединённые к запросу той же ячейки из очереди
+        std::vector<Request> merged;
+    };
+
+    Request& AddRequest(Position pos);
+    void Complete(Request& request, const CellInterface::Value& value, std::exception_ptr error);
+    void Work();
+    //false, если вычисление отменено
+    bool Evaluate(Position pos, CellInterface::Value& value);
+
+    Sheet& sheet_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    //запросы, ожидающие в очереди, и очередь их позиций
+    std::unordered_map<Position, Request, Sheet::CellPositionHasher> requests_;
+    std::deque<Position> queue_;
+    std::uint64_t cancelled_count_ = 0;
+    std::atomic<std::uint64_t> callback_error_count_{0};
+
+    std::vector<std::thread> workers_;
+};
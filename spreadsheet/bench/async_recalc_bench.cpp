@@ -0,0 +1,57 @@
+#include "../async_recalculator.h"
+#include "../sheet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Бенчмарк асинхронного пересчёта: цепочка формул A2=A1+1, A3=A2+1, ... и поток
+// изменений её начала. После каждого изменения запрашивается значение конца цепочки;
+// следующее изменение не дожидается результата и отменяет устаревшее вычисление.
+// Выводится время SetCell (не зависит от длины цепочки), число отменённых вычислений
+// и проверяется, что дождавшиеся запросы получили значение не старее своего изменения.
+// Аргументы: длина цепочки (по умолчанию 1000), число изменений (по умолчанию 200).
+int main(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+
+    const int chain_size = argc > 1 ? std::stoi(argv[1]) : 1000;
+    const int edit_count = argc > 2 ? std::stoi(argv[2]) : 200;
+
+    Sheet sheet;
+    sheet.SetCell({0, 0}, "0");
+    for (int row = 1; row < chain_size; ++row) {
+        sheet.SetCell({row, 0}, "=" + Position{row - 1, 0}.ToString() + "+1");
+    }
+    const Position last{chain_size - 1, 0};
+
+    int errors = 0;
+    std::vector<double> set_times;
+    {
+        AsyncRecalculator recalculator(sheet);
+        for (int edit = 1; edit <= edit_count; ++edit) {
+            auto start = Clock::now();
+            recalculator.SetCell({0, 0}, std::to_string(edit));
+            set_times.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+
+            std::shared_future<CellInterface::Value> value = recalculator.GetValueAsync(last);
+            //каждое десятое изменение дожидается результата
+            if (edit % 10 == 0) {
+                const CellInterface::Value& result = value.get();
+                if (!std::holds_alternative<double>(result)
+                    || std::get<double>(result) != edit + chain_size - 1) {
+                    std::cerr << "unexpected value after edit " << edit << '\n';
+                    ++errors;
+                }
+            }
+        }
+        std::cout << "cancelled " << recalculator.GetCancelledCount() << '\n';
+    }
+
+    std::sort(set_times.begin(), set_times.end());
+    std::cout << "SetCell median " << set_times[set_times.size() / 2] << " us, max " << set_times.back()
+              << " us\nerrors " << errors << '\n';
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Минимальный набор для бенчмарков без внешних зависимостей.
+// Бенчмарк состоит из подготовки (не измеряется) и измеряемой части, которая
+// возвращает число выполненных операций. Каждый бенчмарк запускается repetitions раз
+// с новой подготовкой; результат - время одной операции: минимум, медиана и среднее
+// по запускам. Результаты выводятся в JSON.
+
+struct BenchmarkResult {
+    std::string name;
+    size_t operations = 0;
+    size_t repetitions = 0;
+    double min_ns = 0.0;
+    double median_ns = 0.0;
+    double mean_ns = 0.0;
+};
+
+class BenchmarkRunner {
+public:
+    //подготовка возвращает измеряемую часть; та возвращает число операций
+    using Body = std::function<size_t()>;
+    using Setup = std::function<Body()>;
+
+    //выполняются только бенчмарки, имя которых содержит filter
+    explicit BenchmarkRunner(size_t repetitions, std::string filter = {})
+        : repetitions_(std::max<size_t>(repetitions, 1))
+        , filter_(std::move(filter)) {
+    }
+
+    void Run(const std::string& name, const Setup& setup) {
+        using Clock = std::chrono::steady_clock;
+
+        if (name.find(filter_) == std::string::npos) {
+            return void();
+        }
+
+        BenchmarkResult result;
+        result.name = name;
+        result.repetitions = repetitions_;
+        std::vector<double> times;
+        for (size_t i = 0; i < repetitions_; ++i) {
+            Body body = setup();
+            auto start = Clock::now();
+            size_t operations = body();
+            double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            result.operations = std::max<size_t>(operations, 1);
+            times.push_back(ns / result.operations);
+        }
+        std::sort(times.begin(), times.end());
+        result.min_ns = times.front();
+        result.median_ns = times[times.size() / 2];
+        for (double time : times) {
+            result.mean_ns += time / times.size();
+        }
+        results_.push_back(std::move(result));
+    }
+
+    const std::vector<BenchmarkResult>& GetResults() const {
+        return results_;
+    }
+
+    //{"benchmarks": [{"name": ..., "operations": ..., "repetitions": ...,
+    //                 "min_ns": ..., "median_ns": ..., "mean_ns": ...}, ...]}
+    void WriteJson(std::ostream& output) const {
+        output << "{\n  \"benchmarks\": [";
+        bool is_first = true;
+        for (const BenchmarkResult& result : results_) {
+            output << (is_first ? "\n" : ",\n");
+            is_first = false;
+            output << "    {\"name\": ";
+            WriteJsonString(output, result.name);
+            output << ", \"operations\": " << result.operations
+                   << ", \"repetitions\": " << result.repetitions
+                   << ", \"min_ns\": " << FormatNumber(result.min_ns)
+                   << ", \"median_ns\": " << FormatNumber(result.median_ns)
+                   << ", \"mean_ns\": " << FormatNumber(result.mean_ns) << '}';
+        }
+        output << "\n  ]\n}\n";
+    }
+
+    static void WriteJsonString(std::ostream& output, std::string_view str) {
+        output << '"';
+        for (char c : str) {
+            if (c == '"' || c == '\\') {
+                output << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                output << buffer;
+            } else {
+                output << c;
+            }
+        }
+        output << '"';
+    }
+
+    //читает результаты, записанные WriteJson (по одному бенчмарку в строке)
+    static std::vector<BenchmarkResult> ReadJson(std::istream& input) {
+        std::vector<BenchmarkResult> results;
+        std::string line;
+        while (std::getline(input, line)) {
+            const std::string name_key = "{\"name\": \"";
+            size_t name_start = line.find(name_key);
+            if (name_start == std::string::npos) {
+                continue;
+            }
+            BenchmarkResult result;
+            for (size_t i = name_start + name_key.size(); i < line.size() && line[i] != '"'; ++i) {
+                if (line[i] == '\\' && i + 1 < line.size()) {
+                    ++i;
+                }
+                result.name += line[i];
+            }
+            result.operations = static_cast<size_t>(ReadNumber(line, "operations"));
+            result.repetitions = static_cast<size_t>(ReadNumber(line, "repetitions"));
+            result.min_ns = ReadNumber(line, "min_ns");
+            result.median_ns = ReadNumber(line, "median_ns");
+            result.mean_ns = ReadNumber(line, "mean_ns");
+            results.push_back(std::move(result));
+        }
+        return results;
+    }
+
+    //сравнивает минимальное время операции с базовыми результатами, полученными на
+    //той же машине с теми же параметрами. Бенчмарк регрессировал, если его время
+    //больше базового более чем в 1 + tolerance раз. Выводит таблицу сравнения и
+    //возвращает false при регрессии, при другом числе операций (другие параметры
+    //запуска) и если бенчмарка нет в базовых результатах
+    bool CheckAgainst(const std::vector<BenchmarkResult>& baseline, double tolerance, std::ostream& report) const {
+        bool is_ok = true;
+        for (const BenchmarkResult& result : results_) {
+            auto it = std::find_if(baseline.begin(), baseline.end(), [&result](const BenchmarkResult& base) {
+                return base.name == result.name;
+            });
+            report << result.name << '\t';
+            if (it == baseline.end()) {
+                report << "no baseline\n";
+                is_ok = false;
+                continue;
+            }
+            if (it->operations != result.operations) {
+                report << "operations " << result.operations << " != baseline " << it->operations << '\n';
+                is_ok = false;
+                continue;
+            }
+            double ratio = it->min_ns > 0 ? result.min_ns / it->min_ns : 1.0;
+            bool is_regression = ratio > 1.0 + tolerance;
+            report << FormatNumber(it->min_ns) << " ns -> " << FormatNumber(result.min_ns) << " ns ("
+                   << FormatNumber((ratio - 1.0) * 100.0) << "%)" << (is_regression ? "\tREGRESSION" : "") << '\n';
+            is_ok = is_ok && !is_regression;
+        }
+        return is_ok;
+    }
+
+private:
+    static double ReadNumber(const std::string& line, const std::string& key) {
+        size_t pos = line.find('"' + key + "\": ");
+        return pos == std::string::npos ? 0.0 : std::strtod(line.c_str() + pos + key.size() + 4, nullptr);
+    }
+
+    static std::string FormatNumber(double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.3f", value);
+        return buffer;
+    }
+
+    size_t repetitions_;
+    std::string filter_;
+    std::vector<BenchmarkResult> results_;
+};
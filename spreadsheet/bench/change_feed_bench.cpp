@@ -0,0 +1,134 @@
+#include "../sheet.h"
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Бенчмарк ленты изменений. Лист из rows строк: A - числа, B = A * 2, C = B + 1.
+// 1. Проверки: подписчик на столбец C получает значения, совпадающие с листом;
+//    изменение, не меняющее значений, не доставляется; после отписки события не приходят.
+// 2. Время SetCell (вместе с обработкой лентой) без подписок, с одной подпиской и с
+//    подписками на каждую ячейку столбца D (их ячейки не меняются): стоимость изменения
+//    не должна зависеть от числа подписок.
+// Аргументы: число строк (по умолчанию 10000), число изменений (по умолчанию 2000).
+namespace {
+
+int errors = 0;
+
+void Expect(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << message << '\n';
+        ++errors;
+    }
+}
+
+void FillSheet(Sheet& sheet, int rows) {
+    for (int row = 0; row < rows; ++row) {
+        std::string suffix = std::to_string(row + 1);
+        sheet.SetCell({row, 0}, std::to_string(row));
+        sheet.SetCell({row, 1}, "=A" + suffix + "*2");
+        sheet.SetCell({row, 2}, "=B" + suffix + "+1");
+    }
+}
+
+struct Recorder {
+    std::mutex mutex;
+    std::map<Position, CellInterface::Value> values;
+    size_t batch_count = 0;
+    size_t event_count = 0;
+
+    ChangeCallback MakeCallback() {
+        return [this](const std::vector<CellChange>& changes) {
+            std::lock_guard lock(mutex);
+            ++batch_count;
+            event_count += changes.size();
+            for (const CellChange& change : changes) {
+                values[change.pos] = change.value;
+            }
+        };
+    }
+};
+
+void CheckDelivery(int rows, int edit_count) {
+    Sheet sheet;
+    FillSheet(sheet, rows);
+    Recorder recorder;
+    size_t id = sheet.Subscribe(Position{0, 2}, Position{rows - 1, 2}, recorder.MakeCallback());
+
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> random_row(0, rows - 1);
+    for (int edit = 0; edit < edit_count; ++edit) {
+        sheet.SetCell({random_row(random), 0}, std::to_string(edit * 7));
+    }
+    sheet.FlushNotifications();
+    {
+        std::lock_guard lock(recorder.mutex);
+        for (const auto& [pos, value] : recorder.values) {
+            Expect(value == sheet.ReadValue(pos), "delivered value differs from the sheet at " + pos.ToString());
+        }
+        std::cout << "delivered " << recorder.event_count << " changes in " << recorder.batch_count << " batches\n";
+    }
+
+    sheet.SetCell({0, 0}, "5");
+    sheet.FlushNotifications();
+    //то же число формулой: значения C не меняются
+    size_t event_count = recorder.event_count;
+    sheet.SetCell({0, 0}, "=2+3");
+    sheet.FlushNotifications();
+    {
+        std::lock_guard lock(recorder.mutex);
+        Expect(recorder.event_count == event_count, "unchanged value was delivered");
+    }
+
+    sheet.Unsubscribe(id);
+    sheet.SetCell({0, 0}, "1000000");
+    sheet.FlushNotifications();
+    {
+        std::lock_guard lock(recorder.mutex);
+        Expect(recorder.event_count == event_count, "change was delivered after unsubscribe");
+    }
+}
+
+double MeasureEdits(int rows, int edit_count, int subscription_count) {
+    using Clock = std::chrono::steady_clock;
+
+    Sheet sheet;
+    FillSheet(sheet, rows);
+    Recorder recorder;
+    for (int row = 0; row < subscription_count; ++row) {
+        sheet.Subscribe(Position{row, 3}, recorder.MakeCallback());
+    }
+
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> random_row(0, rows - 1);
+    auto start = Clock::now();
+    for (int edit = 0; edit < edit_count; ++edit) {
+        sheet.SetCell({random_row(random), 0}, std::to_string(edit));
+    }
+    sheet.FlushNotifications();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    Expect(recorder.event_count == 0, "change of an unsubscribed cell was delivered");
+    return seconds * 1e6 / edit_count;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const int rows = argc > 1 ? std::stoi(argv[1]) : 10000;
+    const int edit_count = argc > 2 ? std::stoi(argv[2]) : 2000;
+
+    CheckDelivery(rows, edit_count);
+
+    for (int subscription_count : {0, 1, rows}) {
+        std::cout << "SetCell with " << subscription_count << " subscriptions "
+                  << MeasureEdits(rows, edit_count, subscription_count) << " us\n";
+    }
+
+    std::cout << "errors " << errors << '\n';
+    return errors == 0 ? 0 : 1;
+}
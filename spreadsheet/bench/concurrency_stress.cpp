@@ -0,0 +1,131 @@
+#include "../sheet.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+// Стресс-тест режима параллельного чтения: потоки чтения читают значения ячеек
+// через Sheet::ReadValue, а поток снимков проверяет весь лист через Sheet::Snapshot,
+// пока потоки записи переписывают формулы и аргументы.
+// Каждое чтение и каждый снимок должны видеть согласованное состояние листа:
+// * C = B + 1, B = A * 2 (формулы B и C заменяются равносильными), поэтому C = 2 * A + 1;
+// * Y = X * 3, W = Y - X * 3 при любых X, поэтому W = 0.
+// Для проверки гонок собирается с -fsanitize=thread (SPREADSHEET_TSAN в CMake).
+// Аргументы: число потоков чтения (по умолчанию 4) и длительность в секундах (по умолчанию 2).
+int main(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+
+    const int reader_count = argc > 1 ? std::stoi(argv[1]) : 4;
+    const double seconds = argc > 2 ? std::stod(argv[2]) : 2.0;
+    const int rows = 500;
+
+    //столбцы разнесены, чтобы ячейки строки попадали в разные области листа
+    const int col_a = 0, col_b = 20, col_c = 40, col_x = 60, col_y = 80, col_w = 100;
+    auto ref = [](int row, int col) {
+        return Position{row, col}.ToString();
+    };
+
+    Sheet sheet;
+    for (int row = 0; row < rows; ++row) {
+        sheet.SetCell({row, col_a}, std::to_string(row));
+        sheet.SetCell({row, col_b}, "=" + ref(row, col_a) + "*2");
+        sheet.SetCell({row, col_c}, "=" + ref(row, col_b) + "+1");
+        sheet.SetCell({row, col_x}, "1");
+        sheet.SetCell({row, col_y}, "=" + ref(row, col_x) + "*3");
+        sheet.SetCell({row, col_w}, "=" + ref(row, col_y) + "-" + ref(row, col_x) + "*3");
+    }
+
+    std::atomic<bool> stop = false;
+    std::atomic<long long> read_count = 0;
+    std::atomic<long long> snapshot_count = 0;
+    std::atomic<long long> write_count = 0;
+    std::atomic<long long> error_count = 0;
+
+    auto expect = [&error_count](const CellInterface::Value& value, double expected, Position pos) {
+        if (!std::holds_alternative<double>(value) || std::get<double>(value) != expected) {
+            if (error_count++ < 10) {
+                std::cerr << "unexpected value in " << pos.ToString() << '\n';
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < reader_count; ++i) {
+        threads.emplace_back([&, i]() {
+            std::mt19937 random(i);
+            long long count = 0;
+            while (!stop) {
+                int row = static_cast<int>(random() % rows);
+                expect(sheet.ReadValue({row, col_c}), 2.0 * row + 1, {row, col_c});
+                expect(sheet.ReadValue({row, col_w}), 0.0, {row, col_w});
+                count += 2;
+            }
+            read_count += count;
+        });
+    }
+
+    //снимок проверяется целиком, в том числе выводом значений
+    threads.emplace_back([&]() {
+        long long count = 0;
+        while (!stop) {
+            std::shared_ptr<const SheetView> view = sheet.Snapshot();
+            for (int row = 0; row < rows; ++row) {
+                expect(view->GetCell({row, col_c})->GetValue(), 2.0 * row + 1, {row, col_c});
+                expect(view->GetCell({row, col_w})->GetValue(), 0.0, {row, col_w});
+            }
+            std::ostringstream output;
+            view->PrintValues(output);
+            ++count;
+        }
+        snapshot_count += count;
+    });
+
+    //формулы B и C переписываются равносильными
+    threads.emplace_back([&]() {
+        std::mt19937 random(1000);
+        long long count = 0;
+        while (!stop) {
+            int row = static_cast<int>(random() % rows);
+            std::string a = ref(row, col_a);
+            std::string b = ref(row, col_b);
+            if (random() % 2 == 0) {
+                sheet.SetCell({row, col_b}, random() % 2 == 0 ? "=" + a + "*2" : "=" + a + "+" + a);
+            } else {
+                sheet.SetCell({row, col_c}, random() % 2 == 0 ? "=" + b + "+1" : "=1+" + b);
+            }
+            ++count;
+        }
+        write_count += count;
+    });
+
+    //аргументы X меняются произвольно
+    threads.emplace_back([&]() {
+        std::mt19937 random(2000);
+        long long count = 0;
+        while (!stop) {
+            int row = static_cast<int>(random() % rows);
+            sheet.SetCell({row, col_x}, std::to_string(random() % 1000));
+            ++count;
+        }
+        write_count += count;
+    });
+
+    auto start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cout << "readers " << reader_count << ": " << read_count / elapsed << " reads/s, "
+              << snapshot_count / elapsed << " snapshots/s, " << write_count / elapsed
+              << " writes/s, errors " << error_count << '\n';
+    return error_count == 0 ? 0 : 1;
+}
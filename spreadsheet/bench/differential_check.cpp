@@ -0,0 +1,377 @@
+#include "../async_recalculator.h"
+#include "../journal.h"
+#include "../sheet.h"
+#include "../snapshot.h"
+#include "differential_harness.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Дифференциальная проверка путей вычисления и хранения (см. differential_harness.h).
+// Эталон - лист, который изменяется через SetCell / ClearCell и читается через
+// GetCell, PrintValues и PrintTexts. Проверяемые движки:
+//   blocks           перед каждым чтением вычисляет лист блоками (EvaluateFormulaBlocks)
+//   set_cells        изменяет ячейки через SetCells
+//   concurrent_read  читает через ReadValue / ReadText, выводит через ExportTexts и
+//                    ExportValuesParallel
+//   view             читает через снимок листа (Snapshot)
+//   binary_snapshot  читает лист, восстановленный из двоичного снимка
+//   journal          читает лист, восстановленный из журнала изменений
+//   async            изменяет и вычисляет через AsyncRecalculator
+// Аргументы:
+//   --engine NAME   проверяемый движок (по умолчанию все)
+//   --seed N        первый сценарий (по умолчанию 1)  --cases N  число сценариев (200)
+//   --steps N  --rows N  --cols N  --depth N   параметры сценариев (см. DifferentialOptions)
+//   --replay FILE   выполнить сценарий из файла вместо случайных
+//   --output FILE   куда записать уменьшенный сценарий первого расхождения (по умолчанию
+//                   стандартный вывод)
+// При расхождении программа завершается с кодом 1.
+
+namespace {
+
+CellObservation ObserveCell(const CellInterface* cell) {
+    CellObservation result;
+    if (cell) {
+        result.text = cell->GetText();
+    }
+    if (!result.text.empty()) {
+        result.value = cell->GetValue();
+        result.references = cell->GetReferencedCells();
+    }
+    return result;
+}
+
+class SheetEngine : public DifferentialEngine {
+public:
+    void Reset() override {
+        sheet_ = std::make_unique<Sheet>();
+    }
+    void SetCell(Position pos, std::string text) override {
+        sheet_->SetCell(pos, std::move(text));
+    }
+    void ClearCell(Position pos) override {
+        sheet_->ClearCell(pos);
+    }
+    CellObservation Read(Position pos) override {
+        return ObserveCell(GetSheet().GetCell(pos));
+    }
+    Size GetPrintableSize() override {
+        return GetSheet().GetPrintableSize();
+    }
+    std::string PrintValues() override {
+        std::ostringstream output;
+        GetSheet().PrintValues(output);
+        return output.str();
+    }
+    std::string PrintTexts() override {
+        std::ostringstream output;
+        GetSheet().PrintTexts(output);
+        return output.str();
+    }
+
+protected:
+    //лист, из которого читают Read и Print*
+    virtual const Sheet& GetSheet() {
+        return *sheet_;
+    }
+
+    std::unique_ptr<Sheet> sheet_;
+};
+
+class BlockEngine : public SheetEngine {
+protected:
+    const Sheet& GetSheet() override {
+        sheet_->EvaluateFormulaBlocks();
+        return *sheet_;
+    }
+};
+
+class SetCellsEngine : public SheetEngine {
+public:
+    void SetCell(Position pos, std::string text) override {
+        sheet_->SetCells({{pos, std::move(text)}});
+    }
+};
+
+class ConcurrentReadEngine : public SheetEngine {
+public:
+    CellObservation Read(Position pos) override {
+        CellObservation result;
+        result.text = sheet_->ReadText(pos);
+        if (!result.text.empty()) {
+            result.value = sheet_->ReadValue(pos);
+            result.references = sheet_->GetCell(pos)->GetReferencedCells();
+        }
+        return result;
+    }
+    std::string PrintValues() override {
+        std::ostringstream output;
+        sheet_->ExportValuesParallel(MakeStreamSink(output), 3);
+        return output.str();
+    }
+    std::string PrintTexts() override {
+        std::ostringstream output;
+        sheet_->ExportTexts(MakeStreamSink(output));
+        return output.str();
+    }
+};
+
+class ViewEngine : public SheetEngine {
+public:
+    CellObservation Read(Position pos) override {
+        return ObserveCell(sheet_->Snapshot()->GetCell(pos));
+    }
+    Size GetPrintableSize() override {
+        return sheet_->Snapshot()->GetPrintableSize();
+    }
+    std::string PrintValues() override {
+        std::ostringstream output;
+        sheet_->Snapshot()->PrintValues(output);
+        return output.str();
+    }
+    std::string PrintTexts() override {
+        std::ostringstream output;
+        sheet_->Snapshot()->PrintTexts(output);
+        return output.str();
+    }
+};
+
+// Читает лист, восстановленный из файла; лист восстанавливается заново после изменений.
+class RestoringEngine : public SheetEngine {
+public:
+    explicit RestoringEngine(std::string path)
+        : path_(std::move(path)) {
+    }
+    ~RestoringEngine() override {
+        std::remove(path_.c_str());
+    }
+
+    void Reset() override {
+        restored_.reset();
+        SheetEngine::Reset();
+    }
+    void SetCell(Position pos, std::string text) override {
+        restored_.reset();
+        SheetEngine::SetCell(pos, std::move(text));
+    }
+    void ClearCell(Position pos) override {
+        restored_.reset();
+        SheetEngine::ClearCell(pos);
+    }
+
+protected:
+    virtual std::unique_ptr<Sheet> Restore() = 0;
+
+    const Sheet& GetSheet() override {
+        if (!restored_) {
+            restored_ = Restore();
+        }
+        return *restored_;
+    }
+
+    std::string path_;
+    std::unique_ptr<Sheet> restored_;
+};
+
+class BinarySnapshotEngine : public RestoringEngine {
+public:
+    using RestoringEngine::RestoringEngine;
+
+protected:
+    std::unique_ptr<Sheet> Restore() override {
+        SaveSnapshot(*sheet_, path_);
+        return SheetSnapshot(path_).Restore();
+    }
+};
+
+class JournalEngine : public RestoringEngine {
+public:
+    using RestoringEngine::RestoringEngine;
+
+    void Reset() override {
+        journal_.reset();
+        std::remove(path_.c_str());
+        RestoringEngine::Reset();
+        journal_ = std::make_unique<SheetJournal>(path_);
+    }
+    void SetCell(Position pos, std::string text) override {
+        restored_.reset();
+        journal_->SetCell(*sheet_, pos, std::move(text));
+    }
+    void ClearCell(Position pos) override {
+        restored_.reset();
+        journal_->ClearCell(*sheet_, pos);
+    }
+
+protected:
+    std::unique_ptr<Sheet> Restore() override {
+        journal_->Commit();
+        return RecoverSheet({}, path_);
+    }
+
+private:
+    std::unique_ptr<SheetJournal> journal_;
+};
+
+class AsyncEngine : public SheetEngine {
+public:
+    void Reset() override {
+        recalculator_.reset();
+        SheetEngine::Reset();
+        recalculator_ = std::make_unique<AsyncRecalculator>(*sheet_);
+    }
+    void SetCell(Position pos, std::string text) override {
+        recalculator_->SetCell(pos, std::move(text));
+    }
+    void ClearCell(Position pos) override {
+        recalculator_->ClearCell(pos);
+    }
+    CellObservation Read(Position pos) override {
+        CellObservation result;
+        result.text = sheet_->ReadText(pos);
+        if (!result.text.empty()) {
+            result.value = recalculator_->GetValueAsync(pos).get();
+            result.references = sheet_->GetCell(pos)->GetReferencedCells();
+        }
+        return result;
+    }
+
+private:
+    std::unique_ptr<AsyncRecalculator> recalculator_;
+};
+
+using EngineFactory = std::function<std::unique_ptr<DifferentialEngine>()>;
+
+std::map<std::string, EngineFactory> GetEngines(const std::string& work_path) {
+    return {
+        {"blocks", [] { return std::make_unique<BlockEngine>(); }},
+        {"set_cells", [] { return std::make_unique<SetCellsEngine>(); }},
+        {"concurrent_read", [] { return std::make_unique<ConcurrentReadEngine>(); }},
+        {"view", [] { return std::make_unique<ViewEngine>(); }},
+        {"binary_snapshot", [work_path] { return std::make_unique<BinarySnapshotEngine>(work_path + ".snap"); }},
+        {"journal", [work_path] { return std::make_unique<JournalEngine>(work_path + ".jnl"); }},
+        {"async", [] { return std::make_unique<AsyncEngine>(); }},
+    };
+}
+
+void WriteReproducer(std::ostream& output, const std::string& engine, const DifferentialCase& steps,
+                     const DifferentialMismatch& mismatch) {
+    output << "# engine " << engine << ", step " << mismatch.step << ": " << mismatch.description << '\n';
+    WriteCase(output, steps);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    DifferentialOptions options;
+    std::string engine_name;
+    std::uint32_t first_seed = 1;
+    size_t case_count = 200;
+    std::string replay_path;
+    std::string output_path;
+    for (int i = 1; i < argc; i += 2) {
+        std::string option = argv[i];
+        if (i + 1 == argc) {
+            std::cerr << "no value for option " << option << '\n';
+            return 2;
+        }
+        std::string value = argv[i + 1];
+        if (option == "--engine") {
+            engine_name = value;
+        } else if (option == "--seed") {
+            first_seed = static_cast<std::uint32_t>(std::stoul(value));
+        } else if (option == "--cases") {
+            case_count = std::stoul(value);
+        } else if (option == "--steps") {
+            options.steps = std::stoul(value);
+        } else if (option == "--rows") {
+            options.rows = std::stoi(value);
+        } else if (option == "--cols") {
+            options.cols = std::stoi(value);
+        } else if (option == "--depth") {
+            options.max_depth = std::stoi(value);
+        } else if (option == "--replay") {
+            replay_path = value;
+        } else if (option == "--output") {
+            output_path = value;
+        } else {
+            std::cerr << "unknown option " << option << '\n';
+            return 2;
+        }
+    }
+    if (options.rows <= 0 || options.rows >= Position::MAX_ROWS || options.cols <= 0
+        || options.cols >= Position::MAX_COLS) {
+        std::cerr << "rows and cols must be in [1, " << Position::MAX_ROWS - 1 << "] and [1, "
+                  << Position::MAX_COLS - 1 << "]\n";
+        return 2;
+    }
+
+    //файлы снимков и журналов
+    std::string work_path =
+        (std::filesystem::temp_directory_path() / ("differential_check_" + std::to_string(getpid()))).string();
+    std::map<std::string, EngineFactory> engines = GetEngines(work_path);
+    if (!engine_name.empty()) {
+        auto it = engines.find(engine_name);
+        if (it == engines.end()) {
+            std::cerr << "unknown engine " << engine_name << '\n';
+            return 2;
+        }
+        engines = {*it};
+    }
+
+    std::vector<std::pair<std::uint32_t, DifferentialCase>> cases;
+    if (!replay_path.empty()) {
+        std::ifstream input(replay_path);
+        if (!input) {
+            std::cerr << "cannot read " << replay_path << '\n';
+            return 2;
+        }
+        try {
+            cases.emplace_back(0, ReadCase(input));
+        } catch (const std::invalid_argument& e) {
+            std::cerr << replay_path << ": " << e.what() << '\n';
+            return 2;
+        }
+    } else {
+        for (size_t i = 0; i < case_count; ++i) {
+            std::uint32_t seed = first_seed + static_cast<std::uint32_t>(i);
+            cases.emplace_back(seed, GenerateCase(seed, options));
+        }
+    }
+
+    SheetEngine reference;
+    for (const auto& [name, factory] : engines) {
+        std::unique_ptr<DifferentialEngine> candidate = factory();
+        for (const auto& [seed, steps] : cases) {
+            std::optional<DifferentialMismatch> mismatch = RunCase(steps, reference, *candidate);
+            if (!mismatch) {
+                continue;
+            }
+            std::cerr << name << ": seed " << seed << ", step " << mismatch->step << ": " << mismatch->description
+                      << '\n';
+            auto [shrunk_steps, shrunk_mismatch] = ShrinkCase(steps, *mismatch, reference, *candidate);
+            std::cerr << "shrunk from " << steps.size() << " to " << shrunk_steps.size() << " steps\n";
+            if (output_path.empty()) {
+                WriteReproducer(std::cout, name, shrunk_steps, shrunk_mismatch);
+            } else {
+                std::ofstream output(output_path);
+                WriteReproducer(output, name, shrunk_steps, shrunk_mismatch);
+                if (!output) {
+                    std::cerr << "cannot write " << output_path << '\n';
+                }
+            }
+            return 1;
+        }
+        std::cerr << name << ": " << cases.size() << " cases match\n";
+    }
+    return 0;
+}
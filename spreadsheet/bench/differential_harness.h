@@ -0,0 +1,570 @@
+#pragma once
+
+#include "../common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Дифференциальная проверка движков таблицы.
+// Случайный сценарий - последовательность шагов: изменения ячеек (SetCell, ClearCell),
+// в том числе формулами с ошибками вычисления, синтаксическими ошибками и цикличными
+// ссылками, чтения отдельных ячеек и полные проверки листа. Сценарий выполняется на
+// эталонном движке и на проверяемом; после каждого шага сравниваются исход изменения
+// (успех или тип исключения), значения, тексты и ссылки прочитанных ячеек, размер
+// печатной области и вывод PrintValues / PrintTexts. Чтения между изменениями
+// вычисляют ячейки в случайном порядке, поэтому проверяется и работа кэша значений.
+// Расходящийся сценарий уменьшается (ShrinkCase): удаляются шаги и упрощаются тексты
+// ячеек, пока расхождение сохраняется; результат записывается в текстовом формате,
+// который читает ReadCase.
+
+struct DifferentialStep {
+    enum class Kind {
+        Set,
+        Clear,
+        //чтение значения, текста и ссылок ячейки pos
+        Read,
+        //сравнение всего листа
+        Check,
+    };
+
+    Kind kind = Kind::Check;
+    Position pos;
+    std::string text;
+};
+
+using DifferentialCase = std::vector<DifferentialStep>;
+
+//наблюдаемое содержимое ячейки; у отсутствующей ячейки и ячейки с пустым текстом
+//значение - пустая строка, ссылок нет
+struct CellObservation {
+    std::string text;
+    CellInterface::Value value;
+    std::vector<Position> references;
+};
+
+// Движок таблицы для сравнения. Исключения SetCell и ClearCell - часть наблюдаемого
+// поведения; исключение из остальных методов считается расхождением.
+class DifferentialEngine {
+public:
+    virtual ~DifferentialEngine() = default;
+
+    //начинает с пустого листа
+    virtual void Reset() = 0;
+    virtual void SetCell(Position pos, std::string text) = 0;
+    virtual void ClearCell(Position pos) = 0;
+    virtual CellObservation Read(Position pos) = 0;
+    virtual Size GetPrintableSize() = 0;
+    virtual std::string PrintValues() = 0;
+    virtual std::string PrintTexts() = 0;
+};
+
+//первое расхождение: номер шага, ячейка (Position::NONE, если расходится не ячейка) и описание
+struct DifferentialMismatch {
+    size_t step = 0;
+    Position pos = Position::NONE;
+    std::string description;
+};
+
+// Параметры случайных сценариев.
+struct DifferentialOptions {
+    //ячейки изменяются внутри rows x cols; ссылки ведут и на ячейку за этими границами
+    int rows = 12;
+    int cols = 4;
+    size_t steps = 40;
+    int max_depth = 3;
+};
+
+inline std::string FormatValue(const CellInterface::Value& value) {
+    std::ostringstream output;
+    output << std::setprecision(17);
+    std::visit(
+        [&output](const auto& item) {
+            output << item;
+        },
+        value);
+    return output.str();
+}
+
+inline bool IsSameValue(const CellInterface::Value& lhs, const CellInterface::Value& rhs) {
+    if (std::holds_alternative<double>(lhs) && std::holds_alternative<double>(rhs)) {
+        double left = std::get<double>(lhs);
+        double right = std::get<double>(rhs);
+        return left == right || (std::isnan(left) && std::isnan(right));
+    }
+    return lhs == rhs;
+}
+
+//исход изменения: "ok" или тип исключения
+inline std::string ApplyEdit(DifferentialEngine& engine, const DifferentialStep& step) {
+    try {
+        if (step.kind == DifferentialStep::Kind::Set) {
+            engine.SetCell(step.pos, step.text);
+        } else {
+            engine.ClearCell(step.pos);
+        }
+        return "ok";
+    } catch (const FormulaException&) {
+        return "FormulaException";
+    } catch (const CircularDependencyException&) {
+        return "CircularDependencyException";
+    } catch (const InvalidPositionException&) {
+        return "InvalidPositionException";
+    } catch (const std::exception& e) {
+        return std::string("exception: ") + e.what();
+    }
+}
+
+namespace differential_detail {
+
+using namespace std::literals;
+
+inline std::string FormatReferences(const std::vector<Position>& references) {
+    std::string result = "[";
+    for (Position pos : references) {
+        result += (result.size() > 1 ? " " : "") + pos.ToString();
+    }
+    return result + "]";
+}
+
+inline std::string Quote(std::string_view text) {
+    std::string result = "\"";
+    for (char c : text) {
+        if (c == '\n') {
+            result += "\\n";
+        } else if (c == '\t') {
+            result += "\\t";
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+//сравнивает чтения ячейки pos; пустая строка, если они совпадают
+inline std::string CompareCell(Position pos, const CellObservation& expected, const CellObservation& actual) {
+    if (expected.text != actual.text) {
+        return pos.ToString() + " text: reference " + Quote(expected.text) + ", candidate " + Quote(actual.text);
+    }
+    if (!IsSameValue(expected.value, actual.value)) {
+        return pos.ToString() + " value: reference " + FormatValue(expected.value) + ", candidate "
+            + FormatValue(actual.value);
+    }
+    if (expected.references != actual.references) {
+        return pos.ToString() + " references: reference " + FormatReferences(expected.references)
+            + ", candidate " + FormatReferences(actual.references);
+    }
+    return {};
+}
+
+//чтение, при котором исключение движка становится частью результата
+template <typename Result>
+std::string Observe(const std::function<Result()>& read, Result& result) {
+    try {
+        result = read();
+        return {};
+    } catch (const std::exception& e) {
+        return "exception: "s + e.what();
+    }
+}
+
+inline std::optional<DifferentialMismatch> CompareRead(size_t index, Position pos, DifferentialEngine& reference,
+                                                       DifferentialEngine& candidate) {
+    CellObservation expected;
+    CellObservation actual;
+    std::string expected_error = Observe<CellObservation>([&] { return reference.Read(pos); }, expected);
+    std::string actual_error = Observe<CellObservation>([&] { return candidate.Read(pos); }, actual);
+    if (!expected_error.empty() || !actual_error.empty()) {
+        if (expected_error == actual_error) {
+            return std::nullopt;
+        }
+        return DifferentialMismatch{index, pos, pos.ToString() + " read: reference " + Quote(expected_error)
+                                                    + ", candidate " + Quote(actual_error)};
+    }
+    std::string difference = CompareCell(pos, expected, actual);
+    if (difference.empty()) {
+        return std::nullopt;
+    }
+    return DifferentialMismatch{index, pos, difference};
+}
+
+inline std::optional<DifferentialMismatch> CompareSheets(size_t index, DifferentialEngine& reference,
+                                                         DifferentialEngine& candidate) {
+    Size expected_size;
+    Size actual_size;
+    std::string expected_error = Observe<Size>([&] { return reference.GetPrintableSize(); }, expected_size);
+    std::string actual_error = Observe<Size>([&] { return candidate.GetPrintableSize(); }, actual_size);
+    if (expected_error != actual_error || !(expected_size == actual_size)) {
+        std::ostringstream description;
+        description << "printable size: reference " << expected_size.rows << 'x' << expected_size.cols << ' '
+                    << expected_error << ", candidate " << actual_size.rows << 'x' << actual_size.cols << ' '
+                    << actual_error;
+        return DifferentialMismatch{index, Position::NONE, description.str()};
+    }
+
+    for (int row = 0; row < expected_size.rows; ++row) {
+        for (int col = 0; col < expected_size.cols; ++col) {
+            if (auto mismatch = CompareRead(index, {row, col}, reference, candidate)) {
+                return mismatch;
+            }
+        }
+    }
+
+    const std::pair<const char*, std::string (DifferentialEngine::*)()> prints[] = {
+        {"PrintTexts", &DifferentialEngine::PrintTexts},
+        {"PrintValues", &DifferentialEngine::PrintValues},
+    };
+    for (const auto& [name, print] : prints) {
+        std::string expected;
+        std::string actual;
+        expected_error = Observe<std::string>([&, print = print] { return (reference.*print)(); }, expected);
+        actual_error = Observe<std::string>([&, print = print] { return (candidate.*print)(); }, actual);
+        if (expected_error != actual_error || expected != actual) {
+            return DifferentialMismatch{index, Position::NONE,
+                                        name + ": reference "s + Quote(expected_error.empty() ? expected : expected_error)
+                                            + ", candidate " + Quote(actual_error.empty() ? actual : actual_error)};
+        }
+    }
+
+    return std::nullopt;
+}
+
+//ссылки на ячейки в тексте формулы: смещение и длина
+inline std::vector<std::pair<size_t, size_t>> FindReferences(std::string_view text) {
+    std::vector<std::pair<size_t, size_t>> references;
+    size_t i = 0;
+    while (i < text.size()) {
+        size_t start = i;
+        while (i < text.size() && text[i] >= 'A' && text[i] <= 'Z') {
+            ++i;
+        }
+        size_t letters_end = i;
+        while (i < text.size() && text[i] >= '0' && text[i] <= '9') {
+            ++i;
+        }
+        if (letters_end > start && i > letters_end) {
+            references.emplace_back(start, i - start);
+        } else if (i == start) {
+            ++i;
+        }
+    }
+    return references;
+}
+
+//сдвигает корректные ссылки формулы на rows строк вниз
+inline std::string ShiftReferences(const std::string& text, int rows) {
+    std::string result;
+    size_t copied = 0;
+    for (auto [offset, size] : FindReferences(text)) {
+        Position pos = Position::FromString(std::string_view(text).substr(offset, size));
+        if (!pos.IsValid()) {
+            continue;
+        }
+        result.append(text, copied, offset - copied);
+        result += Position{pos.row + rows, pos.col}.ToString();
+        copied = offset + size;
+    }
+    result.append(text, copied);
+    return result;
+}
+
+//std::mt19937 выдаёт одну и ту же последовательность на всех платформах, а
+//стандартные распределения - нет, поэтому распределение своё
+class Random {
+public:
+    explicit Random(std::uint32_t seed)
+        : engine_(seed) {
+    }
+
+    //число от 0 до bound - 1
+    int Uniform(int bound) {
+        return bound <= 1 ? 0 : static_cast<int>(engine_() % static_cast<std::uint32_t>(bound));
+    }
+
+    template <typename T, size_t N>
+    const T& Choose(const T (&items)[N]) {
+        return items[Uniform(static_cast<int>(N))];
+    }
+
+private:
+    std::mt19937 engine_;
+};
+
+class CaseGenerator {
+public:
+    CaseGenerator(std::uint32_t seed, const DifferentialOptions& options)
+        : random_(seed)
+        , options_(options) {
+    }
+
+    DifferentialCase Generate() {
+        DifferentialCase steps;
+        for (size_t i = 0; i < options_.steps; ++i) {
+            DifferentialStep step;
+            step.pos = {random_.Uniform(options_.rows), random_.Uniform(options_.cols)};
+            int kind = random_.Uniform(20);
+            if (kind < 2) {
+                AddFormulaRun(steps, step.pos);
+                continue;
+            } else if (kind < 12) {
+                step.kind = DifferentialStep::Kind::Set;
+                step.text = MakeText();
+            } else if (kind < 14) {
+                step.kind = DifferentialStep::Kind::Clear;
+            } else if (kind < 18) {
+                step.kind = DifferentialStep::Kind::Read;
+            } else {
+                step.kind = DifferentialStep::Kind::Check;
+            }
+            steps.push_back(std::move(step));
+        }
+        steps.push_back(DifferentialStep{});
+        return steps;
+    }
+
+private:
+    //одна формула, скопированная со сдвигом ссылок в несколько ячеек столбца подряд:
+    //такие ячейки вычисляются блоками (см. BlockEvaluator)
+    void AddFormulaRun(DifferentialCase& steps, Position pos) {
+        std::string text = "=" + MakeExpression(1 + random_.Uniform(std::max(options_.max_depth, 1)));
+        int length = 4 + random_.Uniform(8);
+        for (int i = 0; i < length && pos.row + i < options_.rows; ++i) {
+            steps.push_back(
+                DifferentialStep{DifferentialStep::Kind::Set, {pos.row + i, pos.col}, ShiftReferences(text, i)});
+        }
+    }
+
+    std::string MakeText() {
+        //тексты, похожие на числа и формулы, пустой текст и ошибки разбора
+        static const char* const TEXTS[] = {"12", "1.5", "-3", "1e2", "abc", "'=A1", "'7", "", "=", " 4", "=1+",
+                                            "=(A1", "=A1 A2", "=1/", "=A0", "=ZZZZ1", "=1e400"};
+        switch (random_.Uniform(8)) {
+        case 0:
+            return random_.Choose(TEXTS);
+        case 1:
+            return std::to_string(random_.Uniform(10));
+        default:
+            return "=" + MakeExpression(1 + random_.Uniform(std::max(options_.max_depth, 1)));
+        }
+    }
+
+    std::string MakeReference() {
+        //ссылки ведут и за границы изменяемых ячеек, на ячейки, которые никогда не задаются
+        return Position{random_.Uniform(options_.rows + 1), random_.Uniform(options_.cols + 1)}.ToString();
+    }
+
+    std::string MakeExpression(int depth) {
+        static const char* const NUMBERS[] = {"0", "1", "2", "2.5", "10", ".5", "1e3"};
+        static const char* const OPERATIONS[] = {"+", "-", "*", "/"};
+        if (depth <= 0 || random_.Uniform(10) < 3) {
+            return random_.Uniform(2) == 0 ? MakeReference() : random_.Choose(NUMBERS);
+        }
+        switch (random_.Uniform(5)) {
+        case 0:
+            return (random_.Uniform(2) == 0 ? "-" : "+") + MakeExpression(depth - 1);
+        case 1:
+            return "(" + MakeExpression(depth - 1) + ")";
+        default:
+            return MakeExpression(depth - 1) + random_.Choose(OPERATIONS) + MakeExpression(depth - 1);
+        }
+    }
+
+    Random random_;
+    DifferentialOptions options_;
+};
+
+//более простые тексты той же ячейки, от простых к сложным; каждый короче text
+inline std::vector<std::string> SimplifyText(const std::string& text) {
+    std::vector<std::string> candidates = {"", "1"};
+    if (!text.empty() && text[0] == FORMULA_SIGN) {
+        candidates.push_back("=1");
+        for (auto [offset, size] : FindReferences(text)) {
+            candidates.push_back("=" + text.substr(offset, size));
+        }
+    }
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                    [&text](const std::string& candidate) {
+                                        return candidate.size() >= text.size();
+                                    }),
+                     candidates.end());
+    return candidates;
+}
+
+} // namespace differential_detail
+
+// Выполняет сценарий на обоих движках (предварительно очищая их) и возвращает первое
+// расхождение.
+inline std::optional<DifferentialMismatch> RunCase(const DifferentialCase& steps, DifferentialEngine& reference,
+                                                   DifferentialEngine& candidate) {
+    using namespace differential_detail;
+
+    reference.Reset();
+    candidate.Reset();
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const DifferentialStep& step = steps[i];
+        switch (step.kind) {
+        case DifferentialStep::Kind::Set:
+        case DifferentialStep::Kind::Clear: {
+            std::string expected = ApplyEdit(reference, step);
+            std::string actual = ApplyEdit(candidate, step);
+            if (expected != actual) {
+                return DifferentialMismatch{i, step.pos, (step.kind == DifferentialStep::Kind::Set ? "SetCell " : "ClearCell ")
+                                                             + step.pos.ToString() + ": reference " + expected
+                                                             + ", candidate " + actual};
+            }
+            break;
+        }
+        case DifferentialStep::Kind::Read:
+            if (auto mismatch = CompareRead(i, step.pos, reference, candidate)) {
+                return mismatch;
+            }
+            break;
+        case DifferentialStep::Kind::Check:
+            if (auto mismatch = CompareSheets(i, reference, candidate)) {
+                return mismatch;
+            }
+            break;
+        }
+    }
+    return std::nullopt;
+}
+
+inline DifferentialCase GenerateCase(std::uint32_t seed, const DifferentialOptions& options) {
+    return differential_detail::CaseGenerator(seed, options).Generate();
+}
+
+// Уменьшает расходящийся сценарий: отбрасывает шаги после расхождения, удаляет группы
+// шагов (от больших к одиночным), заменяет полную проверку чтением расходящейся ячейки
+// и упрощает тексты ячеек, пока сценарий продолжает расходиться. Возвращает
+// уменьшенный сценарий и его расхождение.
+inline std::pair<DifferentialCase, DifferentialMismatch> ShrinkCase(DifferentialCase steps,
+                                                                    DifferentialMismatch mismatch,
+                                                                    DifferentialEngine& reference,
+                                                                    DifferentialEngine& candidate) {
+    using namespace differential_detail;
+
+    auto try_steps = [&](DifferentialCase attempt) {
+        std::optional<DifferentialMismatch> result = RunCase(attempt, reference, candidate);
+        if (!result) {
+            return false;
+        }
+        attempt.resize(result->step + 1);
+        steps = std::move(attempt);
+        mismatch = std::move(*result);
+        return true;
+    };
+
+    steps.resize(mismatch.step + 1);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (size_t chunk = std::max<size_t>(steps.size() / 2, 1); chunk > 0; chunk /= 2) {
+            for (size_t start = 0; start < steps.size();) {
+                DifferentialCase attempt = steps;
+                attempt.erase(attempt.begin() + start, attempt.begin() + std::min(start + chunk, attempt.size()));
+                if (!attempt.empty() && try_steps(std::move(attempt))) {
+                    changed = true;
+                } else {
+                    start += chunk;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < steps.size(); ++i) {
+            DifferentialStep& step = steps[i];
+            if (step.kind == DifferentialStep::Kind::Check && mismatch.pos.IsValid()) {
+                DifferentialCase attempt = steps;
+                attempt[i] = DifferentialStep{DifferentialStep::Kind::Read, mismatch.pos, {}};
+                changed = try_steps(std::move(attempt)) || changed;
+            } else if (step.kind == DifferentialStep::Kind::Set) {
+                for (const std::string& text : SimplifyText(step.text)) {
+                    DifferentialCase attempt = steps;
+                    attempt[i].text = text;
+                    if (try_steps(std::move(attempt))) {
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    return {std::move(steps), std::move(mismatch)};
+}
+
+// Сценарий в текстовом формате: по шагу в строке, поля разделены табуляцией:
+//   set<TAB>A1<TAB>текст    clear<TAB>A1    read<TAB>A1    check
+// Строки, начинающиеся с '#', - комментарии.
+inline void WriteCase(std::ostream& output, const DifferentialCase& steps) {
+    for (const DifferentialStep& step : steps) {
+        switch (step.kind) {
+        case DifferentialStep::Kind::Set:
+            output << "set\t" << step.pos.ToString() << '\t' << step.text << '\n';
+            break;
+        case DifferentialStep::Kind::Clear:
+            output << "clear\t" << step.pos.ToString() << '\n';
+            break;
+        case DifferentialStep::Kind::Read:
+            output << "read\t" << step.pos.ToString() << '\n';
+            break;
+        case DifferentialStep::Kind::Check:
+            output << "check\n";
+            break;
+        }
+    }
+}
+
+//бросает std::invalid_argument, если строка не является шагом сценария
+inline DifferentialCase ReadCase(std::istream& input) {
+    using namespace std::literals;
+
+    DifferentialCase steps;
+    std::string line;
+    while (std::getline(input, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        size_t command_end = line.find('\t');
+        std::string_view command = std::string_view(line).substr(0, command_end);
+        DifferentialStep step;
+        if (command == "check") {
+            steps.push_back(std::move(step));
+            continue;
+        }
+        if (command_end == std::string::npos) {
+            throw std::invalid_argument("no cell in step: "s + line);
+        }
+        size_t pos_end = line.find('\t', command_end + 1);
+        step.pos = Position::FromString(std::string_view(line).substr(command_end + 1, pos_end - command_end - 1));
+        if (command == "set") {
+            step.kind = DifferentialStep::Kind::Set;
+            step.text = pos_end == std::string::npos ? std::string() : line.substr(pos_end + 1);
+        } else if (command == "clear") {
+            step.kind = DifferentialStep::Kind::Clear;
+        } else if (command == "read") {
+            step.kind = DifferentialStep::Kind::Read;
+        } else {
+            throw std::invalid_argument("unknown step: "s + line);
+        }
+        if (!step.pos.IsValid()) {
+            throw std::invalid_argument("invalid cell in step: "s + line);
+        }
+        steps.push_back(std::move(step));
+    }
+    return steps;
+}
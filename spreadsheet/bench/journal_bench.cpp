@@ -0,0 +1,74 @@
+#include "../journal.h"
+#include "../sheet.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Бенчмарк журнала изменений: скорость непрерывного редактирования листа без
+// журнала и с журналом при разных размерах группы, а также скорость
+// восстановления листа из журнала по сравнению с повторением SetCell.
+// Аргументы: число изменений (по умолчанию 100000) и путь к файлу журнала.
+int main(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+
+    const size_t edit_count = argc > 1 ? std::stoul(argv[1]) : 100000;
+    const std::string path = argc > 2 ? argv[2] : "journal_bench.jnl";
+
+    //числа и формулы, ссылающиеся на ячейки левее, поэтому циклов не возникает
+    std::mt19937 random(42);
+    std::vector<std::pair<Position, std::string>> edits;
+    edits.reserve(edit_count);
+    for (size_t i = 0; i < edit_count; ++i) {
+        Position pos{static_cast<int>(random() % 1000), static_cast<int>(random() % 26)};
+        if (pos.col > 0 && random() % 2 == 0) {
+            Position ref{static_cast<int>(random() % 1000), static_cast<int>(random() % pos.col)};
+            edits.emplace_back(pos, "=" + ref.ToString() + "*2+1");
+        } else {
+            edits.emplace_back(pos, std::to_string(random() % 1000));
+        }
+    }
+
+    auto report = [edit_count](const std::string& name, Clock::duration duration) {
+        double seconds = std::chrono::duration<double>(duration).count();
+        std::cout << name << ": " << edit_count / seconds << " edits/s\n";
+    };
+
+    {
+        Sheet sheet;
+        auto start = Clock::now();
+        for (const auto& [pos, text] : edits) {
+            sheet.SetCell(pos, text);
+        }
+        report("without journal", Clock::now() - start);
+    }
+
+    for (size_t group_size : {1, 16, 256, 4096}) {
+        std::remove(path.c_str());
+        Sheet sheet;
+        auto start = Clock::now();
+        {
+            SheetJournal journal(path, group_size);
+            for (const auto& [pos, text] : edits) {
+                journal.SetCell(sheet, pos, text);
+            }
+            journal.Commit();
+        }
+        report("journal, group " + std::to_string(group_size), Clock::now() - start);
+    }
+
+    {
+        Sheet sheet;
+        auto start = Clock::now();
+        SheetJournal journal(path);
+        journal.Replay(sheet);
+        report("replay", Clock::now() - start);
+    }
+
+    std::remove(path.c_str());
+    return 0;
+}
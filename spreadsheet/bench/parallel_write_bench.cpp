@@ -0,0 +1,135 @@
+#include "../sheet.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Бенчмарк параллельных изменений листа.
+// 1. Потоки записывают каждый свою полосу столбцов: числа и формулы, ссылающиеся на
+//    соседнюю ячейку той же строки, поэтому изменения не выходят за область и
+//    выполняются параллельно. Выводится число изменений в секунду для разного числа
+//    потоков и проверяется, что результат совпадает с последовательной записью.
+// 2. Потоки одновременно задают формулы, которые вместе образовали бы цикл через
+//    несколько областей; проверяется, что цикл не возник.
+// Аргументы: максимальное число потоков (по умолчанию 8) и число строк полосы (по умолчанию 2000).
+namespace {
+
+const int BAND_COLS = 16;
+
+void WriteBand(Sheet& sheet, int band, int rows) {
+    for (int row = 0; row < rows; ++row) {
+        for (int i = 0; i < BAND_COLS; ++i) {
+            Position pos{row, band * BAND_COLS + i};
+            if (i == 0) {
+                sheet.SetCell(pos, std::to_string(row));
+            } else {
+                sheet.SetCell(pos, "=" + Position{row, pos.col - 1}.ToString() + "+1");
+            }
+        }
+    }
+}
+
+std::string PrintValues(const Sheet& sheet) {
+    std::string result;
+    sheet.ExportValues([&result](std::string_view data) {
+        result.append(data);
+    });
+    return result;
+}
+
+bool HasCycle(const Sheet& sheet, const std::vector<Position>& cells) {
+    for (Position start : cells) {
+        std::unordered_set<Position, Sheet::CellPositionHasher> visited;
+        std::vector<Position> stack;
+        if (const Cell* cell = sheet.GetCell(start)) {
+            stack = cell->GetReferencedCells();
+        }
+        while (!stack.empty()) {
+            Position pos = stack.back();
+            stack.pop_back();
+            if (pos == start) {
+                return true;
+            }
+            if (!visited.insert(pos).second) {
+                continue;
+            }
+            if (const Cell* cell = sheet.GetCell(pos)) {
+                std::vector<Position> references = cell->GetReferencedCells();
+                stack.insert(stack.end(), references.begin(), references.end());
+            }
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+
+    const int max_threads = argc > 1 ? std::stoi(argv[1]) : 8;
+    const int rows = argc > 2 ? std::stoi(argv[2]) : 2000;
+    int errors = 0;
+
+    for (int thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+        Sheet sheet;
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (int band = 0; band < thread_count; ++band) {
+            threads.emplace_back([&sheet, band, rows]() {
+                WriteBand(sheet, band, rows);
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << "threads " << thread_count << ": "
+                  << static_cast<double>(thread_count) * rows * BAND_COLS / seconds << " edits/s\n";
+
+        Sheet expected;
+        for (int band = 0; band < thread_count; ++band) {
+            WriteBand(expected, band, rows);
+        }
+        if (PrintValues(sheet) != PrintValues(expected)) {
+            std::cerr << "parallel result differs from sequential with " << thread_count << " threads\n";
+            ++errors;
+        }
+    }
+
+    //кольцо ячеек из разных областей: каждый поток замыкает свою ссылку на следующую ячейку
+    const int ring_size = std::max(2, max_threads);
+    for (int round = 0; round < 200; ++round) {
+        Sheet sheet;
+        std::vector<Position> ring;
+        for (int i = 0; i < ring_size; ++i) {
+            ring.push_back(Position{round % 64, i * BAND_COLS});
+        }
+        std::atomic<int> rejected = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < ring_size; ++i) {
+            threads.emplace_back([&sheet, &ring, &rejected, i]() {
+                try {
+                    sheet.SetCell(ring[i], "=" + ring[(i + 1) % ring.size()].ToString() + "+1");
+                } catch (const CircularDependencyException&) {
+                    ++rejected;
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        if (rejected != 1 || HasCycle(sheet, ring)) {
+            std::cerr << "cycle check failed in round " << round << '\n';
+            ++errors;
+        }
+    }
+
+    std::cout << "errors " << errors << '\n';
+    return errors == 0 ? 0 : 1;
+}
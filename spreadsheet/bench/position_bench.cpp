@@ -0,0 +1,55 @@
+#include "../common.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Микробенчмарк разбора и печати позиций ячеек: Position::FromString,
+// Position::ToString и Position::ToChars на всех позициях сетки с шагом.
+int main() {
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<Position> positions;
+    for (int row = 0; row < Position::MAX_ROWS; row += 3) {
+        for (int col = 0; col < Position::MAX_COLS; col += 97) {
+            positions.push_back({row, col});
+        }
+    }
+
+    std::vector<std::string> strings;
+    strings.reserve(positions.size());
+    for (Position pos : positions) {
+        strings.push_back(pos.ToString());
+    }
+
+    auto report = [&positions](const char* name, Clock::duration duration, long long checksum) {
+        double ns = std::chrono::duration<double, std::nano>(duration).count() / positions.size();
+        std::cout << name << ": " << ns << " ns/op (checksum " << checksum << ")\n";
+    };
+
+    long long checksum = 0;
+    auto start = Clock::now();
+    for (const std::string& str : strings) {
+        Position pos = Position::FromString(str);
+        checksum += pos.row + pos.col;
+    }
+    report("FromString", Clock::now() - start, checksum);
+
+    checksum = 0;
+    start = Clock::now();
+    for (Position pos : positions) {
+        checksum += pos.ToString().size();
+    }
+    report("ToString", Clock::now() - start, checksum);
+
+    checksum = 0;
+    char buffer[Position::MAX_POSITION_LENGTH];
+    start = Clock::now();
+    for (Position pos : positions) {
+        checksum += pos.ToChars(buffer, buffer + Position::MAX_POSITION_LENGTH) - buffer;
+    }
+    report("ToChars", Clock::now() - start, checksum);
+
+    return 0;
+}
@@ -0,0 +1,585 @@
+#include "../formula.h"
+#include "../sheet.h"
+#include "../snapshot.h"
+#include "../tsv_loader.h"
+#include "../workload_generator.h"
+#include "bench_harness.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// Набор бенчмарков движка таблицы; результаты выводятся в JSON (см. BenchmarkRunner).
+// Аргументы:
+//   --size N         размер задач: число ячеек (по умолчанию 10000); длина цепочек - N / 5
+//   --repetitions R  число запусков каждого бенчмарка (по умолчанию 5)
+//   --filter S       выполнять только бенчмарки, имя которых содержит S
+//   --output FILE    записать JSON в файл, а не в стандартный вывод
+//   --baseline FILE  сравнить результаты с базовыми (JSON, записанный --output на этой же
+//                    машине с теми же параметрами); код возврата 1, если какой-то бенчмарк
+//                    стал медленнее более чем в 1 + tolerance раз (см. CheckAgainst), и
+//                    NO_BASELINE_RETURN_CODE без запуска бенчмарков, если файла нет
+//   --tolerance X    допустимое замедление для --baseline (по умолчанию 0.25)
+//   --memory 1       вместо замеров времени вывести память синтетических таблиц из
+//                    size ячеек по частям и в байтах на ячейку (см. Sheet::GetMemoryUsage)
+namespace {
+
+const int GRID_COLS = 10;
+//число слагаемых формулы fan_in/sum: дерево разбора такой формулы глубиной с число слагаемых
+const int MAX_FAN_IN = 1000;
+//код возврата, если файла базовых результатов нет: ctest считает такую проверку
+//пропущенной (SKIP_RETURN_CODE)
+const int NO_BASELINE_RETURN_CODE = 77;
+
+//лист бенчмарков shift: число столбцов, число строк ниже сдвигаемой у нижнего края
+//и число пар вставка-удаление за запуск
+const int SHIFT_COLS = 6;
+const int SHIFT_EDGE_ROWS = 10;
+const int SHIFT_REPEATS = 50;
+
+//результаты вычислений, которые иначе компилятор мог бы выбросить
+size_t checksum = 0;
+
+Position GridPosition(int index) {
+    return {index / GRID_COLS, index % GRID_COLS};
+}
+
+std::string CellName(int row, int col) {
+    return Position{row, col}.ToString();
+}
+
+//строка row листа бенчмарков copy: каждая формула ссылается на ячейку слева и на
+//ячейку выше
+std::vector<std::pair<Position, std::string>> FillRowTexts(int row) {
+    std::vector<std::pair<Position, std::string>> cells;
+    cells.emplace_back(Position{row, 0}, "=" + CellName(row - 1, 0) + "+1");
+    for (int col = 1; col < SHIFT_COLS; ++col) {
+        cells.emplace_back(Position{row, col}, "=(" + CellName(row, col - 1) + "*2+" + CellName(row - 1, col) + ")/3");
+    }
+    return cells;
+}
+
+//A1 = 0, A2 = A1 + 1, ..., A<length> = A<length-1> + 1
+std::shared_ptr<Sheet> MakeChain(int length) {
+    auto sheet = std::make_shared<Sheet>();
+    sheet->SetCell({0, 0}, "0");
+    for (int row = 1; row < length; ++row) {
+        sheet->SetCell({row, 0}, "=" + CellName(row - 1, 0) + "+1");
+    }
+    return sheet;
+}
+
+//формулы разной формы: ссылки, скобки, унарные операции, числа с дробной частью
+std::vector<std::string> MakeFormulas(int count) {
+    std::vector<std::string> formulas;
+    formulas.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        std::string a = CellName(i % 1000, i % 26);
+        std::string b = CellName(i % 777, (i * 7) % 40);
+        switch (i % 4) {
+        case 0:
+            formulas.push_back(a + "+" + b + "*2");
+            break;
+        case 1:
+            formulas.push_back("(" + a + "+" + b + ")*(" + a + "-1.5)");
+            break;
+        case 2:
+            formulas.push_back("-" + a + "/(" + std::to_string(i % 9 + 1) + "+" + b + ")");
+            break;
+        default:
+            formulas.push_back("((" + a + "))+" + std::to_string(i) + ".25-+" + b);
+        }
+    }
+    return formulas;
+}
+
+void RunBenchmarks(BenchmarkRunner& runner, int size) {
+    const int chain_length = std::max(size / 5, 2);
+
+    runner.Run("set_cell/numbers", [size]() {
+        auto sheet = std::make_shared<Sheet>();
+        return [sheet, size]() {
+            for (int i = 0; i < size; ++i) {
+                sheet->SetCell(GridPosition(i), std::to_string(i));
+            }
+            return size_t(size);
+        };
+    });
+
+    runner.Run("set_cell/text", [size]() {
+        auto sheet = std::make_shared<Sheet>();
+        return [sheet, size]() {
+            for (int i = 0; i < size; ++i) {
+                sheet->SetCell(GridPosition(i), "text " + std::to_string(i));
+            }
+            return size_t(size);
+        };
+    });
+
+    //каждая формула ссылается на соседнюю ячейку слева, первая в строке - на число
+    runner.Run("set_cell/formulas", [size]() {
+        auto sheet = std::make_shared<Sheet>();
+        return [sheet, size]() {
+            for (int i = 0; i < size; ++i) {
+                Position pos = GridPosition(i);
+                sheet->SetCell(pos, pos.col == 0 ? std::to_string(i) : "=" + CellName(pos.row, pos.col - 1) + "*2+1");
+            }
+            return size_t(size);
+        };
+    });
+
+    //каждая новая ячейка цепочки проверяется на цикл по всей цепочке
+    runner.Run("chain/build", [chain_length]() {
+        return [chain_length]() {
+            MakeChain(chain_length);
+            return size_t(chain_length);
+        };
+    });
+
+    runner.Run("chain/recalculate", [chain_length]() {
+        std::shared_ptr<Sheet> sheet = MakeChain(chain_length);
+        sheet->GetCell({chain_length - 1, 0})->GetValue();
+        return [sheet, chain_length]() {
+            sheet->SetCell({0, 0}, "1");
+            sheet->GetCell({chain_length - 1, 0})->GetValue();
+            return size_t(chain_length);
+        };
+    });
+
+    //B1:B<size> = A1 * k: изменение A1 инвалидирует все ячейки
+    runner.Run("fan_out/edit_root", [size]() {
+        auto sheet = std::make_shared<Sheet>();
+        sheet->SetCell({0, 0}, "1");
+        for (int row = 0; row < size; ++row) {
+            sheet->SetCell({row, 1}, "=A1*" + std::to_string(row));
+        }
+        sheet->EvaluateFormulaBlocks();
+        return [sheet, size]() {
+            sheet->SetCell({0, 0}, "2");
+            for (int row = 0; row < size; ++row) {
+                sheet->GetCell({row, 1})->GetValue();
+            }
+            return size_t(size);
+        };
+    });
+
+    //B1 = A1 + A2 + ... : разбор, проверка на цикл и вычисление формулы со многими ссылками
+    runner.Run("fan_in/sum", [size]() {
+        const int terms = std::min(size, MAX_FAN_IN);
+        auto sheet = std::make_shared<Sheet>();
+        std::string formula = "=";
+        for (int row = 0; row < terms; ++row) {
+            sheet->SetCell({row, 0}, std::to_string(row));
+            formula += (row == 0 ? "" : "+") + CellName(row, 0);
+        }
+        return [sheet, formula, terms]() {
+            sheet->SetCell({0, 1}, formula);
+            sheet->GetCell({0, 1})->GetValue();
+            return size_t(terms);
+        };
+    });
+
+    //попытки замкнуть цепочку: каждая обходит всю цепочку и отклоняется
+    runner.Run("cycle_check/reject", [chain_length]() {
+        std::shared_ptr<Sheet> sheet = MakeChain(chain_length);
+        std::string formula = "=" + CellName(chain_length - 1, 0) + "+1";
+        return [sheet, formula]() {
+            const size_t attempts = 20;
+            for (size_t i = 0; i < attempts; ++i) {
+                try {
+                    sheet->SetCell({0, 0}, formula);
+                } catch (const CircularDependencyException&) {
+                }
+            }
+            return attempts;
+        };
+    });
+
+    //сетка: первый столбец ссылается на A1, остальные - на соседа слева
+    runner.Run("recalculate/root_edit", [size]() {
+        auto sheet = std::make_shared<Sheet>();
+        sheet->SetCell({0, 0}, "1");
+        for (int i = 1; i < size; ++i) {
+            Position pos = GridPosition(i);
+            sheet->SetCell(pos, pos.col == 0 ? "=A1+" + std::to_string(pos.row) : "=" + CellName(pos.row, pos.col - 1) + "*2");
+        }
+        sheet->EvaluateFormulaBlocks();
+        return [sheet, size]() {
+            sheet->SetCell({0, 0}, "3");
+            sheet->EvaluateFormulaBlocks();
+            return size_t(size);
+        };
+    });
+
+    runner.Run("formula/parse", [size]() {
+        auto formulas = std::make_shared<std::vector<std::string>>(MakeFormulas(size));
+        return [formulas]() {
+            for (const std::string& formula : *formulas) {
+                checksum += ParseFormula(formula)->GetReferencedCells().size();
+            }
+            return formulas->size();
+        };
+    });
+
+    runner.Run("formula/get_expression", [size]() {
+        auto formulas = std::make_shared<std::vector<std::unique_ptr<FormulaInterface>>>();
+        for (const std::string& formula : MakeFormulas(size)) {
+            formulas->push_back(ParseFormula(formula));
+        }
+        return [formulas]() {
+            for (const auto& formula : *formulas) {
+                checksum += formula->GetExpression().size();
+            }
+            return formulas->size();
+        };
+    });
+
+    //синтетическая таблица из size ячеек с параметрами генератора по умолчанию
+    WorkloadOptions workload;
+    workload.rows = std::max(size / workload.cols, 1);
+
+    runner.Run("workload/generate", [workload]() {
+        auto sheet = std::make_shared<Sheet>();
+        return [sheet, workload]() {
+            GenerateWorkload(*sheet, workload);
+            return size_t(workload.rows) * workload.cols;
+        };
+    });
+
+    runner.Run("workload/evaluate", [workload]() {
+        auto sheet = std::make_shared<Sheet>();
+        WorkloadStats stats = GenerateWorkload(*sheet, workload);
+        return [sheet, stats]() {
+            sheet->EvaluateFormulaBlocks();
+            return stats.formulas;
+        };
+    });
+
+    //загрузка синтетической таблицы из текста в формате PrintTexts
+    runner.Run("load/tsv", [workload]() {
+        Sheet source;
+        GenerateWorkload(source, workload);
+        auto input = std::make_shared<std::stringstream>();
+        source.PrintTexts(*input);
+        auto sheet = std::make_shared<Sheet>();
+        return [sheet, input]() {
+            LoadStats stats = TsvLoader(*sheet).Load(*input);
+            return stats.text_cells + stats.formula_cells;
+        };
+    });
+
+    //те же ячейки одним вызовом SetCells
+    runner.Run("load/set_cells", [workload]() {
+        Sheet source;
+        GenerateWorkload(source, workload);
+        auto cells = std::make_shared<std::vector<std::pair<Position, std::string>>>();
+        Size size = source.GetPrintableSize();
+        for (int row = 0; row < size.rows; ++row) {
+            for (int col = 0; col < size.cols; ++col) {
+                const CellInterface* cell = source.GetCell({row, col});
+                if (cell != nullptr && !cell->GetText().empty()) {
+                    cells->emplace_back(Position{row, col}, cell->GetText());
+                }
+            }
+        }
+        auto sheet = std::make_shared<Sheet>();
+        return [sheet, cells]() {
+            const size_t count = cells->size();
+            sheet->SetCells(std::move(*cells));
+            return count;
+        };
+    });
+
+    //восстановление синтетической таблицы с вычисленными значениями из двоичного снимка
+    runner.Run("snapshot/restore", [workload]() {
+        Sheet source;
+        GenerateWorkload(source, workload);
+        std::string path =
+            (std::filesystem::temp_directory_path() / ("spreadsheet_bench_" + std::to_string(getpid()) + ".snap")).string();
+        SaveSnapshot(source, path);
+        auto snapshot = std::make_shared<SheetSnapshot>(path);
+        //отображение в память остаётся действительным после удаления файла
+        std::remove(path.c_str());
+        //восстановленный лист удаляется вне замера
+        auto restored = std::make_shared<std::unique_ptr<Sheet>>();
+        return [snapshot, restored]() {
+            *restored = snapshot->Restore();
+            checksum += (*restored)->GetPrintableSize().rows;
+            return snapshot->GetCellCount();
+        };
+    });
+
+    //числа, текст и формулы поровну; значения вычислены заранее
+    auto make_mixed_sheet = [size]() {
+        auto sheet = std::make_shared<Sheet>();
+        for (int i = 0; i < size; ++i) {
+            Position pos = GridPosition(i);
+            if (i % 3 == 0) {
+                sheet->SetCell(pos, std::to_string(i * 0.5));
+            } else if (i % 3 == 1) {
+                sheet->SetCell(pos, "label" + std::to_string(i));
+            } else {
+                sheet->SetCell(pos, pos.col == 0 ? "=" + std::to_string(i) + "/3" : "=" + CellName(pos.row, pos.col - 1) + "/3");
+            }
+        }
+        sheet->EvaluateFormulaBlocks();
+        return sheet;
+    };
+
+    runner.Run("print/values", [make_mixed_sheet, size]() {
+        std::shared_ptr<Sheet> sheet = make_mixed_sheet();
+        return [sheet, size]() {
+            std::ostringstream output;
+            sheet->PrintValues(output);
+            checksum += output.str().size();
+            return size_t(size);
+        };
+    });
+
+    runner.Run("print/texts", [make_mixed_sheet, size]() {
+        std::shared_ptr<Sheet> sheet = make_mixed_sheet();
+        return [sheet, size]() {
+            std::ostringstream output;
+            sheet->PrintTexts(output);
+            checksum += output.str().size();
+            return size_t(size);
+        };
+    });
+
+    //size ячеек в SHIFT_COLS столбцах: первый столбец - числа, остальные ссылаются на
+    //соседа слева в своей и предыдущей строке; значения вычислены заранее
+    const int shift_rows = std::max(size / SHIFT_COLS, SHIFT_EDGE_ROWS + 1);
+    auto make_shift_sheet = [shift_rows]() {
+        auto sheet = std::make_shared<Sheet>();
+        std::vector<std::pair<Position, std::string>> cells;
+        for (int row = 0; row < shift_rows; ++row) {
+            cells.emplace_back(Position{row, 0}, "=" + std::to_string(row));
+            for (int col = 1; col < SHIFT_COLS; ++col) {
+                cells.emplace_back(Position{row, col},
+                                   "=" + CellName(row, col - 1) + "+" + CellName(std::max(row - 1, 0), col - 1));
+            }
+        }
+        sheet->SetCells(std::move(cells));
+        sheet->EvaluateFormulaBlocks();
+        return sheet;
+    };
+
+    //вставка и удаление строки у нижнего края: сдвигаются SHIFT_EDGE_ROWS строк
+    runner.Run("shift/rows_near_end", [make_shift_sheet, shift_rows]() {
+        std::shared_ptr<Sheet> sheet = make_shift_sheet();
+        return [sheet, shift_rows]() {
+            for (int i = 0; i < SHIFT_REPEATS; ++i) {
+                sheet->InsertRows(shift_rows - SHIFT_EDGE_ROWS);
+                sheet->DeleteRows(shift_rows - SHIFT_EDGE_ROWS);
+            }
+            return size_t(2 * SHIFT_REPEATS);
+        };
+    });
+
+    //вставка и удаление первой строки: сдвигается весь лист
+    runner.Run("shift/rows_whole_sheet", [make_shift_sheet]() {
+        std::shared_ptr<Sheet> sheet = make_shift_sheet();
+        return [sheet]() {
+            sheet->InsertRows(0);
+            sheet->DeleteRows(0);
+            return size_t(2);
+        };
+    });
+
+    //вставка и удаление последнего столбца: затрагивает каждую строку
+    runner.Run("shift/last_col", [make_shift_sheet]() {
+        std::shared_ptr<Sheet> sheet = make_shift_sheet();
+        return [sheet]() {
+            sheet->InsertCols(SHIFT_COLS - 1);
+            sheet->DeleteCols(SHIFT_COLS - 1);
+            return size_t(2);
+        };
+    });
+
+    //заполнение shift_rows строк по SHIFT_COLS формул из первой строки: формулы
+    //переводятся в постфиксную запись один раз, проверка на цикл - одна на всё заполнение
+    auto make_fill_sheet = []() {
+        auto sheet = std::make_shared<Sheet>();
+        sheet->SetCell({0, 0}, "=1");
+        for (int col = 1; col < SHIFT_COLS; ++col) {
+            sheet->SetCell({0, col}, "=2");
+        }
+        sheet->SetCells(FillRowTexts(1));
+        return sheet;
+    };
+
+    runner.Run("copy/fill_down", [make_fill_sheet, shift_rows]() {
+        std::shared_ptr<Sheet> sheet = make_fill_sheet();
+        return [sheet, shift_rows]() {
+            sheet->FillDown({1, 0}, {shift_rows - 1, SHIFT_COLS - 1});
+            return size_t(shift_rows - 2) * SHIFT_COLS;
+        };
+    });
+
+    //те же ячейки через SetCells с текстами, которые даёт заполнение
+    runner.Run("copy/set_cells", [make_fill_sheet, shift_rows]() {
+        std::shared_ptr<Sheet> sheet = make_fill_sheet();
+        auto cells = std::make_shared<std::vector<std::pair<Position, std::string>>>();
+        for (int row = 2; row < shift_rows; ++row) {
+            std::vector<std::pair<Position, std::string>> row_cells = FillRowTexts(row);
+            cells->insert(cells->end(), row_cells.begin(), row_cells.end());
+        }
+        return [sheet, cells]() {
+            const size_t count = cells->size();
+            sheet->SetCells(std::move(*cells));
+            return count;
+        };
+    });
+
+    //копирование блока в пустую часть листа и обратно поверх ячеек с содержимым;
+    //пустые ячейки источника очищают ячейки назначения
+    runner.Run("copy/range", [make_shift_sheet, shift_rows]() {
+        std::shared_ptr<Sheet> sheet = make_shift_sheet();
+        return [sheet, shift_rows]() {
+            const int rows = shift_rows / 2;
+            sheet->CopyRange({0, 0}, {rows - 1, SHIFT_COLS - 1}, {0, SHIFT_COLS});
+            sheet->CopyRange({rows, SHIFT_COLS}, {2 * rows - 1, 2 * SHIFT_COLS - 1}, {rows, 0});
+            return size_t(2 * rows) * SHIFT_COLS;
+        };
+    });
+
+    //то, что заменяют сдвиги: построение листа заново из текстов ячеек
+    runner.Run("shift/rebuild", [make_shift_sheet]() {
+        std::shared_ptr<Sheet> sheet = make_shift_sheet();
+        auto cells = std::make_shared<std::vector<std::pair<Position, std::string>>>();
+        Size size = sheet->GetPrintableSize();
+        for (int row = 0; row < size.rows; ++row) {
+            for (int col = 0; col < size.cols; ++col) {
+                cells->emplace_back(Position{row, col}, sheet->GetCell({row, col})->GetText());
+            }
+        }
+        return [cells]() {
+            Sheet rebuilt;
+            rebuilt.SetCells(*cells);
+            return size_t(1);
+        };
+    });
+}
+
+//{"memory": [{"name": ..., "usage": {...}}, ...]}; значения таблиц вычислены
+void ReportMemory(std::ostream& output, int size) {
+    WorkloadOptions workload;
+    workload.rows = std::max(size / workload.cols, 1);
+    std::vector<std::pair<std::string, WorkloadOptions>> workloads(5, {"", workload});
+    workloads[0].first = "workload/default";
+    workloads[1].first = "workload/formulas";
+    workloads[1].second.formula_share = 0.8;
+    workloads[2].first = "workload/text";
+    workloads[2].second.formula_share = 0.05;
+    workloads[2].second.text_share = 0.7;
+    workloads[3].first = "workload/chains";
+    workloads[3].second.chain_columns = 8;
+    //таблица по умолчанию, в которой очищена каждая третья ячейка: очищенные ячейки
+    //остаются в таблице без содержимого
+    workloads[4].first = "workload/cleared";
+
+    output << "{\"memory\": [";
+    for (size_t i = 0; i < workloads.size(); ++i) {
+        Sheet sheet;
+        GenerateWorkload(sheet, workloads[i].second);
+        if (workloads[i].first == "workload/cleared") {
+            for (int row = 0; row < workload.rows; ++row) {
+                for (int col = row % 3; col < workload.cols; col += 3) {
+                    sheet.ClearCell(Position{row, col});
+                }
+            }
+        }
+        std::ostringstream values;
+        sheet.PrintValues(values);
+        output << (i == 0 ? "\n" : ",\n") << "{\"name\": ";
+        BenchmarkRunner::WriteJsonString(output, workloads[i].first);
+        output << ", \"usage\": ";
+        WriteMemoryUsage(output, sheet.GetMemoryUsage());
+        output << '}';
+    }
+    output << "\n]}\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int size = 10000;
+    size_t repetitions = 5;
+    std::string filter;
+    std::string output_path;
+    bool is_memory_report = false;
+    std::string baseline_path;
+    double tolerance = 0.25;
+    for (int i = 1; i < argc; i += 2) {
+        std::string option = argv[i];
+        if (i + 1 == argc) {
+            std::cerr << "no value for option " << option << '\n';
+            return 2;
+        } else if (option == "--size") {
+            size = std::stoi(argv[i + 1]);
+        } else if (option == "--repetitions") {
+            repetitions = std::stoul(argv[i + 1]);
+        } else if (option == "--filter") {
+            filter = argv[i + 1];
+        } else if (option == "--output") {
+            output_path = argv[i + 1];
+        } else if (option == "--baseline") {
+            baseline_path = argv[i + 1];
+        } else if (option == "--tolerance") {
+            tolerance = std::stod(argv[i + 1]);
+        } else if (option == "--memory") {
+            is_memory_report = std::string(argv[i + 1]) != "0";
+        } else {
+            std::cerr << "unknown option " << option << '\n';
+            return 2;
+        }
+    }
+
+    if (is_memory_report) {
+        if (output_path.empty()) {
+            ReportMemory(std::cout, size);
+        } else {
+            std::ofstream output(output_path);
+            ReportMemory(output, size);
+        }
+        return 0;
+    }
+
+    //базовые результаты читаются до запуска бенчмарков: без них сравнивать не с чем
+    std::optional<std::ifstream> baseline_file;
+    if (!baseline_path.empty()) {
+        baseline_file.emplace(baseline_path);
+        if (!*baseline_file) {
+            std::cerr << "no baseline " << baseline_path << ", run perf_baseline first\n";
+            return NO_BASELINE_RETURN_CODE;
+        }
+    }
+
+    BenchmarkRunner runner(repetitions, filter);
+    RunBenchmarks(runner, size);
+
+    if (output_path.empty()) {
+        runner.WriteJson(std::cout);
+    } else {
+        std::ofstream output(output_path);
+        runner.WriteJson(output);
+    }
+    std::cerr << "checksum " << checksum << '\n';
+
+    if (baseline_file) {
+        if (!runner.CheckAgainst(BenchmarkRunner::ReadJson(*baseline_file), tolerance, std::cerr)) {
+            std::cerr << "performance check failed\n";
+            return 1;
+        }
+    }
+    return 0;
+}
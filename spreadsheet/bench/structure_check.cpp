@@ -0,0 +1,662 @@
+#include "../journal.h"
+#include "../sheet.h"
+#include "../workbook.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Проверка вставки и удаления строк и столбцов (Sheet::InsertRows и др.) и
+// копирования диапазонов (CopyRange, FillDown, FillRight).
+// 1. Отдельные случаи: вставка и удаление перед ячейками, на которые ссылаются
+//    формулы, на их месте и после них, ссылки #REF! и их распространение на
+//    зависимые ячейки, ссылки с другого листа (S2!A1), повторный разбор текста
+//    формул с #REF!; сдвиг ссылок копий, пересекающиеся источник и назначение,
+//    ссылки за краем листа, одна проверка на цикл для всего копирования, очистка
+//    ячеек назначения пустыми ячейками источника.
+// 2. Случайные сценарии на книге из двух листов: изменения ячеек обоих листов
+//    чередуются со сдвигами строк и столбцов первого листа и копированием
+//    диапазонов второго. Ожидаемые тексты ячеек получаются переписыванием ссылок
+//    в текстах модели; после каждого шага лист сравнивается с книгой, заново
+//    построенной из этих текстов: тексты, значения и ссылки ячеек должны
+//    совпадать. Дополнительно проверяется, что
+//    снимок, сделанный до изменения, не меняется, что GetChanges сообщает о каждой
+//    изменённой позиции и что журнал (SheetJournal) восстанавливает тексты листа.
+// Аргументы: число сценариев (по умолчанию 200), число шагов сценария (по умолчанию
+// 60), путь к временному файлу журнала (по умолчанию structure_check.jnl).
+// Код возврата 1, если найдено расхождение.
+namespace {
+
+//размер области, в которой задаются ячейки случайных сценариев
+const int ROWS = 12;
+const int COLS = 5;
+//размер сравниваемой области: сдвиги выносят ячейки за пределы ROWS x COLS
+const int CHECK_ROWS = ROWS + 8;
+const int CHECK_COLS = COLS + 8;
+//сообщений о расхождениях выводится не больше
+const int MAX_REPORTED_ERRORS = 10;
+
+int errors = 0;
+
+void Expect(bool condition, const std::string& message) {
+    if (!condition) {
+        if (errors < MAX_REPORTED_ERRORS) {
+            std::cerr << message << '\n';
+        }
+        ++errors;
+    }
+}
+
+std::string ToString(const CellInterface::Value& value) {
+    std::ostringstream output;
+    std::visit([&output](const auto& x) {
+        output << x;
+    }, value);
+    return output.str();
+}
+
+std::string GetText(const Sheet& sheet, Position pos) {
+    const Cell* cell = sheet.GetCell(pos);
+    return cell == nullptr ? std::string() : cell->GetText();
+}
+
+std::string GetValue(const Sheet& sheet, Position pos) {
+    const Cell* cell = sheet.GetCell(pos);
+    return cell == nullptr ? std::string() : ToString(cell->GetValue());
+}
+
+std::string PrintTexts(const Sheet& sheet) {
+    std::ostringstream output;
+    sheet.PrintTexts(output);
+    return output.str();
+}
+
+//сдвиг строк или столбцов первого листа
+struct ShiftStep {
+    bool is_rows = true;
+    bool is_deletion = false;
+    int first = 0;
+    int count = 1;
+
+    //новая позиция ячейки; Position::NONE для удалённой
+    Position Apply(Position pos) const {
+        int& index = is_rows ? pos.row : pos.col;
+        if (index < first) {
+            return pos;
+        }
+        if (is_deletion) {
+            if (index < first + count) {
+                return Position::NONE;
+            }
+            index -= count;
+            return pos;
+        }
+        index += count;
+        return pos.IsValid() ? pos : Position::NONE;
+    }
+
+    std::string ToString() const {
+        return std::string(is_deletion ? "delete " : "insert ") + (is_rows ? "rows " : "cols ") + std::to_string(first)
+               + "+" + std::to_string(count);
+    }
+};
+
+void ApplyShift(SheetJournal& journal, Sheet& sheet, const ShiftStep& step) {
+    if (step.is_rows) {
+        step.is_deletion ? journal.DeleteRows(sheet, step.first, step.count)
+                         : journal.InsertRows(sheet, step.first, step.count);
+    } else {
+        step.is_deletion ? journal.DeleteCols(sheet, step.first, step.count)
+                         : journal.InsertCols(sheet, step.first, step.count);
+    }
+}
+
+bool IsLetter(char c) {
+    return c >= 'A' && c <= 'Z';
+}
+
+bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+//новая позиция ячейки pos листа sheet, на которую ссылается формула
+using ReferenceRewrite = std::function<Position(const std::string& sheet, Position pos)>;
+
+//переписывает ссылки формулы text, записанной на листе sheet_name; ссылка на
+//Position::NONE записывается как #REF!
+std::string RewriteReferences(const std::string& text, const std::string& sheet_name, const ReferenceRewrite& rewrite) {
+    if (text.size() < 2 || text[0] != '=') {
+        return text;
+    }
+    std::string result;
+    size_t i = 0;
+    while (i < text.size()) {
+        if (text.compare(i, 5, "#REF!") == 0) {
+            result += "#REF!";
+            i += 5;
+            continue;
+        }
+        if (!IsLetter(text[i])) {
+            result += text[i++];
+            continue;
+        }
+        //имя листа или ячейки: буквы, затем цифры; после имени листа - '!'
+        size_t begin = i;
+        while (i < text.size() && (IsLetter(text[i]) || IsDigit(text[i]))) {
+            ++i;
+        }
+        std::string name = text.substr(begin, i - begin);
+        std::string sheet = sheet_name;
+        if (i < text.size() && text[i] == '!') {
+            sheet = name;
+            result += name + '!';
+            ++i;
+            if (text.compare(i, 5, "#REF!") == 0) {
+                continue;
+            }
+            begin = i;
+            while (i < text.size() && (IsLetter(text[i]) || IsDigit(text[i]))) {
+                ++i;
+            }
+            name = text.substr(begin, i - begin);
+        }
+        Position pos = rewrite(sheet, Position::FromString(name));
+        result += pos.IsValid() ? pos.ToString() : "#REF!";
+    }
+    return result;
+}
+
+//тексты ячеек книги: лист 0 - "S1", лист 1 - "S2"
+using Model = std::map<std::pair<int, Position>, std::string>;
+
+const char* const SHEET_NAMES[] = {"S1", "S2"};
+
+struct TestBook {
+    Workbook workbook;
+    Sheet* sheets[2] = {&workbook.AddSheet(SHEET_NAMES[0]), &workbook.AddSheet(SHEET_NAMES[1])};
+};
+
+//заполняет книгу текстами модели; бросает исключение SetCells
+void Rebuild(TestBook& book, const Model& model) {
+    std::vector<std::pair<Position, std::string>> cells[2];
+    for (const auto& [key, text] : model) {
+        cells[key.first].emplace_back(key.second, text);
+    }
+    for (int sheet = 0; sheet < 2; ++sheet) {
+        book.sheets[sheet]->SetCells(std::move(cells[sheet]));
+    }
+}
+
+//сравнивает книгу с книгой, заново построенной из текстов модели
+void CompareWithRebuilt(TestBook& book, const Model& model, const std::string& where) {
+    TestBook rebuilt;
+    try {
+        Rebuild(rebuilt, model);
+    } catch (const std::exception& e) {
+        Expect(false, where + ": expected texts are rejected: " + e.what());
+        return void();
+    }
+
+    for (int sheet = 0; sheet < 2; ++sheet) {
+        for (int row = 0; row < CHECK_ROWS; ++row) {
+            for (int col = 0; col < CHECK_COLS; ++col) {
+                Position pos{row, col};
+                std::string cell_name = std::string(SHEET_NAMES[sheet]) + "!" + pos.ToString();
+                std::string text = GetText(*book.sheets[sheet], pos);
+                std::string expected = GetText(*rebuilt.sheets[sheet], pos);
+                if (text != expected) {
+                    Expect(false, where + ": text of " + cell_name + " is '" + text + "', expected '" + expected + "'");
+                    continue;
+                }
+                if (text.empty()) {
+                    continue;
+                }
+                Expect(GetValue(*book.sheets[sheet], pos) == GetValue(*rebuilt.sheets[sheet], pos),
+                       where + ": wrong value of " + cell_name);
+                Expect(book.sheets[sheet]->GetCell(pos)->GetReferencedCells()
+                           == rebuilt.sheets[sheet]->GetCell(pos)->GetReferencedCells(),
+                       where + ": wrong references of " + cell_name);
+            }
+        }
+    }
+}
+
+std::string RandomFormula(std::mt19937& random, int sheet) {
+    auto random_cell = [&random]() {
+        return Position{int(random() % ROWS), int(random() % COLS)}.ToString();
+    };
+    int kind = random() % 10;
+    if (kind < 2) {
+        return "=" + std::to_string(random() % 100);
+    }
+    if (kind == 2) {
+        return "text";
+    }
+    std::string other_sheet = std::string(SHEET_NAMES[1 - sheet]) + "!";
+    std::string lhs = (random() % 4 == 0 ? other_sheet : "") + random_cell();
+    std::string rhs = (random() % 5 == 0 ? std::string(SHEET_NAMES[sheet]) + "!" : "") + random_cell();
+    if (kind < 6) {
+        return "=" + lhs + "+" + rhs;
+    }
+    if (kind < 8) {
+        return "=" + lhs + "*2";
+    }
+    return "=(" + lhs + "+1)/" + rhs;
+}
+
+//состояние листа до изменения: тексты и значения сравниваемой области, снимок и
+//версия для GetChanges
+struct SheetState {
+    std::map<Position, std::pair<std::string, std::string>> cells;
+    std::shared_ptr<const SheetView> view;
+    std::string view_texts;
+    std::uint64_t version = 0;
+};
+
+SheetState SaveState(const Sheet& sheet) {
+    SheetState state;
+    for (int row = 0; row < CHECK_ROWS; ++row) {
+        for (int col = 0; col < CHECK_COLS; ++col) {
+            state.cells[{row, col}] = {GetText(sheet, {row, col}), GetValue(sheet, {row, col})};
+        }
+    }
+    state.view = sheet.Snapshot();
+    std::ostringstream view_texts;
+    state.view->PrintTexts(view_texts);
+    state.view_texts = view_texts.str();
+    state.version = sheet.GetChanges(0).version;
+    return state;
+}
+
+//снимок, сделанный до изменения, не меняется; GetChanges сообщает о каждой изменённой ячейке
+void ExpectChangesReported(const Sheet& sheet, const SheetState& before, const std::string& where) {
+    std::ostringstream view_texts;
+    before.view->PrintTexts(view_texts);
+    Expect(view_texts.str() == before.view_texts, where + ": snapshot taken before the change has changed");
+
+    Sheet::Changes changes = sheet.GetChanges(before.version);
+    std::set<Position> reported(changes.cells.begin(), changes.cells.end());
+    for (const auto& [pos, old_cell] : before.cells) {
+        std::pair<std::string, std::string> new_cell{GetText(sheet, pos), GetValue(sheet, pos)};
+        //у ячеек без текста значения не выводятся
+        if (old_cell.first.empty() && new_cell.first.empty()) {
+            continue;
+        }
+        Expect(new_cell == old_cell || reported.count(pos) > 0, where + ": change of " + pos.ToString() + " is not reported");
+    }
+}
+
+void CheckShift(TestBook& book, SheetJournal& journal, Model& model, const ShiftStep& step,
+                const std::string& where) {
+    Sheet& sheet = *book.sheets[0];
+    SheetState before = SaveState(sheet);
+
+    try {
+        ApplyShift(journal, sheet, step);
+    } catch (const InvalidPositionException&) {
+        //вставка, вытесняющая ячейку за пределы листа, в этой области невозможна
+        Expect(false, where + ": unexpected InvalidPositionException");
+        return void();
+    }
+
+    //сдвигаются ячейки первого листа и ссылки на них
+    auto rewrite = [&step](const std::string& sheet, Position pos) {
+        return sheet == SHEET_NAMES[0] ? step.Apply(pos) : pos;
+    };
+    Model shifted;
+    for (const auto& [key, text] : model) {
+        Position pos = key.first == 0 ? step.Apply(key.second) : key.second;
+        if (pos.IsValid()) {
+            shifted[{key.first, pos}] = RewriteReferences(text, SHEET_NAMES[key.first], rewrite);
+        }
+    }
+    model = std::move(shifted);
+    ExpectChangesReported(sheet, before, where);
+}
+
+//копирование диапазона второго листа: CopyRange(top_left, bottom_right, destination),
+//FillDown(top_left, bottom_right) или FillRight(top_left, bottom_right)
+struct CopyStep {
+    enum class Kind {
+        Copy,
+        FillDown,
+        FillRight,
+    };
+
+    Kind kind = Kind::Copy;
+    Position top_left;
+    Position bottom_right;
+    Position destination;
+
+    std::string ToString() const {
+        std::string range = top_left.ToString() + ":" + bottom_right.ToString();
+        switch (kind) {
+            case Kind::Copy:
+                return "copy " + range + " to " + (destination.IsValid() ? destination.ToString() : "invalid");
+            case Kind::FillDown:
+                return "fill down " + range;
+            default:
+                return "fill right " + range;
+        }
+    }
+};
+
+void ApplyCopy(Sheet& sheet, const CopyStep& step) {
+    switch (step.kind) {
+        case CopyStep::Kind::Copy:
+            return sheet.CopyRange(step.top_left, step.bottom_right, step.destination);
+        case CopyStep::Kind::FillDown:
+            return sheet.FillDown(step.top_left, step.bottom_right);
+        default:
+            return sheet.FillRight(step.top_left, step.bottom_right);
+    }
+}
+
+//тексты модели после копирования; nullopt, если диапазон назначения выходит за пределы листа
+std::optional<Model> ApplyCopy(const Model& model, int sheet, const CopyStep& step) {
+    const int rows = step.bottom_right.row - step.top_left.row + 1;
+    const int cols = step.bottom_right.col - step.top_left.col + 1;
+    //назначение и повторяемая часть источника
+    Position destination_top_left = step.destination;
+    Position destination_bottom_right{step.destination.row + rows - 1, step.destination.col + cols - 1};
+    int source_rows = rows;
+    int source_cols = cols;
+    if (step.kind == CopyStep::Kind::FillDown) {
+        destination_top_left = {step.top_left.row + 1, step.top_left.col};
+        destination_bottom_right = step.bottom_right;
+        source_rows = 1;
+    } else if (step.kind == CopyStep::Kind::FillRight) {
+        destination_top_left = {step.top_left.row, step.top_left.col + 1};
+        destination_bottom_right = step.bottom_right;
+        source_cols = 1;
+    } else if (!destination_top_left.IsValid() || !destination_bottom_right.IsValid()) {
+        return std::nullopt;
+    }
+
+    Model result = model;
+    for (int row = destination_top_left.row; row <= destination_bottom_right.row; ++row) {
+        for (int col = destination_top_left.col; col <= destination_bottom_right.col; ++col) {
+            Position source{step.top_left.row + (row - destination_top_left.row) % source_rows,
+                            step.top_left.col + (col - destination_top_left.col) % source_cols};
+            auto it = model.find({sheet, source});
+            if (it == model.end()) {
+                result.erase({sheet, {row, col}});
+                continue;
+            }
+            //все ссылки копии сдвигаются на расстояние от исходной ячейки
+            auto rewrite = [offset = Position{row - source.row, col - source.col}](const std::string&, Position pos) {
+                Position moved{pos.row + offset.row, pos.col + offset.col};
+                return moved.IsValid() ? moved : Position::NONE;
+            };
+            result[{sheet, {row, col}}] = RewriteReferences(it->second, SHEET_NAMES[sheet], rewrite);
+        }
+    }
+    return result;
+}
+
+void CheckCopy(TestBook& book, Model& model, const CopyStep& step, const std::string& where) {
+    Sheet& sheet = *book.sheets[1];
+    SheetState before = SaveState(sheet);
+    std::optional<Model> expected = ApplyCopy(model, 1, step);
+
+    try {
+        ApplyCopy(sheet, step);
+    } catch (const InvalidPositionException&) {
+        Expect(!expected, where + ": unexpected InvalidPositionException");
+        return void();
+    } catch (const CircularDependencyException&) {
+        //цикл отклоняет всё копирование; ожидаемые тексты тоже должны содержать цикл
+        Expect(PrintTexts(sheet) == before.view_texts, where + ": sheet is changed by a rejected copy");
+        if (expected) {
+            TestBook rebuilt;
+            try {
+                Rebuild(rebuilt, *expected);
+                Expect(false, where + ": copy is rejected without a cycle");
+            } catch (const CircularDependencyException&) {
+            }
+        }
+        return void();
+    }
+
+    if (!expected) {
+        Expect(false, where + ": copy beyond the sheet is not rejected");
+        return void();
+    }
+    model = std::move(*expected);
+    ExpectChangesReported(sheet, before, where);
+}
+
+void CheckRandomScenarios(int scenarios, int steps, const std::string& journal_path) {
+    for (int scenario = 1; scenario <= scenarios && errors == 0; ++scenario) {
+        std::mt19937 random(scenario);
+        std::remove(journal_path.c_str());
+        TestBook book;
+        Model model;
+        {
+            SheetJournal journal(journal_path);
+            for (int step = 0; step < steps && errors == 0; ++step) {
+                std::string where = "scenario " + std::to_string(scenario) + ", step " + std::to_string(step);
+                int sheet = random() % 2;
+                Position pos{int(random() % ROWS), int(random() % COLS)};
+                if (random() % 4 == 0) {
+                    ShiftStep shift{random() % 2 == 0, random() % 2 == 0, int(random() % (ROWS + 1)),
+                                    int(1 + random() % 3)};
+                    where += " (" + shift.ToString() + ")";
+                    CheckShift(book, journal, model, shift, where);
+                } else if (random() % 4 == 0) {
+                    //копирование - на втором листе: журнал первого листа его не записывает.
+                    //Назначение может выходить за левый и верхний край листа
+                    CopyStep copy;
+                    copy.kind = static_cast<CopyStep::Kind>(random() % 3);
+                    copy.top_left = pos;
+                    copy.bottom_right = {pos.row + int(random() % 4), pos.col + int(random() % 3)};
+                    copy.destination = {int(random() % (ROWS + 2)) - 1, int(random() % (COLS + 2)) - 1};
+                    where += " (" + copy.ToString() + ")";
+                    CheckCopy(book, model, copy, where);
+                } else if (random() % 5 == 0) {
+                    where += " (clear " + pos.ToString() + ")";
+                    if (sheet == 0) {
+                        journal.ClearCell(*book.sheets[0], pos);
+                    } else {
+                        book.sheets[1]->ClearCell(pos);
+                    }
+                    model.erase({sheet, pos});
+                } else {
+                    std::string text = RandomFormula(random, sheet);
+                    where += " (set " + std::string(SHEET_NAMES[sheet]) + "!" + pos.ToString() + " " + text + ")";
+                    try {
+                        if (sheet == 0) {
+                            journal.SetCell(*book.sheets[0], pos, text);
+                        } else {
+                            book.sheets[1]->SetCell(pos, text);
+                        }
+                        model[{sheet, pos}] = text;
+                    } catch (const CircularDependencyException&) {
+                    }
+                }
+                CompareWithRebuilt(book, model, where);
+            }
+        }
+
+        //формулы листа ссылаются на листы книги по имени
+        TestBook replayed;
+        SheetJournal(journal_path).Replay(*replayed.sheets[0]);
+        Expect(PrintTexts(*replayed.sheets[0]) == PrintTexts(*book.sheets[0]),
+               "scenario " + std::to_string(scenario) + ": journal replay differs from the sheet");
+    }
+    std::remove(journal_path.c_str());
+}
+
+void CheckCases() {
+    Workbook workbook;
+    Sheet& sheet = workbook.AddSheet("S1");
+    Sheet& other = workbook.AddSheet("S2");
+    auto expect_text = [](const Sheet& sheet, const char* pos, const std::string& expected, const std::string& what) {
+        std::string text = GetText(sheet, Position::FromString(pos));
+        Expect(text == expected, what + ": " + pos + " is '" + text + "', expected '" + expected + "'");
+    };
+
+    //A1:A5 = 1..5, B1 ссылается на A2 и A4, C1 - на B1, S2!A1 - на S1!A3
+    for (int row = 0; row < 5; ++row) {
+        sheet.SetCell({row, 0}, "=" + std::to_string(row + 1));
+    }
+    sheet.SetCell(Position::FromString("B1"), "=A2+A4");
+    sheet.SetCell(Position::FromString("C1"), "=B1*10");
+    other.SetCell(Position::FromString("A1"), "=S1!A3");
+
+    sheet.InsertRows(10, 2);
+    expect_text(sheet, "B1", "=A2+A4", "insert after the referenced rows");
+    sheet.InsertRows(3, 1);
+    expect_text(sheet, "B1", "=A2+A5", "insert between the referenced rows");
+    sheet.InsertRows(1, 2);
+    expect_text(sheet, "B1", "=A4+A7", "insert at the first referenced row");
+    expect_text(other, "A1", "=S1!A5", "insert on the referenced sheet");
+    Expect(GetValue(sheet, Position::FromString("C1")) == "60", "insert changes values");
+    sheet.DeleteRows(1, 2);
+    sheet.DeleteRows(3, 1);
+    expect_text(sheet, "B1", "=A2+A4", "delete around the referenced rows");
+    expect_text(other, "A1", "=S1!A3", "delete on the referenced sheet");
+
+    sheet.DeleteRows(1, 1);
+    expect_text(sheet, "B1", "=#REF!+A3", "delete a referenced row");
+    Expect(GetValue(sheet, Position::FromString("B1")) == "#REF!", "reference to a deleted cell is not #REF!");
+    Expect(GetValue(sheet, Position::FromString("C1")) == "#REF!", "#REF! does not propagate to dependents");
+    expect_text(other, "A1", "=S1!A2", "delete above a cell of another sheet");
+    sheet.DeleteRows(1, 1);
+    expect_text(other, "A1", "=S1!#REF!", "delete a cell referenced from another sheet");
+    Expect(GetValue(other, Position::FromString("A1")) == "#REF!", "cross-sheet reference to a deleted cell is not #REF!");
+
+    //тексты с #REF! разбираются снова
+    sheet.SetCell(Position::FromString("D1"), GetText(sheet, Position::FromString("B1")));
+    other.SetCell(Position::FromString("B1"), GetText(other, Position::FromString("A1")));
+    expect_text(sheet, "D1", "=#REF!+A2", "re-parse a formula with #REF!");
+    expect_text(other, "B1", "=S1!#REF!", "re-parse a sheet reference with #REF!");
+
+    //столбцы: B1 и D1 ссылаются на столбец A
+    sheet.InsertCols(0, 1);
+    expect_text(sheet, "C1", "=#REF!+B2", "insert a column before the referenced one");
+    expect_text(sheet, "E1", "=#REF!+B2", "insert a column before the referenced one");
+    sheet.DeleteCols(1, 1);
+    expect_text(sheet, "B1", "=#REF!+#REF!", "delete the referenced column");
+    expect_text(sheet, "D1", "=#REF!+#REF!", "delete the referenced column");
+    expect_text(sheet, "E1", "", "delete a column");
+
+    //вставка не вытесняет за пределы листа ячейки с содержимым
+    Sheet edge;
+    edge.SetCell({Position::MAX_ROWS - 1, 0}, "last");
+    bool is_rejected = false;
+    try {
+        edge.InsertRows(0, 1);
+    } catch (const InvalidPositionException&) {
+        is_rejected = true;
+    }
+    Expect(is_rejected && GetText(edge, {Position::MAX_ROWS - 1, 0}) == "last",
+           "insert pushes a cell off the sheet");
+}
+
+void CheckCopyCases() {
+    auto expect_text = [](const Sheet& sheet, const char* pos, const std::string& expected, const std::string& what) {
+        std::string text = GetText(sheet, Position::FromString(pos));
+        Expect(text == expected, what + ": " + pos + " is '" + text + "', expected '" + expected + "'");
+    };
+    auto expect_value = [](const Sheet& sheet, const char* pos, const std::string& expected, const std::string& what) {
+        std::string value = GetValue(sheet, Position::FromString(pos));
+        Expect(value == expected, what + ": value of " + pos + " is '" + value + "', expected '" + expected + "'");
+    };
+
+    //сдвиг ссылок копий: A2 = A1 + 1, B1 = A1 * 2
+    Sheet sheet;
+    sheet.SetCell(Position::FromString("A1"), "=1");
+    sheet.SetCell(Position::FromString("A2"), "=A1+1");
+    sheet.SetCell(Position::FromString("B1"), "=A1*2");
+    sheet.FillDown(Position::FromString("A2"), Position::FromString("A5"));
+    expect_text(sheet, "A5", "=A4+1", "fill down");
+    expect_value(sheet, "A5", "5", "fill down");
+    sheet.FillRight(Position::FromString("B1"), Position::FromString("D1"));
+    expect_text(sheet, "D1", "=C1*2", "fill right");
+    expect_value(sheet, "D1", "8", "fill right");
+    sheet.CopyRange(Position::FromString("A2"), Position::FromString("A3"), Position::FromString("C4"));
+    expect_text(sheet, "C5", "=C4+1", "copy range");
+
+    //источник и назначение пересекаются: источник читается до изменения
+    sheet.CopyRange(Position::FromString("A1"), Position::FromString("A3"), Position::FromString("A2"));
+    expect_text(sheet, "A2", "=1", "overlapping copy");
+    expect_text(sheet, "A3", "=A2+1", "overlapping copy");
+    expect_text(sheet, "A4", "=A3+1", "overlapping copy");
+
+    //ссылки за краем листа становятся #REF!
+    sheet.SetCell(Position::FromString("B5"), "=A1*3");
+    sheet.CopyRange(Position::FromString("A3"), Position::FromString("A3"), Position::FromString("A1"));
+    expect_text(sheet, "A1", "=#REF!+1", "reference off the sheet");
+    expect_value(sheet, "A1", "#REF!", "reference off the sheet");
+    expect_value(sheet, "B5", "#REF!", "#REF! of a copy is not propagated");
+    bool is_rejected = false;
+    try {
+        sheet.CopyRange(Position::FromString("A1"), Position::FromString("A2"), Position{Position::MAX_ROWS - 1, 0});
+    } catch (const InvalidPositionException&) {
+        is_rejected = true;
+    }
+    Expect(is_rejected, "copy beyond the sheet is not rejected");
+
+    //одна проверка на цикл для всего заполнения: цикл в третьей строке отклоняет и
+    //первые две, лист не меняется
+    Sheet cycle;
+    cycle.SetCell(Position::FromString("D1"), "=E2");
+    cycle.SetCell(Position::FromString("E4"), "=D3");
+    std::string texts = PrintTexts(cycle);
+    is_rejected = false;
+    try {
+        cycle.FillDown(Position::FromString("D1"), Position::FromString("D5"));
+    } catch (const CircularDependencyException&) {
+        is_rejected = true;
+    }
+    Expect(is_rejected && PrintTexts(cycle) == texts, "fill down with a cycle is not rejected as a whole");
+    //ячейка, на которую ссылается цикл, очищается тем же копированием: цикла нет
+    cycle.SetCell(Position::FromString("A1"), "=B1");
+    cycle.SetCell(Position::FromString("C1"), "=A1");
+    cycle.CopyRange(Position::FromString("A1"), Position::FromString("B1"), Position::FromString("B1"));
+    expect_text(cycle, "B1", "=C1", "copy over a referenced cell");
+    expect_text(cycle, "C1", "", "copy over a referenced cell");
+
+    //пустые ячейки источника очищают ячейки назначения, в том числе на краю таблицы
+    Sheet edge;
+    edge.SetCell(Position::FromString("A1"), "a");
+    edge.SetCell(Position::FromString("C4"), "c");
+    edge.SetCell(Position::FromString("B2"), "=C4");
+    edge.CopyRange(Position::FromString("E1"), Position::FromString("E4"), Position::FromString("C1"));
+    expect_text(edge, "C4", "", "copy of empty cells");
+    expect_value(edge, "B2", "0", "copy of empty cells");
+    Size size = edge.GetPrintableSize();
+    Expect(size == Size{2, 2}, "printable size after copying empty cells is " + std::to_string(size.rows) + "x"
+                                   + std::to_string(size.cols) + ", expected 2x2");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int scenarios = argc > 1 ? std::atoi(argv[1]) : 200;
+    int steps = argc > 2 ? std::atoi(argv[2]) : 60;
+    std::string journal_path = argc > 3 ? argv[3] : "structure_check.jnl";
+
+    CheckCases();
+    CheckCopyCases();
+    CheckRandomScenarios(scenarios, steps, journal_path);
+
+    if (errors != 0) {
+        std::cerr << errors << " errors\n";
+        return 1;
+    }
+    std::cout << "ok\n";
+    return 0;
+}
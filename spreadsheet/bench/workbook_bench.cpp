@@ -0,0 +1,149 @@
+#include "../workbook.h"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Бенчмарк книги из нескольких листов.
+// 1. Проверки ссылок между листами: пересчёт после изменения ячейки другого листа,
+//    отказ от формул, образующих цикл через несколько листов (в том числе при
+//    задании группы ячеек), и от ссылок на отсутствующий лист.
+// 2. Пересчёт книги из независимых листов: листы заполняются формулами, затем все
+//    аргументы изменяются и книга пересчитывается одним потоком и несколькими.
+//    Выводится время пересчёта и проверяется, что значения совпадают.
+// Аргументы: число листов (по умолчанию 8), число строк листа (по умолчанию 10000).
+namespace {
+
+const int COLS = 8;
+
+int errors = 0;
+
+void Expect(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << message << '\n';
+        ++errors;
+    }
+}
+
+bool IsNumber(const CellInterface::Value& value, double expected) {
+    return std::holds_alternative<double>(value) && std::get<double>(value) == expected;
+}
+
+template <typename Exception, typename Action>
+bool Throws(Action action) {
+    try {
+        action();
+    } catch (const Exception&) {
+        return true;
+    }
+    return false;
+}
+
+void CheckReferences() {
+    Workbook workbook;
+    Sheet& data = workbook.AddSheet("Data");
+    Sheet& calc = workbook.AddSheet("Calc");
+    Sheet& report = workbook.AddSheet("Report");
+
+    data.SetCell({0, 0}, "1");
+    calc.SetCell({0, 0}, "=Data!A1*2");
+    report.SetCell({0, 0}, "=Calc!A1+Data!A1");
+    Expect(IsNumber(report.GetCell({0, 0})->GetValue(), 3.0), "wrong value of a cross-sheet formula");
+    Expect(report.GetCell({0, 0})->GetText() == "=Calc!A1+Data!A1", "wrong text of a cross-sheet formula");
+
+    data.SetCell({0, 0}, "10");
+    Expect(IsNumber(report.GetCell({0, 0})->GetValue(), 30.0), "cross-sheet dependents are not invalidated");
+    data.ClearCell({0, 0});
+    Expect(IsNumber(report.GetCell({0, 0})->GetValue(), 0.0), "cleared cell of another sheet is not zero");
+
+    //ссылка на ячейку, которой ещё нет, не меняет размер того листа
+    report.SetCell({1, 0}, "=Data!Z100");
+    Expect(data.GetPrintableSize() == Size{0, 0}, "reference changed the size of another sheet");
+    data.SetCell({99, 25}, "5");
+    Expect(IsNumber(report.GetCell({1, 0})->GetValue(), 5.0), "new cell of another sheet is not seen");
+
+    Expect(Throws<CircularDependencyException>([&]() {
+        data.SetCell({0, 1}, "=Report!B1");
+        report.SetCell({0, 1}, "=Calc!B1");
+        calc.SetCell({0, 1}, "=Data!B1");
+    }), "cycle through three sheets is not detected");
+    Expect(calc.GetCell({0, 1}) == nullptr, "rejected formula changed the sheet");
+
+    Expect(Throws<CircularDependencyException>([&]() {
+        calc.SetCells({{{0, 2}, "=Data!C1"}, {{1, 2}, "=C1"}});
+        data.SetCells({{{0, 2}, "=C2"}, {{1, 2}, "=Calc!C2"}});
+    }), "cycle through a group of cells is not detected");
+
+    Expect(Throws<FormulaException>([&]() {
+        calc.SetCell({5, 5}, "=Missing!A1");
+    }), "reference to a missing sheet is accepted");
+    Expect(Throws<std::invalid_argument>([&]() {
+        workbook.AddSheet("Data");
+    }), "duplicate sheet name is accepted");
+}
+
+void FillSheet(Sheet& sheet, int rows, int seed) {
+    for (int row = 0; row < rows; ++row) {
+        sheet.SetCell({row, 0}, std::to_string(row + seed));
+        for (int col = 1; col < COLS; ++col) {
+            //ссылки только внутри строки: проверка на цикличные ссылки при заполнении
+            //не обходит всю таблицу
+            Position left{row, col - 1};
+            Position first{row, 0};
+            sheet.SetCell({row, col}, "=" + left.ToString() + "*2-" + first.ToString() + "/3");
+        }
+    }
+}
+
+std::string PrintWorkbook(const Workbook& workbook) {
+    std::ostringstream output;
+    for (const std::string& name : workbook.GetSheetNames()) {
+        workbook.GetSheet(name)->PrintValues(output);
+    }
+    return output.str();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+
+    const int sheet_count = argc > 1 ? std::stoi(argv[1]) : 8;
+    const int rows = argc > 2 ? std::stoi(argv[2]) : 10000;
+
+    CheckReferences();
+
+    std::string expected;
+    for (size_t thread_count : {size_t(1), static_cast<size_t>(sheet_count)}) {
+        Workbook workbook;
+        for (int i = 0; i < sheet_count; ++i) {
+            FillSheet(workbook.AddSheet("Sheet" + std::to_string(i + 1)), rows, i);
+        }
+        workbook.Recalculate(thread_count);
+        //изменение аргументов инвалидирует все формулы
+        for (int i = 0; i < sheet_count; ++i) {
+            Sheet& sheet = *workbook.GetSheet("Sheet" + std::to_string(i + 1));
+            for (int row = 0; row < rows; ++row) {
+                sheet.SetCell({row, 0}, std::to_string(row * 2 + i));
+            }
+        }
+
+        auto start = Clock::now();
+        workbook.Recalculate(thread_count);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << "threads " << thread_count << ": recalculation " << seconds * 1000 << " ms\n";
+
+        std::string values = PrintWorkbook(workbook);
+        if (expected.empty()) {
+            expected = std::move(values);
+        } else {
+            Expect(values == expected, "parallel recalculation differs from sequential");
+        }
+    }
+
+    std::cout << "errors " << errors << '\n';
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+#include "../sheet.h"
+#include "../workload_generator.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Генератор синтетических таблиц (см. GenerateWorkload). Таблица строится через
+// SheetInterface и выводится в формате PrintTexts (TSV), который читает TsvLoader.
+// Аргументы (значения по умолчанию - в WorkloadOptions):
+//   --seed N  --rows N  --cols N  --density X  --formulas X  --text X  --depth N
+//   --locality N  --cross X  --chains N  --chain-length N  --totals N  --errors X
+//   --output FILE  (по умолчанию стандартный вывод)
+//   --profile N    вычислить значения таблицы под профилировщиком и вывести N самых дорогих ячеек
+//   --trace FILE   записать построение таблицы (и вычисление при --profile) на временную
+//                  шкалу в формате Chrome trace-event JSON
+// Статистика, время построения и отчёт профилировщика выводятся в стандартный поток ошибок.
+int main(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+
+    WorkloadOptions options;
+    std::string output_path;
+    size_t profile_count = 0;
+    std::string trace_path;
+    for (int i = 1; i < argc; i += 2) {
+        std::string option = argv[i];
+        if (i + 1 == argc) {
+            std::cerr << "no value for option " << option << '\n';
+            return 2;
+        }
+        std::string value = argv[i + 1];
+        if (option == "--seed") {
+            options.seed = static_cast<std::uint32_t>(std::stoul(value));
+        } else if (option == "--rows") {
+            options.rows = std::stoi(value);
+        } else if (option == "--cols") {
+            options.cols = std::stoi(value);
+        } else if (option == "--density") {
+            options.density = std::stod(value);
+        } else if (option == "--formulas") {
+            options.formula_share = std::stod(value);
+        } else if (option == "--text") {
+            options.text_share = std::stod(value);
+        } else if (option == "--depth") {
+            options.max_depth = std::stoi(value);
+        } else if (option == "--locality") {
+            options.locality = std::stoi(value);
+        } else if (option == "--cross") {
+            options.cross_reference_share = std::stod(value);
+        } else if (option == "--chains") {
+            options.chain_columns = std::stoi(value);
+        } else if (option == "--chain-length") {
+            options.chain_length = std::stoi(value);
+        } else if (option == "--totals") {
+            options.total_interval = std::stoi(value);
+        } else if (option == "--errors") {
+            options.error_region_share = std::stod(value);
+        } else if (option == "--output") {
+            output_path = value;
+        } else if (option == "--profile") {
+            profile_count = std::stoul(value);
+        } else if (option == "--trace") {
+            trace_path = value;
+        } else {
+            std::cerr << "unknown option " << option << '\n';
+            return 2;
+        }
+    }
+    if (options.rows <= 0 || options.rows > Position::MAX_ROWS || options.cols <= 0 || options.cols > Position::MAX_COLS) {
+        std::cerr << "rows and cols must be in [1, " << Position::MAX_ROWS << "] and [1, " << Position::MAX_COLS << "]\n";
+        return 2;
+    }
+
+    auto sheet = std::make_unique<Sheet>();
+    if (!trace_path.empty()) {
+        Tracing::Start();
+    }
+    auto start = Clock::now();
+    WorkloadStats stats = GenerateWorkload(*sheet, options);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cerr << "numbers " << stats.numbers << ", texts " << stats.texts << ", formulas " << stats.formulas
+              << ", references " << stats.references << ", generated in " << seconds << " s\n";
+
+    if (profile_count > 0) {
+        sheet->StartProfiling();
+        //вывод значений вычисляет всю таблицу
+        std::ostringstream values;
+        sheet->PrintValues(values);
+        sheet->StopProfiling();
+        WriteProfileReport(std::cerr, sheet->GetProfileReport(profile_count));
+    }
+    if (!trace_path.empty()) {
+        Tracing::Stop();
+        Tracing::Save(trace_path);
+    }
+
+    if (output_path.empty()) {
+        sheet->PrintTexts(std::cout);
+    } else {
+        std::ofstream output(output_path);
+        sheet->PrintTexts(output);
+        if (!output) {
+            std::cerr << "cannot write " << output_path << '\n';
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,260 @@
+#include "block_evaluator.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <tuple>
+
+namespace {
+
+//блоки короче этого размера выгоднее вычислять обычным образом
+const int MIN_BLOCK_SIZE = 8;
+
+//код ошибки в маске дорожки: 0 - ошибки нет, иначе категория ошибки + 1
+const std::uint8_t NO_FORMULA_ERROR = 0;
+
+std::uint8_t ToErrorCode(FormulaError::Category category) {
+    return static_cast<std::uint8_t>(category) + 1;
+}
+
+FormulaError FromErrorCode(std::uint8_t code) {
+    return FormulaError(static_cast<FormulaError::Category>(code - 1));
+}
+
+//при переполнении и делении на ноль обычное вычисление возвращает #DIV/0!
+void MarkNonFinite(const std::vector<double>& column, std::vector<std::uint8_t>& errors) {
+    const std::uint8_t div0 = ToErrorCode(FormulaError::Category::Div0);
+    for (size_t i = 0; i < column.size(); ++i) {
+        if (errors[i] == NO_FORMULA_ERROR && !std::isfinite(column[i])) {
+            errors[i] = div0;
+        }
+    }
+}
+
+} // namespace
+
+BlockEvaluator::BlockEvaluator(const Sheet& sheet)
+    : sheet_(sheet) {
+}
+
+void BlockEvaluator::Evaluate(std::vector<Position> cells) const {
+    //блоки образуют подряд идущие строки одного столбца
+    std::sort(cells.begin(), cells.end(), [](Position lhs, Position rhs) {
+        return std::tie(lhs.col, lhs.row) < std::tie(rhs.col, rhs.row);
+    });
+
+    Block block;
+    auto flush_block = [this, &block]() {
+        if (block.size >= MIN_BLOCK_SIZE && !IsSelfReferencing(block)) {
+            EvaluateBlock(block);
+        }
+        block = Block();
+    };
+
+    for (Position pos : cells) {
+        const Cell* cell_ptr = sheet_.GetCell(pos);
+        //ячейка могла быть вычислена при сборе аргументов предыдущего блока
+        if (cell_ptr == nullptr || cell_ptr->GetValidity() || cell_ptr->GetFormula() == nullptr) {
+            flush_block();
+            continue;
+        }
+
+        FormulaProgram program = cell_ptr->GetFormula()->GetProgram();
+        if (block.size > 0 && IsSameShape(block, pos, program)) {
+            ++block.size;
+            continue;
+        }
+
+        flush_block();
+        block.first = pos;
+        block.size = 1;
+        block.program = std::move(program);
+    }
+    flush_block();
+}
+
+bool BlockEvaluator::IsSameShape(const Block& block, Position pos, const FormulaProgram& program) const {
+    if (pos.col != block.first.col || pos.row != block.first.row + block.size) {
+        return false;
+    }
+    if (program.size() != block.program.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < program.size(); ++i) {
+        const FormulaOp& lhs = block.program[i];
+        const FormulaOp& rhs = program[i];
+        if (lhs.type != rhs.type) {
+            return false;
+        }
+        if (lhs.type == FormulaOp::Number && lhs.value != rhs.value) {
+            return false;
+        }
+        //ссылки сравниваются относительно позиции своей ячейки
+        if ((lhs.type == FormulaOp::Cell || lhs.type == FormulaOp::SheetCell)
+            && (lhs.cell.row - block.first.row != rhs.cell.row - pos.row
+                || lhs.cell.col - block.first.col != rhs.cell.col - pos.col)) {
+            return false;
+        }
+        if (lhs.type == FormulaOp::SheetCell && lhs.sheet != rhs.sheet) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BlockEvaluator::IsSelfReferencing(const Block& block) const {
+    //если формулы блока ссылаются на ячейки этого же блока (B2=B1+1), строки
+    //зависят друг от друга и их нельзя вычислять одновременно; ссылка может указывать
+    //и имя своего листа
+    for (const FormulaOp& op : block.program) {
+        bool is_same_sheet = op.type == FormulaOp::Cell
+            || (op.type == FormulaOp::SheetCell && sheet_.FindSheet(op.sheet) == &sheet_);
+        if (is_same_sheet && op.cell.col == block.first.col
+            && std::abs(op.cell.row - block.first.row) < block.size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<BlockEvaluator::Argument> BlockEvaluator::GatherArguments(const Block& block) const {
+    const size_t size = static_cast<size_t>(block.size);
+    std::vector<Argument> arguments;
+    for (const FormulaOp& op : block.program) {
+        if (op.type != FormulaOp::Cell && op.type != FormulaOp::SheetCell) {
+            continue;
+        }
+        //лист, которого нет в книге, даёт ошибку ссылки во всех строках
+        const SheetInterface* sheet = op.type == FormulaOp::Cell ? &sheet_ : sheet_.FindSheet(op.sheet);
+        //собираем значения аргумента всех строк блока в один буфер
+        Argument argument{std::vector<double>(size, 0.0), std::vector<std::uint8_t>(size, NO_FORMULA_ERROR)};
+        for (size_t lane = 0; lane < size; ++lane) {
+            Position pos{op.cell.row + static_cast<int>(lane), op.cell.col};
+            FormulaInterface::Value value = sheet ? LookupCellValue(*sheet, pos)
+                                                  : FormulaError(FormulaError::Category::Ref);
+            if (std::holds_alternative<double>(value)) {
+                argument.values[lane] = std::get<double>(value);
+            } else {
+                argument.errors[lane] = ToErrorCode(std::get<FormulaError>(value).GetCategory());
+            }
+        }
+        arguments.push_back(std::move(argument));
+    }
+    return arguments;
+}
+
+void BlockEvaluator::EvaluateBlock(const Block& block) const {
+    const size_t size = static_cast<size_t>(block.size);
+
+    //аргументы вычисляются до захвата ячеек блока: аргумент может зависеть от ячейки
+    //блока через другие ячейки (D7=B6, B6=D11), и её вычисление не должно ждать
+    //захватившего её потока. Такая ячейка при этом вычисляется обычным образом, и
+    //захват блока ниже не удаётся
+    std::vector<Argument> arguments = GatherArguments(block);
+    auto argument = arguments.begin();
+
+    //захватываем ячейки блока для вычисления, как это делает Cell::GetValue(); если
+    //какую-то ячейку уже вычисляет другой поток, блок вычисляется обычным образом
+    std::vector<const Cell*> cells;
+    cells.reserve(size);
+    struct ClaimGuard {
+        std::vector<const Cell*>& cells;
+        ~ClaimGuard() {
+            for (const Cell* cell : cells) {
+                cell->AbortEvaluation();
+            }
+        }
+    } guard{cells};
+    for (size_t lane = 0; lane < size; ++lane) {
+        const Cell* cell = sheet_.GetCell(Position{block.first.row + static_cast<int>(lane), block.first.col});
+        if (!cell->TryBeginEvaluation()) {
+            return;
+        }
+        cells.push_back(cell);
+    }
+
+    TraceSpan span("evaluate_block", block.first);
+    //время блока делится между его ячейками
+    ProfileScope profile(sheet_.GetProfiler(), cells);
+
+    std::vector<std::uint8_t> errors(size, NO_FORMULA_ERROR);
+    std::vector<std::vector<double>> stack;
+
+    for (const FormulaOp& op : block.program) {
+        switch (op.type) {
+            case FormulaOp::Number:
+                stack.emplace_back(size, op.value);
+                break;
+            case FormulaOp::Cell:
+            case FormulaOp::SheetCell: {
+                for (size_t lane = 0; lane < size; ++lane) {
+                    if (errors[lane] == NO_FORMULA_ERROR) {
+                        errors[lane] = argument->errors[lane];
+                    }
+                }
+                stack.push_back(std::move(argument->values));
+                ++argument;
+                break;
+            }
+            case FormulaOp::Add:
+            case FormulaOp::Subtract:
+            case FormulaOp::Multiply:
+            case FormulaOp::Divide: {
+                assert(stack.size() >= 2);
+                std::vector<double> rhs = std::move(stack.back());
+                stack.pop_back();
+                std::vector<double>& lhs = stack.back();
+
+                double* lhs_data = lhs.data();
+                const double* rhs_data = rhs.data();
+                if (op.type == FormulaOp::Add) {
+                    for (size_t i = 0; i < size; ++i) {
+                        lhs_data[i] += rhs_data[i];
+                    }
+                } else if (op.type == FormulaOp::Subtract) {
+                    for (size_t i = 0; i < size; ++i) {
+                        lhs_data[i] -= rhs_data[i];
+                    }
+                } else if (op.type == FormulaOp::Multiply) {
+                    for (size_t i = 0; i < size; ++i) {
+                        lhs_data[i] *= rhs_data[i];
+                    }
+                } else {
+                    for (size_t i = 0; i < size; ++i) {
+                        lhs_data[i] /= rhs_data[i];
+                    }
+                }
+                MarkNonFinite(lhs, errors);
+                break;
+            }
+            case FormulaOp::UnaryMinus: {
+                assert(!stack.empty());
+                double* data = stack.back().data();
+                for (size_t i = 0; i < size; ++i) {
+                    data[i] = -data[i];
+                }
+                break;
+            }
+            case FormulaOp::UnaryPlus:
+                break;
+            default:
+                // have to do this because VC++ has a buggy warning
+                assert(false);
+        }
+    }
+
+    assert(stack.size() == 1);
+    const std::vector<double>& result = stack.back();
+
+    //валидируем кэш ячеек блока вычисленными значениями
+    for (size_t lane = 0; lane < size; ++lane) {
+        if (errors[lane] == NO_FORMULA_ERROR) {
+            cells[lane]->FinishEvaluation(result[lane]);
+        } else {
+            cells[lane]->FinishEvaluation(FromErrorCode(errors[lane]));
+        }
+    }
+    cells.clear();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+#include "formula.h"
+
+#include <cstdint>
+#include <vector>
+
+class Sheet;
+
+// Поблочное вычисление формул.
+// Подряд идущие по строкам ячейки одного столбца, формулы которых совпадают с
+// точностью до сдвига ссылок (B1=A1*2, B2=A2*2, ...), вычисляются одним блоком:
+// по одной "дорожке" на строку. Значения ячеек-аргументов собираются в столбцовые
+// буферы, каждая операция формулы выполняется одним циклом по буферу (такие циклы
+// компилятор векторизует). Ошибки вычисления хранятся в маске по дорожкам: для
+// каждой строки запоминается первая возникшая ошибка, как при обычном вычислении
+// дерева формулы.
+class BlockEvaluator {
+public:
+    explicit BlockEvaluator(const Sheet& sheet);
+
+    // Вычисляет переданные ячейки с формулами и записывает результат в их кэш.
+    // Ячейки, не попавшие ни в один блок, остаются невычисленными и будут
+    // вычислены обычным образом при обращении к GetValue().
+    void Evaluate(std::vector<Position> cells) const;
+
+private:
+    struct Block {
+        Position first;
+        int size = 0;
+        FormulaProgram program;
+    };
+
+    //значения ячеек, на которые ссылается формула блока, по строкам блока
+    struct Argument {
+        std::vector<double> values;
+        std::vector<std::uint8_t> errors;
+    };
+
+    bool IsSameShape(const Block& block, Position pos, const FormulaProgram& program) const;
+    bool IsSelfReferencing(const Block& block) const;
+    //аргументы блока в порядке операций формулы
+    std::vector<Argument> GatherArguments(const Block& block) const;
+    void EvaluateBlock(const Block& block) const;
+
+    const Sheet& sheet_;
+};
@@ -0,0 +1,116 @@
+#include "buffered_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <locale>
+#include <ostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//числа выводятся как "%g" с точностью 6 (как std::ostream по умолчанию):
+//знак, до 6 цифр, точка и экспонента помещаются в 32 символа
+const size_t MAX_DOUBLE_LENGTH = 32;
+const int DOUBLE_PRECISION = 6;
+
+OutputSink MakeFileDescriptorSink(int fd) {
+    return [fd](std::string_view data) {
+        while (!data.empty()) {
+#ifdef _WIN32
+            auto written = _write(fd, data.data(), static_cast<unsigned int>(data.size()));
+#else
+            auto written = write(fd, data.data(), data.size());
+#endif
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                using namespace std::literals;
+                throw std::runtime_error("Failed to write to file descriptor: "s + std::strerror(errno));
+            }
+            data.remove_prefix(static_cast<size_t>(written));
+        }
+    };
+}
+
+OutputSink MakeStreamSink(std::ostream& output) {
+    return [&output](std::string_view data) {
+        output.write(data.data(), static_cast<std::streamsize>(data.size()));
+    };
+}
+
+bool HasDefaultFormat(const std::ostream& output) {
+    return output.flags() == (std::ios_base::dec | std::ios_base::skipws) && output.precision() == DOUBLE_PRECISION
+        && output.width() == 0 && output.getloc() == std::locale::classic();
+}
+
+BufferedWriter::BufferedWriter(OutputSink sink, size_t buffer_size)
+    : sink_(std::move(sink))
+    , buffer_(std::max(buffer_size, MAX_DOUBLE_LENGTH)) {
+}
+
+BufferedWriter::~BufferedWriter() {
+    try {
+        Flush();
+    } catch (...) {
+        //ошибку записи получит тот, кто вызывает Flush() явно
+    }
+}
+
+void BufferedWriter::Write(std::string_view text) {
+    if (text.size() > buffer_.size()) {
+        Flush();
+        sink_(text);
+        return;
+    }
+    char* dest = Reserve(text.size());
+    std::memcpy(dest, text.data(), text.size());
+    size_ += text.size();
+}
+
+void BufferedWriter::Write(char c, size_t count) {
+    while (count > 0) {
+        size_t chunk = std::min(count, buffer_.size());
+        char* dest = Reserve(chunk);
+        std::memset(dest, c, chunk);
+        size_ += chunk;
+        count -= chunk;
+    }
+}
+
+void BufferedWriter::Write(double value) {
+    char* dest = Reserve(MAX_DOUBLE_LENGTH);
+    auto result = std::to_chars(dest, dest + MAX_DOUBLE_LENGTH, value, std::chars_format::general, DOUBLE_PRECISION);
+    size_ += result.ptr - dest;
+}
+
+void BufferedWriter::Write(const CellInterface::Value& value) {
+    if (std::holds_alternative<double>(value)) {
+        Write(std::get<double>(value));
+    } else if (std::holds_alternative<std::string>(value)) {
+        Write(std::string_view(std::get<std::string>(value)));
+    } else {
+        Write(std::string_view(std::get<FormulaError>(value).ToString()));
+    }
+}
+
+void BufferedWriter::Flush() {
+    if (size_ > 0) {
+        size_t size = size_;
+        size_ = 0;
+        sink_(std::string_view(buffer_.data(), size));
+    }
+}
+
+char* BufferedWriter::Reserve(size_t size) {
+    if (size_ + size > buffer_.size()) {
+        Flush();
+    }
+    return buffer_.data() + size_;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "common.h"
+
+#include <functional>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Приёмник вывода: получает содержимое буфера большими порциями.
+using OutputSink = std::function<void(std::string_view)>;
+
+// Приёмник, записывающий данные в файловый дескриптор.
+OutputSink MakeFileDescriptorSink(int fd);
+// Приёмник, записывающий данные в поток вывода.
+OutputSink MakeStreamSink(std::ostream& output);
+
+// true, если поток выводит данные так же, как BufferedWriter: флаги форматирования,
+// точность, ширина поля и локаль потока - по умолчанию.
+bool HasDefaultFormat(const std::ostream& output);
+
+// Выводит таблицу размера size в поток операторами <<, как при обходе всех её позиций:
+// print_cell(output, cell) для каждой ячейки cells (пары позиции и указателя на
+// ячейку в порядке строк), '\t' между столбцами и '\n' после каждой строки. Служит для
+// потоков, форматирование которых BufferedWriter не воспроизводит.
+template <typename CellList, typename CellPrinter>
+void PrintRows(std::ostream& output, Size size, const CellList& cells, CellPrinter print_cell) {
+    auto it = cells.begin();
+    for (int row = 0; row < size.rows; ++row) {
+        for (int col = 0; col < size.cols; ++col) {
+            if (it != cells.end() && it->first == Position{row, col}) {
+                print_cell(output, *it->second);
+                ++it;
+            }
+            if (col + 1 != size.cols) {
+                output << '\t';
+            }
+        }
+        output << '\n';
+    }
+}
+
+// Буферизованный вывод таблицы. Данные накапливаются в буфере и передаются в
+// приёмник, когда буфер заполнен, а также при вызове Flush() и в деструкторе.
+// Числа форматируются через std::to_chars так же, как их выводит std::ostream
+// с настройками по умолчанию.
+class BufferedWriter {
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    explicit BufferedWriter(OutputSink sink, size_t buffer_size = BUFFER_SIZE);
+    ~BufferedWriter();
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    void Write(std::string_view text);
+    void Write(char c, size_t count = 1);
+    void Write(double value);
+    void Write(const CellInterface::Value& value);
+
+    void Flush();
+
+private:
+    char* Reserve(size_t size);
+
+    OutputSink sink_;
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+};
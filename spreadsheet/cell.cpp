@@ -1,261 +1,562 @@
-#include "cell.h"
-#include "sheet.h"
-
-#include <cassert>
-#include <iostream>
-#include <string>
-#include <optional>
-
-//---------EmptyImpl--------------------------------
-
-EmptyImpl::EmptyImpl() : zero_val_(0.0) {
-}
-
-CellInterface::Value EmptyImpl::GetValue(const SheetInterface& sheet) const {
-    return zero_val_;
-}
-
-std::string EmptyImpl::GetText() const {
-    return {};
-}
-
-std::vector<Position> EmptyImpl::GetReferencedCells() const {
-    return {};
-}
-
-//---------TextImpl---------------------------------
-TextImpl::TextImpl(std::string text) : text_(std::move(text)) {
-}
-
-CellInterface::Value TextImpl::GetValue(const SheetInterface& sheet) const {
-    if (text_[0] == ESCAPE_SIGN) {
-        if (text_.length() > 1) {
-            return text_.substr(1);
-        } else {
-            return std::string("");
-        }
-    }
-    return text_;
-}
-
-std::string TextImpl::GetText() const {
-    return text_;
-}
-
-std::vector<Position> TextImpl::GetReferencedCells() const {
-    return {};
-}
-
-//---------FormulaImpl-------------------------------
-
-FormulaImpl::FormulaImpl(std::string text) 
-    : formula_(std::move(ParseFormula(std::move(text)))) {
-}
-
-CellInterface::Value FormulaImpl::GetValue(const SheetInterface& sheet) const {
-    CellInterface::Value cell_value;
-    FormulaInterface::Value formula_value = formula_->Evaluate(sheet);
-
-    std::visit([&cell_value](const auto& x) { cell_value = x; }, formula_value);
-
-    return cell_value;
-}
-
-std::string FormulaImpl::GetText() const {
-    return '=' + formula_->GetExpression();
-}
-
-std::vector<Position> FormulaImpl::GetReferencedCells() const {
-    return std::move(formula_->GetReferencedCells());
-}
-
-//-------------------Cell--------------------------------------
-
-Cell::Cell(Sheet& sheet) 
-    : impl_(std::make_unique<EmptyImpl>())
-    , sheet_(sheet) {
-}
-
-bool Cell::IsEmptyCell() const {
-    return impl_ == nullptr || impl_ == std::make_unique<EmptyImpl>();
-}
-
-void Cell::Clear() {
-    //инвалидируем кэш (устанавливаем признак валидации false) в зависимых "сверху" ячейках
-    for (Position cell_pos : cash_.cells_from_) {
-        const Cell* cell_ptr = GetCell(cell_pos);
-        if (cell_ptr) {
-            cell_ptr->SetValidateFlag(false);
-        }
-    }
-
-    std::unique_ptr<Impl> empty_ptr = nullptr;
-    swap(impl_, empty_ptr);
-
-    cash_.value_ = CellInterface::Value();
-    cash_.is_validate_ = false;
-    cash_.cells_to_.clear();
-}
-
-void Cell::BuildGraph(std::unordered_map<Position, std::set<Position>, CellPositionHasher>& graph, std::set<Position> cells, Position pos, Position new_pos) const {
-    for (Position cell_pos : cells) {
-        graph[pos].insert(cell_pos);
-        const Cell *cell_ptr = GetCell(cell_pos);
-
-        if (cell_ptr && !cell_ptr->cash_.cells_to_.empty() && !(cell_pos == new_pos)) {
-            BuildGraph(graph, cell_ptr->cash_.cells_to_, cell_pos, new_pos);
-        }
-    }
-}
-
-void Cell::CheckCycle(Position pos, const std::vector<Position>& cells) const {
-    std::unordered_map<Position, std::set<Position>, CellPositionHasher> graph;
-    std::unordered_map<Position, int, CellPositionHasher> visited;
-    
-    if (!cells.empty()) {
-        std::set<Position> cells_pos(cells.begin(), cells.end());
-        BuildGraph(graph, cells_pos, pos, pos);
-    }
-
-    for (const auto& [cell_pos, cells] : graph) {
-        if (visited[cell_pos] == 0) {
-            try {
-                DFS(graph, visited, cell_pos, pos);
-            } catch (const std::exception& e) {
-                throw CircularDependencyException(e.what());
-            }
-        }
-    }
-}
-
-void Cell::SetFormulaCell(Position pos, const std::string& text) {
-    std::unique_ptr<Impl> tmp_impl_ptr = nullptr;
-    try {
-        tmp_impl_ptr = ParseFormulaCell(text);
-    } catch (const std::exception& e) {
-        throw FormulaException(e.what());
-    }
-
-    std::vector<Position> cells(tmp_impl_ptr->GetReferencedCells());
-    try {
-        CheckCycle(pos, cells);
-    } catch (const std::exception& e) {
-        throw CircularDependencyException(e.what());
-    }
-
-    impl_ = std::move(tmp_impl_ptr);
-}
-
-void Cell::SetTextCell(const std::string& text) {
-    if (text.empty()) {
-        impl_ = std::make_unique<EmptyImpl>();
-    } else {
-        impl_ = std::make_unique<TextImpl>(std::move(text));
-    }
-}
-
-void Cell::Set(Position pos, std::string text) {
-    if (text.length() > 1 && text[0] == FORMULA_SIGN) {
-        try {
-            text.erase(0, 1);
-            SetFormulaCell(pos, text);
-        } catch (const FormulaException& e) {
-            throw FormulaException(e.what());
-        } catch (const CircularDependencyException& e) {
-            throw CircularDependencyException(e.what());
-        }
-    
-    } else {
-        SetTextCell(text);
-    }
-}
-
-void Cell::SetCellTo(Position pos) const {
-    cash_.cells_to_.insert(pos);
-}
-
-void Cell::SetCellFrom(Position pos) const {
-    cash_.cells_from_.insert(pos);
-}
-
-void Cell::SetDependentCells(const std::set<Position>& cells) const {
-    cash_.cells_from_ = std::move(cells);
-}
-
-void Cell::SetValue(const CellInterface::Value& value) const {
-    cash_.value_ = value;
-}
-
-void Cell::SetValidateFlag(bool is_validate) const {
-    cash_.is_validate_ = is_validate;
-}
-
-CellInterface::Value Cell::GetValue() const {
-    if (cash_.is_validate_) {
-        return cash_.value_;
-    }
-
-    //инвалидируем кэш (устанавливаем признак валидации false) в зависимых "сверху" ячейках
-    for (Position cell_pos : cash_.cells_from_) {
-        const Cell* cell_ptr = GetCell(cell_pos);
-        if (cell_ptr) {
-            cell_ptr->SetValidateFlag(false);
-        }
-    }
-
-    Value value = impl_->GetValue(sheet_);
-
-    //валидируем кэш новым значением и устанавливаем признак валидации true
-    SetValue(value);
-    SetValidateFlag(true);
-
-    return value;
-}
-
-std::string Cell::GetText() const {
-    return impl_->GetText();
-}
-
-std::vector<Position> Cell::GetReferencedCells() const {
-    return impl_->GetReferencedCells();
-}
-
-std::set<Position> Cell::GetDependentCells() const {
-    return cash_.cells_from_;
-}
-
-const Cell* Cell::GetCell(Position pos) const {
-    return sheet_.GetCell(pos);
-}
-
-bool Cell::GetValidity() const {
-    return cash_.is_validate_;
-}
-
-//--------------------------------------------------------
-
-std::unique_ptr<Impl> ParseFormulaCell(std::string text) {
-    try {
-        return std::make_unique<FormulaImpl>(std::move(text));
-    } catch (const std::exception& e) {
-        std::throw_with_nested(FormulaException(e.what()));
-    }
-}
-
-void DFS(std::unordered_map<Position, std::set<Position>, Cell::CellPositionHasher>& graph, std::unordered_map<Position, int, Cell::CellPositionHasher>& visited, Position v, Position pos) {
-    visited[v] = 1;
-    for (const Position u : graph[v]) {
-        if (visited[u] == 0) {
-            DFS(graph, visited, u, v);
-        } else if (visited[u] == 1) {
-            using namespace std::literals;
-            throw CircularDependencyException("Formula has cycle"s);
-        }
-    }
-    visited[v] = 2;
-}
-
-std::ostream& operator<<(std::ostream& output, const CellInterface::Value& value) {
-    std::visit([&](const auto& x) { output << x; }, value);
-    return output;
+#include "cell.h"
+#include "sheet.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+
+//---------EmptyImpl--------------------------------
+
+EmptyImpl::EmptyImpl() : zero_val_(0.0) {
+}
+
+CellInterface::Value EmptyImpl::GetValue(const SheetInterface& sheet) const {
+    return zero_val_;
+}
+
+std::string EmptyImpl::GetText() const {
+    return {};
+}
+
+std::vector<Position> EmptyImpl::GetReferencedCells() const {
+    return {};
+}
+
+const FormulaInterface* EmptyImpl::GetFormula() const {
+    return nullptr;
+}
+
+size_t EmptyImpl::GetMemoryUsage() const {
+    return EstimateAllocation(sizeof(*this));
+}
+
+//---------TextImpl---------------------------------
+TextImpl::TextImpl(std::string text) : text_(std::move(text)) {
+}
+
+CellInterface::Value TextImpl::GetValue(const SheetInterface& sheet) const {
+    if (text_[0] == ESCAPE_SIGN) {
+        if (text_.length() > 1) {
+            return text_.substr(1);
+        } else {
+            return std::string("");
+        }
+    }
+    return text_;
+}
+
+std::string TextImpl::GetText() const {
+    return text_;
+}
+
+std::vector<Position> TextImpl::GetReferencedCells() const {
+    return {};
+}
+
+const FormulaInterface* TextImpl::GetFormula() const {
+    return nullptr;
+}
+
+size_t TextImpl::GetMemoryUsage() const {
+    return EstimateAllocation(sizeof(*this)) + EstimateStringMemory(text_);
+}
+
+//---------FormulaImpl-------------------------------
+
+FormulaImpl::FormulaImpl(std::string text) 
+    : formula_(std::move(ParseFormula(std::move(text)))) {
+}
+
+FormulaImpl::FormulaImpl(std::unique_ptr<FormulaInterface> formula)
+    : formula_(std::move(formula)) {
+}
+
+CellInterface::Value FormulaImpl::GetValue(const SheetInterface& sheet) const {
+    CellInterface::Value cell_value;
+    FormulaInterface::Value formula_value = formula_->Evaluate(sheet);
+
+    std::visit([&cell_value](const auto& x) { cell_value = x; }, formula_value);
+
+    return cell_value;
+}
+
+std::string FormulaImpl::GetText() const {
+    return '=' + formula_->GetExpression();
+}
+
+std::vector<Position> FormulaImpl::GetReferencedCells() const {
+    return std::move(formula_->GetReferencedCells());
+}
+
+const FormulaInterface* FormulaImpl::GetFormula() const {
+    return formula_.get();
+}
+
+size_t FormulaImpl::GetMemoryUsage() const {
+    return EstimateAllocation(sizeof(*this)) + formula_->GetMemoryUsage();
+}
+
+//-------------------EvaluationCancellation--------------------
+
+namespace {
+
+thread_local const EvaluationCancellation* current_cancellation = nullptr;
+
+} // namespace
+
+EvaluationCancellation::EvaluationCancellation(std::function<bool()> is_cancelled)
+    : is_cancelled_(std::move(is_cancelled))
+    , previous_(current_cancellation) {
+    current_cancellation = this;
+}
+
+EvaluationCancellation::~EvaluationCancellation() {
+    current_cancellation = previous_;
+}
+
+void EvaluationCancellation::Check() {
+    if (current_cancellation && current_cancellation->is_cancelled_()) {
+        throw EvaluationCancelled{};
+    }
+}
+
+//-------------------Cell--------------------------------------
+
+Cell::Cell(Sheet& sheet) 
+    : impl_(std::make_shared<EmptyImpl>())
+    , sheet_(sheet) {
+    sheet_.GetCounters().AddCell();
+}
+
+bool Cell::IsEmptyCell() const {
+    return impl_ == nullptr;
+}
+
+void Cell::Clear() {
+    //инвалидируем кэш (устанавливаем признак валидации false) в зависимых "сверху" ячейках
+    InvalidateDependentCells();
+
+    std::shared_ptr<const Impl> empty_ptr = nullptr;
+    swap(impl_, empty_ptr);
+
+    cash_.value_ = CellInterface::Value();
+    cash_.state_.store(0, std::memory_order_relaxed);
+    cash_.cells_to_.clear();
+    cash_.external_to_.clear();
+}
+
+void Cell::CheckCycle(Position pos, const std::vector<Position>& cells) const {
+    TraceSpan span("cycle_check", pos);
+    //формула в ячейке pos образует цикл, если из ячеек, на которые она ссылается,
+    //по ссылкам можно дойти до самой pos (остальной граф ссылок ацикличен). Ссылки
+    //на другие листы заменяются ячейками этого листа, до которых по ним можно дойти
+    std::unordered_set<Position, CellPositionHasher> visited;
+    std::vector<Position> cells_to_visit(cells.begin(), cells.end());
+    if (!cash_.external_to_.empty()) {
+        std::vector<Position> returning_cells = sheet_.GetReturningCells(cash_.external_to_);
+        cells_to_visit.insert(cells_to_visit.end(), returning_cells.begin(), returning_cells.end());
+    }
+    if (cells_to_visit.empty()) {
+        return void();
+    }
+    while (!cells_to_visit.empty()) {
+        Position cell_pos = cells_to_visit.back();
+        cells_to_visit.pop_back();
+        if (cell_pos == pos) {
+            sheet_.GetCounters().AddCycleCheck(visited.size());
+            using namespace std::literals;
+            throw CircularDependencyException("Formula has cycle"s);
+        }
+        if (!visited.insert(cell_pos).second) {
+            continue;
+        }
+        const Cell* cell_ptr = GetCell(cell_pos);
+        if (cell_ptr) {
+            cells_to_visit.insert(cells_to_visit.end(), cell_ptr->cash_.cells_to_.begin(), cell_ptr->cash_.cells_to_.end());
+            if (!cell_ptr->cash_.external_to_.empty()) {
+                std::vector<Position> returning_cells = sheet_.GetReturningCells(cell_ptr->cash_.external_to_);
+                cells_to_visit.insert(cells_to_visit.end(), returning_cells.begin(), returning_cells.end());
+            }
+        }
+    }
+    sheet_.GetCounters().AddCycleCheck(visited.size());
+}
+
+std::unique_ptr<Impl> Cell::Parse(std::string text) const {
+    TraceSpan span("parse");
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    try {
+        std::unique_ptr<Impl> impl = ParseFormulaCell(std::move(text));
+        sheet_.GetCounters().AddParse(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        return impl;
+    } catch (const std::exception& e) {
+        sheet_.GetCounters().AddParse(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        throw FormulaException(e.what());
+    }
+}
+
+void Cell::SetFormulaCell(Position pos, const std::string& text) {
+    std::unique_ptr<Impl> tmp_impl_ptr = Parse(text);
+
+    std::vector<Position> cells(tmp_impl_ptr->GetReferencedCells());
+    try {
+        CheckCycle(pos, cells);
+    } catch (const std::exception& e) {
+        throw CircularDependencyException(e.what());
+    }
+
+    impl_ = std::move(tmp_impl_ptr);
+}
+
+void Cell::SetTextCell(const std::string& text) {
+    if (text.empty()) {
+        impl_ = std::make_unique<EmptyImpl>();
+    } else {
+        impl_ = std::make_unique<TextImpl>(std::move(text));
+    }
+}
+
+void Cell::SetFormula(std::unique_ptr<FormulaInterface> formula) {
+    impl_ = std::make_unique<FormulaImpl>(std::move(formula));
+}
+
+void Cell::Set(Position pos, std::string text) {
+    if (text.length() > 1 && text[0] == FORMULA_SIGN) {
+        try {
+            text.erase(0, 1);
+            SetFormulaCell(pos, text);
+        } catch (const FormulaException& e) {
+            throw FormulaException(e.what());
+        } catch (const CircularDependencyException& e) {
+            throw CircularDependencyException(e.what());
+        }
+    
+    } else {
+        SetTextCell(text);
+    }
+}
+
+void Cell::SetWithoutCycleCheck(std::string text) {
+    if (text.length() > 1 && text[0] == FORMULA_SIGN) {
+        text.erase(0, 1);
+        impl_ = Parse(std::move(text));
+    } else {
+        SetTextCell(text);
+    }
+}
+
+void Cell::SetCellTo(Position pos) const {
+    cash_.cells_to_.insert(pos);
+}
+
+void Cell::SetCellFrom(Position pos) const {
+    cash_.cells_from_.insert(pos);
+}
+
+void Cell::SetDependentCells(const std::set<Position>& cells) const {
+    cash_.cells_from_ = std::move(cells);
+}
+
+void Cell::SetExternalCellsTo(std::vector<ExternalCell> cells) {
+    cash_.external_to_ = std::move(cells);
+}
+
+void Cell::SetExternalCellFrom(ExternalCell cell) const {
+    cash_.external_from_.insert(cell);
+}
+
+void Cell::SetExternalDependentCells(std::set<ExternalCell> cells) const {
+    cash_.external_from_ = std::move(cells);
+}
+
+void Cell::MoveLinks(const Sheet& sheet, const CellMove& move) const {
+    //сдвиг строк и столбцов сохраняет порядок позиций, поэтому множества заполняются
+    //вставкой в конец
+    auto move_cells = [&move](std::set<Position>& cells) {
+        std::set<Position> moved_cells;
+        for (Position pos : cells) {
+            Position new_pos = move(pos);
+            if (new_pos.IsValid()) {
+                moved_cells.insert(moved_cells.end(), new_pos);
+            }
+        }
+        cells = std::move(moved_cells);
+    };
+    if (&sheet_ == &sheet) {
+        move_cells(cash_.cells_to_);
+        move_cells(cash_.cells_from_);
+    }
+
+    std::vector<ExternalCell> external_to;
+    for (ExternalCell cell : cash_.external_to_) {
+        if (cell.sheet == &sheet) {
+            cell.pos = move(cell.pos);
+        }
+        if (cell.pos.IsValid()) {
+            external_to.push_back(cell);
+        }
+    }
+    cash_.external_to_ = std::move(external_to);
+
+    std::set<ExternalCell> external_from;
+    for (ExternalCell cell : cash_.external_from_) {
+        if (cell.sheet == &sheet) {
+            cell.pos = move(cell.pos);
+        }
+        if (cell.pos.IsValid()) {
+            external_from.insert(cell);
+        }
+    }
+    cash_.external_from_ = std::move(external_from);
+}
+
+void Cell::InvalidateDependentCells() const {
+    //обходим зависимые ячейки транзитивно, останавливаясь на уже невалидных:
+    //зависимые "сверху" от невалидной ячейки тоже невалидны. Через вычисляемые
+    //ячейки обход продолжается: их зависимые могут вычисляться с ними одновременно.
+    //Обход переходит и на другие листы книги, поэтому ячейки ищутся в листе той
+    //ячейки, от которой зависят
+    std::vector<const Cell*> cells{this};
+    while (!cells.empty()) {
+        const Cell* cell = cells.back();
+        cells.pop_back();
+        for (Position cell_pos : cell->cash_.cells_from_) {
+            const Cell* cell_ptr = cell->GetCell(cell_pos);
+            if (cell_ptr && cell_ptr->Invalidate()) {
+                cell->sheet_.LogChange(cell_pos);
+                cells.push_back(cell_ptr);
+            }
+        }
+        for (const ExternalCell& external_cell : cell->cash_.external_from_) {
+            const Cell* cell_ptr = static_cast<const Sheet*>(external_cell.sheet)->GetCell(external_cell.pos);
+            if (cell_ptr && cell_ptr->Invalidate()) {
+                external_cell.sheet->LogChange(external_cell.pos);
+                cells.push_back(cell_ptr);
+            }
+        }
+    }
+}
+
+bool Cell::Invalidate() const {
+    std::uint32_t state = cash_.state_.load(std::memory_order_relaxed);
+    std::uint32_t new_state;
+    do {
+        if ((state & (Cash::VALID | Cash::COMPUTING)) == 0) {
+            return false;
+        }
+        new_state = state & ~Cash::VALID;
+        if (state & Cash::COMPUTING) {
+            new_state |= Cash::STALE;
+        }
+    } while (!cash_.state_.compare_exchange_weak(state, new_state, std::memory_order_acq_rel));
+    sheet_.GetCounters().AddInvalidation();
+    return true;
+}
+
+void Cell::SetValue(const CellInterface::Value& value) const {
+    cash_.value_ = value;
+}
+
+void Cell::SetValidateFlag(bool is_validate) const {
+    if (is_validate) {
+        cash_.state_.fetch_or(Cash::VALID, std::memory_order_release);
+    } else {
+        Invalidate();
+    }
+}
+
+bool Cell::TryBeginEvaluation() const {
+    //захватить можно только невалидную ячейку, которую никто не вычисляет и не читает
+    std::uint32_t state = 0;
+    return cash_.state_.compare_exchange_strong(state, Cash::COMPUTING, std::memory_order_acquire,
+                                                std::memory_order_relaxed);
+}
+
+void Cell::AbortEvaluation() const {
+    cash_.state_.fetch_and(~(Cash::COMPUTING | Cash::STALE), std::memory_order_release);
+}
+
+bool Cell::FinishEvaluation(const CellInterface::Value& value) const {
+    if (impl_->GetFormula() != nullptr) {
+        sheet_.GetCounters().AddFormulaEvaluation();
+    }
+    std::uint64_t version = sheet_.GetVersion();
+    //0 и -0 выводятся по-разному, поэтому числа сравниваются побитово
+    bool is_same_value = cash_.value_.index() == value.index()
+        && (std::holds_alternative<double>(value)
+                ? std::memcmp(&std::get<double>(value), &std::get<double>(cash_.value_), sizeof(double)) == 0
+                : cash_.value_ == value);
+    if (!is_same_value) {
+        cash_.value_version_.store(version, std::memory_order_relaxed);
+    }
+    cash_.recomputed_version_.store(version, std::memory_order_relaxed);
+    SetValue(value);
+
+    //значение, вычисленное после инвалидации, могло использовать устаревшие данные,
+    //поэтому ячейка остаётся невалидной
+    std::uint32_t state = cash_.state_.load(std::memory_order_relaxed);
+    std::uint32_t new_state;
+    do {
+        new_state = (state & Cash::STALE) ? 0 : Cash::VALID;
+    } while (!cash_.state_.compare_exchange_weak(state, new_state, std::memory_order_release,
+                                                 std::memory_order_relaxed));
+    return new_state == Cash::VALID;
+}
+
+CellInterface::Value Cell::GetValue() const {
+    LatencyRecorder* recorder = sheet_.GetLatencyRecorder();
+    LatencyTimer timer(recorder, LatencyOperation::GetValue,
+                       recorder && impl_->GetFormula() ? CellKind::Formula : CellKind::Text);
+    //промах - вызов, не заставший значение в кэше хотя бы раз
+    bool is_miss = false;
+    while (true) {
+        std::uint32_t state = cash_.state_.load(std::memory_order_acquire);
+        if (state & Cash::VALID) {
+            //учитываем себя в счётчике читателей, чтобы значение не перезаписали во время копирования
+            if (cash_.state_.compare_exchange_weak(state, state + Cash::READER, std::memory_order_acquire,
+                                                   std::memory_order_relaxed)) {
+                Value value = cash_.value_;
+                cash_.state_.fetch_sub(Cash::READER, std::memory_order_release);
+                if (is_miss) {
+                    sheet_.GetCounters().AddCacheMiss();
+                } else {
+                    sheet_.GetCounters().AddCacheHit();
+                }
+                return value;
+            }
+        } else {
+            is_miss = true;
+            //вычисление может быть отменено, если его результат больше не нужен
+            EvaluationCancellation::Check();
+            if (!TryBeginEvaluation()) {
+                //значение вычисляет другой поток
+                std::this_thread::yield();
+                continue;
+            }
+
+            Value value;
+            try {
+                //время вычисления формулы записывается, только если профилирование включено
+                TraceSpan span("evaluate");
+                EvaluationProfiler* profiler = sheet_.GetProfiler();
+                ProfileScope profile(profiler && impl_->GetFormula() ? profiler : nullptr, this);
+                value = impl_->GetValue(sheet_);
+            } catch (...) {
+                AbortEvaluation();
+                throw;
+            }
+            //валидируем кэш новым значением; если во время вычисления ячейку инвалидировали,
+            //значение могло смешать старые и новые данные, и его нужно вычислить заново
+            if (FinishEvaluation(value)) {
+                sheet_.GetCounters().AddCacheMiss();
+                return value;
+            }
+        }
+    }
+}
+
+const CellInterface::Value& Cell::GetCachedValue() const {
+    return cash_.value_;
+}
+
+std::string Cell::GetText() const {
+    return impl_->GetText();
+}
+
+std::vector<Position> Cell::GetReferencedCells() const {
+    return impl_->GetReferencedCells();
+}
+
+const std::set<Position>& Cell::GetDependentCells() const {
+    return cash_.cells_from_;
+}
+
+const std::vector<ExternalCell>& Cell::GetExternalReferencedCells() const {
+    return cash_.external_to_;
+}
+
+const std::set<ExternalCell>& Cell::GetExternalDependentCells() const {
+    return cash_.external_from_;
+}
+
+const Cell* Cell::GetCell(Position pos) const {
+    return sheet_.GetCell(pos);
+}
+
+std::shared_ptr<const Impl> Cell::GetImpl() const {
+    return impl_;
+}
+
+const FormulaInterface* Cell::GetFormula() const {
+    if (impl_ == nullptr) {
+        return nullptr;
+    }
+    return impl_->GetFormula();
+}
+
+bool Cell::GetValidity() const {
+    return (cash_.state_.load(std::memory_order_acquire) & Cash::VALID) != 0;
+}
+
+bool Cell::IsStale() const {
+    return (cash_.state_.load(std::memory_order_acquire) & Cash::STALE) != 0;
+}
+
+void Cell::SetModifiedVersion(std::uint64_t version) {
+    modified_version_ = version;
+}
+
+std::uint64_t Cell::GetModifiedVersion() const {
+    return modified_version_;
+}
+
+std::uint64_t Cell::GetRecomputedVersion() const {
+    return cash_.recomputed_version_.load(std::memory_order_relaxed);
+}
+
+void Cell::AddMemoryUsage(MemoryUsage& usage) const {
+    usage.cells += EstimateAllocation(sizeof(*this)) - sizeof(Value);
+    //у очищенной ячейки содержимого нет, остаются связи и кэш
+    if (!IsEmptyCell()) {
+        //блок управления shared_ptr содержимого: указатель на таблицу функций и два счётчика
+        size_t impl_usage = impl_->GetMemoryUsage() + EstimateAllocation(3 * sizeof(void*));
+        if (GetFormula()) {
+            usage.formulas += impl_usage;
+        } else {
+            usage.texts += impl_usage;
+        }
+    }
+    usage.dependencies += EstimateSetMemory(cash_.cells_to_) + EstimateSetMemory(cash_.cells_from_)
+        + EstimateVectorMemory(cash_.external_to_) + EstimateSetMemory(cash_.external_from_);
+    usage.cached_values += sizeof(Value);
+    //невалидное значение может в это время вычислять другой поток
+    const std::string* text = GetValidity() ? std::get_if<std::string>(&cash_.value_) : nullptr;
+    if (text) {
+        usage.cached_values += EstimateStringMemory(*text);
+    }
+}
+
+std::uint64_t Cell::GetValueVersion() const {
+    return cash_.value_version_.load(std::memory_order_relaxed);
+}
+
+//--------------------------------------------------------
+
+std::unique_ptr<Impl> ParseFormulaCell(std::string text) {
+    try {
+        return std::make_unique<FormulaImpl>(std::move(text));
+    } catch (const std::exception& e) {
+        std::throw_with_nested(FormulaException(e.what()));
+    }
+}
+
+std::ostream& operator<<(std::ostream& output, const CellInterface::Value& value) {
+    std::visit([&](const auto& x) { output << x; }, value);
+    return output;
 }
\ No newline at end of file
@@ -1,104 +1,217 @@
-#pragma once
-
-#include "common.h"
-#include "formula.h"
-
-#include <set>
-
-class Sheet;
-
-struct Cash {
-    bool is_validate_ = false;
-    CellInterface::Value value_;
-    std::set<Position> cells_to_;
-    std::set<Position> cells_from_;
-};
-
-class Impl {
-public:
-    virtual ~Impl() = default;
-    virtual CellInterface::Value GetValue(const SheetInterface& sheet) const = 0;
-    virtual std::string GetText() const = 0;
-    virtual std::vector<Position> GetReferencedCells() const = 0;
-};
-
-class EmptyImpl : public Impl {
-public:
-    EmptyImpl();
-    CellInterface::Value GetValue(const SheetInterface& sheet) const override;
-    std::string GetText() const override;
-    std::vector<Position> GetReferencedCells() const override;
-private:
-    double zero_val_;
-};
-
-class TextImpl : public Impl {
-public:
-    explicit TextImpl(std::string text);
-    CellInterface::Value GetValue(const SheetInterface& sheet) const override;
-    std::string GetText() const override;
-    std::vector<Position> GetReferencedCells() const override;
-
-private:
-    std::string text_;
-};
-
-class FormulaImpl : public Impl {
-public:
-    explicit FormulaImpl(std::string text);
-    CellInterface::Value GetValue(const SheetInterface& sheet) const override;
-    std::string GetText() const override;
-    std::vector<Position> GetReferencedCells() const override;
-
-private:
-    std::unique_ptr<FormulaInterface> formula_;
-};
-
-class Cell : public CellInterface {
-public:
-    struct CellPositionHasher {
-        std::size_t operator()(Position pos) const {
-            uint64_t hash = (size_t)(pos.row) * 37 + (size_t)(pos.col) * 37 * 37;
-            return static_cast<size_t>(hash);
-        }
-    };
-
-    Cell(Sheet& sheet);
-    ~Cell() = default;
-
-    bool IsEmptyCell() const;
-    void Clear();
-
-    void BuildGraph(std::unordered_map<Position, std::set<Position>, CellPositionHasher> &graph, std::set<Position> cells, Position pos, Position new_pos) const;
-    void CheckCycle(Position pos, const std::vector<Position>& cells) const;
-
-    void SetFormulaCell(Position pos, const std::string &text);
-    void SetTextCell(const std::string &text);
-    void Set(Position pos, std::string text);
-
-    void SetCellTo(Position pos) const;
-    void SetCellFrom(Position pos) const;
-    void SetDependentCells(const std::set<Position>& cells) const;
-
-    void SetValue(const Value& value) const;
-    void SetValidateFlag(bool is_validate) const;
-
-    Value GetValue() const override;
-    std::string GetText() const override;
-    std::vector<Position> GetReferencedCells() const override;
-    std::set<Position> GetDependentCells() const;
-    const Cell* GetCell(Position pos) const;
-    bool GetValidity() const;
-
-private:
-    std::unique_ptr<Impl> impl_ = std::make_unique<EmptyImpl>();
-    const Sheet& sheet_;
-    mutable Cash cash_;
-};
-
-std::unique_ptr<Impl> ParseFormulaCell(std::string text);
-
-//обход графа в глубину (проверяем на ацикличность)
-void DFS(std::unordered_map<Position, std::set<Position>, Cell::CellPositionHasher>& graph, std::unordered_map<Position, int, Cell::CellPositionHasher>& visited, Position v, Position pos);
-
-std::ostream &operator<<(std::ostream &output, const CellInterface::Value &value);
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+#include "memory_usage.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <set>
+
+class Sheet;
+
+//ячейка другого листа книги
+struct ExternalCell {
+    Sheet* sheet = nullptr;
+    Position pos;
+
+    bool operator==(const ExternalCell& rhs) const {
+        return sheet == rhs.sheet && pos == rhs.pos;
+    }
+    bool operator<(const ExternalCell& rhs) const {
+        return std::less<const Sheet*>()(sheet, rhs.sheet) || (sheet == rhs.sheet && pos < rhs.pos);
+    }
+};
+
+struct Cash {
+    //флаги состояния значения; младшие биты state_ - флаги, старшие - число потоков,
+    //копирующих значение в данный момент
+    static const std::uint32_t VALID = 1;      //значение вычислено и актуально
+    static const std::uint32_t COMPUTING = 2;  //значение вычисляет один из потоков
+    static const std::uint32_t STALE = 4;      //ячейку инвалидировали во время вычисления
+    static const std::uint32_t READER = 8;     //единица счётчика копирующих потоков
+
+    //value_ записывает только поток, переведший state_ из 0 в COMPUTING, а читают
+    //только потоки, учтённые в счётчике при установленном VALID
+    std::atomic<std::uint32_t> state_{0};
+    CellInterface::Value value_;
+    std::set<Position> cells_to_;
+    std::set<Position> cells_from_;
+    //связи с ячейками других листов книги
+    std::vector<ExternalCell> external_to_;
+    std::set<ExternalCell> external_from_;
+    //версии листа, в которых значение последний раз вычислялось и последний раз изменилось
+    std::atomic<std::uint64_t> recomputed_version_{0};
+    std::atomic<std::uint64_t> value_version_{0};
+};
+
+class Impl {
+public:
+    virtual ~Impl() = default;
+    virtual CellInterface::Value GetValue(const SheetInterface& sheet) const = 0;
+    virtual std::string GetText() const = 0;
+    virtual std::vector<Position> GetReferencedCells() const = 0;
+    virtual const FormulaInterface* GetFormula() const = 0;
+    //память объекта и его данных (см. MemoryUsage)
+    virtual size_t GetMemoryUsage() const = 0;
+};
+
+class EmptyImpl : public Impl {
+public:
+    EmptyImpl();
+    CellInterface::Value GetValue(const SheetInterface& sheet) const override;
+    std::string GetText() const override;
+    std::vector<Position> GetReferencedCells() const override;
+    const FormulaInterface* GetFormula() const override;
+    size_t GetMemoryUsage() const override;
+private:
+    double zero_val_;
+};
+
+class TextImpl : public Impl {
+public:
+    explicit TextImpl(std::string text);
+    CellInterface::Value GetValue(const SheetInterface& sheet) const override;
+    std::string GetText() const override;
+    std::vector<Position> GetReferencedCells() const override;
+    const FormulaInterface* GetFormula() const override;
+    size_t GetMemoryUsage() const override;
+
+private:
+    std::string text_;
+};
+
+class FormulaImpl : public Impl {
+public:
+    explicit FormulaImpl(std::string text);
+    explicit FormulaImpl(std::unique_ptr<FormulaInterface> formula);
+    CellInterface::Value GetValue(const SheetInterface& sheet) const override;
+    std::string GetText() const override;
+    std::vector<Position> GetReferencedCells() const override;
+    const FormulaInterface* GetFormula() const override;
+    size_t GetMemoryUsage() const override;
+
+private:
+    std::unique_ptr<FormulaInterface> formula_;
+};
+
+// Бросается из Cell::GetValue(), если вычисление, выполняемое потоком, отменено.
+// Не наследуется от std::exception, чтобы его не перехватили обработчики ошибок
+// вычисления формул.
+struct EvaluationCancelled {};
+
+// Пока объект существует, Cell::GetValue() в текущем потоке перед вычислением каждой
+// невалидной ячейки вызывает is_cancelled и при true бросает EvaluationCancelled;
+// захваченные для вычисления ячейки при этом освобождаются.
+class EvaluationCancellation {
+public:
+    explicit EvaluationCancellation(std::function<bool()> is_cancelled);
+    ~EvaluationCancellation();
+
+    EvaluationCancellation(const EvaluationCancellation&) = delete;
+    EvaluationCancellation& operator=(const EvaluationCancellation&) = delete;
+
+    static void Check();
+
+private:
+    std::function<bool()> is_cancelled_;
+    const EvaluationCancellation* previous_;
+};
+
+class Cell : public CellInterface {
+public:
+    struct CellPositionHasher {
+        std::size_t operator()(Position pos) const {
+            uint64_t hash = (size_t)(pos.row) * Position::MAX_COLS + (size_t)(pos.col);
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    Cell(Sheet& sheet);
+    ~Cell() = default;
+
+    bool IsEmptyCell() const;
+    void Clear();
+
+    void CheckCycle(Position pos, const std::vector<Position>& cells) const;
+
+    void SetFormulaCell(Position pos, const std::string &text);
+    void SetTextCell(const std::string &text);
+    //задаёт готовую формулу без разбора текста и без проверки на цикличные ссылки
+    void SetFormula(std::unique_ptr<FormulaInterface> formula);
+    void Set(Position pos, std::string text);
+    //задаёт содержимое ячейки без проверки на цикличные ссылки (её выполняет вызывающий)
+    void SetWithoutCycleCheck(std::string text);
+
+    void SetCellTo(Position pos) const;
+    void SetCellFrom(Position pos) const;
+    void SetDependentCells(const std::set<Position>& cells) const;
+    //ячейки других листов, на которые ссылается формула (задаёт лист при разборе) и
+    //которые ссылаются на эту ячейку
+    void SetExternalCellsTo(std::vector<ExternalCell> cells);
+    void SetExternalCellFrom(ExternalCell cell) const;
+    void SetExternalDependentCells(std::set<ExternalCell> cells) const;
+    //переводит связи с ячейками листа sheet (в том числе ссылки этого листа на самого
+    //себя по имени) в новые позиции move(позиция); связи с удалёнными ячейками
+    //(Position::NONE) отбрасываются
+    void MoveLinks(const Sheet& sheet, const CellMove& move) const;
+    //инвалидирует зависимые ячейки, в том числе на других листах книги
+    void InvalidateDependentCells() const;
+
+    void SetValue(const Value& value) const;
+    void SetValidateFlag(bool is_validate) const;
+
+    //вычисление значения вне GetValue(): TryBeginEvaluation() захватывает невалидную
+    //ячейку, которую никто не вычисляет; FinishEvaluation() записывает значение в кэш,
+    //валидирует его и обновляет версии значения (возвращает false, если ячейку
+    //инвалидировали во время вычисления и она осталась невалидной);
+    //AbortEvaluation() отменяет захват
+    bool TryBeginEvaluation() const;
+    bool FinishEvaluation(const Value& value) const;
+    void AbortEvaluation() const;
+
+    //может вызываться из нескольких потоков одновременно: значение вычисляет один поток,
+    //остальные дожидаются его результата
+    Value GetValue() const override;
+    //значение из кэша без вычисления и без проверки признака валидации
+    const Value& GetCachedValue() const;
+    std::string GetText() const override;
+    std::vector<Position> GetReferencedCells() const override;
+    const std::set<Position>& GetDependentCells() const;
+    const std::vector<ExternalCell>& GetExternalReferencedCells() const;
+    const std::set<ExternalCell>& GetExternalDependentCells() const;
+    const Cell* GetCell(Position pos) const;
+    const FormulaInterface* GetFormula() const;
+    //содержимое ячейки; nullptr для очищенной ячейки
+    std::shared_ptr<const Impl> GetImpl() const;
+    bool GetValidity() const;
+    //значение вычисляется, но ячейку уже инвалидировали: результат будет отброшен
+    bool IsStale() const;
+
+    //версия листа, в которой задан текст ячейки
+    void SetModifiedVersion(std::uint64_t version);
+    std::uint64_t GetModifiedVersion() const;
+    std::uint64_t GetRecomputedVersion() const;
+    std::uint64_t GetValueVersion() const;
+
+    //добавляет к usage память ячейки, её содержимого, связей и значения в кэше
+    void AddMemoryUsage(MemoryUsage& usage) const;
+
+private:
+    //сбрасывает признак валидации; возвращает false, если значение уже было невалидно
+    //и не вычислялось
+    bool Invalidate() const;
+    //разбирает формулу (text без знака '='), учитывая разбор в счётчиках листа
+    std::unique_ptr<Impl> Parse(std::string text) const;
+
+    //содержимое ячейки не изменяется после создания и может быть общим со снимками листа
+    std::shared_ptr<const Impl> impl_ = std::make_shared<EmptyImpl>();
+    const Sheet& sheet_;
+    mutable Cash cash_;
+    std::uint64_t modified_version_ = 0;
+};
+
+std::unique_ptr<Impl> ParseFormulaCell(std::string text);
+
+std::ostream &operator<<(std::ostream &output, const CellInterface::Value &value);
@@ -0,0 +1,251 @@
+#include "change_feed.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <shared_mutex>
+#include <utility>
+
+struct ChangeFeed::Subscription {
+    size_t id = 0;
+    Position top_left;
+    Position bottom_right;
+    ChangeCallback callback;
+    //сбрасывается при отписке; защищён mutex_
+    bool is_active = true;
+
+    //используются только фоновым потоком: последние доставленные значения ячеек и
+    //пачка изменений текущего прохода
+    std::unordered_map<Position, CellInterface::Value, Sheet::CellPositionHasher> values;
+    std::vector<CellChange> changes;
+
+    bool Contains(Position pos) const {
+        return pos.row >= top_left.row && pos.row <= bottom_right.row
+            && pos.col >= top_left.col && pos.col <= bottom_right.col;
+    }
+};
+
+ChangeFeed::ChangeFeed(const Sheet& sheet)
+    : sheet_(sheet) {
+    worker_ = std::thread([this]() {
+        Work();
+    });
+}
+
+ChangeFeed::~ChangeFeed() {
+    {
+        std::lock_guard lock(wake_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    processed_.notify_all();
+    worker_.join();
+}
+
+size_t ChangeFeed::Subscribe(Position top_left, Position bottom_right, ChangeCallback callback,
+                             std::vector<CellChange> values) {
+    auto subscription = std::make_shared<Subscription>();
+    subscription->top_left = top_left;
+    subscription->bottom_right = bottom_right;
+    subscription->callback = std::move(callback);
+    for (CellChange& value : values) {
+        subscription->values.emplace(value.pos, std::move(value.value));
+    }
+
+    size_t tile_count = size_t(subscription->bottom_right.row / TILE_ROWS - subscription->top_left.row / TILE_ROWS + 1)
+                      * size_t(subscription->bottom_right.col / TILE_COLS - subscription->top_left.col / TILE_COLS + 1);
+
+    std::lock_guard lock(mutex_);
+    size_t id = next_id_++;
+    subscription->id = id;
+    if (tile_count > MAX_SUBSCRIPTION_TILES) {
+        large_subscriptions_.push_back(id);
+    } else {
+        ForEachTile(*subscription, [this, id](std::uint64_t tile) {
+            tiles_[tile].push_back(id);
+        });
+    }
+    subscriptions_.emplace(id, std::move(subscription));
+    return id;
+}
+
+void ChangeFeed::Unsubscribe(size_t id) {
+    {
+        std::lock_guard lock(mutex_);
+        auto it = subscriptions_.find(id);
+        if (it == subscriptions_.end()) {
+            return void();
+        }
+        Subscription& subscription = *it->second;
+        subscription.is_active = false;
+
+        auto erase_id = [id](std::vector<size_t>& ids) {
+            ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+        };
+        erase_id(large_subscriptions_);
+        ForEachTile(subscription, [this, &erase_id](std::uint64_t tile) {
+            auto tile_it = tiles_.find(tile);
+            if (tile_it != tiles_.end()) {
+                erase_id(tile_it->second);
+                if (tile_it->second.empty()) {
+                    tiles_.erase(tile_it);
+                }
+            }
+        });
+        subscriptions_.erase(it);
+    }
+
+    //дожидаемся доставки, которая могла взять подписку до отписки
+    if (std::this_thread::get_id() != worker_.get_id()) {
+        std::lock_guard delivery_lock(delivery_mutex_);
+    }
+}
+
+void ChangeFeed::Push(Position pos) {
+    QueueShard& shard = queue_[Sheet::GetRegionIndex(pos) % QUEUE_SHARD_COUNT];
+    std::uint64_t pushed_count;
+    {
+        //счётчик увеличивается после добавления позиции, поэтому фоновый поток,
+        //увидевший новое значение счётчика, найдёт позицию в очереди
+        std::lock_guard lock(shard.mutex);
+        shard.positions.push_back(pos);
+        pushed_count = pushed_count_++;
+    }
+
+    //будим фоновый поток только при появлении первой позиции: пока очередь не пуста,
+    //он её ещё не забрал. Последовательная согласованность счётчиков гарантирует, что
+    //либо эта проверка увидит забранные позиции, либо фоновый поток перед сном увидит
+    //новую позицию
+    if (pushed_count == taken_count_) {
+        {
+            std::lock_guard lock(wake_mutex_);
+        }
+        wake_.notify_one();
+    }
+}
+
+void ChangeFeed::Flush() const {
+    if (std::this_thread::get_id() == worker_.get_id()) {
+        return void();
+    }
+    std::uint64_t pushed_count = pushed_count_.load(std::memory_order_relaxed);
+    std::unique_lock lock(wake_mutex_);
+    processed_.wait(lock, [this, pushed_count]() {
+        return stop_ || processed_count_ >= pushed_count;
+    });
+}
+
+std::uint64_t ChangeFeed::GetTile(int row, int col) {
+    return (std::uint64_t(row / TILE_ROWS) << 32) | std::uint64_t(col / TILE_COLS);
+}
+
+template <typename Action>
+void ChangeFeed::ForEachTile(const Subscription& subscription, Action action) {
+    for (int row = subscription.top_left.row / TILE_ROWS; row <= subscription.bottom_right.row / TILE_ROWS; ++row) {
+        for (int col = subscription.top_left.col / TILE_COLS; col <= subscription.bottom_right.col / TILE_COLS; ++col) {
+            action(GetTile(row * TILE_ROWS, col * TILE_COLS));
+        }
+    }
+}
+
+void ChangeFeed::Work() {
+    Tracing::SetThreadName("change feed");
+    while (true) {
+        {
+            std::unique_lock lock(wake_mutex_);
+            wake_.wait(lock, [this]() {
+                return stop_ || pushed_count_ != taken_count_;
+            });
+            if (stop_) {
+                return void();
+            }
+        }
+
+        //забираем все накопленные позиции разом: изменения, сделанные за время
+        //предыдущей доставки, доставляются одной пачкой
+        std::vector<Position> positions;
+        for (QueueShard& shard : queue_) {
+            std::lock_guard lock(shard.mutex);
+            positions.insert(positions.end(), shard.positions.begin(), shard.positions.end());
+            shard.positions.clear();
+        }
+        size_t count = positions.size();
+        taken_count_ += count;
+        Deliver(std::move(positions));
+
+        {
+            std::lock_guard lock(wake_mutex_);
+            processed_count_ += count;
+        }
+        processed_.notify_all();
+    }
+}
+
+void ChangeFeed::Deliver(std::vector<Position> positions) {
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+    std::lock_guard delivery_lock(delivery_mutex_);
+
+    //подписки, накрывающие изменённые ячейки; ячейки без подписок пропускаются
+    std::vector<std::pair<Position, std::vector<std::shared_ptr<Subscription>>>> targets;
+    {
+        std::lock_guard lock(mutex_);
+        if (subscriptions_.empty()) {
+            return void();
+        }
+        for (Position pos : positions) {
+            std::vector<std::shared_ptr<Subscription>> covering;
+            auto add_covering = [this, pos, &covering](size_t id) {
+                const std::shared_ptr<Subscription>& subscription = subscriptions_.at(id);
+                if (subscription->Contains(pos)) {
+                    covering.push_back(subscription);
+                }
+            };
+            auto it = tiles_.find(GetTile(pos.row, pos.col));
+            if (it != tiles_.end()) {
+                std::for_each(it->second.begin(), it->second.end(), add_covering);
+            }
+            std::for_each(large_subscriptions_.begin(), large_subscriptions_.end(), add_covering);
+            if (!covering.empty()) {
+                targets.emplace_back(pos, std::move(covering));
+            }
+        }
+    }
+
+    //значения вычисляются в режиме параллельного чтения; блокировка листа на чтение
+    //не пропускает операции над всем листом, изменения областей идут параллельно
+    std::vector<std::shared_ptr<Subscription>> changed;
+    {
+        std::shared_lock sheet_lock(sheet_.structure_mutex_);
+        for (auto& [pos, covering] : targets) {
+            CellInterface::Value value = sheet_.ReadValue(pos);
+            for (const std::shared_ptr<Subscription>& subscription : covering) {
+                //ячейки, которых не было при подписке, были пустыми
+                CellInterface::Value& previous = subscription->values[pos];
+                if (previous == value) {
+                    continue;
+                }
+                previous = value;
+                if (subscription->changes.empty()) {
+                    changed.push_back(subscription);
+                }
+                subscription->changes.push_back(CellChange{pos, value});
+            }
+        }
+    }
+
+    for (const std::shared_ptr<Subscription>& subscription : changed) {
+        std::vector<CellChange> changes = std::move(subscription->changes);
+        subscription->changes.clear();
+        {
+            std::lock_guard lock(mutex_);
+            if (!subscription->is_active) {
+                continue;
+            }
+        }
+        try {
+            subscription->callback(changes);
+        } catch (...) {
+        }
+    }
+}
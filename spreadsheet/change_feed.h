@@ -0,0 +1,110 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Sheet;
+
+//изменение значения ячейки, на которую есть подписка
+struct CellChange {
+    Position pos;
+    //пустая строка, если ячейка очищена
+    CellInterface::Value value;
+};
+
+using ChangeCallback = std::function<void(const std::vector<CellChange>&)>;
+
+// Лента изменений листа: доставляет подписчикам изменения значений ячеек
+// прямоугольников, на которые они подписаны (см. Sheet::Subscribe).
+// * Лист передаёт в ленту позиции ячеек, значения которых могли измениться (изменённые
+//   ячейки и инвалидированные зависимые от них), через очередь из частей со своими
+//   блокировками: часть выбирается по области листа, поэтому изменения разных
+//   областей почти не ждут друг друга. Запись в очередь не выделяет память (кроме
+//   роста буфера части) и не зависит от числа подписок.
+// * Фоновый поток забирает из очереди всё накопленное, объединяет повторы, находит
+//   подписки, накрывающие ячейки, и вычисляет их значения в режиме параллельного
+//   чтения листа. Каждый подписчик получает одну пачку изменений (в порядке строк) за
+//   проход; ячейка попадает в пачку, только если её значение отличается от
+//   доставленного этому подписчику в прошлый раз (или от значения при подписке).
+// * Поиск подписок идёт по участкам листа, поэтому работа потока пропорциональна
+//   числу изменённых ячеек и доставленных событий, а не числу подписок.
+class ChangeFeed {
+public:
+    explicit ChangeFeed(const Sheet& sheet);
+    //недоставленные изменения отбрасываются
+    ~ChangeFeed();
+
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+    //top_left не правее и не ниже bottom_right; values - значения непустых ячеек
+    //прямоугольника на момент подписки. callback вызывается в фоновом потоке ленты,
+    //исключения из него игнорируются
+    size_t Subscribe(Position top_left, Position bottom_right, ChangeCallback callback,
+                     std::vector<CellChange> values);
+    //после возврата callback подписки больше не вызывается (кроме вызова из самого callback)
+    void Unsubscribe(size_t id);
+
+    //вызывается листом
+    void Push(Position pos);
+    //дожидается обработки изменений, переданных в ленту до вызова
+    void Flush() const;
+
+private:
+    struct Subscription;
+    struct QueueShard {
+        std::mutex mutex;
+        //буфер сохраняет память между проходами фонового потока
+        std::vector<Position> positions;
+    };
+
+    //участки листа, по которым ищутся подписки; прямоугольник, накрывающий больше
+    //MAX_SUBSCRIPTION_TILES участков, проверяется для каждой изменённой ячейки
+    static const int TILE_ROWS = 64;
+    static const int TILE_COLS = 16;
+    static const size_t MAX_SUBSCRIPTION_TILES = 1024;
+    static const size_t QUEUE_SHARD_COUNT = 16;
+
+    static std::uint64_t GetTile(int row, int col);
+    template <typename Action>
+    static void ForEachTile(const Subscription& subscription, Action action);
+
+    void Work();
+    void Deliver(std::vector<Position> positions);
+
+    const Sheet& sheet_;
+
+    //очередь позиций; фоновый поток забирает её целиком. Счётчики позиций, добавленных
+    //в очередь и забранных из неё, показывают, есть ли в очереди позиции
+    std::array<QueueShard, QUEUE_SHARD_COUNT> queue_;
+    std::atomic<std::uint64_t> pushed_count_{0};
+    std::atomic<std::uint64_t> taken_count_{0};
+
+    mutable std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    mutable std::condition_variable processed_;
+    std::uint64_t processed_count_ = 0;
+    bool stop_ = false;
+
+    //подписки; защищены mutex_
+    mutable std::mutex mutex_;
+    size_t next_id_ = 0;
+    std::unordered_map<size_t, std::shared_ptr<Subscription>> subscriptions_;
+    std::unordered_map<std::uint64_t, std::vector<size_t>> tiles_;
+    std::vector<size_t> large_subscriptions_;
+
+    //захватывается фоновым потоком на время доставки
+    std::mutex delivery_mutex_;
+
+    std::thread worker_;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iosfwd>
+#include <limits>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -19,10 +20,46 @@ struct Position {
     bool IsValid() const;
     std::string ToString() const;
 
-    static Position FromString(std::string_view str);
+    // Записывает позицию в буфер [first, last) без завершающего нуля и возвращает
+    // указатель за последним записанным символом. Для некорректной позиции или
+    // недостаточного буфера ничего не записывает и возвращает first.
+    char* ToChars(char* first, char* last) const;
+
+    // Разбирает позицию вида "A1" без выделения памяти. Для строки, которая не
+    // является позицией, возвращает NONE.
+    static constexpr Position FromString(std::string_view str) {
+        size_t letter_count = 0;
+        int col = 0;
+        while (letter_count < str.size() && str[letter_count] >= 'A' && str[letter_count] <= 'Z') {
+            if (letter_count == MAX_POS_LETTER_COUNT) {
+                return Position{-1, -1};
+            }
+            col = col * LETTERS + (str[letter_count] - 'A' + 1);
+            ++letter_count;
+        }
+        if (letter_count == 0 || letter_count == str.size()) {
+            return Position{-1, -1};
+        }
+
+        long long row = 0;
+        for (size_t i = letter_count; i < str.size(); ++i) {
+            if (str[i] < '0' || str[i] > '9') {
+                return Position{-1, -1};
+            }
+            row = row * 10 + (str[i] - '0');
+            if (row > std::numeric_limits<int>::max()) {
+                return Position{-1, -1};
+            }
+        }
+
+        return Position{static_cast<int>(row) - 1, col - 1};
+    }
 
     static const int MAX_ROWS = 16384;
     static const int MAX_COLS = 16384;
+    static const int LETTERS = 26;
+    static const int MAX_POS_LETTER_COUNT = 3;
+    static const int MAX_POSITION_LENGTH = 17;
     static const Position NONE;
 };
 
@@ -145,6 +182,13 @@ public:
     // соответственно. Пустая ячейка представляется пустой строкой в любом случае.
     virtual void PrintValues(std::ostream& output) const = 0;
     virtual void PrintTexts(std::ostream& output) const = 0;
+
+    // Возвращает лист той же книги с именем name, на ячейки которого ссылаются
+    // формулы вида Sheet2!A1, либо nullptr, если такого листа нет или таблица не
+    // входит в книгу.
+    virtual const SheetInterface* FindSheet(std::string_view /* name */) const {
+        return nullptr;
+    }
 };
 
 // Создаёт готовую к работе пустую таблицу.
@@ -1,120 +1,184 @@
-#include "formula.h"
-
-#include <algorithm>
-#include <cassert>
-#include <cctype>
-#include <sstream>
-
-using namespace std::literals;
-
-//--------------------------FormulaError-------------------------------
-
-FormulaError::FormulaError(Category category) 
-    : category_(category) {
-}
-
-FormulaError::Category FormulaError::GetCategory() const {
-    return category_;
-}
-
-bool FormulaError::operator==(FormulaError rhs) const {
-    return ToString() == rhs.ToString();
-}
-
-std::string FormulaError::ToString() const {
-    switch (category_) {
-        case Category::Ref:
-            return std::string("#REF!"s);
-        case Category::Value:
-            return std::string("#VALUE!"s);
-        case Category::Div0:
-            return std::string("#DIV/0!"s);
-        default:
-            // have to do this because VC++ has a buggy warning
-            assert(false);
-            return std::string();
-    }
-}
-
-std::ostream& operator<<(std::ostream& output, FormulaError fe) {
-    return output << fe.ToString();
-}
-
-//---------------Formula---------------------------------------------------
-
-Formula::Formula(std::string expression) 
-    : ast_(ParseFormulaAST(std::move(expression))) {
-}
-
-FormulaInterface::Value Formula::Evaluate(const SheetInterface& sheet) const {
-    auto cell_lookup = [&sheet](Position pos) -> double {
-        if (!pos.IsValid()) {
-            throw FormulaError::Category::Ref;
-        }
-        double result = 0.0;
-        CellInterface::Value value;
-        const CellInterface* cell_ptr = sheet.GetCell(pos);
-        if (cell_ptr) {
-            value = cell_ptr->GetValue(); 
-        } else {
-            value = 0.0;
-        }
-        if (std::holds_alternative<double>(value)) {
-            result = std::get<double>(value);
-        } else if (std::holds_alternative<std::string>(value)) {
-            std::optional<double> numeric = IsStringDoubleNumeric(std::get<std::string>(value));
-            if (numeric.has_value()) {
-                result = numeric.value();
-            } else {
-                throw FormulaError(FormulaError::Category::Value);
-            }
-        } else {
-            throw FormulaError(std::get<FormulaError>(value).GetCategory());
-        }
-        return result;
-    };
-
-    try {
-        return ast_.Execute(cell_lookup);
-    } catch (const FormulaError& e) {
-        return FormulaError(e.GetCategory());
-    } 
-}
-
-std::string Formula::GetExpression() const {
-    std::ostringstream out;
-    ast_.PrintFormula(out);
-    return out.str();
-}
-
-std::vector<Position> Formula::GetReferencedCells() const {
-    std::forward_list<Position> cells(ast_.GetReferencedCells());
-    std::vector<Position> result(cells.begin(), cells.end());
-    auto it = std::unique(result.begin(), result.end());
-    result.erase(it, result.end());
-    return result;
-}
-
-//-----------------------------------------------------------------
-
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
-    try {
-        return std::make_unique<Formula>(std::move(expression));
-    } catch (const std::exception& e) {
-        throw FormulaException(e.what());
-    }
-}
-
-std::ostream& operator<<(std::ostream& output, const FormulaInterface::Value& value) {
-    std::visit([&](const auto& x) { output << x; }, value);
-    return output;
-}
-
-std::optional<double> IsStringDoubleNumeric(const std::string &str) {
-    char *p;
-    std::optional<double> result = strtod(str.c_str(), &p);
-    if (*p == 0) { //если указатель указывает на конец строки
-        return result;
-    }
-    return std::optional<double>{};
+#include "formula.h"
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <sstream>
+
+using namespace std::literals;
+
+//--------------------------FormulaError-------------------------------
+
+FormulaError::FormulaError(Category category) 
+    : category_(category) {
+}
+
+FormulaError::Category FormulaError::GetCategory() const {
+    return category_;
+}
+
+bool FormulaError::operator==(FormulaError rhs) const {
+    return ToString() == rhs.ToString();
+}
+
+std::string FormulaError::ToString() const {
+    switch (category_) {
+        case Category::Ref:
+            return std::string("#REF!"s);
+        case Category::Value:
+            return std::string("#VALUE!"s);
+        case Category::Div0:
+            return std::string("#DIV/0!"s);
+        default:
+            // have to do this because VC++ has a buggy warning
+            assert(false);
+            return std::string();
+    }
+}
+
+std::ostream& operator<<(std::ostream& output, FormulaError fe) {
+    return output << fe.ToString();
+}
+
+//---------------Formula---------------------------------------------------
+
+Formula::Formula(std::string expression) 
+    : ast_(ParseFormulaAST(std::move(expression))) {
+}
+
+Formula::Formula(const FormulaProgram& program)
+    : ast_(ParseFormulaAST(program)) {
+}
+
+FormulaInterface::Value Formula::Evaluate(const SheetInterface& sheet) const {
+    auto cell_lookup = [&sheet](Position pos) -> double {
+        FormulaInterface::Value value = LookupCellValue(sheet, pos);
+        if (std::holds_alternative<FormulaError>(value)) {
+            throw std::get<FormulaError>(value);
+        }
+        return std::get<double>(value);
+    };
+    //лист, которого нет в книге, даёт ошибку ссылки
+    auto sheet_cell_lookup = [&sheet](const std::string& name, Position pos) -> double {
+        const SheetInterface* other_sheet = sheet.FindSheet(name);
+        if (other_sheet == nullptr) {
+            throw FormulaError(FormulaError::Category::Ref);
+        }
+        FormulaInterface::Value value = LookupCellValue(*other_sheet, pos);
+        if (std::holds_alternative<FormulaError>(value)) {
+            throw std::get<FormulaError>(value);
+        }
+        return std::get<double>(value);
+    };
+
+    try {
+        return ast_.Execute(cell_lookup, sheet_cell_lookup);
+    } catch (const FormulaError& e) {
+        return FormulaError(e.GetCategory());
+    } 
+}
+
+std::string Formula::GetExpression() const {
+    std::ostringstream out;
+    ast_.PrintFormula(out);
+    return out.str();
+}
+
+std::vector<Position> Formula::GetReferencedCells() const {
+    std::forward_list<Position> cells(ast_.GetReferencedCells());
+    std::vector<Position> result(cells.begin(), cells.end());
+    auto it = std::unique(result.begin(), result.end());
+    result.erase(it, result.end());
+    //ссылки на удалённые ячейки (#REF!) не задействуют ячеек
+    if (!result.empty() && !result.front().IsValid()) {
+        result.erase(result.begin());
+    }
+    return result;
+}
+
+std::vector<SheetReference> Formula::GetSheetReferences() const {
+    const std::forward_list<SheetReference>& references = ast_.GetSheetReferences();
+    std::vector<SheetReference> result;
+    for (const SheetReference& reference : references) {
+        if (reference.cell.IsValid() && (result.empty() || !(result.back() == reference))) {
+            result.push_back(reference);
+        }
+    }
+    return result;
+}
+
+FormulaProgram Formula::GetProgram() const {
+    return ast_.Compile();
+}
+
+std::unique_ptr<FormulaInterface> Formula::MoveReferences(const CellMove& move_cell,
+                                                          const SheetCellMove& move_sheet_cell) const {
+    FormulaProgram program = ast_.Compile();
+    for (FormulaOp& op : program) {
+        if (!op.cell.IsValid()) {
+            continue;
+        }
+        if (op.type == FormulaOp::Cell) {
+            op.cell = move_cell(op.cell);
+        } else if (op.type == FormulaOp::SheetCell) {
+            op.cell = move_sheet_cell(op.sheet, op.cell);
+        }
+    }
+    return std::make_unique<Formula>(program);
+}
+
+size_t Formula::GetMemoryUsage() const {
+    return EstimateAllocation(sizeof(*this)) + ast_.GetMemoryUsage();
+}
+
+//-----------------------------------------------------------------
+
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
+    try {
+        return std::make_unique<Formula>(std::move(expression));
+    } catch (const std::exception& e) {
+        throw FormulaException(e.what());
+    }
+}
+
+std::unique_ptr<FormulaInterface> ParseFormula(const FormulaProgram& program) {
+    return std::make_unique<Formula>(program);
+}
+
+std::ostream& operator<<(std::ostream& output, const FormulaInterface::Value& value) {
+    std::visit([&](const auto& x) { output << x; }, value);
+    return output;
+}
+
+std::optional<double> IsStringDoubleNumeric(const std::string &str) {
+    char *p;
+    std::optional<double> result = strtod(str.c_str(), &p);
+    if (*p == 0) { //если указатель указывает на конец строки
+        return result;
+    }
+    return std::optional<double>{};
+}
+
+FormulaInterface::Value LookupCellValue(const SheetInterface& sheet, Position pos) {
+    if (!pos.IsValid()) {
+        return FormulaError(FormulaError::Category::Ref);
+    }
+    CellInterface::Value value;
+    const CellInterface* cell_ptr = sheet.GetCell(pos);
+    if (cell_ptr) {
+        value = cell_ptr->GetValue(); 
+    } else {
+        value = 0.0;
+    }
+    if (std::holds_alternative<double>(value)) {
+        return std::get<double>(value);
+    } else if (std::holds_alternative<std::string>(value)) {
+        std::optional<double> numeric = IsStringDoubleNumeric(std::get<std::string>(value));
+        if (numeric.has_value()) {
+            return numeric.value();
+        }
+        return FormulaError(FormulaError::Category::Value);
+    }
+    return FormulaError(std::get<FormulaError>(value).GetCategory());
 }
\ No newline at end of file
@@ -1,56 +1,89 @@
-#pragma once
-
-#include "common.h"
-#include "FormulaAST.h"
-
-#include <memory>
-#include <optional>
-#include <vector>
-
-// Формула, позволяющая вычислять и обновлять арифметическое выражение.
-// Поддерживаемые возможности:
-// * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
-// * Значения ячеек в качестве переменных: A1+B2*C3
-// Ячейки, указанные в формуле, могут быть как формулами, так и текстом. Если это
-// текст, но он представляет число, тогда его нужно трактовать как число. Пустая
-// ячейка или ячейка с пустым текстом трактуется как число ноль.
-class FormulaInterface {
-public:
-    using Value = std::variant<double, FormulaError>;
-
-    virtual ~FormulaInterface() = default;
-
-    // Возвращает вычисленное значение формулы для переданного листа либо ошибку.
-    // Если вычисление какой-то из указанных в формуле ячеек приводит к ошибке, то
-    // возвращается именно эта ошибка. Если таких ошибок несколько, возвращается
-    // любая.
-    virtual Value Evaluate(const SheetInterface& sheet) const = 0;
-
-    // Возвращает выражение, которое описывает формулу.
-    // Не содержит пробелов и лишних скобок.
-    virtual std::string GetExpression() const = 0;
-
-    // Возвращает список ячеек, которые непосредственно задействованы в вычислении
-    // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
-    // ячеек.
-    virtual std::vector<Position> GetReferencedCells() const = 0;
-};
-
-class Formula : public FormulaInterface {
-public:
-    explicit Formula(std::string expression);
-
-    Value Evaluate(const SheetInterface& sheet) const override;
-    std::string GetExpression() const override;
-    std::vector<Position> GetReferencedCells() const override;
-private:
-    FormulaAST ast_;
-};
-
-// Парсит переданное выражение и возвращает объект формулы.
-// Бросает FormulaException в случае, если формула синтаксически некорректна.
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
-
-std::ostream &operator<<(std::ostream &output, const FormulaInterface::Value &value);
-
-std::optional<double> IsStringDoubleNumeric(const std::string &str);
+#pragma once
+
+#include "common.h"
+#include "FormulaAST.h"
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Формула, позволяющая вычислять и обновлять арифметическое выражение.
+// Поддерживаемые возможности:
+// * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
+// * Значения ячеек в качестве переменных: A1+B2*C3
+// * Значения ячеек других листов книги: Sheet2!A1 (см. Workbook)
+// Ячейки, указанные в формуле, могут быть как формулами, так и текстом. Если это
+// текст, но он представляет число, тогда его нужно трактовать как число. Пустая
+// ячейка или ячейка с пустым текстом трактуется как число ноль.
+class FormulaInterface {
+public:
+    using Value = std::variant<double, FormulaError>;
+
+    virtual ~FormulaInterface() = default;
+
+    // Возвращает вычисленное значение формулы для переданного листа либо ошибку.
+    // Если вычисление какой-то из указанных в формуле ячеек приводит к ошибке, то
+    // возвращается именно эта ошибка. Если таких ошибок несколько, возвращается
+    // любая.
+    virtual Value Evaluate(const SheetInterface& sheet) const = 0;
+
+    // Возвращает выражение, которое описывает формулу.
+    // Не содержит пробелов и лишних скобок.
+    virtual std::string GetExpression() const = 0;
+
+    // Возвращает список ячеек, которые непосредственно задействованы в вычислении
+    // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
+    // ячеек.
+    virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Возвращает список ячеек других листов, на которые ссылается формула.
+    // Список отсортирован по имени листа и позиции и не содержит повторяющихся
+    // ссылок.
+    virtual std::vector<SheetReference> GetSheetReferences() const = 0;
+
+    // Возвращает формулу в постфиксной записи (для поблочного вычисления).
+    virtual FormulaProgram GetProgram() const = 0;
+
+    // Возвращает копию формулы, в которой ссылки на ячейки листа заменены на
+    // move_cell(ячейка), а ссылки на ячейки других листов - на move_sheet_cell(лист,
+    // ячейка); текст формулы повторно не разбирается. Ссылка, заменённая на
+    // Position::NONE, выводится и вычисляется как #REF!.
+    virtual std::unique_ptr<FormulaInterface> MoveReferences(const CellMove& move_cell,
+                                                             const SheetCellMove& move_sheet_cell) const = 0;
+
+    // Возвращает примерный объём памяти формулы в байтах: объект формулы, дерево
+    // разбора и списки ссылок (см. MemoryUsage).
+    virtual size_t GetMemoryUsage() const = 0;
+};
+
+class Formula : public FormulaInterface {
+public:
+    explicit Formula(std::string expression);
+    explicit Formula(const FormulaProgram& program);
+
+    Value Evaluate(const SheetInterface& sheet) const override;
+    std::string GetExpression() const override;
+    std::vector<Position> GetReferencedCells() const override;
+    std::vector<SheetReference> GetSheetReferences() const override;
+    FormulaProgram GetProgram() const override;
+    std::unique_ptr<FormulaInterface> MoveReferences(const CellMove& move_cell,
+                                                     const SheetCellMove& move_sheet_cell) const override;
+    size_t GetMemoryUsage() const override;
+private:
+    FormulaAST ast_;
+};
+
+// Парсит переданное выражение и возвращает объект формулы.
+// Бросает FormulaException в случае, если формула синтаксически некорректна.
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+// Восстанавливает формулу из постфиксной записи, полученной через GetProgram().
+// Бросает FormulaException, если запись некорректна.
+std::unique_ptr<FormulaInterface> ParseFormula(const FormulaProgram& program);
+
+std::ostream &operator<<(std::ostream &output, const FormulaInterface::Value &value);
+
+std::optional<double> IsStringDoubleNumeric(const std::string &str);
+
+// Возвращает значение ячейки, приведённое к числу, либо ошибку, с которой
+// завершится вычисление формулы, ссылающейся на эту ячейку.
+FormulaInterface::Value LookupCellValue(const SheetInterface& sheet, Position pos);
@@ -0,0 +1,472 @@
+#include "journal.h"
+#include "buffered_writer.h"
+#include "sheet.h"
+#include "snapshot.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char JOURNAL_MAGIC[8] = {'S', 'H', 'E', 'E', 'T', 'J', 'N', 'L'};
+//версия 2 добавила записи вставки и удаления строк и столбцов; журнал версии 1
+//читается и при открытии переписывается с новым заголовком
+const std::uint32_t JOURNAL_VERSION = 2;
+const std::uint32_t JOURNAL_MIN_VERSION = 1;
+const std::uint32_t JOURNAL_BYTE_ORDER = 0x01020304;
+
+//заголовок: сигнатура, версия, порядок байтов, номер последней записи в снимке
+const size_t HEADER_SIZE = 8 + 4 + 4 + 8;
+//запись: размер данных, контрольная сумма, данные (номер, тип, строка, столбец, текст);
+//у вставки и удаления строк (столбцов) вместо строки и столбца записываются номер
+//первой строки (столбца) и их число, текста нет
+const size_t RECORD_PREFIX_SIZE = 4 + 4;
+const size_t RECORD_FIXED_SIZE = 8 + 1 + 4 + 4;
+
+const char SET_RECORD = 'S';
+const char CLEAR_RECORD = 'C';
+const char INSERT_ROWS_RECORD = 'I';
+const char DELETE_ROWS_RECORD = 'D';
+const char INSERT_COLS_RECORD = 'i';
+const char DELETE_COLS_RECORD = 'd';
+
+bool IsRecordType(char type) {
+    return type == SET_RECORD || type == CLEAR_RECORD || type == INSERT_ROWS_RECORD || type == DELETE_ROWS_RECORD
+           || type == INSERT_COLS_RECORD || type == DELETE_COLS_RECORD;
+}
+
+struct JournalRecord {
+    std::uint64_t sequence = 0;
+    char type = SET_RECORD;
+    Position pos;
+    std::string_view text;
+};
+
+[[noreturn]] void ThrowInvalidJournal(const char* reason) {
+    using namespace std::literals;
+    throw std::runtime_error("Invalid journal: "s + reason);
+}
+
+[[noreturn]] void ThrowSystemError(const char* action, const std::string& path) {
+    using namespace std::literals;
+    throw std::runtime_error("Failed to "s + action + " file " + path + ": " + std::strerror(errno));
+}
+
+//FNV-1a
+std::uint32_t Checksum(std::string_view data) {
+    std::uint32_t hash = 2166136261u;
+    for (char c : data) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+void AppendValue(std::string& output, T value) {
+    output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T ReadValue(const char* data) {
+    T value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+std::uint64_t ReadHeader(std::string_view data) {
+    if (data.size() < HEADER_SIZE || std::memcmp(data.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+        ThrowInvalidJournal("wrong signature");
+    }
+    std::uint32_t version = ReadValue<std::uint32_t>(data.data() + 8);
+    if (version < JOURNAL_MIN_VERSION || version > JOURNAL_VERSION) {
+        ThrowInvalidJournal("unsupported version");
+    }
+    if (ReadValue<std::uint32_t>(data.data() + 12) != JOURNAL_BYTE_ORDER) {
+        ThrowInvalidJournal("wrong byte order");
+    }
+    return ReadValue<std::uint64_t>(data.data() + 16);
+}
+
+std::uint32_t ReadHeaderVersion(std::string_view data) {
+    return ReadValue<std::uint32_t>(data.data() + 8);
+}
+
+//обходит записи, следующие за заголовком, и возвращает размер их корректной части:
+//обход останавливается на неполной или повреждённой записи
+template <typename Action>
+size_t ForEachRecord(std::string_view data, std::uint64_t base_sequence, Action action) {
+    size_t offset = HEADER_SIZE;
+    std::uint64_t sequence = base_sequence;
+    while (data.size() - offset >= RECORD_PREFIX_SIZE) {
+        std::uint32_t size = ReadValue<std::uint32_t>(data.data() + offset);
+        std::uint32_t checksum = ReadValue<std::uint32_t>(data.data() + offset + 4);
+        if (size < RECORD_FIXED_SIZE || size > data.size() - offset - RECORD_PREFIX_SIZE) {
+            break;
+        }
+        std::string_view payload = data.substr(offset + RECORD_PREFIX_SIZE, size);
+        if (Checksum(payload) != checksum) {
+            break;
+        }
+
+        JournalRecord record;
+        record.sequence = ReadValue<std::uint64_t>(payload.data());
+        record.type = payload[8];
+        record.pos.row = ReadValue<std::int32_t>(payload.data() + 9);
+        record.pos.col = ReadValue<std::int32_t>(payload.data() + 13);
+        record.text = payload.substr(RECORD_FIXED_SIZE);
+        if (record.sequence != sequence + 1 || !IsRecordType(record.type)) {
+            break;
+        }
+
+        action(record);
+        sequence = record.sequence;
+        offset += RECORD_PREFIX_SIZE + size;
+    }
+    return offset;
+}
+
+std::string ReadWholeFile(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        return {};
+    }
+    return std::string(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+void WriteHeader(int fd, std::uint64_t base_sequence) {
+    std::string header(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    AppendValue(header, JOURNAL_VERSION);
+    AppendValue(header, JOURNAL_BYTE_ORDER);
+    AppendValue(header, base_sequence);
+    MakeFileDescriptorSink(fd)(header);
+}
+
+bool IsFileExists(const std::string& path) {
+    return std::ifstream(path).good();
+}
+
+int OpenFile(const std::string& path, int flags) {
+#ifdef _WIN32
+    int fd = _open(path.c_str(), flags | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(path.c_str(), flags, 0644);
+#endif
+    if (fd < 0) {
+        ThrowSystemError("open", path);
+    }
+    return fd;
+}
+
+void CloseFile(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+void SyncFile(int fd, const std::string& path) {
+#ifdef _WIN32
+    int result = _commit(fd);
+#else
+    int result = fsync(fd);
+#endif
+    if (result != 0) {
+        ThrowSystemError("sync", path);
+    }
+}
+
+void TruncateFile(int fd, const std::string& path, size_t size) {
+#ifdef _WIN32
+    int result = _chsize_s(fd, static_cast<__int64>(size));
+#else
+    int result = ftruncate(fd, static_cast<off_t>(size));
+#endif
+    if (result != 0) {
+        ThrowSystemError("truncate", path);
+    }
+}
+
+void SyncFile(const std::string& path) {
+    int fd = OpenFile(path, O_RDWR);
+    try {
+        SyncFile(fd, path);
+    } catch (...) {
+        CloseFile(fd);
+        throw;
+    }
+    CloseFile(fd);
+}
+
+//атомарно заменяет файл target файлом source (в Windows - удаление и переименование)
+void ReplaceFile(const std::string& source, const std::string& target) {
+#ifdef _WIN32
+    std::remove(target.c_str());
+#endif
+    if (std::rename(source.c_str(), target.c_str()) != 0) {
+        ThrowSystemError("rename", source);
+    }
+#ifndef _WIN32
+    //переименование сохраняется на диске вместе с каталогом
+    size_t slash = target.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : target.substr(0, slash + 1);
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+} // namespace
+
+//----------SheetJournal------
+
+SheetJournal::SheetJournal(const std::string& path, size_t group_size)
+    : path_(path)
+    , group_size_(group_size > 0 ? group_size : GROUP_SIZE) {
+    Open();
+}
+
+SheetJournal::~SheetJournal() {
+    try {
+        Commit();
+    } catch (...) {
+        //ошибку записи получит тот, кто вызывает Commit() явно
+    }
+    Close();
+}
+
+void SheetJournal::SetCell(Sheet& sheet, Position pos, std::string text) {
+    sheet.SetCell(pos, text);
+    Append(SET_RECORD, pos, text);
+}
+
+void SheetJournal::ClearCell(Sheet& sheet, Position pos) {
+    sheet.ClearCell(pos);
+    Append(CLEAR_RECORD, pos, {});
+}
+
+void SheetJournal::InsertRows(Sheet& sheet, int row, int count) {
+    sheet.InsertRows(row, count);
+    Append(INSERT_ROWS_RECORD, Position{row, count}, {});
+}
+
+void SheetJournal::DeleteRows(Sheet& sheet, int row, int count) {
+    sheet.DeleteRows(row, count);
+    Append(DELETE_ROWS_RECORD, Position{row, count}, {});
+}
+
+void SheetJournal::InsertCols(Sheet& sheet, int col, int count) {
+    sheet.InsertCols(col, count);
+    Append(INSERT_COLS_RECORD, Position{col, count}, {});
+}
+
+void SheetJournal::DeleteCols(Sheet& sheet, int col, int count) {
+    sheet.DeleteCols(col, count);
+    Append(DELETE_COLS_RECORD, Position{col, count}, {});
+}
+
+void SheetJournal::Commit() {
+    if (buffer_.empty()) {
+        return;
+    }
+    //после неудачной записи в файле может остаться часть группы: группа записывается
+    //заново с конца последней сохранённой записи, иначе она оказалась бы после
+    //неполной записи и была бы отброшена при открытии журнала
+    if (is_write_failed_) {
+        TruncateFile(fd_, path_, file_size_);
+        is_write_failed_ = false;
+    }
+    is_write_failed_ = true;
+    MakeFileDescriptorSink(fd_)(buffer_);
+    SyncFile(fd_, path_);
+    is_write_failed_ = false;
+    file_size_ += buffer_.size();
+    buffer_.clear();
+    pending_ = 0;
+}
+
+void SheetJournal::Checkpoint(const Sheet& sheet, const std::string& snapshot_path) {
+    Commit();
+
+    //снимок помечается номером последней записи: если сбой произойдёт до очистки
+    //журнала, при восстановлении записи, вошедшие в снимок, будут пропущены
+    std::string snapshot_tmp = snapshot_path + ".tmp";
+    SaveSnapshot(sheet, snapshot_tmp, last_sequence_);
+    SyncFile(snapshot_tmp);
+    ReplaceFile(snapshot_tmp, snapshot_path);
+
+    std::string journal_tmp = path_ + ".tmp";
+    int fd = OpenFile(journal_tmp, O_WRONLY | O_CREAT | O_TRUNC);
+    try {
+        WriteHeader(fd, last_sequence_);
+        SyncFile(fd, journal_tmp);
+    } catch (...) {
+        CloseFile(fd);
+        throw;
+    }
+    CloseFile(fd);
+
+    Close();
+    ReplaceFile(journal_tmp, path_);
+    Open();
+}
+
+size_t SheetJournal::Replay(Sheet& sheet, std::uint64_t after_sequence) const {
+    std::string data = ReadWholeFile(path_);
+    std::uint64_t base_sequence = ReadHeader(data);
+
+    //в одной группе позиции не повторяются, чтобы результат совпадал с последовательными SetCell
+    std::vector<std::pair<Position, std::string>> batch;
+    std::unordered_set<Position, Sheet::CellPositionHasher> batch_positions;
+    auto flush_batch = [&sheet, &batch, &batch_positions]() {
+        if (!batch.empty()) {
+            sheet.SetCells(std::move(batch));
+            batch.clear();
+            batch_positions.clear();
+        }
+    };
+
+    size_t count = 0;
+    ForEachRecord(data, base_sequence, [&](const JournalRecord& record) {
+        if (record.sequence <= after_sequence) {
+            return;
+        }
+        ++count;
+        if (record.type != SET_RECORD) {
+            flush_batch();
+            switch (record.type) {
+                case CLEAR_RECORD:
+                    return sheet.ClearCell(record.pos);
+                case INSERT_ROWS_RECORD:
+                    return sheet.InsertRows(record.pos.row, record.pos.col);
+                case DELETE_ROWS_RECORD:
+                    return sheet.DeleteRows(record.pos.row, record.pos.col);
+                case INSERT_COLS_RECORD:
+                    return sheet.InsertCols(record.pos.row, record.pos.col);
+                default:
+                    return sheet.DeleteCols(record.pos.row, record.pos.col);
+            }
+        }
+        if (!batch_positions.insert(record.pos).second) {
+            flush_batch();
+            batch_positions.insert(record.pos);
+        }
+        batch.emplace_back(record.pos, std::string(record.text));
+    });
+    flush_batch();
+    return count;
+}
+
+std::uint64_t SheetJournal::GetLastSequence() const {
+    return last_sequence_;
+}
+
+void SheetJournal::Open() {
+    std::string data = ReadWholeFile(path_);
+    if (data.empty()) {
+        int fd = OpenFile(path_, O_WRONLY | O_CREAT | O_TRUNC);
+        try {
+            WriteHeader(fd, 0);
+            SyncFile(fd, path_);
+        } catch (...) {
+            CloseFile(fd);
+            throw;
+        }
+        CloseFile(fd);
+        data = ReadWholeFile(path_);
+    }
+
+    base_sequence_ = ReadHeader(data);
+    last_sequence_ = base_sequence_;
+    size_t valid_size = ForEachRecord(data, base_sequence_, [this](const JournalRecord& record) {
+        last_sequence_ = record.sequence;
+    });
+
+    if (ReadHeaderVersion(data) != JOURNAL_VERSION) {
+        //журнал прежней версии переписываем целиком, чтобы новые записи не попали в
+        //файл, который прежняя версия прочитала бы только до первой из них
+        std::string journal_tmp = path_ + ".tmp";
+        int fd = OpenFile(journal_tmp, O_WRONLY | O_CREAT | O_TRUNC);
+        try {
+            WriteHeader(fd, base_sequence_);
+            MakeFileDescriptorSink(fd)(std::string_view(data).substr(HEADER_SIZE, valid_size - HEADER_SIZE));
+            SyncFile(fd, journal_tmp);
+        } catch (...) {
+            CloseFile(fd);
+            throw;
+        }
+        CloseFile(fd);
+        ReplaceFile(journal_tmp, path_);
+        data.resize(valid_size);
+    }
+
+    fd_ = OpenFile(path_, O_WRONLY | O_APPEND);
+    if (valid_size < data.size()) {
+        //отбрасываем запись, запись которой на диск была прервана
+        TruncateFile(fd_, path_, valid_size);
+    }
+    file_size_ = valid_size;
+    is_write_failed_ = false;
+}
+
+void SheetJournal::Close() {
+    if (fd_ >= 0) {
+        CloseFile(fd_);
+        fd_ = -1;
+    }
+}
+
+void SheetJournal::Append(char type, Position pos, std::string_view text) {
+    size_t payload_size = RECORD_FIXED_SIZE + text.size();
+    size_t start = buffer_.size();
+    AppendValue(buffer_, static_cast<std::uint32_t>(payload_size));
+    AppendValue(buffer_, std::uint32_t(0));
+    AppendValue(buffer_, last_sequence_ + 1);
+    buffer_.push_back(type);
+    AppendValue(buffer_, static_cast<std::int32_t>(pos.row));
+    AppendValue(buffer_, static_cast<std::int32_t>(pos.col));
+    buffer_.append(text);
+
+    std::uint32_t checksum = Checksum(std::string_view(buffer_).substr(start + RECORD_PREFIX_SIZE));
+    std::memcpy(&buffer_[start + 4], &checksum, sizeof(checksum));
+
+    ++last_sequence_;
+    if (++pending_ >= group_size_) {
+        Commit();
+    }
+}
+
+std::unique_ptr<Sheet> RecoverSheet(const std::string& snapshot_path, const std::string& journal_path) {
+    std::unique_ptr<Sheet> sheet;
+    std::uint64_t sequence = 0;
+    if (IsFileExists(snapshot_path)) {
+        SheetSnapshot snapshot(snapshot_path);
+        sheet = snapshot.Restore();
+        sequence = snapshot.GetJournalSequence();
+    } else {
+        sheet = std::make_unique<Sheet>();
+    }
+
+    if (IsFileExists(journal_path)) {
+        SheetJournal journal(journal_path);
+        journal.Replay(*sheet, sequence);
+    }
+    return sheet;
+}
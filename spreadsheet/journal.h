@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+class Sheet;
+
+// Журнал изменений листа: файл, в конец которого дописываются записи SetCell,
+// ClearCell, вставки и удаления строк и столбцов. Каждая запись содержит номер (номера растут на единицу), позицию,
+// текст и контрольную сумму. Записи накапливаются в памяти и сбрасываются на диск
+// группами: когда их набирается group_size, а также при вызове Commit() и в
+// деструкторе. Изменение сохранено после того, как завершился Commit().
+// Если запись на диск была прервана, неполная последняя запись отбрасывается
+// при открытии журнала. Если запись группы завершилась ошибкой, Commit() бросает
+// исключение, а записи остаются в памяти: следующий Commit() обрезает файл до
+// последней сохранённой записи и записывает группу заново.
+class SheetJournal {
+public:
+    static const size_t GROUP_SIZE = 256;
+
+    //открывает журнал, создавая файл при необходимости
+    explicit SheetJournal(const std::string& path, size_t group_size = GROUP_SIZE);
+    ~SheetJournal();
+
+    SheetJournal(const SheetJournal&) = delete;
+    SheetJournal& operator=(const SheetJournal&) = delete;
+
+    //изменяют лист и записывают изменение в журнал; если лист не изменён из-за
+    //исключения, журнал тоже не изменяется
+    void SetCell(Sheet& sheet, Position pos, std::string text);
+    void ClearCell(Sheet& sheet, Position pos);
+    void InsertRows(Sheet& sheet, int row, int count = 1);
+    void DeleteRows(Sheet& sheet, int row, int count = 1);
+    void InsertCols(Sheet& sheet, int col, int count = 1);
+    void DeleteCols(Sheet& sheet, int col, int count = 1);
+
+    //записывает накопленные записи и дожидается их сохранения на диске
+    void Commit();
+
+    //сохраняет снимок листа и очищает журнал; снимок записывается во временный
+    //файл и заменяет прежний только после сохранения на диске
+    void Checkpoint(const Sheet& sheet, const std::string& snapshot_path);
+
+    //применяет к листу записи с номерами больше after_sequence; подряд идущие SetCell
+    //передаются в лист группами через Sheet::SetCells. Возвращает число записей
+    size_t Replay(Sheet& sheet, std::uint64_t after_sequence = 0) const;
+
+    std::uint64_t GetLastSequence() const;
+
+private:
+    void Open();
+    void Close();
+    void Append(char type, Position pos, std::string_view text);
+
+    std::string path_;
+    size_t group_size_;
+    int fd_ = -1;
+
+    //номер последней записи, вошедшей в снимок при последней контрольной точке
+    std::uint64_t base_sequence_ = 0;
+    std::uint64_t last_sequence_ = 0;
+
+    std::string buffer_;
+    size_t pending_ = 0;
+
+    //размер файла до конца последней сохранённой группы
+    size_t file_size_ = 0;
+    //запись группы не завершилась: в конце файла может быть её часть
+    bool is_write_failed_ = false;
+};
+
+// Восстанавливает лист из снимка (если он есть) и записей журнала, сделанных после него.
+std::unique_ptr<Sheet> RecoverSheet(const std::string& snapshot_path, const std::string& journal_path);
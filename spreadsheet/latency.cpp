@@ -0,0 +1,221 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+
+namespace {
+
+const char* const OPERATION_NAMES[] = {"SetCell", "ClearCell", "GetValue"};
+const char* const KIND_NAMES[] = {"text", "formula"};
+const char* const OUTCOME_NAMES[] = {"ok", "FormulaException", "CircularDependencyException"};
+
+std::int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+//часть гистограмм, в которую пишет текущий поток; потоки получают части по кругу
+size_t GetStripe(size_t stripe_count) {
+    static std::atomic<size_t> next_stripe{0};
+    thread_local size_t stripe = next_stripe.fetch_add(1, std::memory_order_relaxed);
+    return stripe % stripe_count;
+}
+
+} // namespace
+
+//-------------------LatencyHistogram--------------------------
+
+LatencyHistogram::LatencyHistogram(const LatencyHistogram& other) {
+    Merge(other);
+}
+
+LatencyHistogram& LatencyHistogram::operator=(const LatencyHistogram& other) {
+    if (this != &other) {
+        Reset();
+        Merge(other);
+    }
+    return *this;
+}
+
+size_t LatencyHistogram::GetBucket(std::uint64_t nanoseconds) {
+    if (nanoseconds > MAX_NANOSECONDS) {
+        nanoseconds = MAX_NANOSECONDS;
+    }
+    if (nanoseconds < SUB_BUCKET_COUNT) {
+        return static_cast<size_t>(nanoseconds);
+    }
+    //exponent - число младших битов, которые отбрасываются, чтобы осталось SUB_BUCKET_BITS битов
+    int exponent = 1;
+    while ((nanoseconds >> exponent) >= SUB_BUCKET_COUNT) {
+        ++exponent;
+    }
+    return SUB_BUCKET_COUNT + (exponent - 1) * HALF_SUB_BUCKET_COUNT
+        + static_cast<size_t>(nanoseconds >> exponent) - HALF_SUB_BUCKET_COUNT;
+}
+
+std::uint64_t LatencyHistogram::GetBucketMax(size_t bucket) {
+    if (bucket < SUB_BUCKET_COUNT) {
+        return bucket;
+    }
+    size_t exponent = (bucket - SUB_BUCKET_COUNT) / HALF_SUB_BUCKET_COUNT + 1;
+    std::uint64_t mantissa = (bucket - SUB_BUCKET_COUNT) % HALF_SUB_BUCKET_COUNT + HALF_SUB_BUCKET_COUNT;
+    return ((mantissa + 1) << exponent) - 1;
+}
+
+void LatencyHistogram::Record(std::uint64_t nanoseconds) {
+    counts_[GetBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        std::uint64_t count = other.counts_[i].load(std::memory_order_relaxed);
+        if (count != 0) {
+            counts_[i].fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+}
+
+void LatencyHistogram::Reset() {
+    for (std::atomic<std::uint64_t>& count : counts_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::uint64_t LatencyHistogram::GetCount() const {
+    std::uint64_t total = 0;
+    for (const std::atomic<std::uint64_t>& count : counts_) {
+        total += count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::uint64_t LatencyHistogram::GetPercentile(double percentile) const {
+    std::uint64_t total = GetCount();
+    if (total == 0) {
+        return 0;
+    }
+    //номер значения в порядке возрастания, начиная с 1
+    double rank = std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * total);
+    std::uint64_t target = std::max<std::uint64_t>(static_cast<std::uint64_t>(rank), 1);
+    std::uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts_[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return GetBucketMax(i);
+        }
+    }
+    return GetMax();
+}
+
+std::uint64_t LatencyHistogram::GetMax() const {
+    for (size_t i = BUCKET_COUNT; i > 0; --i) {
+        if (counts_[i - 1].load(std::memory_order_relaxed) != 0) {
+            return GetBucketMax(i - 1);
+        }
+    }
+    return 0;
+}
+
+LatencyPercentiles GetPercentiles(const LatencyHistogram& histogram) {
+    LatencyPercentiles percentiles;
+    percentiles.count = histogram.GetCount();
+    percentiles.p50 = histogram.GetPercentile(50);
+    percentiles.p90 = histogram.GetPercentile(90);
+    percentiles.p99 = histogram.GetPercentile(99);
+    percentiles.p999 = histogram.GetPercentile(99.9);
+    percentiles.max = histogram.GetMax();
+    return percentiles;
+}
+
+//-------------------LatencyRecorder---------------------------
+
+LatencyRecorder::~LatencyRecorder() {
+    for (std::atomic<LatencyHistogram*>& histogram : histograms_) {
+        delete histogram.load(std::memory_order_relaxed);
+    }
+}
+
+size_t LatencyRecorder::GetIndex(LatencyOperation operation, CellKind kind, LatencyOutcome outcome) {
+    return (static_cast<size_t>(operation) * KIND_COUNT + static_cast<size_t>(kind)) * OUTCOME_COUNT
+        + static_cast<size_t>(outcome);
+}
+
+void LatencyRecorder::Record(LatencyOperation operation, CellKind kind, LatencyOutcome outcome,
+                             std::uint64_t nanoseconds) {
+    std::atomic<LatencyHistogram*>& place =
+        histograms_[GetIndex(operation, kind, outcome) * STRIPE_COUNT + GetStripe(STRIPE_COUNT)];
+    LatencyHistogram* histogram = place.load(std::memory_order_acquire);
+    if (histogram == nullptr) {
+        //гистограмму могут одновременно создавать несколько потоков одной части
+        LatencyHistogram* created = new LatencyHistogram();
+        if (place.compare_exchange_strong(histogram, created, std::memory_order_acq_rel)) {
+            histogram = created;
+        } else {
+            delete created;
+        }
+    }
+    histogram->Record(nanoseconds);
+}
+
+LatencyHistogram LatencyRecorder::Get(LatencyOperation operation, CellKind kind, LatencyOutcome outcome) const {
+    LatencyHistogram result;
+    const size_t first = GetIndex(operation, kind, outcome) * STRIPE_COUNT;
+    for (size_t stripe = 0; stripe < STRIPE_COUNT; ++stripe) {
+        if (const LatencyHistogram* histogram = histograms_[first + stripe].load(std::memory_order_acquire)) {
+            result.Merge(*histogram);
+        }
+    }
+    return result;
+}
+
+void LatencyRecorder::Reset() {
+    for (std::atomic<LatencyHistogram*>& histogram : histograms_) {
+        if (LatencyHistogram* ptr = histogram.load(std::memory_order_acquire)) {
+            ptr->Reset();
+        }
+    }
+}
+
+void LatencyRecorder::WriteReport(std::ostream& output) const {
+    std::ios_base::fmtflags flags = output.flags();
+    std::streamsize precision = output.precision();
+    output << std::fixed << std::setprecision(3);
+    output << "operation\tkind\toutcome\tcount\tp50_us\tp90_us\tp99_us\tp999_us\tmax_us\n";
+    for (size_t operation = 0; operation < OPERATION_COUNT; ++operation) {
+        for (size_t kind = 0; kind < KIND_COUNT; ++kind) {
+            for (size_t outcome = 0; outcome < OUTCOME_COUNT; ++outcome) {
+                LatencyPercentiles percentiles = GetPercentiles(Get(static_cast<LatencyOperation>(operation),
+                                                                    static_cast<CellKind>(kind),
+                                                                    static_cast<LatencyOutcome>(outcome)));
+                if (percentiles.count == 0) {
+                    continue;
+                }
+                output << OPERATION_NAMES[operation] << '\t' << KIND_NAMES[kind] << '\t' << OUTCOME_NAMES[outcome]
+                       << '\t' << percentiles.count;
+                for (std::uint64_t value : {percentiles.p50, percentiles.p90, percentiles.p99, percentiles.p999,
+                                            percentiles.max}) {
+                    output << '\t' << value / 1e3;
+                }
+                output << '\n';
+            }
+        }
+    }
+    output.flags(flags);
+    output.precision(precision);
+}
+
+//-------------------LatencyTimer------------------------------
+
+void LatencyTimer::Start() {
+    uncaught_exceptions_ = std::uncaught_exceptions();
+    start_ = Now();
+}
+
+void LatencyTimer::Finish(LatencyOutcome outcome) {
+    std::int64_t elapsed = Now() - start_;
+    recorder_->Record(operation_, kind_, outcome, static_cast<std::uint64_t>(std::max<std::int64_t>(elapsed, 0)));
+    recorder_ = nullptr;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <iosfwd>
+
+enum class LatencyOperation {
+    SetCell,
+    ClearCell,
+    GetValue,
+};
+
+//вид ячейки: задаваемой (SetCell), очищаемой (ClearCell) или читаемой (GetValue);
+//пустые ячейки считаются текстовыми
+enum class CellKind {
+    Text,
+    Formula,
+};
+
+//исход операции: успех или исключение, которым она завершилась
+enum class LatencyOutcome {
+    Ok,
+    FormulaException,
+    CircularDependencyException,
+};
+
+// Гистограмма задержек в наносекундах в духе HdrHistogram: до 128 нс значения
+// хранятся точно, дальше каждая степень двойки делится на 64 равные части, поэтому
+// относительная погрешность процентилей не больше 1/64. Значения больше
+// MAX_NANOSECONDS учитываются как MAX_NANOSECONDS. Запись атомарна, гистограммы
+// разных потоков складываются через Merge.
+class LatencyHistogram {
+public:
+    static const std::uint64_t MAX_NANOSECONDS = (std::uint64_t(1) << 40) - 1;
+
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram& other);
+    LatencyHistogram& operator=(const LatencyHistogram& other);
+
+    void Record(std::uint64_t nanoseconds);
+    void Merge(const LatencyHistogram& other);
+    void Reset();
+
+    std::uint64_t GetCount() const;
+    //значение, которого не превышают percentile процентов записанных значений (с
+    //точностью до погрешности гистограммы); 0 для пустой гистограммы
+    std::uint64_t GetPercentile(double percentile) const;
+    std::uint64_t GetMax() const;
+
+private:
+    static const int SUB_BUCKET_BITS = 7;
+    static const size_t SUB_BUCKET_COUNT = size_t(1) << SUB_BUCKET_BITS;
+    static const size_t HALF_SUB_BUCKET_COUNT = SUB_BUCKET_COUNT / 2;
+    static const size_t BUCKET_COUNT = SUB_BUCKET_COUNT + (40 - SUB_BUCKET_BITS) * HALF_SUB_BUCKET_COUNT;
+
+    static size_t GetBucket(std::uint64_t nanoseconds);
+    //наибольшее значение, попадающее в bucket
+    static std::uint64_t GetBucketMax(size_t bucket);
+
+    std::array<std::atomic<std::uint64_t>, BUCKET_COUNT> counts_{};
+};
+
+// Процентили задержек в наносекундах.
+struct LatencyPercentiles {
+    std::uint64_t count = 0;
+    std::uint64_t p50 = 0;
+    std::uint64_t p90 = 0;
+    std::uint64_t p99 = 0;
+    std::uint64_t p999 = 0;
+    std::uint64_t max = 0;
+};
+
+LatencyPercentiles GetPercentiles(const LatencyHistogram& histogram);
+
+// Гистограммы задержек операций листа по операции, виду ячейки и исходу. Каждая
+// гистограмма разбита на части, в которые пишут разные потоки, чтобы потоки не
+// изменяли одни и те же счётчики; Get складывает части. Гистограмма создаётся при
+// первой записи в неё.
+class LatencyRecorder {
+public:
+    LatencyRecorder() = default;
+    LatencyRecorder(const LatencyRecorder&) = delete;
+    LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+    ~LatencyRecorder();
+
+    void Record(LatencyOperation operation, CellKind kind, LatencyOutcome outcome, std::uint64_t nanoseconds);
+    LatencyHistogram Get(LatencyOperation operation, CellKind kind, LatencyOutcome outcome) const;
+    void Reset();
+
+    //строки "операция<TAB>вид<TAB>исход<TAB>число<TAB>p50 ... max" (время в микросекундах)
+    //для непустых гистограмм
+    void WriteReport(std::ostream& output) const;
+
+private:
+    static const size_t OPERATION_COUNT = 3;
+    static const size_t KIND_COUNT = 2;
+    static const size_t OUTCOME_COUNT = 3;
+    static const size_t STRIPE_COUNT = 4;
+    static const size_t HISTOGRAM_COUNT = OPERATION_COUNT * KIND_COUNT * OUTCOME_COUNT;
+
+    static size_t GetIndex(LatencyOperation operation, CellKind kind, LatencyOutcome outcome);
+
+    std::array<std::atomic<LatencyHistogram*>, HISTOGRAM_COUNT * STRIPE_COUNT> histograms_{};
+};
+
+// Измеряет время от создания до удаления объекта и записывает его с исходом Ok, если
+// объект удаляется не из-за исключения. Операцию, завершившуюся исключением,
+// записывает Fail. Без recorder ничего не делает.
+class LatencyTimer {
+public:
+    LatencyTimer(LatencyRecorder* recorder, LatencyOperation operation, CellKind kind)
+        : recorder_(recorder)
+        , operation_(operation)
+        , kind_(kind) {
+        if (recorder_) {
+            Start();
+        }
+    }
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+    ~LatencyTimer() {
+        if (recorder_ && std::uncaught_exceptions() == uncaught_exceptions_) {
+            Finish(LatencyOutcome::Ok);
+        }
+    }
+
+    //вид ячейки, если он стал известен после создания таймера
+    void SetKind(CellKind kind) {
+        kind_ = kind;
+    }
+    void Fail(LatencyOutcome outcome) {
+        if (recorder_) {
+            Finish(outcome);
+        }
+    }
+
+private:
+    void Start();
+    void Finish(LatencyOutcome outcome);
+
+    LatencyRecorder* recorder_;
+    LatencyOperation operation_;
+    CellKind kind_;
+    int uncaught_exceptions_ = 0;
+    std::int64_t start_ = 0;
+};
@@ -6,8 +6,8 @@
 
 #include <limits>
 
-inline Position operator"" _pos(const char* str, std::size_t) {
-    return Position::FromString(str);
+inline constexpr Position operator"" _pos(const char* str, std::size_t size) {
+    return Position::FromString(std::string_view(str, size));
 }
 
 int main() {
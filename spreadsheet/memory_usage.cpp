@@ -0,0 +1,43 @@
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <functional>
+#include <ostream>
+
+namespace {
+
+//блоки распределителя выровнены по 16 байт и содержат 8-байтовый заголовок; меньше
+//MIN_ALLOCATION блок не бывает (так устроен распределитель glibc)
+const size_t ALLOCATION_ALIGNMENT = 16;
+const size_t ALLOCATION_HEADER = sizeof(size_t);
+const size_t MIN_ALLOCATION = 32;
+
+} // namespace
+
+size_t MemoryUsage::GetTotal() const {
+    return cell_map + cells + texts + formulas + dependencies + cached_values + change_log;
+}
+
+void WriteMemoryUsage(std::ostream& output, const MemoryUsage& usage) {
+    output << "{\"cell_map\": " << usage.cell_map << ", \"cells\": " << usage.cells << ", \"texts\": " << usage.texts
+           << ", \"formulas\": " << usage.formulas << ", \"dependencies\": " << usage.dependencies
+           << ", \"cached_values\": " << usage.cached_values << ", \"change_log\": " << usage.change_log
+           << ", \"cell_count\": " << usage.cell_count << ", \"total\": " << usage.GetTotal()
+           << ", \"bytes_per_cell\": "
+           << (usage.cell_count == 0 ? 0.0 : static_cast<double>(usage.GetTotal()) / usage.cell_count) << '}';
+}
+
+size_t EstimateAllocation(size_t size) {
+    size_t block = (size + ALLOCATION_HEADER + ALLOCATION_ALIGNMENT - 1) / ALLOCATION_ALIGNMENT * ALLOCATION_ALIGNMENT;
+    return std::max(block, MIN_ALLOCATION);
+}
+
+size_t EstimateStringMemory(const std::string& text) {
+    //короткая строка хранится в самом объекте std::string
+    const char* data = text.data();
+    const char* object = reinterpret_cast<const char*>(&text);
+    if (!std::less<const char*>()(data, object) && std::less<const char*>()(data, object + sizeof(std::string))) {
+        return 0;
+    }
+    return EstimateAllocation(text.capacity() + 1);
+}
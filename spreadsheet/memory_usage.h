@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <forward_list>
+#include <iosfwd>
+#include <set>
+#include <string>
+#include <vector>
+
+// Память листа в байтах по частям (см. Sheet::GetMemoryUsage). Размеры оцениваются по
+// размерам объектов и контейнеров с учётом выравнивания и заголовков блоков
+// распределителя памяти, поэтому совпадают с реально выделенной памятью приблизительно.
+struct MemoryUsage {
+    //области листа и хеш-таблицы ячеек в них: массивы корзин и узлы
+    size_t cell_map = 0;
+    //объекты Cell без кэшированного значения
+    size_t cells = 0;
+    //содержимое текстовых и пустых ячеек: объекты Impl и строки текста
+    size_t texts = 0;
+    //содержимое ячеек с формулами: объекты Impl и Formula, деревья разбора, списки ссылок
+    size_t formulas = 0;
+    //связи ячеек в Cash: множества ячеек, на которые ячейка ссылается и которые
+    //ссылаются на неё, в том числе на других листах книги
+    size_t dependencies = 0;
+    //кэшированные значения: сами значения и строки текстовых значений
+    size_t cached_values = 0;
+    //журнал изменений листа
+    size_t change_log = 0;
+    //ячейки в таблице листа, включая очищенные и пустые ячейки для ссылок
+    size_t cell_count = 0;
+
+    size_t GetTotal() const;
+};
+
+//объект {"cell_map": ..., ..., "total": ..., "bytes_per_cell": ...}
+void WriteMemoryUsage(std::ostream& output, const MemoryUsage& usage);
+
+//размер блока памяти, занимаемого выделением size байт
+size_t EstimateAllocation(size_t size);
+//память строки вне объекта std::string (0 для коротких строк, хранящихся в самом объекте)
+size_t EstimateStringMemory(const std::string& text);
+
+//размер узла красно-чёрного дерева std::set без значения: цвет и три указателя
+const size_t SET_NODE_OVERHEAD = 4 * sizeof(void*);
+
+template <typename T>
+size_t EstimateSetMemory(const std::set<T>& items) {
+    return items.size() * EstimateAllocation(SET_NODE_OVERHEAD + sizeof(T));
+}
+
+template <typename T>
+size_t EstimateVectorMemory(const std::vector<T>& items) {
+    return items.capacity() == 0 ? 0 : EstimateAllocation(items.capacity() * sizeof(T));
+}
+
+template <typename T>
+size_t EstimateForwardListMemory(const std::forward_list<T>& items) {
+    size_t count = 0;
+    for (auto it = items.begin(); it != items.end(); ++it) {
+        ++count;
+    }
+    return count * EstimateAllocation(sizeof(void*) + sizeof(T));
+}
@@ -0,0 +1,121 @@
+#include "profiler.h"
+
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Frame {
+    Clock::time_point start;
+    //время и число вычислений, вложенных в кадр
+    std::uint64_t child_nanoseconds = 0;
+    std::uint64_t nested_evaluations = 0;
+};
+
+//стек общий для всех листов: вычисление ячейки другого листа книги тоже вложено
+//в кадр вызвавшей ячейки
+thread_local std::vector<Frame> frames;
+
+void WriteCells(std::ostream& output, const char* title, const std::vector<CellProfile>& cells) {
+    output << title << '\n';
+    output << "cell\tevaluations\texclusive_ms\tinclusive_ms\tnested_evaluations\n";
+    for (const CellProfile& cell : cells) {
+        output << cell.pos.ToString() << '\t' << cell.evaluations << '\t' << cell.exclusive_nanoseconds / 1e6 << '\t'
+               << cell.inclusive_nanoseconds / 1e6 << '\t' << cell.nested_evaluations << '\n';
+    }
+}
+
+} // namespace
+
+EvaluationProfiler::Shard& EvaluationProfiler::GetShard(const Cell* cell) {
+    //младшие биты адресов ячеек одинаковы из-за выравнивания
+    return shards_[(reinterpret_cast<std::uintptr_t>(cell) >> 4) % SHARD_COUNT];
+}
+
+void EvaluationProfiler::Record(const Cell* cell, std::uint64_t evaluations, std::uint64_t inclusive_nanoseconds,
+                                std::uint64_t exclusive_nanoseconds, std::uint64_t nested_evaluations) {
+    Shard& shard = GetShard(cell);
+    std::lock_guard lock(shard.mutex);
+    CellProfile& entry = shard.entries[cell];
+    entry.evaluations += evaluations;
+    entry.inclusive_nanoseconds += inclusive_nanoseconds;
+    entry.exclusive_nanoseconds += exclusive_nanoseconds;
+    entry.nested_evaluations += nested_evaluations;
+}
+
+void EvaluationProfiler::MoveEntry(const Cell* from, const Cell* to) {
+    CellProfile moved;
+    {
+        Shard& shard = GetShard(from);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.entries.find(from);
+        if (it == shard.entries.end()) {
+            return void();
+        }
+        moved = it->second;
+        shard.entries.erase(it);
+    }
+    Record(to, moved.evaluations, moved.inclusive_nanoseconds, moved.exclusive_nanoseconds, moved.nested_evaluations);
+}
+
+void EvaluationProfiler::RemoveEntry(const Cell* cell) {
+    Shard& shard = GetShard(cell);
+    std::lock_guard lock(shard.mutex);
+    shard.entries.erase(cell);
+}
+
+EvaluationProfiler::Entries EvaluationProfiler::GetEntries() const {
+    Entries entries;
+    for (const Shard& shard : shards_) {
+        std::lock_guard lock(shard.mutex);
+        entries.insert(shard.entries.begin(), shard.entries.end());
+    }
+    return entries;
+}
+
+void EvaluationProfiler::Reset() {
+    for (Shard& shard : shards_) {
+        std::lock_guard lock(shard.mutex);
+        shard.entries.clear();
+    }
+}
+
+void ProfileScope::Begin() {
+    frames.push_back(Frame{Clock::now()});
+}
+
+void ProfileScope::End() {
+    Frame frame = frames.back();
+    frames.pop_back();
+    std::uint64_t inclusive = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - frame.start).count();
+    std::uint64_t exclusive = inclusive > frame.child_nanoseconds ? inclusive - frame.child_nanoseconds : 0;
+    std::uint64_t evaluations = cells_.empty() ? 1 : cells_.size();
+    if (!frames.empty()) {
+        frames.back().child_nanoseconds += inclusive;
+        frames.back().nested_evaluations += frame.nested_evaluations + evaluations;
+    }
+
+    if (cells_.empty()) {
+        profiler_->Record(cell_, 1, inclusive, exclusive, frame.nested_evaluations);
+        return void();
+    }
+    //время блока делится между его ячейками поровну
+    for (const Cell* cell : cells_) {
+        profiler_->Record(cell, 1, inclusive / evaluations, exclusive / evaluations,
+                          frame.nested_evaluations / evaluations);
+    }
+}
+
+void WriteProfileReport(std::ostream& output, const ProfileReport& report) {
+    std::ios_base::fmtflags flags = output.flags();
+    std::streamsize precision = output.precision();
+    output << std::fixed << std::setprecision(3);
+    output << "evaluations " << report.evaluations << ", total " << report.total_nanoseconds / 1e6 << " ms\n";
+    WriteCells(output, "hottest cells (exclusive time)", report.hottest_cells);
+    WriteCells(output, "hottest dependency subtrees (inclusive time)", report.hottest_subtrees);
+    output.flags(flags);
+    output.precision(precision);
+}
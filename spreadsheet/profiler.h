@@ -0,0 +1,109 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class Cell;
+
+// Время вычислений одной ячейки за время профилирования.
+struct CellProfile {
+    Position pos;
+    std::uint64_t evaluations = 0;
+    //время вычислений ячейки вместе с вычислениями ячеек, на которые она ссылается
+    //(поддерево зависимостей), и без них
+    std::uint64_t inclusive_nanoseconds = 0;
+    std::uint64_t exclusive_nanoseconds = 0;
+    //вычисления других ячеек, выполненные во время вычислений этой ячейки
+    std::uint64_t nested_evaluations = 0;
+};
+
+// Отчёт профилировщика (см. Sheet::GetProfileReport).
+struct ProfileReport {
+    std::uint64_t evaluations = 0;
+    //сумма собственного времени вычислений всех ячеек
+    std::uint64_t total_nanoseconds = 0;
+    //самые дорогие ячейки по собственному времени и по времени с поддеревом
+    std::vector<CellProfile> hottest_cells;
+    std::vector<CellProfile> hottest_subtrees;
+};
+
+void WriteProfileReport(std::ostream& output, const ProfileReport& report);
+
+// Профилировщик вычислений ячеек листа. Время вычисления ячейки измеряется вокруг
+// вычисления формулы в Cell::GetValue и поблочного вычисления (время блока делится
+// между его ячейками поровну). Вложенные вычисления ячеек, на которые ссылается
+// формула, отслеживаются стеком кадров потока: их время входит во время с поддеревом
+// вызвавшей ячейки и вычитается из её собственного времени. Записи разбиты на части
+// со своими блокировками, поэтому потоки, вычисляющие разные ячейки, почти не ждут
+// друг друга.
+class EvaluationProfiler {
+public:
+    //ячейки записываются по адресам, позиции подставляет лист при построении отчёта.
+    //Лист переносит записи заменяемой ячейки на новую ячейку той же позиции и удаляет
+    //записи удаляемых ячеек, поэтому ячейка, занявшая освободившийся адрес, не
+    //получает чужих записей
+    using Entries = std::unordered_map<const Cell*, CellProfile>;
+
+    void Record(const Cell* cell, std::uint64_t evaluations, std::uint64_t inclusive_nanoseconds,
+                std::uint64_t exclusive_nanoseconds, std::uint64_t nested_evaluations);
+    //добавляет записи ячейки from к записям ячейки to и удаляет записи from
+    void MoveEntry(const Cell* from, const Cell* to);
+    void RemoveEntry(const Cell* cell);
+    Entries GetEntries() const;
+    void Reset();
+
+private:
+    static const size_t SHARD_COUNT = 16;
+
+    struct Shard {
+        mutable std::mutex mutex;
+        Entries entries;
+    };
+
+    Shard& GetShard(const Cell* cell);
+
+    std::array<Shard, SHARD_COUNT> shards_;
+};
+
+// Кадр профилирования вычисления ячейки (или блока ячеек). Если профилировщика нет,
+// ничего не делает: вся стоимость выключенного профилирования - проверка указателя.
+class ProfileScope {
+public:
+    ProfileScope(EvaluationProfiler* profiler, const Cell* cell)
+        : profiler_(profiler)
+        , cell_(cell) {
+        if (profiler_) {
+            Begin();
+        }
+    }
+    ProfileScope(EvaluationProfiler* profiler, const std::vector<const Cell*>& cells)
+        : profiler_(profiler) {
+        if (profiler_) {
+            cells_ = cells;
+            Begin();
+        }
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    ~ProfileScope() {
+        if (profiler_) {
+            End();
+        }
+    }
+
+private:
+    void Begin();
+    void End();
+
+    EvaluationProfiler* profiler_;
+    const Cell* cell_ = nullptr;
+    //ячейки блока; у кадра одной ячейки пуст
+    std::vector<const Cell*> cells_;
+};
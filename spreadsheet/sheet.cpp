@@ -1,195 +1,1727 @@
-#include "sheet.h"
-
-#include <algorithm>
-#include <functional>
-#include <iostream>
-#include <optional>
-
-Sheet::~Sheet() = default;
-
-void Sheet::CheckSheetSize(Position pos) {
-    if (pos.row + 1 > sheet_size_.rows) {
-        sheet_size_.rows = pos.row + 1;
-    }
-    if (pos.col + 1 > sheet_size_.cols) {
-        sheet_size_.cols = pos.col + 1;
-    }
-}
-
-void Sheet::InvalidateDependentCells(Position pos) {
-    const Cell *cell_ptr = GetCell(pos);
-    if (cell_ptr) {
-        for (Position cell_pos : cell_ptr->GetDependentCells()) {
-            const Cell *ptr_cell = GetCell(cell_pos);
-            if (ptr_cell == nullptr) {
-                SetCell(cell_pos, "");
-                ptr_cell = GetCell(cell_pos);
-            }
-            ptr_cell->SetValidateFlag(false);
-        }
-    }
-}
-
-void Sheet::SetReferencedAndDependentCells(Position pos) {
-    const Cell *cell_ptr = GetCell(pos);
-    if (cell_ptr) {
-        for (Position cell_pos : cell_ptr->GetReferencedCells()) {
-            cell_ptr->SetCellTo(cell_pos);
-            const Cell *ptr_cell = GetCell(cell_pos);
-            if (ptr_cell == nullptr) {
-                SetCell(cell_pos, "");
-                ptr_cell = GetCell(cell_pos);
-            }
-            ptr_cell->SetCellFrom(pos);
-        }
-    }
-}
-
-void Sheet::SetCell(Position pos, std::string text) {
-    //проверяем, что позиция ячейки валидна
-    if (!pos.IsValid()) {
-        using namespace std::literals;
-        throw InvalidPositionException("Position is not valid"s);
-    }
-
-    auto cell_ptr = GetCell(pos);
-    //проверяем, что ячейка не содержит тот же текст
-    if (cell_ptr) {
-        if (cell_ptr->GetText() == text) {
-            return void();
-        }
-    }
-
-    //создаем временную ячейку (в процессе проверяем корректность формулы и отсутствие цикличных ссылок)
-    std::unique_ptr<Cell> tmp_cell_ptr = nullptr;
-    try {
-        tmp_cell_ptr = std::make_unique<Cell>(*this);
-        tmp_cell_ptr->Set(pos, std::move(text));
-
-    } catch (const FormulaException& e) {
-        throw FormulaException(e.what());
-    } catch (const CircularDependencyException& e) {
-        throw CircularDependencyException(e.what());
-    }
-
-    //проверяем, что размера таблицы достаточно (при необходимости добавляем строки / столбцы)
-    CheckSheetSize(pos);
-
-    if (IsSheetIncludesPos(pos)) {
-        //проверяем, инициализирована ли ячейка, если да - переносим в новую ячейку список ячеек "сверху"
-        std::set<Position> dependent_cells = sheet_[pos]->GetDependentCells();
-        tmp_cell_ptr->SetDependentCells(std::move(dependent_cells));
-        //вставляем временную ячейку в таблицу
-        std::swap(sheet_[pos], tmp_cell_ptr);
-    } else {
-        //вставляем временную ячейку в таблицу
-        sheet_[pos] = std::move(tmp_cell_ptr);
-    }
-
-    //добавляем информацию о связанных ячейках
-    SetReferencedAndDependentCells(pos);
-
-    //инвалидируем зависимые ячейки "сверху"
-    InvalidateDependentCells(pos);
-}
-
-const Cell* Sheet::GetCell(Position pos) const {
-    if (pos.IsValid()) {
-        if (IsSheetIncludesPos(pos)) {
-            if (sheet_.at(pos)->IsEmptyCell()) {
-                return nullptr;
-            }
-            return sheet_.at(pos).get();
-        } else {
-            return nullptr;
-        }
-    } else {
-        using namespace std::literals;
-        throw InvalidPositionException("Position is not valid"s);
-    }
-}
-
-Cell* Sheet::GetCell(Position pos) {
-    if (pos.IsValid()) {
-        if (IsSheetIncludesPos(pos)) {
-            if (sheet_[pos]->IsEmptyCell()) {
-                return nullptr;
-            }
-            return sheet_[pos].get();
-        } else {
-            return nullptr;
-        }
-    } else {
-        using namespace std::literals;
-        throw InvalidPositionException("Position is not valid"s);
-    }
-}
-
-void Sheet::ClearCell(Position pos) {
-    if (pos.IsValid()) {
-        if (IsSheetIncludesPos(pos)) {
-            sheet_.at(pos)->Clear();
-        }
-
-        int row_max = -1;
-        int col_max = -1;
-        if (pos.row + 1 == sheet_size_.rows || pos.col + 1 == sheet_size_.cols) {
-            for (const auto& [position, cell] : sheet_) {
-                if (!cell->IsEmptyCell()) {
-                    row_max = std::max(row_max, position.row);
-                    col_max = std::max(col_max, position.col);
-                }
-            }
-            sheet_size_.rows = row_max + 1;
-            sheet_size_.cols = col_max + 1;
-        }
-    } else {
-        using namespace std::literals;
-        throw InvalidPositionException("Position is not valid"s);        
-    }
-}
-
-Size Sheet::GetPrintableSize() const {
-    return sheet_size_;
-}
-
-void Sheet::PrintValues(std::ostream& output) const {
-    Size print_size = GetPrintableSize();
-    for (int i = 0; i < print_size.rows; ++i) {
-        for (int j = 0; j < print_size.cols; ++j) {
-            Position pos{i, j};
-            if (IsSheetIncludesPos(pos) && !sheet_.at(pos)->IsEmptyCell()) {
-                output << sheet_.at(pos)->GetValue();
-            }
-            if (j + 1 != print_size.cols) {
-                output << '\t';
-            }
-        }
-        output << '\n';
-    }
-}
-
-void Sheet::PrintTexts(std::ostream& output) const {
-    Size print_size = GetPrintableSize();
-    for (int i = 0; i < print_size.rows; ++i) {
-        for (int j = 0; j < print_size.cols; ++j) {
-            Position pos{i, j};
-            if (IsSheetIncludesPos(pos) && !sheet_.at(pos)->IsEmptyCell()) {
-                output << sheet_.at(pos)->GetText();
-            }
-            if (j + 1 != print_size.cols) {
-                output << '\t';
-            }
-        }
-        output << '\n';
-    }
-}
-
-bool Sheet::IsSheetIncludesPos(Position pos) const {
-    auto it = sheet_.find(pos);
-    return it != sheet_.end();
-}
-
-std::unique_ptr<SheetInterface> CreateSheet() {
-    return std::make_unique<Sheet>();
+#include "sheet.h"
+#include "block_evaluator.h"
+#include "buffered_writer.h"
+#include "workbook.h"
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+
+namespace {
+
+//блокировки областей, взятые текущим чтением в режиме параллельного чтения, и
+//счётчики изменений, ожидающих эти области
+struct ReadContext {
+    int depth = 0;
+    std::vector<std::pair<std::shared_mutex*, const std::atomic<int>*>> locked;
+};
+
+thread_local ReadContext read_context;
+
+//бросается, если чтению нужна область, занятая изменением; не наследуется от
+//std::exception, чтобы его не перехватили обработчики ошибок вычисления
+struct ReadRetry {};
+
+void UnlockRead() {
+    for (const auto& [mutex, waiting_writers] : read_context.locked) {
+        mutex->unlock_shared();
+    }
+    read_context.locked.clear();
+}
+
+void LockForRead(std::shared_mutex& mutex, const std::atomic<int>& waiting_writers) {
+    if (read_context.depth == 0) {
+        return;
+    }
+    //долгое вычисление не задерживает изменения занятых им областей: чтение отпускает
+    //блокировки и начинается заново, уже вычисленные значения остаются в кэше
+    bool is_locked = false;
+    for (const auto& [locked_mutex, locked_waiting_writers] : read_context.locked) {
+        if (locked_waiting_writers->load(std::memory_order_relaxed) > 0) {
+            throw ReadRetry{};
+        }
+        is_locked = is_locked || locked_mutex == &mutex;
+    }
+    if (is_locked) {
+        return;
+    }
+    //ожидать можно только первую блокировку: остальные ждут, не отпуская взятых,
+    //поэтому при занятой области чтение начинается заново
+    if (read_context.locked.empty()) {
+        mutex.lock_shared();
+    } else if (!mutex.try_lock_shared()) {
+        throw ReadRetry{};
+    }
+    read_context.locked.emplace_back(&mutex, &waiting_writers);
+}
+
+template <typename Action>
+auto ReadConcurrently(Action action) {
+    if (read_context.depth > 0) {
+        return action();
+    }
+    ++read_context.depth;
+    while (true) {
+        try {
+            auto result = action();
+            UnlockRead();
+            --read_context.depth;
+            return result;
+        } catch (const ReadRetry&) {
+            UnlockRead();
+            std::this_thread::yield();
+        } catch (...) {
+            UnlockRead();
+            --read_context.depth;
+            throw;
+        }
+    }
+}
+
+//изменение листа, выполняемое текущим потоком: вложенные изменения (пустые ячейки,
+//создаваемые для ссылок) выполняются под уже взятыми блокировками
+struct WriteContext {
+    const Sheet* sheet = nullptr;
+};
+
+thread_local WriteContext write_context;
+
+class WriteScope {
+public:
+    explicit WriteScope(const Sheet& sheet)
+        : previous_(write_context.sheet) {
+        write_context.sheet = &sheet;
+    }
+    ~WriteScope() {
+        write_context.sheet = previous_;
+    }
+
+private:
+    const Sheet* previous_;
+};
+
+//сдвигает ссылки формулы на row_offset строк и col_offset столбцов; ссылки за
+//пределы листа становятся #REF!
+FormulaProgram OffsetReferences(FormulaProgram program, int row_offset, int col_offset) {
+    for (FormulaOp& op : program) {
+        if ((op.type == FormulaOp::Cell || op.type == FormulaOp::SheetCell) && op.cell.IsValid()) {
+            op.cell = Position{op.cell.row + row_offset, op.cell.col + col_offset};
+            if (!op.cell.IsValid()) {
+                op.cell = Position::NONE;
+            }
+        }
+    }
+    return program;
+}
+
+} // namespace
+
+Sheet::ExclusiveLock::ExclusiveLock(const Sheet& sheet)
+    : previous_(write_context.sheet) {
+    //листы книги используют общую блокировку, взятую изменением любого из них
+    if (previous_ == nullptr || &previous_->structure_mutex_ != &sheet.structure_mutex_) {
+        sheet.structure_mutex_.lock();
+        write_context.sheet = &sheet;
+        sheet_ = &sheet;
+    }
+}
+
+Sheet::ExclusiveLock::~ExclusiveLock() {
+    if (sheet_) {
+        write_context.sheet = previous_;
+        sheet_->structure_mutex_.unlock();
+    }
+}
+
+Sheet::Sheet()
+    : regions_(REGION_COUNT)
+    , structure_mutex_(own_structure_mutex_) {
+}
+
+Sheet::Sheet(Workbook& workbook)
+    : regions_(REGION_COUNT)
+    , structure_mutex_(workbook.structure_mutex_)
+    , workbook_(&workbook) {
+}
+
+Sheet::~Sheet() {
+    //фоновый поток ленты изменений читает лист, поэтому останавливается первым
+    delete change_feed_.exchange(nullptr);
+
+    //снимки могут пережить лист, поэтому нескопированные области копируются сейчас
+    for (const Region& region : regions_) {
+        CopyRegionOnWrite(region);
+    }
+}
+
+void Sheet::CheckSheetSize(Position pos) {
+    //размер могут одновременно увеличивать изменения других областей
+    Size size = sheet_size_.load();
+    Size new_size;
+    do {
+        new_size = Size{std::max(size.rows, pos.row + 1), std::max(size.cols, pos.col + 1)};
+        if (new_size == size) {
+            return;
+        }
+    } while (!sheet_size_.compare_exchange_weak(size, new_size));
+}
+
+void Sheet::InvalidateDependentCells(Position pos) {
+    const Cell *cell_ptr = GetCell(pos);
+    if (cell_ptr) {
+        for (Position cell_pos : cell_ptr->GetDependentCells()) {
+            const Cell *ptr_cell = GetCell(cell_pos);
+            if (ptr_cell == nullptr) {
+                SetCell(cell_pos, "");
+                counters_.AddPlaceholderCell();
+                ptr_cell = GetCell(cell_pos);
+            }
+            ptr_cell->SetValidateFlag(false);
+            LogChange(cell_pos);
+            ptr_cell->InvalidateDependentCells();
+        }
+    }
+}
+
+void Sheet::SetReferencedAndDependentCells(Position pos) {
+    const Cell *cell_ptr = GetCell(pos);
+    if (cell_ptr) {
+        for (Position cell_pos : cell_ptr->GetReferencedCells()) {
+            cell_ptr->SetCellTo(cell_pos);
+            const Cell *ptr_cell = GetCell(cell_pos);
+            if (ptr_cell == nullptr) {
+                SetCell(cell_pos, "");
+                counters_.AddPlaceholderCell();
+                ptr_cell = GetCell(cell_pos);
+            }
+            ptr_cell->SetCellFrom(pos);
+        }
+        //ссылки на другие листы добавляются под блокировкой всей книги
+        for (const ExternalCell& external_cell : cell_ptr->GetExternalReferencedCells()) {
+            external_cell.sheet->AddExternalDependentCell(external_cell.pos, ExternalCell{this, pos});
+            referenced_sheets_.insert(external_cell.sheet);
+        }
+    }
+}
+
+void Sheet::SetCell(Position pos, std::string text) {
+    //проверяем, что позиция ячейки валидна
+    if (!pos.IsValid()) {
+        using namespace std::literals;
+        throw InvalidPositionException("Position is not valid"s);
+    }
+    TraceSpan span("SetCell", pos);
+
+    if (write_context.sheet == this) {
+        SetCellLocked(pos, std::move(text));
+        return void();
+    }
+
+    LatencyTimer timer(GetLatencyRecorder(), LatencyOperation::SetCell,
+                       text.length() > 1 && text[0] == FORMULA_SIGN ? CellKind::Formula : CellKind::Text);
+    try {
+        //создаем временную ячейку до захвата блокировок, чтобы формулы разбирались параллельно
+        std::unique_ptr<Cell> tmp_cell_ptr = std::make_unique<Cell>(*this);
+        tmp_cell_ptr->SetWithoutCycleCheck(text);
+        ResolveSheetReferences(*tmp_cell_ptr);
+        std::vector<Position> references = tmp_cell_ptr->GetReferencedCells();
+
+        //изменение, связанное с другими листами, захватывает всю книгу
+        if (tmp_cell_ptr->GetExternalReferencedCells().empty()) {
+            std::shared_lock structure_lock(structure_mutex_);
+            Region& region = GetRegion(pos);
+            std::lock_guard region_lock(region.write_mutex);
+            if (IsRegionLocal(pos, references)) {
+                WriteScope scope(*this);
+                CommitCell(pos, text, std::move(tmp_cell_ptr));
+                return void();
+            }
+        }
+
+        ExclusiveLock lock(*this);
+        CommitCell(pos, text, std::move(tmp_cell_ptr));
+    } catch (const FormulaException&) {
+        timer.Fail(LatencyOutcome::FormulaException);
+        throw;
+    } catch (const CircularDependencyException&) {
+        timer.Fail(LatencyOutcome::CircularDependencyException);
+        throw;
+    }
+}
+
+void Sheet::SetCellLocked(Position pos, std::string text) {
+    std::unique_ptr<Cell> tmp_cell_ptr = std::make_unique<Cell>(*this);
+    tmp_cell_ptr->SetWithoutCycleCheck(text);
+    ResolveSheetReferences(*tmp_cell_ptr);
+    CommitCell(pos, text, std::move(tmp_cell_ptr));
+}
+
+void Sheet::CommitCell(Position pos, const std::string& text, std::unique_ptr<Cell> cell) {
+    auto cell_ptr = GetCell(pos);
+    //проверяем, что ячейка не содержит тот же текст
+    if (cell_ptr) {
+        if (cell_ptr->GetText() == text) {
+            return void();
+        }
+    }
+
+    //проверяем отсутствие цикличных ссылок
+    cell->CheckCycle(pos, cell->GetReferencedCells());
+
+    BeginChange();
+    InsertCell(pos, std::move(cell));
+}
+
+bool Sheet::IsRegionLocal(Position pos, const std::vector<Position>& references) const {
+    const size_t region = GetRegionIndex(pos);
+    size_t count = 0;
+    std::unordered_set<Position, CellPositionHasher> visited;
+
+    //ячейки, от которых зависит новая формула: их обходит проверка на цикличные ссылки
+    std::vector<Position> cells_to_visit(references.begin(), references.end());
+    while (!cells_to_visit.empty()) {
+        Position cell_pos = cells_to_visit.back();
+        cells_to_visit.pop_back();
+        if (GetRegionIndex(cell_pos) != region || ++count > LOCAL_CHANGE_LIMIT) {
+            return false;
+        }
+        if (!visited.insert(cell_pos).second) {
+            continue;
+        }
+        if (const Cell* cell_ptr = GetCell(cell_pos)) {
+            if (!cell_ptr->GetExternalReferencedCells().empty()) {
+                return false;
+            }
+            std::vector<Position> cells = cell_ptr->GetReferencedCells();
+            cells_to_visit.insert(cells_to_visit.end(), cells.begin(), cells.end());
+        }
+    }
+
+    //ячейки, зависящие от изменяемой: их инвалидирует изменение
+    visited.clear();
+    cells_to_visit.assign(1, pos);
+    while (!cells_to_visit.empty()) {
+        Position cell_pos = cells_to_visit.back();
+        cells_to_visit.pop_back();
+        if (GetRegionIndex(cell_pos) != region || ++count > LOCAL_CHANGE_LIMIT) {
+            return false;
+        }
+        if (!visited.insert(cell_pos).second) {
+            continue;
+        }
+        if (const Cell* cell_ptr = FindCell(cell_pos)) {
+            if (!cell_ptr->GetExternalDependentCells().empty()) {
+                return false;
+            }
+            for (Position dependent_pos : cell_ptr->GetDependentCells()) {
+                cells_to_visit.push_back(dependent_pos);
+            }
+        }
+    }
+    return true;
+}
+
+void Sheet::SetCells(std::vector<std::pair<Position, std::string>> cells) {
+    TraceSpan span("SetCells");
+    ExclusiveLock lock(*this);
+
+    //проверяем позиции; для ячейки, записываемой несколько раз, действует последняя запись
+    std::unordered_map<Position, size_t, CellPositionHasher> last_entries;
+    last_entries.reserve(cells.size());
+    for (size_t i = 0; i < cells.size(); ++i) {
+        if (!cells[i].first.IsValid()) {
+            using namespace std::literals;
+            throw InvalidPositionException("Position is not valid"s);
+        }
+        last_entries[cells[i].first] = i;
+    }
+
+    //разбираем формулы до изменения таблицы; формулы предыдущих записей в ту же ячейку
+    //тоже разбираются, чтобы ошибка в них, как и у последовательных SetCell, не
+    //оставалась незамеченной
+    std::vector<std::pair<Position, std::unique_ptr<Cell>>> new_cells;
+    new_cells.reserve(last_entries.size());
+    for (size_t i = 0; i < cells.size(); ++i) {
+        auto& [pos, text] = cells[i];
+        const bool is_last = last_entries.at(pos) == i;
+
+        //проверяем, что ячейка не содержит тот же текст
+        const Cell* cell_ptr = GetCell(pos);
+        if (is_last && cell_ptr && cell_ptr->GetText() == text) {
+            continue;
+        }
+
+        std::unique_ptr<Cell> tmp_cell_ptr = std::make_unique<Cell>(*this);
+        tmp_cell_ptr->SetWithoutCycleCheck(std::move(text));
+        ResolveSheetReferences(*tmp_cell_ptr);
+        if (is_last) {
+            new_cells.emplace_back(pos, std::move(tmp_cell_ptr));
+        }
+    }
+
+    CommitCells(std::move(new_cells));
+}
+
+void Sheet::CommitCells(std::vector<std::pair<Position, std::unique_ptr<Cell>>> new_cells,
+                        const std::vector<Position>& cleared_cells) {
+    //одна проверка на цикличные ссылки для всех новых ячеек; при повторной записи
+    //в ту же ячейку действует последнее значение. Ссылки на другие листы заменяются
+    //ячейками этого листа, до которых по ним можно дойти. Очищаемые ячейки ни на что
+    //не ссылаются
+    std::unordered_map<Position, std::vector<Position>, CellPositionHasher> references;
+    references.reserve(new_cells.size() + cleared_cells.size());
+    for (Position pos : cleared_cells) {
+        references[pos];
+    }
+    for (const auto& [pos, cell] : new_cells) {
+        std::vector<Position>& cell_references = references[pos];
+        cell_references = cell->GetReferencedCells();
+        if (!cell->GetExternalReferencedCells().empty()) {
+            std::vector<Position> returning_cells = GetReturningCells(cell->GetExternalReferencedCells());
+            cell_references.insert(cell_references.end(), returning_cells.begin(), returning_cells.end());
+        }
+    }
+    CheckCycles(references);
+
+    if (!new_cells.empty() || !cleared_cells.empty()) {
+        BeginChange();
+    }
+
+    for (auto& [pos, cell] : new_cells) {
+        InsertCell(pos, std::move(cell));
+    }
+
+    //размер таблицы пересчитывается один раз, если очищена ячейка на её границе
+    Size size = sheet_size_.load();
+    bool is_boundary_cleared = false;
+    for (Position pos : cleared_cells) {
+        ClearExistingCell(pos);
+        is_boundary_cleared |= pos.row + 1 == size.rows || pos.col + 1 == size.cols;
+    }
+    if (is_boundary_cleared) {
+        RecomputeSheetSize();
+    }
+}
+
+void Sheet::CopyRange(Position top_left, Position bottom_right, Position destination) {
+    TraceSpan span("CopyRange");
+    Position destination_bottom_right{destination.row + bottom_right.row - top_left.row,
+                                      destination.col + bottom_right.col - top_left.col};
+    if (!top_left.IsValid() || !bottom_right.IsValid() || !destination.IsValid()
+        || top_left.row > bottom_right.row || top_left.col > bottom_right.col || !destination_bottom_right.IsValid()) {
+        using namespace std::literals;
+        throw InvalidPositionException("Range is not valid"s);
+    }
+    if (destination == top_left) {
+        return void();
+    }
+
+    ExclusiveLock lock(*this);
+    CopyCells(top_left, bottom_right, destination, destination_bottom_right);
+}
+
+void Sheet::FillDown(Position top_left, Position bottom_right) {
+    TraceSpan span("FillDown");
+    if (!top_left.IsValid() || !bottom_right.IsValid() || top_left.row > bottom_right.row
+        || top_left.col > bottom_right.col) {
+        using namespace std::literals;
+        throw InvalidPositionException("Range is not valid"s);
+    }
+    if (top_left.row == bottom_right.row) {
+        return void();
+    }
+
+    ExclusiveLock lock(*this);
+    CopyCells(top_left, Position{top_left.row, bottom_right.col}, Position{top_left.row + 1, top_left.col},
+              bottom_right);
+}
+
+void Sheet::FillRight(Position top_left, Position bottom_right) {
+    TraceSpan span("FillRight");
+    if (!top_left.IsValid() || !bottom_right.IsValid() || top_left.row > bottom_right.row
+        || top_left.col > bottom_right.col) {
+        using namespace std::literals;
+        throw InvalidPositionException("Range is not valid"s);
+    }
+    if (top_left.col == bottom_right.col) {
+        return void();
+    }
+
+    ExclusiveLock lock(*this);
+    CopyCells(top_left, Position{bottom_right.row, top_left.col}, Position{top_left.row, top_left.col + 1},
+              bottom_right);
+}
+
+void Sheet::CopyCells(Position top_left, Position bottom_right, Position destination_top_left,
+                      Position destination_bottom_right) {
+    //ячейки источника читаются до изменения таблицы, поэтому источник и назначение
+    //могут пересекаться. Формула каждой исходной ячейки переводится в постфиксную
+    //запись один раз, копии собираются из неё со сдвинутыми ссылками
+    struct SourceCell {
+        const Cell* cell = nullptr;
+        std::optional<FormulaProgram> program;
+    };
+    const int rows = bottom_right.row - top_left.row + 1;
+    const int cols = bottom_right.col - top_left.col + 1;
+    std::vector<SourceCell> source(static_cast<size_t>(rows) * cols);
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            SourceCell& source_cell = source[static_cast<size_t>(row) * cols + col];
+            source_cell.cell = FindCell(Position{top_left.row + row, top_left.col + col});
+            if (source_cell.cell && source_cell.cell->IsEmptyCell()) {
+                source_cell.cell = nullptr;
+            }
+            if (source_cell.cell && source_cell.cell->GetFormula()) {
+                source_cell.program = source_cell.cell->GetFormula()->GetProgram();
+            }
+        }
+    }
+
+    //ячейка с текстом или формулой (не пустая ячейка для ссылки и не очищенная)
+    auto has_content = [](const Cell& cell) {
+        return !cell.IsEmptyCell() && (cell.GetFormula() != nullptr || !cell.GetText().empty());
+    };
+
+    std::vector<std::pair<Position, std::unique_ptr<Cell>>> new_cells;
+    std::vector<Position> cleared_cells;
+    for (int row = destination_top_left.row; row <= destination_bottom_right.row; ++row) {
+        const int source_row = (row - destination_top_left.row) % rows;
+        for (int col = destination_top_left.col; col <= destination_bottom_right.col; ++col) {
+            const int source_col = (col - destination_top_left.col) % cols;
+            const SourceCell& source_cell = source[static_cast<size_t>(source_row) * cols + source_col];
+            Position pos{row, col};
+
+            if (!source_cell.cell) {
+                //пустая ячейка источника очищает только непустую ячейку назначения
+                const Cell* cell_ptr = FindCell(pos);
+                if (cell_ptr && has_content(*cell_ptr)) {
+                    cleared_cells.push_back(pos);
+                }
+                continue;
+            }
+
+            std::unique_ptr<Cell> cell = std::make_unique<Cell>(*this);
+            if (source_cell.program) {
+                cell->SetFormula(ParseFormula(OffsetReferences(*source_cell.program, row - top_left.row - source_row,
+                                                               col - top_left.col - source_col)));
+                ResolveSheetReferences(*cell);
+            } else {
+                cell->SetTextCell(source_cell.cell->GetText());
+            }
+            new_cells.emplace_back(pos, std::move(cell));
+        }
+    }
+
+    CommitCells(std::move(new_cells), cleared_cells);
+}
+
+void Sheet::BeginChange() {
+    ++version_;
+}
+
+void Sheet::InsertCell(Position pos, std::unique_ptr<Cell> cell) {
+    cell->SetModifiedVersion(version_);
+
+    //проверяем, что размера таблицы достаточно (при необходимости добавляем строки / столбцы)
+    CheckSheetSize(pos);
+
+    {
+        //заменяемую ячейку могут читать другие потоки, поэтому замена выполняется под блокировкой области
+        Region& region = GetRegion(pos);
+        CopyRegionOnWrite(region);
+        std::unique_lock lock = LockRegionForWrite(region);
+        std::unique_ptr<Cell>& place = region.cells[pos];
+        if (place) {
+            //проверяем, инициализирована ли ячейка, если да - переносим в новую ячейку список ячеек "сверху"
+            std::set<Position> dependent_cells = place->GetDependentCells();
+            cell->SetDependentCells(std::move(dependent_cells));
+            cell->SetExternalDependentCells(place->GetExternalDependentCells());
+            //вставляем временную ячейку в таблицу
+            std::swap(place, cell);
+            //записи профилировщика относятся к позиции: переносим их на новую ячейку, пока
+            //адрес старой не достался другой ячейке
+            if (profiler_) {
+                profiler_->MoveEntry(cell.get(), place.get());
+            }
+            //зависимые ячейки инвалидируем, не отпуская блокировку: иначе чтение могло бы
+            //увидеть новую ячейку вместе со старыми значениями зависимых от неё
+            TraceSpan invalidation_span("invalidation", pos);
+            place->InvalidateDependentCells();
+        } else {
+            //вставляем временную ячейку в таблицу
+            place = std::move(cell);
+            region.positions.insert(pos);
+            ++cell_count_;
+        }
+    }
+
+    //добавляем информацию о связанных ячейках
+    {
+        TraceSpan span("wiring", pos);
+        SetReferencedAndDependentCells(pos);
+    }
+
+    //инвалидируем зависимые ячейки "сверху"
+    {
+        TraceSpan span("invalidation", pos);
+        InvalidateDependentCells(pos);
+    }
+
+    LogChange(pos);
+}
+
+void Sheet::CheckCycles(const std::unordered_map<Position, std::vector<Position>, CellPositionHasher>& references) const {
+    TraceSpan span("cycle_check");
+    //обход в глубину по ссылкам: для новых ячеек берём ссылки из references, для
+    //остальных - из таблицы. Новый цикл обязательно проходит через новую ячейку,
+    //поэтому обход начинаем только с них
+    enum class State { InProgress, Done };
+    std::unordered_map<Position, State, CellPositionHasher> visited;
+    visited.reserve(references.size());
+
+    auto get_references = [this, &references](Position pos) {
+        auto it = references.find(pos);
+        if (it != references.end()) {
+            return it->second;
+        }
+        const Cell* cell_ptr = GetCell(pos);
+        if (cell_ptr == nullptr) {
+            return std::vector<Position>();
+        }
+        std::vector<Position> cell_references = cell_ptr->GetReferencedCells();
+        if (!cell_ptr->GetExternalReferencedCells().empty()) {
+            std::vector<Position> returning_cells = GetReturningCells(cell_ptr->GetExternalReferencedCells());
+            cell_references.insert(cell_references.end(), returning_cells.begin(), returning_cells.end());
+        }
+        return cell_references;
+    };
+
+    struct Frame {
+        Position pos;
+        std::vector<Position> references;
+        size_t next = 0;
+    };
+
+    for (const auto& [start_pos, start_references] : references) {
+        if (start_references.empty() || visited.count(start_pos)) {
+            continue;
+        }
+        visited[start_pos] = State::InProgress;
+        std::vector<Frame> stack{Frame{start_pos, start_references}};
+        while (!stack.empty()) {
+            Frame& frame = stack.back();
+            if (frame.next == frame.references.size()) {
+                visited[frame.pos] = State::Done;
+                stack.pop_back();
+                continue;
+            }
+            Position next_pos = frame.references[frame.next++];
+            auto it = visited.find(next_pos);
+            if (it == visited.end()) {
+                visited[next_pos] = State::InProgress;
+                stack.push_back(Frame{next_pos, get_references(next_pos)});
+            } else if (it->second == State::InProgress) {
+                counters_.AddCycleCheck(visited.size());
+                using namespace std::literals;
+                throw CircularDependencyException("Formula has cycle"s);
+            }
+        }
+    }
+    counters_.AddCycleCheck(visited.size());
+}
+
+size_t Sheet::GetRegionIndex(Position pos) {
+    size_t index = static_cast<size_t>(pos.row / REGION_ROWS) * 31 + static_cast<size_t>(pos.col / REGION_COLS);
+    return index % REGION_COUNT;
+}
+
+Sheet::Region& Sheet::GetRegion(Position pos) {
+    return regions_[GetRegionIndex(pos)];
+}
+
+const Sheet::Region& Sheet::GetRegion(Position pos) const {
+    return const_cast<Sheet*>(this)->GetRegion(pos);
+}
+
+std::unique_lock<std::shared_mutex> Sheet::LockRegionForWrite(Region& region) const {
+    ++region.waiting_writers;
+    std::unique_lock lock(region.mutex);
+    --region.waiting_writers;
+    return lock;
+}
+
+const Cell* Sheet::FindCell(Position pos) const {
+    const Region& region = GetRegion(pos);
+    auto it = region.cells.find(pos);
+    return it == region.cells.end() ? nullptr : it->second.get();
+}
+
+Cell* Sheet::FindCell(Position pos) {
+    Region& region = GetRegion(pos);
+    auto it = region.cells.find(pos);
+    return it == region.cells.end() ? nullptr : it->second.get();
+}
+
+const Cell* Sheet::GetCell(Position pos) const {
+    if (pos.IsValid()) {
+        const Region& region = GetRegion(pos);
+        LockForRead(region.mutex, region.waiting_writers);
+        auto it = region.cells.find(pos);
+        if (it == region.cells.end() || it->second->IsEmptyCell()) {
+            return nullptr;
+        }
+        return it->second.get();
+    } else {
+        using namespace std::literals;
+        throw InvalidPositionException("Position is not valid"s);
+    }
+}
+
+Cell* Sheet::GetCell(Position pos) {
+    if (pos.IsValid()) {
+        Region& region = GetRegion(pos);
+        auto it = region.cells.find(pos);
+        if (it == region.cells.end() || it->second->IsEmptyCell()) {
+            return nullptr;
+        }
+        return it->second.get();
+    } else {
+        using namespace std::literals;
+        throw InvalidPositionException("Position is not valid"s);
+    }
+}
+
+CellInterface::Value Sheet::ReadValue(Position pos) const {
+    return ReadConcurrently([this, pos]() {
+        const Cell* cell_ptr = GetCell(pos);
+        return cell_ptr ? cell_ptr->GetValue() : CellInterface::Value();
+    });
+}
+
+std::string Sheet::ReadText(Position pos) const {
+    return ReadConcurrently([this, pos]() {
+        const Cell* cell_ptr = GetCell(pos);
+        return cell_ptr ? cell_ptr->GetText() : std::string();
+    });
+}
+
+void Sheet::ClearCell(Position pos) {
+    if (pos.IsValid()) {
+        TraceSpan span("ClearCell", pos);
+        //вид очищаемой ячейки становится известен под блокировкой
+        LatencyTimer timer(GetLatencyRecorder(), LatencyOperation::ClearCell, CellKind::Text);
+        auto set_kind = [this, &timer, pos]() {
+            const Cell* cell_ptr = FindCell(pos);
+            timer.SetKind(cell_ptr && cell_ptr->GetFormula() ? CellKind::Formula : CellKind::Text);
+        };
+        if (write_context.sheet != this) {
+            std::shared_lock structure_lock(structure_mutex_);
+            Region& region = GetRegion(pos);
+            std::lock_guard region_lock(region.write_mutex);
+            //очистка ячейки на границе таблицы пересчитывает размер по всему листу
+            Size size = sheet_size_.load();
+            if (pos.row + 1 != size.rows && pos.col + 1 != size.cols && IsRegionLocal(pos, {})) {
+                WriteScope scope(*this);
+                set_kind();
+                ClearCellLocked(pos);
+                return void();
+            }
+        }
+
+        ExclusiveLock lock(*this);
+        set_kind();
+        ClearCellLocked(pos);
+    } else {
+        using namespace std::literals;
+        throw InvalidPositionException("Position is not valid"s);        
+    }
+}
+
+void Sheet::ClearCellLocked(Position pos) {
+    if (IsSheetIncludesPos(pos)) {
+        BeginChange();
+        ClearExistingCell(pos);
+    }
+
+    Size size = sheet_size_.load();
+    if (pos.row + 1 == size.rows || pos.col + 1 == size.cols) {
+        RecomputeSheetSize();
+    }
+}
+
+void Sheet::ClearExistingCell(Position pos) {
+    Region& region = GetRegion(pos);
+    CopyRegionOnWrite(region);
+    std::unique_lock region_lock = LockRegionForWrite(region);
+    Cell* cell_ptr = region.cells.at(pos).get();
+    cell_ptr->Clear();
+    cell_ptr->SetModifiedVersion(version_);
+    LogChange(pos);
+}
+
+void Sheet::RecomputeSheetSize() {
+    int row_max = -1;
+    int col_max = -1;
+    ForEachCell([&row_max, &col_max](Position position, const Cell& cell) {
+        if (!cell.IsEmptyCell()) {
+            row_max = std::max(row_max, position.row);
+            col_max = std::max(col_max, position.col);
+        }
+    });
+    sheet_size_.store(Size{row_max + 1, col_max + 1});
+}
+
+Position Sheet::Shift::Apply(Position pos) const {
+    int& index = is_rows ? pos.row : pos.col;
+    if (index < first) {
+        return pos;
+    }
+    if (is_deletion) {
+        if (index < first + count) {
+            return Position::NONE;
+        }
+        index -= count;
+        return pos;
+    }
+    index += count;
+    return pos.IsValid() ? pos : Position::NONE;
+}
+
+void Sheet::InsertRows(int row, int count) {
+    TraceSpan span("InsertRows");
+    ShiftCells(Shift{true, false, row, count});
+}
+
+void Sheet::DeleteRows(int row, int count) {
+    TraceSpan span("DeleteRows");
+    ShiftCells(Shift{true, true, row, count});
+}
+
+void Sheet::InsertCols(int col, int count) {
+    TraceSpan span("InsertCols");
+    ShiftCells(Shift{false, false, col, count});
+}
+
+void Sheet::DeleteCols(int col, int count) {
+    TraceSpan span("DeleteCols");
+    ShiftCells(Shift{false, true, col, count});
+}
+
+void Sheet::ShiftCells(Shift shift) {
+    using namespace std::literals;
+    const int limit = shift.is_rows ? Position::MAX_ROWS : Position::MAX_COLS;
+    if (shift.first < 0 || shift.first >= limit || shift.count < 0) {
+        throw InvalidPositionException("Position is not valid"s);
+    }
+    shift.count = std::min(shift.count, limit - shift.first);
+    if (shift.count == 0) {
+        return void();
+    }
+    const CellMove move = [&shift](Position pos) {
+        return shift.Apply(pos);
+    };
+
+    ExclusiveLock lock(*this);
+
+    //затронутые ячейки таблицы: старая позиция и новая (NONE для удаляемой). Сдвигаемые
+    //столбцы в каждой строке области - хвост позиций строки
+    std::vector<std::pair<Position, Position>> moves;
+    for (const Region& region : regions_) {
+        const std::set<Position>& positions = region.positions;
+        auto it = positions.lower_bound(shift.is_rows ? Position{shift.first, 0} : Position{0, shift.first});
+        while (it != positions.end()) {
+            if (!shift.is_rows && it->col < shift.first) {
+                it = positions.lower_bound(Position{it->row, shift.first});
+                continue;
+            }
+            moves.emplace_back(*it, shift.Apply(*it));
+            ++it;
+        }
+    }
+    if (moves.empty()) {
+        return void();
+    }
+
+    //ячейка с текстом или формулой (не пустая ячейка для ссылки и не очищенная)
+    auto has_content = [](const Cell& cell) {
+        return !cell.IsEmptyCell() && (cell.GetFormula() != nullptr || !cell.GetText().empty());
+    };
+
+    //формулы, которые могут ссылаться на затронутые ячейки (в том числе формулы других
+    //листов и ссылки листа на самого себя по имени), и ячейки, связи которых меняются;
+    //повторы удаляются после сбора
+    std::vector<ExternalCell> dependents;
+    std::vector<const Cell*> linked_cells;
+    for (const auto& [pos, new_pos] : moves) {
+        const Cell* cell = FindCell(pos);
+        const std::set<ExternalCell>& external_dependents = cell->GetExternalDependentCells();
+        const std::set<Position>& dependent_cells = cell->GetDependentCells();
+        if (!shift.is_deletion && !new_pos.IsValid()
+            && (has_content(*cell) || !dependent_cells.empty() || !external_dependents.empty())) {
+            throw InvalidPositionException("Cells would be shifted out of the sheet"s);
+        }
+        linked_cells.push_back(cell);
+        for (Position dependent_pos : dependent_cells) {
+            dependents.push_back(ExternalCell{this, dependent_pos});
+        }
+        dependents.insert(dependents.end(), external_dependents.begin(), external_dependents.end());
+        if (cell->GetFormula() == nullptr) {
+            continue;
+        }
+        for (Position referenced_pos : cell->GetReferencedCells()) {
+            if (const Cell* referenced_cell = FindCell(referenced_pos)) {
+                linked_cells.push_back(referenced_cell);
+            }
+        }
+        for (const ExternalCell& referenced : cell->GetExternalReferencedCells()) {
+            if (const Cell* referenced_cell = static_cast<const Sheet*>(referenced.sheet)->FindCell(referenced.pos)) {
+                linked_cells.push_back(referenced_cell);
+            }
+        }
+    }
+    std::sort(dependents.begin(), dependents.end());
+    dependents.erase(std::unique(dependents.begin(), dependents.end()), dependents.end());
+
+    //новые формулы строятся до изменения таблицы. Ссылки без имени листа в формулах
+    //других листов указывают на их собственные ячейки; имена листов у всех листов книги
+    //общие
+    const CellMove keep = [](Position pos) {
+        return pos;
+    };
+    const SheetCellMove move_sheet_cell = [this, &move](const std::string& name, Position pos) {
+        return FindSheet(name) == this ? move(pos) : pos;
+    };
+    struct Rewrite {
+        ExternalCell cell;
+        Cell* cell_ptr = nullptr;
+        std::unique_ptr<FormulaInterface> formula;
+        //формула стала ссылаться на удалённые ячейки, и её значение изменилось
+        bool has_deleted_references = false;
+    };
+    std::vector<Rewrite> rewrites;
+    for (const ExternalCell& dependent : dependents) {
+        Sheet* sheet = dependent.sheet;
+        Cell* cell = sheet->FindCell(dependent.pos);
+        const FormulaInterface* formula = cell ? cell->GetFormula() : nullptr;
+        if (formula == nullptr || (sheet == this && !shift.Apply(dependent.pos).IsValid())) {
+            continue;
+        }
+        bool is_changed = false;
+        bool has_deleted_references = false;
+        auto check_reference = [&](Position referenced_pos) {
+            Position new_pos = shift.Apply(referenced_pos);
+            is_changed |= !(new_pos == referenced_pos);
+            has_deleted_references |= !new_pos.IsValid();
+        };
+        if (sheet == this) {
+            for (Position referenced_pos : formula->GetReferencedCells()) {
+                check_reference(referenced_pos);
+            }
+        }
+        for (const SheetReference& reference : formula->GetSheetReferences()) {
+            if (FindSheet(reference.sheet) == this) {
+                check_reference(reference.cell);
+            }
+        }
+        if (!is_changed) {
+            continue;
+        }
+        std::unique_ptr<FormulaInterface> new_formula =
+            formula->MoveReferences(sheet == this ? move : keep, move_sheet_cell);
+        rewrites.push_back(Rewrite{dependent, cell, std::move(new_formula), has_deleted_references});
+        linked_cells.push_back(cell);
+    }
+    std::sort(linked_cells.begin(), linked_cells.end(), std::less<const Cell*>());
+    linked_cells.erase(std::unique(linked_cells.begin(), linked_cells.end()), linked_cells.end());
+
+    BeginChange();
+    //затронутые области листа заблокированы, пока ячейки переставляются и связываются
+    std::vector<bool> is_region_changed(REGION_COUNT);
+    for (const auto& [pos, new_pos] : moves) {
+        is_region_changed[GetRegionIndex(pos)] = true;
+        if (new_pos.IsValid()) {
+            is_region_changed[GetRegionIndex(new_pos)] = true;
+        }
+    }
+    for (const Rewrite& rewrite : rewrites) {
+        if (rewrite.cell.sheet == this) {
+            is_region_changed[GetRegionIndex(rewrite.cell.pos)] = true;
+        }
+    }
+    std::vector<std::unique_lock<std::shared_mutex>> region_locks;
+    for (size_t index = 0; index < REGION_COUNT; ++index) {
+        if (is_region_changed[index]) {
+            CopyRegionOnWrite(regions_[index]);
+            region_locks.push_back(LockRegionForWrite(regions_[index]));
+        }
+    }
+
+    for (const Cell* cell : linked_cells) {
+        cell->MoveLinks(*this, move);
+    }
+
+    //ячейки извлекаются из таблицы все сразу: новая позиция может быть занята ещё не
+    //перенесённой ячейкой
+    Size size = sheet_size_.load();
+    bool is_boundary_deleted = false;
+    std::vector<std::pair<Position, std::unique_ptr<Cell>>> moved_cells;
+    std::vector<Position> vacated_positions;
+    std::unordered_set<Position, CellPositionHasher> new_positions;
+    new_positions.reserve(moves.size());
+    for (const auto& [pos, new_pos] : moves) {
+        Region& region = GetRegion(pos);
+        auto it = region.cells.find(pos);
+        std::unique_ptr<Cell> cell = std::move(it->second);
+        region.cells.erase(it);
+        region.positions.erase(pos);
+        //позиции, где был текст, остаются очищенными ячейками, чтобы запрос изменений
+        //сообщил об их очистке
+        if (has_content(*cell)) {
+            vacated_positions.push_back(pos);
+        }
+        if (new_pos.IsValid()) {
+            new_positions.insert(new_pos);
+            moved_cells.emplace_back(new_pos, std::move(cell));
+        } else {
+            is_boundary_deleted |= !cell->IsEmptyCell() && (pos.row + 1 == size.rows || pos.col + 1 == size.cols);
+            --cell_count_;
+            if (profiler_) {
+                profiler_->RemoveEntry(cell.get());
+            }
+        }
+    }
+    for (auto& [pos, cell] : moved_cells) {
+        cell->SetModifiedVersion(version_);
+        Region& region = GetRegion(pos);
+        region.cells.emplace(pos, std::move(cell));
+        region.positions.insert(pos);
+        LogChange(pos);
+    }
+    for (Position pos : vacated_positions) {
+        if (new_positions.count(pos) == 0) {
+            auto empty_cell = std::make_unique<Cell>(*this);
+            empty_cell->Clear();
+            empty_cell->SetModifiedVersion(version_);
+            Region& region = GetRegion(pos);
+            region.cells.emplace(pos, std::move(empty_cell));
+            region.positions.insert(pos);
+            ++cell_count_;
+            LogChange(pos);
+        }
+    }
+
+    std::set<Sheet*> changed_sheets{this};
+    for (Rewrite& rewrite : rewrites) {
+        Sheet* sheet = rewrite.cell.sheet;
+        Position pos = sheet == this ? shift.Apply(rewrite.cell.pos) : rewrite.cell.pos;
+        Cell* cell = rewrite.cell_ptr;
+        std::unique_lock<std::shared_mutex> region_lock;
+        if (sheet != this) {
+            if (changed_sheets.insert(sheet).second) {
+                sheet->BeginChange();
+            }
+            Region& region = sheet->GetRegion(pos);
+            sheet->CopyRegionOnWrite(region);
+            region_lock = sheet->LockRegionForWrite(region);
+        }
+        cell->SetFormula(std::move(rewrite.formula));
+        cell->SetModifiedVersion(sheet->version_);
+        sheet->LogChange(pos);
+        if (rewrite.has_deleted_references) {
+            cell->SetValidateFlag(false);
+            cell->InvalidateDependentCells();
+        }
+    }
+    region_locks.clear();
+
+    int& extent = shift.is_rows ? size.rows : size.cols;
+    bool is_size_recomputed = is_boundary_deleted;
+    if (extent > shift.first) {
+        if (!shift.is_deletion) {
+            extent = std::min(extent + shift.count, limit);
+        } else if (extent > shift.first + shift.count) {
+            extent -= shift.count;
+        } else {
+            is_size_recomputed = true;
+        }
+    }
+    if (is_size_recomputed) {
+        RecomputeSheetSize();
+    } else {
+        sheet_size_.store(size);
+    }
+}
+
+void Sheet::RestoreCell(Position pos, std::unique_ptr<Cell> cell) {
+    Region& region = GetRegion(pos);
+    CopyRegionOnWrite(region);
+    std::unique_ptr<Cell>& place = region.cells[pos];
+    if (!place) {
+        region.positions.insert(pos);
+        ++cell_count_;
+    } else if (profiler_) {
+        profiler_->MoveEntry(place.get(), cell.get());
+    }
+    place = std::move(cell);
+}
+
+void Sheet::RestorePrintableSize(Size size) {
+    sheet_size_.store(size);
+}
+
+std::uint64_t Sheet::GetVersion() const {
+    return version_;
+}
+
+void Sheet::LogChange(Position pos) const {
+    {
+        //у каждой области свой журнал, поэтому изменения разных областей не ждут друг
+        //друга; очистка заполненного журнала не зависит от его размера
+        const Region& region = GetRegion(pos);
+        std::lock_guard lock(region.change_log_mutex);
+        if (region.change_log.size() == CHANGE_LOG_LIMIT) {
+            region.change_log_overflow_version = region.change_log.back().first;
+            ++region.change_log_overflows;
+            region.change_log.clear();
+        }
+        region.change_log.emplace_back(version_, pos);
+    }
+    if (ChangeFeed* change_feed = change_feed_.load(std::memory_order_acquire)) {
+        change_feed->Push(pos);
+    }
+}
+
+size_t Sheet::Subscribe(Position top_left, Position bottom_right, ChangeCallback callback) {
+    if (!top_left.IsValid() || !bottom_right.IsValid()) {
+        using namespace std::literals;
+        throw InvalidPositionException("Position is not valid"s);
+    }
+    ExclusiveLock lock(*this);
+    ChangeFeed* change_feed = change_feed_.load(std::memory_order_relaxed);
+    if (change_feed == nullptr) {
+        change_feed = new ChangeFeed(*this);
+        change_feed_.store(change_feed, std::memory_order_release);
+    }
+
+    //невалидная ячейка не попадает в журнал изменений при инвалидации, поэтому ячейки
+    //прямоугольника вычисляются; их значения - начальные значения подписки
+    Position first{std::min(top_left.row, bottom_right.row), std::min(top_left.col, bottom_right.col)};
+    Position last{std::max(top_left.row, bottom_right.row), std::max(top_left.col, bottom_right.col)};
+    std::vector<CellChange> values;
+    auto add_value = [&values](Position pos, const Cell& cell) {
+        if (!cell.IsEmptyCell()) {
+            values.push_back(CellChange{pos, cell.GetValue()});
+        }
+    };
+    if (size_t(last.row - first.row + 1) * size_t(last.col - first.col + 1) <= cell_count_.load()) {
+        for (int row = first.row; row <= last.row; ++row) {
+            for (int col = first.col; col <= last.col; ++col) {
+                if (const Cell* cell = FindCell({row, col})) {
+                    add_value({row, col}, *cell);
+                }
+            }
+        }
+    } else {
+        ForEachCell([&](Position pos, const Cell& cell) {
+            if (pos.row >= first.row && pos.row <= last.row && pos.col >= first.col && pos.col <= last.col) {
+                add_value(pos, cell);
+            }
+        });
+    }
+    return change_feed->Subscribe(first, last, std::move(callback), std::move(values));
+}
+
+size_t Sheet::Subscribe(Position pos, ChangeCallback callback) {
+    return Subscribe(pos, pos, std::move(callback));
+}
+
+void Sheet::Unsubscribe(size_t id) {
+    if (ChangeFeed* change_feed = change_feed_.load(std::memory_order_acquire)) {
+        change_feed->Unsubscribe(id);
+    }
+}
+
+void Sheet::FlushNotifications() const {
+    if (ChangeFeed* change_feed = change_feed_.load(std::memory_order_acquire)) {
+        change_feed->Flush();
+    }
+}
+
+void Sheet::StartProfiling() {
+    ExclusiveLock lock(*this);
+    if (!profiler_) {
+        profiler_ = std::make_unique<EvaluationProfiler>();
+    }
+    profiler_->Reset();
+    active_profiler_.store(profiler_.get(), std::memory_order_release);
+}
+
+void Sheet::StopProfiling() {
+    active_profiler_.store(nullptr, std::memory_order_release);
+}
+
+ProfileReport Sheet::GetProfileReport(size_t top_count) const {
+    ProfileReport report;
+    ExclusiveLock lock(*this);
+    if (!profiler_) {
+        return report;
+    }
+    EvaluationProfiler::Entries entries = profiler_->GetEntries();
+    std::vector<CellProfile> cells;
+    cells.reserve(entries.size());
+    ForEachCell([&entries, &cells](Position pos, const Cell& cell) {
+        auto it = entries.find(&cell);
+        if (it != entries.end()) {
+            cells.push_back(it->second);
+            cells.back().pos = pos;
+        }
+    });
+    for (const CellProfile& cell : cells) {
+        report.evaluations += cell.evaluations;
+        report.total_nanoseconds += cell.exclusive_nanoseconds;
+    }
+
+    auto select_top = [&cells, top_count](std::uint64_t CellProfile::*time) {
+        size_t count = std::min(top_count, cells.size());
+        std::partial_sort(cells.begin(), cells.begin() + count, cells.end(),
+                          [time](const CellProfile& lhs, const CellProfile& rhs) {
+                              return lhs.*time > rhs.*time || (lhs.*time == rhs.*time && lhs.pos < rhs.pos);
+                          });
+        return std::vector<CellProfile>(cells.begin(), cells.begin() + count);
+    };
+    report.hottest_cells = select_top(&CellProfile::exclusive_nanoseconds);
+    report.hottest_subtrees = select_top(&CellProfile::inclusive_nanoseconds);
+    return report;
+}
+
+void Sheet::StartLatencyRecording() {
+    ExclusiveLock lock(*this);
+    if (!latency_recorder_) {
+        latency_recorder_ = std::make_unique<LatencyRecorder>();
+    }
+    latency_recorder_->Reset();
+    active_latency_recorder_.store(latency_recorder_.get(), std::memory_order_release);
+}
+
+void Sheet::StopLatencyRecording() {
+    active_latency_recorder_.store(nullptr, std::memory_order_release);
+}
+
+LatencyHistogram Sheet::GetLatencyHistogram(LatencyOperation operation, CellKind kind, LatencyOutcome outcome) const {
+    ExclusiveLock lock(*this);
+    if (!latency_recorder_) {
+        return LatencyHistogram();
+    }
+    return latency_recorder_->Get(operation, kind, outcome);
+}
+
+void Sheet::WriteLatencyReport(std::ostream& output) const {
+    ExclusiveLock lock(*this);
+    if (latency_recorder_) {
+        latency_recorder_->WriteReport(output);
+    }
+}
+
+MemoryUsage Sheet::GetMemoryUsage() const {
+    MemoryUsage usage;
+    ExclusiveLock lock(*this);
+    usage.cell_map += EstimateVectorMemory(regions_);
+    for (const Region& region : regions_) {
+        //узел хеш-таблицы: указатель на следующий узел, ячейка и сохранённый хеш
+        using Node = std::pair<const Position, std::unique_ptr<Cell>>;
+        usage.cell_map += EstimateAllocation(region.cells.bucket_count() * sizeof(void*))
+            + region.cells.size() * EstimateAllocation(sizeof(void*) + sizeof(Node) + sizeof(size_t))
+            + EstimateSetMemory(region.positions);
+        for (const auto& [pos, cell] : region.cells) {
+            cell->AddMemoryUsage(usage);
+        }
+        usage.cell_count += region.cells.size();
+
+        std::lock_guard change_log_lock(region.change_log_mutex);
+        usage.change_log += EstimateVectorMemory(region.change_log);
+    }
+    return usage;
+}
+
+SheetCounters& Sheet::GetCounters() const {
+    return counters_;
+}
+
+SheetStatistics Sheet::GetStatistics() const {
+    return counters_.Get();
+}
+
+void Sheet::ResetStatistics() {
+    counters_.Reset();
+}
+
+Sheet::Changes Sheet::GetChanges(std::uint64_t version) const {
+    ExclusiveLock lock(*this);
+
+    //ячейки, инвалидированные до version, могли остаться невычисленными, если после
+    //этого изменения не запрашивались; их значения проверяются тоже
+    std::uint64_t first_version = std::min(version, recomputed_version_);
+
+    std::unordered_set<Position, CellPositionHasher> visited;
+    std::vector<const Cell*> cells;
+    Changes changes;
+    auto add_cell = [this, &visited, &cells, &changes](Position pos) {
+        const Cell* cell_ptr = FindCell(pos);
+        if (cell_ptr == nullptr || !visited.insert(pos).second) {
+            return void();
+        }
+        if (!cell_ptr->IsEmptyCell()) {
+            cell_ptr->GetValue();
+        }
+        changes.cells.push_back(pos);
+        cells.push_back(cell_ptr);
+    };
+
+    //журналы областей объединяются здесь: для каждой области запоминается, сколько её
+    //записей просмотрено. Вычисление ячейки может дописать в журналы инвалидированные
+    //ею ячейки, поэтому журналы просматриваются, пока в них появляются новые записи
+    std::vector<size_t> cursors(REGION_COUNT);
+    std::vector<std::uint64_t> overflows(REGION_COUNT);
+    std::vector<Position> positions;
+    for (size_t index = 0; index < REGION_COUNT; ++index) {
+        const Region& region = regions_[index];
+        std::lock_guard log_lock(region.change_log_mutex);
+        overflows[index] = region.change_log_overflows;
+        //записи, нужные запросу, могли быть удалены очисткой журнала
+        if (region.change_log_overflow_version > first_version) {
+            positions.insert(positions.end(), region.positions.begin(), region.positions.end());
+        }
+        auto first = std::upper_bound(region.change_log.begin(), region.change_log.end(), first_version,
+                                      [](std::uint64_t lhs, const std::pair<std::uint64_t, Position>& rhs) {
+                                          return lhs < rhs.first;
+                                      });
+        cursors[index] = first - region.change_log.begin();
+    }
+    do {
+        for (Position pos : positions) {
+            add_cell(pos);
+        }
+        positions.clear();
+        for (size_t index = 0; index < REGION_COUNT; ++index) {
+            const Region& region = regions_[index];
+            std::lock_guard log_lock(region.change_log_mutex);
+            if (region.change_log_overflows != overflows[index]) {
+                overflows[index] = region.change_log_overflows;
+                cursors[index] = 0;
+                positions.insert(positions.end(), region.positions.begin(), region.positions.end());
+            }
+            for (; cursors[index] < region.change_log.size(); ++cursors[index]) {
+                positions.push_back(region.change_log[cursors[index]].second);
+            }
+        }
+    } while (!positions.empty());
+
+    //версии сравниваются после обхода: вычисление одной ячейки может пересчитать другую,
+    //уже пройденную. Ячейки, оставшиеся невалидными, будут проверены при следующем запросе
+    std::vector<Position> invalid_cells;
+    size_t count = 0;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        if (!cells[i]->IsEmptyCell() && !cells[i]->GetValidity()) {
+            invalid_cells.push_back(changes.cells[i]);
+        }
+        if (cells[i]->GetModifiedVersion() > version || cells[i]->GetValueVersion() > version) {
+            changes.cells[count++] = changes.cells[i];
+        }
+    }
+    changes.cells.resize(count);
+    std::sort(changes.cells.begin(), changes.cells.end());
+
+    changes.version = version_;
+    recomputed_version_ = version_;
+    ++version_;
+    for (Position pos : invalid_cells) {
+        LogChange(pos);
+    }
+    return changes;
+}
+
+std::uint64_t Sheet::ExportChanges(std::uint64_t version, const OutputSink& sink) const {
+    ExclusiveLock lock(*this);
+    Changes changes = GetChanges(version);
+    BufferedWriter writer(sink);
+    char buffer[Position::MAX_POSITION_LENGTH];
+    for (Position pos : changes.cells) {
+        writer.Write(std::string_view(buffer, pos.ToChars(buffer, buffer + Position::MAX_POSITION_LENGTH) - buffer));
+        writer.Write('\t');
+        //очищенная ячейка выводится с пустыми текстом и значением
+        if (const Cell* cell = GetCell(pos)) {
+            writer.Write(std::string_view(cell->GetText()));
+            writer.Write('\t');
+            writer.Write(cell->GetValue());
+        } else {
+            writer.Write('\t');
+        }
+        writer.Write('\n');
+    }
+    writer.Flush();
+    return changes.version;
+}
+
+Size Sheet::GetPrintableSize() const {
+    return sheet_size_.load();
+}
+
+void Sheet::EvaluateFormulaBlocks() const {
+    TraceSpan span("evaluate_blocks");
+    ExclusiveLock lock(*this);
+
+    std::vector<Position> cells;
+    ForEachCell([&cells](Position pos, const Cell& cell) {
+        if (!cell.IsEmptyCell() && !cell.GetValidity() && cell.GetFormula()) {
+            cells.push_back(pos);
+        }
+    });
+    BlockEvaluator(*this).Evaluate(std::move(cells));
+}
+
+void Sheet::PrintValues(std::ostream& output) const {
+    if (HasDefaultFormat(output)) {
+        ExportValues(MakeStreamSink(output));
+        return void();
+    }
+
+    //поток с заданным вызывающим форматированием: значения выводятся через <<
+    ExclusiveLock lock(*this);
+    EvaluateFormulaBlocks();
+    PrintRows(output, GetPrintableSize(), GetNonEmptyCells(), [](std::ostream& output, const Cell& cell) {
+        output << cell.GetValue();
+    });
+}
+
+void Sheet::PrintTexts(std::ostream& output) const {
+    if (HasDefaultFormat(output)) {
+        ExportTexts(MakeStreamSink(output));
+        return void();
+    }
+
+    ExclusiveLock lock(*this);
+    PrintRows(output, GetPrintableSize(), GetNonEmptyCells(), [](std::ostream& output, const Cell& cell) {
+        output << cell.GetText();
+    });
+}
+
+void Sheet::ExportValues(const OutputSink& sink) const {
+    ExclusiveLock lock(*this);
+
+    //одинаковые формулы соседних строк вычисляем блоками до поячеечного вывода
+    EvaluateFormulaBlocks();
+
+    Export(sink, [](BufferedWriter& writer, const Cell& cell) {
+        writer.Write(cell.GetValue());
+    });
+}
+
+void Sheet::ExportTexts(const OutputSink& sink) const {
+    ExclusiveLock lock(*this);
+
+    Export(sink, [](BufferedWriter& writer, const Cell& cell) {
+        writer.Write(std::string_view(cell.GetText()));
+    });
+}
+
+void Sheet::ExportValuesParallel(const OutputSink& sink, size_t thread_count) const {
+    ExclusiveLock lock(*this);
+
+    EvaluateFormulaBlocks();
+
+    CellList cells = GetNonEmptyCells();
+    //пересчитываем невалидные ячейки последовательно, в том же порядке, что и
+    //ExportValues, после чего потоки только читают кэш
+    for (const auto& [pos, cell] : cells) {
+        cell->GetValue();
+    }
+
+    Size print_size = GetPrintableSize();
+    if (print_size.rows == 0) {
+        return;
+    }
+    thread_count = std::clamp<size_t>(thread_count, 1, print_size.rows);
+
+    //границы полос строк выбираем так, чтобы в полосах было примерно поровну непустых ячеек
+    std::vector<int> bounds{0};
+    for (size_t i = 1; i < thread_count; ++i) {
+        size_t cell_index = cells.size() * i / thread_count;
+        int bound = 0;
+        if (cells.empty()) {
+            bound = static_cast<int>(print_size.rows * i / thread_count);
+        } else {
+            bound = cell_index < cells.size() ? cells[cell_index].first.row : print_size.rows;
+        }
+        bounds.push_back(std::max(bound, bounds.back()));
+    }
+    bounds.push_back(print_size.rows);
+
+    std::vector<std::string> buffers(thread_count);
+    std::vector<std::exception_ptr> errors(thread_count);
+    std::vector<std::thread> workers;
+    //потоки дожидаются и при исключении (из приёмника или при создании потока): иначе
+    //деструктор присоединяемого std::thread завершил бы программу
+    struct JoinGuard {
+        std::vector<std::thread>& workers;
+        ~JoinGuard() {
+            for (std::thread& worker : workers) {
+                if (worker.joinable()) {
+                    worker.join();
+                }
+            }
+        }
+    } join_guard{workers};
+    workers.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers.emplace_back([this, &cells, &bounds, &buffers, &errors, i]() {
+            try {
+                auto first_cell = std::lower_bound(cells.begin(), cells.end(), Position{bounds[i], 0},
+                    [](const auto& cell, Position pos) {
+                        return cell.first < pos;
+                    });
+                BufferedWriter writer([&buffer = buffers[i]](std::string_view data) {
+                    buffer.append(data);
+                });
+                ExportRows(writer, bounds[i], bounds[i + 1], first_cell, cells.end(), [](BufferedWriter& writer, const Cell& cell) {
+                    writer.Write(cell.GetCachedValue());
+                });
+                writer.Flush();
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    //выводим полосы по порядку по мере готовности; на первой полосе с ошибкой вывод
+    //останавливается, чтобы в выводе не было пропусков
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers[i].join();
+        if (errors[i]) {
+            std::rethrow_exception(errors[i]);
+        }
+        if (!buffers[i].empty()) {
+            sink(buffers[i]);
+        }
+        std::string().swap(buffers[i]);
+    }
+}
+
+Sheet::CellList Sheet::GetNonEmptyCells() const {
+    CellList cells;
+    cells.reserve(cell_count_);
+    ForEachCell([&cells](Position pos, const Cell& cell) {
+        if (!cell.IsEmptyCell()) {
+            cells.emplace_back(pos, &cell);
+        }
+    });
+    std::sort(cells.begin(), cells.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.first < rhs.first;
+    });
+    return cells;
+}
+
+template <typename CellPrinter>
+void Sheet::Export(const OutputSink& sink, CellPrinter print_cell) const {
+    //обходим только непустые ячейки в порядке строк, пропуски заполняем разделителями
+    CellList cells = GetNonEmptyCells();
+    BufferedWriter writer(sink);
+    ExportRows(writer, 0, GetPrintableSize().rows, cells.begin(), cells.end(), print_cell);
+    writer.Flush();
+}
+
+template <typename CellPrinter>
+void Sheet::ExportRows(BufferedWriter& writer, int first_row, int last_row, CellList::const_iterator it,
+                       CellList::const_iterator end, CellPrinter print_cell) const {
+    const int cols = GetPrintableSize().cols;
+    for (int row = first_row; row < last_row; ++row) {
+        //столбец, до которого уже выведены разделители
+        int col = 0;
+        for (; it != end && it->first.row == row; ++it) {
+            writer.Write('\t', it->first.col - col);
+            col = it->first.col;
+            print_cell(writer, *it->second);
+        }
+        if (col + 1 < cols) {
+            writer.Write('\t', cols - 1 - col);
+        }
+        writer.Write('\n');
+    }
+}
+
+std::shared_ptr<const SheetView> Sheet::Snapshot() const {
+    ExclusiveLock lock(*this);
+
+    if (referenced_sheets_.empty()) {
+        return std::make_shared<SheetView>(*this, GetPrintableSize(), GetRegionCopies());
+    }
+
+    //листы, на которые лист ссылается прямо или через другие листы; блокировка листа
+    //общая для всей книги, поэтому их снимки делаются в том же состоянии книги
+    std::set<const Sheet*> sheets{this};
+    std::vector<const Sheet*> sheets_to_visit{this};
+    while (!sheets_to_visit.empty()) {
+        const Sheet* sheet = sheets_to_visit.back();
+        sheets_to_visit.pop_back();
+        for (const Sheet* referenced_sheet : sheet->referenced_sheets_) {
+            if (sheets.insert(referenced_sheet).second) {
+                sheets_to_visit.push_back(referenced_sheet);
+            }
+        }
+    }
+
+    //снимок листа владеет снимками всех листов, на которые он ссылается
+    auto workbook_view = std::make_shared<WorkbookView>();
+    const SheetView* view = nullptr;
+    std::shared_lock sheets_lock(workbook_->sheets_mutex_);
+    for (const auto& [name, sheet] : workbook_->sheets_) {
+        if (sheets.count(sheet.get()) == 0) {
+            continue;
+        }
+        workbook_view->sheets.push_back(std::make_unique<SheetView>(*sheet, sheet->GetPrintableSize(),
+                                                                    sheet->GetRegionCopies(), workbook_view.get()));
+        workbook_view->sheet_names.emplace(name, workbook_view->sheets.back().get());
+        if (sheet.get() == this) {
+            view = workbook_view->sheets.back().get();
+        }
+    }
+    return std::shared_ptr<const SheetView>(workbook_view, view);
+}
+
+std::vector<std::shared_ptr<RegionCopy>> Sheet::GetRegionCopies() const {
+    std::vector<std::shared_ptr<RegionCopy>> copies;
+    copies.reserve(regions_.size());
+    for (const Region& region : regions_) {
+        if (!region.copy) {
+            region.copy = std::make_shared<RegionCopy>();
+        }
+        copies.push_back(region.copy);
+    }
+    return copies;
+}
+
+FrozenRegion Sheet::CopyRegion(size_t index) const {
+    FrozenRegion cells;
+    for (const auto& [pos, cell] : regions_[index].cells) {
+        if (!cell->IsEmptyCell()) {
+            cells.emplace_back(pos, cell->GetImpl());
+        }
+    }
+    std::sort(cells.begin(), cells.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.first < rhs.first;
+    });
+    return cells;
+}
+
+void Sheet::CopyRegionOnWrite(const Region& region) const {
+    if (!region.copy) {
+        return;
+    }
+    //копия, которую не держит ни один снимок, не нужна
+    if (region.copy.use_count() > 1) {
+        std::lock_guard lock(region.copy->mutex);
+        if (!region.copy->cells) {
+            size_t index = &region - regions_.data();
+            region.copy->cells = std::make_shared<const FrozenRegion>(CopyRegion(index));
+        }
+    }
+    region.copy.reset();
+}
+
+bool Sheet::IsSheetIncludesPos(Position pos) const {
+    return FindCell(pos) != nullptr;
+}
+
+const SheetInterface* Sheet::FindSheet(std::string_view name) const {
+    return workbook_ ? workbook_->GetSheet(name) : nullptr;
+}
+
+std::vector<Position> Sheet::GetReturningCells(const std::vector<ExternalCell>& cells) const {
+    //граф ссылок других листов не меняется во время изменения этого листа и ацикличен
+    std::vector<Position> result;
+    std::set<ExternalCell> visited;
+    std::vector<ExternalCell> cells_to_visit(cells.begin(), cells.end());
+    while (!cells_to_visit.empty()) {
+        ExternalCell cell = cells_to_visit.back();
+        cells_to_visit.pop_back();
+        if (cell.sheet == this) {
+            result.push_back(cell.pos);
+            continue;
+        }
+        if (!visited.insert(cell).second) {
+            continue;
+        }
+        if (const Cell* cell_ptr = static_cast<const Sheet*>(cell.sheet)->GetCell(cell.pos)) {
+            for (Position pos : cell_ptr->GetReferencedCells()) {
+                cells_to_visit.push_back(ExternalCell{cell.sheet, pos});
+            }
+            const std::vector<ExternalCell>& external_cells = cell_ptr->GetExternalReferencedCells();
+            cells_to_visit.insert(cells_to_visit.end(), external_cells.begin(), external_cells.end());
+        }
+    }
+    return result;
+}
+
+void Sheet::ResolveSheetReferences(Cell& cell) const {
+    const FormulaInterface* formula = cell.GetFormula();
+    if (formula == nullptr) {
+        return void();
+    }
+    std::vector<SheetReference> references = formula->GetSheetReferences();
+    if (references.empty()) {
+        return void();
+    }
+
+    std::vector<ExternalCell> cells;
+    cells.reserve(references.size());
+    for (const SheetReference& reference : references) {
+        Sheet* sheet = workbook_ ? workbook_->GetSheet(reference.sheet) : nullptr;
+        if (sheet == nullptr) {
+            using namespace std::literals;
+            throw FormulaException("Unknown sheet: "s + reference.sheet);
+        }
+        cells.push_back(ExternalCell{sheet, reference.cell});
+    }
+    cell.SetExternalCellsTo(std::move(cells));
+}
+
+void Sheet::AddExternalDependentCell(Position pos, ExternalCell cell) {
+    Region& region = GetRegion(pos);
+    auto it = region.cells.find(pos);
+    if (it == region.cells.end()) {
+        auto empty_cell = std::make_unique<Cell>(*this);
+        empty_cell->Clear();
+        counters_.AddPlaceholderCell();
+        CopyRegionOnWrite(region);
+        std::unique_lock lock = LockRegionForWrite(region);
+        it = region.cells.emplace(pos, std::move(empty_cell)).first;
+        region.positions.insert(pos);
+        ++cell_count_;
+    }
+    it->second->SetExternalCellFrom(cell);
+}
+
+void Sheet::RecalculateLocked() const {
+    TraceSpan span("recalculate");
+    WriteScope scope(*this);
+    EvaluateFormulaBlocks();
+    ForEachCell([](Position, const Cell& cell) {
+        if (!cell.IsEmptyCell() && !cell.GetValidity()) {
+            cell.GetValue();
+        }
+    });
+}
+
+Size Sheet::ForEachEvaluatedCell(const std::function<void(Position, const Cell&)>& action) const {
+    ExclusiveLock lock(*this);
+    RecalculateLocked();
+    ForEachCell(action);
+    return GetPrintableSize();
+}
+
+std::unique_ptr<SheetInterface> CreateSheet() {
+    return std::make_unique<Sheet>();
 }
\ No newline at end of file
@@ -1,42 +1,398 @@
-#pragma once
-
-#include "cell.h"
-#include "common.h"
-
-#include <functional>
-#include <memory>
-#include <unordered_map>
-
-class Sheet : public SheetInterface {
-public:
-    ~Sheet();
-
-    void CheckSheetSize(Position pos);
-    void InvalidateDependentCells(Position pos);
-    void SetReferencedAndDependentCells(Position pos);
-    void SetCell(Position pos, std::string text) override;
-
-    const Cell* GetCell(Position pos) const override;
-    Cell* GetCell(Position pos) override;
-
-    void ClearCell(Position pos) override;
-
-    Size GetPrintableSize() const override;
-
-    void PrintValues(std::ostream& output) const override;
-    void PrintTexts(std::ostream& output) const override;
-
-    bool IsSheetIncludesPos(Position pos) const;
-
-    struct CellPositionHasher {
-        std::size_t operator()(Position pos) const {
-            uint64_t hash = (size_t)(pos.row) * 37 + (size_t)(pos.col) * 37 * 37;
-            return static_cast<size_t>(hash);
-        }
-    };
-private:
-    Size sheet_size_;
-    std::unordered_map<Position, std::unique_ptr<Cell>, CellPositionHasher> sheet_;
-};
-
+#pragma once
+
+#include "buffered_writer.h"
+#include "cell.h"
+#include "change_feed.h"
+#include "common.h"
+#include "latency.h"
+#include "memory_usage.h"
+#include "profiler.h"
+#include "sheet_view.h"
+#include "statistics.h"
+#include "tracing.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class Workbook;
+
+// Режим параллельного чтения.
+// ReadValue() и ReadText() можно вызывать из любого числа потоков одновременно
+// друг с другом и с изменяющими лист методами (SetCell, SetCells, ClearCell).
+// Остальные методы, в том числе GetCell() и Cell::GetValue(), в этом режиме не
+// используются: указатель на ячейку остаётся действительным только внутри чтения.
+// * Значение ячейки вычисляет один поток, остальные читающие эту ячейку потоки
+//   дожидаются результата; вычисленное значение публикуется атомарно (см. Cash).
+// * Ячейки листа разбиты на REGION_COUNT областей со своими блокировками. Чтение
+//   блокирует на чтение области ячеек, к которым обращается; изменение блокирует на
+//   запись только область изменяемой ячейки и только на время её замены, поэтому
+//   чтение ячеек других областей не ждёт изменения. Если при вычислении формулы
+//   нужная область занята изменением, чтение снимает свои блокировки и начинается
+//   заново, так что взаимные блокировки невозможны.
+// Для согласованного чтения всего листа во время изменений служат снимки (Snapshot()).
+//
+// Параллельные изменения.
+// SetCell и ClearCell можно вызывать из нескольких потоков. Формула разбирается до
+// захвата блокировок. Изменение, которое затрагивает ячейки только одной области
+// (ссылки формулы и ячейки, от которых она зависит транзитивно, а также ячейки,
+// транзитивно зависящие от изменяемой), блокирует только эту область и выполняется
+// параллельно с изменениями других областей: проверка на цикличные ссылки в этом
+// случае тоже не выходит за область, а ячейки области изменяют только потоки,
+// захватившие её. Остальные изменения, SetCells и операции над всем листом (вывод,
+// запрос изменений, EvaluateFormulaBlocks, создание снимка) захватывают весь лист и
+// выполняются по очереди.
+//
+// Листы книги (см. Workbook) используют одну блокировку листа на всю книгу: изменения
+// одной области выполняются параллельно с изменениями областей других листов, а
+// изменения, связанные с ячейками других листов, и операции над всем листом
+// захватывают всю книгу.
+class Sheet : public SheetInterface {
+public:
+    Sheet();
+    //лист книги; создаётся через Workbook::AddSheet
+    explicit Sheet(Workbook& workbook);
+    ~Sheet();
+
+    void CheckSheetSize(Position pos);
+    void InvalidateDependentCells(Position pos);
+    void SetReferencedAndDependentCells(Position pos);
+    void SetCell(Position pos, std::string text) override;
+
+    //задаёт содержимое группы ячеек; результат тот же, что у последовательных вызовов
+    //SetCell, но все формулы разбираются до изменения таблицы, а проверка на цикличные
+    //ссылки выполняется один раз для всей группы. При ошибке таблица не изменяется.
+    void SetCells(std::vector<std::pair<Position, std::string>> cells);
+
+    //копирует ячейки прямоугольника с углами top_left и bottom_right так, что его левый
+    //верхний угол оказывается в destination; FillDown копирует первую строку
+    //прямоугольника в остальные его строки, FillRight - первый столбец в остальные
+    //столбцы. Формулы не разбираются заново: ссылки копии сдвигаются на расстояние от
+    //исходной ячейки (ссылки за пределы листа становятся #REF!), пустые ячейки источника
+    //очищают ячейки назначения. Проверка на цикличные ссылки выполняется один раз для
+    //всей операции, при ошибке таблица не изменяется
+    void CopyRange(Position top_left, Position bottom_right, Position destination);
+    void FillDown(Position top_left, Position bottom_right);
+    void FillRight(Position top_left, Position bottom_right);
+
+    const Cell* GetCell(Position pos) const override;
+    Cell* GetCell(Position pos) override;
+
+    //чтение в режиме параллельного чтения; для отсутствующих ячеек возвращают
+    //пустую строку
+    CellInterface::Value ReadValue(Position pos) const;
+    std::string ReadText(Position pos) const;
+
+    void ClearCell(Position pos) override;
+
+    //вставляют count пустых строк перед строкой row (столбцов перед столбцом col) и
+    //удаляют count строк начиная с row (столбцов начиная с col). Ячейки ниже (правее)
+    //переносятся в новые позиции вместе со значениями в кэше, ссылки формул на них, в
+    //том числе с других листов книги, переписываются без разбора текста, ссылки на
+    //удалённые ячейки становятся #REF! (такой текст формулы принимает и SetCell). Время работы пропорционально числу затронутых
+    //ячеек и их связей (для столбцов - ещё и числу строк, в которых они находятся).
+    //Вставка бросает InvalidPositionException, если вытесняет за пределы листа непустую
+    //ячейку или ячейку, на которую ссылаются формулы
+    void InsertRows(int row, int count = 1);
+    void DeleteRows(int row, int count = 1);
+    void InsertCols(int col, int count = 1);
+    void DeleteCols(int col, int count = 1);
+
+    Size GetPrintableSize() const override;
+
+    //вычисляет невалидные формулы листа, объединяя одинаковые формулы соседних строк в блоки
+    void EvaluateFormulaBlocks() const;
+
+    void PrintValues(std::ostream& output) const override;
+    void PrintTexts(std::ostream& output) const override;
+
+    //выводит таблицу в том же формате, что PrintValues / PrintTexts, обходя только
+    //непустые ячейки и передавая вывод в приёмник большими порциями
+    void ExportValues(const OutputSink& sink) const;
+    void ExportTexts(const OutputSink& sink) const;
+
+    //выводит то же, что ExportValues: сначала последовательно пересчитывает невалидные
+    //ячейки, затем форматирует полосы строк в отдельных потоках и выводит их по порядку.
+    //Если форматирование полосы завершилось ошибкой, вывод останавливается перед этой
+    //полосой и ошибка бросается после завершения всех потоков; так же завершаются
+    //потоки, если ошибку бросил приёмник
+    void ExportValuesParallel(const OutputSink& sink, size_t thread_count) const;
+
+    bool IsSheetIncludesPos(Position pos) const;
+
+    //лист книги с именем name; nullptr, если листа нет или лист не входит в книгу
+    const SheetInterface* FindSheet(std::string_view name) const override;
+    //ячейки этого листа, до которых можно дойти по ссылкам из ячеек других листов
+    //cells, не проходя через этот лист (для проверки на цикличные ссылки)
+    std::vector<Position> GetReturningCells(const std::vector<ExternalCell>& cells) const;
+
+    //снимок листа в текущем состоянии. Создание снимка не копирует ячейки: области
+    //листа копируются при первом обращении к ним из снимка или перед их изменением
+    //(копия области общая для всех снимков, сделанных до её изменения). Содержимое
+    //ячеек в копиях общее с листом. Вместе со снимком листа книги под той же
+    //блокировкой книги делаются снимки листов, на которые он ссылается, поэтому
+    //ссылки на другие листы читаются из того же состояния книги
+    std::shared_ptr<const SheetView> Snapshot() const;
+
+    //версия листа: увеличивается при каждом изменении текста ячеек
+    std::uint64_t GetVersion() const;
+    //отмечает, что текст или значение ячейки могли измениться в текущей версии
+    void LogChange(Position pos) const;
+
+    //изменения листа: ячейки (в порядке строк), текст или значение которых изменились
+    //после запрошенной версии, и версия, которую нужно передать при следующем запросе
+    struct Changes {
+        std::uint64_t version = 0;
+        std::vector<Position> cells;
+    };
+
+    //перед сравнением невалидные ячейки из журнала изменений вычисляются; время работы
+    //пропорционально числу изменений после version, а не размеру листа
+    Changes GetChanges(std::uint64_t version) const;
+    //выводит изменившиеся ячейки строками "позиция<TAB>текст<TAB>значение" и
+    //возвращает версию для следующего запроса
+    std::uint64_t ExportChanges(std::uint64_t version, const OutputSink& sink) const;
+
+    //счётчики движка (см. SheetStatistics): вычисления формул, попадания в кэш значений,
+    //инвалидации, размеры проверок на цикличные ссылки, разборы формул, созданные ячейки.
+    //Ведутся всегда; SaveStatistics записывает их в файл в JSON или формате Prometheus
+    SheetStatistics GetStatistics() const;
+    void ResetStatistics();
+    //счётчики, которые увеличивают ячейки листа
+    SheetCounters& GetCounters() const;
+
+    //оценка памяти листа по частям: таблица ячеек, ячейки, содержимое, формулы, связи,
+    //значения в кэше, журнал изменений (см. MemoryUsage)
+    MemoryUsage GetMemoryUsage() const;
+
+    //подписка на изменения значений ячеек прямоугольника с углами top_left и bottom_right
+    //(см. ChangeFeed): callback получает пачки изменившихся ячеек в фоновом потоке
+    //после изменений листа. Возвращает номер подписки для Unsubscribe
+    size_t Subscribe(Position top_left, Position bottom_right, ChangeCallback callback);
+    size_t Subscribe(Position pos, ChangeCallback callback);
+    void Unsubscribe(size_t id);
+    //дожидается доставки изменений, сделанных до вызова
+    void FlushNotifications() const;
+
+    //профилирование вычислений ячеек (см. EvaluationProfiler): StartProfiling сбрасывает
+    //собранные данные и включает запись, StopProfiling выключает её. Пока профилирование
+    //выключено, вычисление ячейки только проверяет указатель на профилировщик
+    void StartProfiling();
+    void StopProfiling();
+    //top_count самых дорогих ячеек по собственному времени и по времени с поддеревом
+    //зависимостей; ячейки, удалённые после вычисления, в отчёт не попадают
+    ProfileReport GetProfileReport(size_t top_count) const;
+    //включённый профилировщик или nullptr
+    EvaluationProfiler* GetProfiler() const {
+        return active_profiler_.load(std::memory_order_acquire);
+    }
+
+    //гистограммы задержек SetCell, ClearCell и Cell::GetValue по виду ячейки и исходу
+    //(см. LatencyRecorder). StartLatencyRecording сбрасывает записанные задержки и
+    //включает запись, StopLatencyRecording выключает её. Внутренние изменения листа
+    //(создание пустых ячеек для ссылок, изменения внутри SetCells) не записываются
+    void StartLatencyRecording();
+    void StopLatencyRecording();
+    LatencyHistogram GetLatencyHistogram(LatencyOperation operation, CellKind kind, LatencyOutcome outcome) const;
+    //процентили всех непустых гистограмм (см. LatencyRecorder::WriteReport)
+    void WriteLatencyReport(std::ostream& output) const;
+    //включённые гистограммы задержек или nullptr
+    LatencyRecorder* GetLatencyRecorder() const {
+        return active_latency_recorder_.load(std::memory_order_acquire);
+    }
+
+    //вызывает action(pos, cell) для каждой ячейки таблицы, включая очищенные
+    template <typename Action>
+    void ForEachCell(Action action) const {
+        for (const Region& region : regions_) {
+            for (const auto& [pos, cell] : region.cells) {
+                action(pos, *cell);
+            }
+        }
+    }
+    //под блокировкой всего листа вычисляет все ячейки и вызывает action(pos, cell) для
+    //каждой ячейки таблицы, включая очищенные; возвращает размер печатной области в
+    //момент обхода (для сохранения листа целиком, см. SaveSnapshot)
+    Size ForEachEvaluatedCell(const std::function<void(Position, const Cell&)>& action) const;
+
+    //вставляет ячейку как есть, без проверки ссылок, связывания с другими ячейками и
+    //инвалидации кэша (для восстановления таблицы, сохранённой целиком)
+    void RestoreCell(Position pos, std::unique_ptr<Cell> cell);
+    void RestorePrintableSize(Size size);
+
+    struct CellPositionHasher {
+        std::size_t operator()(Position pos) const {
+            uint64_t hash = (size_t)(pos.row) * Position::MAX_COLS + (size_t)(pos.col);
+            return static_cast<size_t>(hash);
+        }
+    };
+private:
+    friend class ChangeFeed;
+    friend class SheetView;
+    friend class Workbook;
+
+    //лист делится на участки REGION_ROWS x REGION_COLS, участки распределяются по
+    //REGION_COUNT областям; у каждой области свои ячейки и своя блокировка
+    static const int REGION_ROWS = 64;
+    static const int REGION_COLS = 16;
+    static const size_t REGION_COUNT = 256;
+    //сколько ячеек просматривается при проверке, что изменение не выходит за область
+    static const size_t LOCAL_CHANGE_LIMIT = 1024;
+    //сколько записей хранит журнал изменений области (см. Region::change_log)
+    static const size_t CHANGE_LOG_LIMIT = 4096;
+
+    struct Region {
+        //захватывается изменениями ячеек области
+        std::mutex write_mutex;
+        //захватывается на чтение читающими потоками, на запись - на время замены ячейки
+        mutable std::shared_mutex mutex;
+        //число изменений, ожидающих mutex: чтение, занявшее область, уступает им
+        std::atomic<int> waiting_writers{0};
+        std::unordered_map<Position, std::unique_ptr<Cell>, CellPositionHasher> cells;
+        //позиции ячеек области в порядке строк: по ним вставка и удаление строк и
+        //столбцов находят сдвигаемые ячейки, не просматривая весь лист
+        std::set<Position> positions;
+        //копия области для снимков, сделанных после её последнего изменения
+        mutable std::shared_ptr<RegionCopy> copy;
+
+        //журнал изменений области: версия листа и позиция ячейки, текст или значение
+        //которой могли измениться; упорядочен по версиям. Заполненный журнал очищается
+        //целиком, и запрос изменений с версии меньше change_log_overflow_version
+        //проверяет все ячейки области
+        mutable std::mutex change_log_mutex;
+        mutable std::vector<std::pair<std::uint64_t, Position>> change_log;
+        mutable std::uint64_t change_log_overflow_version = 0;
+        //число очисток журнала: по нему запрос изменений замечает очистку во время обхода
+        mutable std::uint64_t change_log_overflows = 0;
+    };
+
+    static size_t GetRegionIndex(Position pos);
+    Region& GetRegion(Position pos);
+    const Region& GetRegion(Position pos) const;
+    std::unique_lock<std::shared_mutex> LockRegionForWrite(Region& region) const;
+    //ячейка в таблице, включая очищенные и пустые; nullptr, если её нет
+    const Cell* FindCell(Position pos) const;
+    Cell* FindCell(Position pos);
+
+    //текущее содержимое области
+    FrozenRegion CopyRegion(size_t index) const;
+    //копии областей для нового снимка (вызывается под блокировкой листа)
+    std::vector<std::shared_ptr<RegionCopy>> GetRegionCopies() const;
+    //вызывается перед изменением области: сохраняет её содержимое в копию, если
+    //копия нужна снимкам и ещё не сделана
+    void CopyRegionOnWrite(const Region& region) const;
+
+    //исключительная блокировка листа; в потоке, уже изменяющем лист, ничего не делает
+    class ExclusiveLock {
+    public:
+        explicit ExclusiveLock(const Sheet& sheet);
+        ~ExclusiveLock();
+
+    private:
+        const Sheet* sheet_ = nullptr;
+        const Sheet* previous_ = nullptr;
+    };
+
+    //true, если изменение ячейки pos с формулой, ссылающейся на references, затрагивает
+    //только её область (вызывается под блокировкой области)
+    bool IsRegionLocal(Position pos, const std::vector<Position>& references) const;
+    //изменения под уже взятыми блокировками
+    void SetCellLocked(Position pos, std::string text);
+    void CommitCell(Position pos, const std::string& text, std::unique_ptr<Cell> cell);
+    void ClearCellLocked(Position pos);
+    //очищает ячейку, которая есть в таблице; версия листа уже увеличена, размер таблицы
+    //не пересчитывается
+    void ClearExistingCell(Position pos);
+    //пересчитывает размер таблицы по неочищенным ячейкам
+    void RecomputeSheetSize();
+
+    //сдвиг строк (is_rows) или столбцов: вставка count строк перед first или удаление
+    //count строк начиная с first (is_deletion)
+    struct Shift {
+        bool is_rows = true;
+        bool is_deletion = false;
+        int first = 0;
+        int count = 0;
+
+        //новая позиция ячейки; Position::NONE, если ячейка удаляется или выходит за
+        //пределы листа
+        Position Apply(Position pos) const;
+    };
+    void ShiftCells(Shift shift);
+
+    //копирует ячейки прямоугольника источника в прямоугольник назначения, повторяя
+    //источник по строкам и столбцам (вызывается под блокировкой листа)
+    void CopyCells(Position top_left, Position bottom_right, Position destination_top_left,
+                   Position destination_bottom_right);
+    //проверяет новые ячейки на цикличные ссылки одним обходом, вставляет их в таблицу и
+    //очищает ячейки cleared_cells: они есть в таблице и не входят в new_cells
+    void CommitCells(std::vector<std::pair<Position, std::unique_ptr<Cell>>> new_cells,
+                     const std::vector<Position>& cleared_cells = {});
+
+    //находит листы, на ячейки которых ссылается формула ячейки; бросает FormulaException,
+    //если листа нет в книге
+    void ResolveSheetReferences(Cell& cell) const;
+    //запоминает, что ячейка другого листа ссылается на ячейку pos; отсутствующая ячейка
+    //создаётся очищенной и не меняет размер листа
+    void AddExternalDependentCell(Position pos, ExternalCell cell);
+    //вычисляет все невалидные ячейки листа (вызывается под блокировкой книги)
+    void RecalculateLocked() const;
+
+    void BeginChange();
+    void InsertCell(Position pos, std::unique_ptr<Cell> cell);
+    void CheckCycles(const std::unordered_map<Position, std::vector<Position>, CellPositionHasher>& references) const;
+
+    //непустые ячейки в порядке строк
+    using CellList = std::vector<std::pair<Position, const Cell*>>;
+    CellList GetNonEmptyCells() const;
+
+    template <typename CellPrinter>
+    void Export(const OutputSink& sink, CellPrinter print_cell) const;
+    template <typename CellPrinter>
+    void ExportRows(BufferedWriter& writer, int first_row, int last_row, CellList::const_iterator it,
+                    CellList::const_iterator end, CellPrinter print_cell) const;
+
+    std::atomic<Size> sheet_size_{Size()};
+    std::vector<Region> regions_;
+    std::atomic<size_t> cell_count_{0};
+
+    //изменения одной области захватывают лист на чтение, остальные изменения и
+    //операции над всем листом - на запись; у листов книги блокировка общая
+    mutable std::shared_mutex own_structure_mutex_;
+    std::shared_mutex& structure_mutex_;
+
+    //запрос изменений тоже увеличивает версию, чтобы значения, вычисленные после
+    //него, имели версию больше выданной
+    mutable std::atomic<std::uint64_t> version_{0};
+    //версия, до которой все ячейки из журналов изменений областей вычислены
+    mutable std::uint64_t recomputed_version_ = 0;
+
+    Workbook* workbook_ = nullptr;
+    //листы книги, на ячейки которых ссылались формулы листа
+    std::set<const Sheet*> referenced_sheets_;
+
+    mutable SheetCounters counters_;
+
+    //лента изменений; создаётся при первой подписке, удаляется в деструкторе листа
+    std::atomic<ChangeFeed*> change_feed_{nullptr};
+
+    //профилировщик создаётся при первом включении и живёт до удаления листа, чтобы
+    //вычисления, начатые до выключения профилирования, могли записать своё время
+    std::unique_ptr<EvaluationProfiler> profiler_;
+    std::atomic<EvaluationProfiler*> active_profiler_{nullptr};
+
+    //гистограммы задержек живут до удаления листа по той же причине, что и профилировщик
+    std::unique_ptr<LatencyRecorder> latency_recorder_;
+    std::atomic<LatencyRecorder*> active_latency_recorder_{nullptr};
+};
+
 std::unique_ptr<SheetInterface> CreateSheet();
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "sheet_view.h"
+#include "buffered_writer.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+//---------ViewCell---------------------------------
+
+CellInterface::Value SheetView::ViewCell::GetValue() const {
+    std::call_once(once_, [this]() {
+        value_ = impl_->GetValue(*view_);
+    });
+    return value_;
+}
+
+std::string SheetView::ViewCell::GetText() const {
+    return impl_->GetText();
+}
+
+std::vector<Position> SheetView::ViewCell::GetReferencedCells() const {
+    return impl_->GetReferencedCells();
+}
+
+//---------SheetView--------------------------------
+
+SheetView::SheetView(const Sheet& sheet, Size size, std::vector<std::shared_ptr<RegionCopy>> regions,
+                     const WorkbookView* workbook)
+    : sheet_(&sheet)
+    , workbook_(workbook)
+    , size_(size)
+    , copies_(std::move(regions))
+    , regions_(copies_.size()) {
+}
+
+void SheetView::SetCell(Position pos, std::string text) {
+    using namespace std::literals;
+    throw std::logic_error("Sheet snapshot is read-only"s);
+}
+
+void SheetView::ClearCell(Position pos) {
+    using namespace std::literals;
+    throw std::logic_error("Sheet snapshot is read-only"s);
+}
+
+const SheetView::ViewRegion& SheetView::GetRegion(size_t index) const {
+    ViewRegion& region = regions_[index];
+    std::call_once(region.once, [this, index, &region]() {
+        RegionCopy& copy = *copies_[index];
+        {
+            //если область ещё не изменялась после создания снимка, копируем её из листа
+            std::lock_guard lock(copy.mutex);
+            if (!copy.cells) {
+                copy.cells = std::make_shared<const FrozenRegion>(sheet_->CopyRegion(index));
+            }
+            region.frozen = copy.cells;
+        }
+        region.cells = std::make_unique<ViewCell[]>(region.frozen->size());
+        for (size_t i = 0; i < region.frozen->size(); ++i) {
+            region.cells[i].view_ = this;
+            region.cells[i].impl_ = (*region.frozen)[i].second.get();
+        }
+    });
+    return region;
+}
+
+const CellInterface* SheetView::GetCell(Position pos) const {
+    if (!pos.IsValid()) {
+        using namespace std::literals;
+        throw InvalidPositionException("Position is not valid"s);
+    }
+
+    const ViewRegion& region = GetRegion(Sheet::GetRegionIndex(pos));
+    auto it = std::lower_bound(region.frozen->begin(), region.frozen->end(), pos,
+                               [](const auto& cell, Position pos) {
+                                   return cell.first < pos;
+                               });
+    if (it == region.frozen->end() || !(it->first == pos)) {
+        return nullptr;
+    }
+    return &region.cells[it - region.frozen->begin()];
+}
+
+CellInterface* SheetView::GetCell(Position pos) {
+    return const_cast<CellInterface*>(static_cast<const SheetView*>(this)->GetCell(pos));
+}
+
+Size SheetView::GetPrintableSize() const {
+    return size_;
+}
+
+const SheetInterface* SheetView::FindSheet(std::string_view name) const {
+    if (workbook_ == nullptr) {
+        return nullptr;
+    }
+    auto it = workbook_->sheet_names.find(name);
+    return it == workbook_->sheet_names.end() ? nullptr : it->second;
+}
+
+void SheetView::PrintValues(std::ostream& output) const {
+    if (!HasDefaultFormat(output)) {
+        //поток с заданным вызывающим форматированием: значения выводятся через <<
+        PrintRows(output, size_, GetCells(), [](std::ostream& output, const ViewCell& cell) {
+            output << cell.GetValue();
+        });
+        return void();
+    }
+    Print(output, [](BufferedWriter& writer, const ViewCell& cell) {
+        writer.Write(cell.GetValue());
+    });
+}
+
+void SheetView::PrintTexts(std::ostream& output) const {
+    if (!HasDefaultFormat(output)) {
+        PrintRows(output, size_, GetCells(), [](std::ostream& output, const ViewCell& cell) {
+            output << cell.GetText();
+        });
+        return void();
+    }
+    Print(output, [](BufferedWriter& writer, const ViewCell& cell) {
+        writer.Write(std::string_view(cell.GetText()));
+    });
+}
+
+std::vector<std::pair<Position, const SheetView::ViewCell*>> SheetView::GetCells() const {
+    std::vector<std::pair<Position, const ViewCell*>> cells;
+    for (size_t index = 0; index < regions_.size(); ++index) {
+        const ViewRegion& region = GetRegion(index);
+        for (size_t i = 0; i < region.frozen->size(); ++i) {
+            cells.emplace_back((*region.frozen)[i].first, &region.cells[i]);
+        }
+    }
+    std::sort(cells.begin(), cells.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.first < rhs.first;
+    });
+    return cells;
+}
+
+template <typename CellPrinter>
+void SheetView::Print(std::ostream& output, CellPrinter print_cell) const {
+    std::vector<std::pair<Position, const ViewCell*>> cells = GetCells();
+
+    BufferedWriter writer(MakeStreamSink(output));
+    auto it = cells.begin();
+    for (int row = 0; row < size_.rows; ++row) {
+        //столбец, до которого уже выведены разделители
+        int col = 0;
+        for (; it != cells.end() && it->first.row == row; ++it) {
+            writer.Write('\t', it->first.col - col);
+            col = it->first.col;
+            print_cell(writer, *it->second);
+        }
+        if (col + 1 < size_.cols) {
+            writer.Write('\t', size_.cols - 1 - col);
+        }
+        writer.Write('\n');
+    }
+    writer.Flush();
+}
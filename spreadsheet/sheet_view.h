@@ -0,0 +1,97 @@
+#pragma once
+
+#include "cell.h"
+#include "common.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class Sheet;
+class SheetView;
+
+// Неизменяемое содержимое области листа: ячейки (кроме очищенных), упорядоченные
+// по позициям. Содержимое ячеек (Impl) общее с ячейками листа.
+using FrozenRegion = std::vector<std::pair<Position, std::shared_ptr<const Impl>>>;
+
+// Копия области листа для снимков. Создаётся первым снимком после изменения области
+// и используется всеми снимками, сделанными до следующего её изменения. Содержимое
+// копируется при первом обращении к области из снимка либо перед изменением области,
+// если к этому времени оно ещё не скопировано.
+struct RegionCopy {
+    std::mutex mutex;
+    std::shared_ptr<const FrozenRegion> cells;
+};
+
+// Снимки листов книги, сделанные под одной блокировкой книги: снимок листа и снимки
+// листов, на которые он ссылается (прямо или через другие листы). Снимки находят
+// друг друга по именам листов.
+struct WorkbookView {
+    std::vector<std::unique_ptr<SheetView>> sheets;
+    std::map<std::string, const SheetView*, std::less<>> sheet_names;
+};
+
+// Снимок листа (см. Sheet::Snapshot()): лист в том состоянии, в котором он был при
+// создании снимка. Снимок можно читать из нескольких потоков одновременно с
+// изменением листа. Значения формул вычисляются по содержимому снимка при первом
+// обращении, каждое значение вычисляется один раз. Ссылки на другие листы книги
+// вычисляются по их снимкам из того же WorkbookView.
+class SheetView : public SheetInterface {
+public:
+    SheetView(const Sheet& sheet, Size size, std::vector<std::shared_ptr<RegionCopy>> regions,
+              const WorkbookView* workbook = nullptr);
+
+    //снимок не изменяется: бросают std::logic_error
+    void SetCell(Position pos, std::string text) override;
+    void ClearCell(Position pos) override;
+
+    const CellInterface* GetCell(Position pos) const override;
+    CellInterface* GetCell(Position pos) override;
+
+    Size GetPrintableSize() const override;
+
+    void PrintValues(std::ostream& output) const override;
+    void PrintTexts(std::ostream& output) const override;
+
+    //снимок листа книги с именем name, сделанный вместе с этим снимком
+    const SheetInterface* FindSheet(std::string_view name) const override;
+
+private:
+    class ViewCell : public CellInterface {
+    public:
+        Value GetValue() const override;
+        std::string GetText() const override;
+        std::vector<Position> GetReferencedCells() const override;
+
+        const SheetView* view_ = nullptr;
+        const Impl* impl_ = nullptr;
+
+    private:
+        mutable std::once_flag once_;
+        mutable Value value_;
+    };
+
+    struct ViewRegion {
+        std::once_flag once;
+        std::shared_ptr<const FrozenRegion> frozen;
+        std::unique_ptr<ViewCell[]> cells;
+    };
+
+    const ViewRegion& GetRegion(size_t index) const;
+    //ячейки всех областей в порядке строк, как в Sheet::ExportRows
+    std::vector<std::pair<Position, const ViewCell*>> GetCells() const;
+
+    template <typename CellPrinter>
+    void Print(std::ostream& output, CellPrinter print_cell) const;
+
+    const Sheet* sheet_;
+    const WorkbookView* workbook_;
+    Size size_;
+    std::vector<std::shared_ptr<RegionCopy>> copies_;
+    mutable std::vector<ViewRegion> regions_;
+};
@@ -0,0 +1,447 @@
+#include "snapshot.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const size_t SECTION_ALIGNMENT = 8;
+
+size_t AlignSize(size_t size) {
+    return (size + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+[[noreturn]] void ThrowInvalidSnapshot(const char* reason) {
+    using namespace std::literals;
+    throw std::runtime_error("Invalid snapshot: "s + reason);
+}
+
+//секция из count элементов размера item_size должна целиком лежать в файле
+bool IsSectionValid(std::uint64_t offset, std::uint64_t count, size_t item_size, size_t file_size) {
+    return offset % SECTION_ALIGNMENT == 0 && offset <= file_size
+        && count <= (file_size - offset) / item_size;
+}
+
+void WriteSection(std::ofstream& output, const void* data, size_t size) {
+    static const char padding[SECTION_ALIGNMENT] = {};
+    output.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    output.write(padding, static_cast<std::streamsize>(AlignSize(size) - size));
+}
+
+//собирает секции снимка в памяти
+class SnapshotBuilder {
+public:
+    void AddCell(Position pos, const Cell& cell) {
+        SnapshotCell item{};
+        item.row = pos.row;
+        item.col = pos.col;
+        item.kind = GetKind(cell);
+
+        if (item.kind != SnapshotCell::Cleared) {
+            std::string text = cell.GetText();
+            item.text_offset = AddString(text);
+            item.text_size = static_cast<std::uint32_t>(text.size());
+        }
+        if (item.kind == SnapshotCell::Formula) {
+            FormulaProgram program = cell.GetFormula()->GetProgram();
+            item.program_offset = ops_.size();
+            item.program_size = static_cast<std::uint32_t>(program.size());
+            for (const FormulaOp& op : program) {
+                SnapshotOp snapshot_op{};
+                snapshot_op.value = op.value;
+                snapshot_op.row = op.cell.row;
+                snapshot_op.col = op.cell.col;
+                snapshot_op.type = static_cast<std::uint8_t>(op.type);
+                if (op.type == FormulaOp::SheetCell) {
+                    AddString(op.sheet);
+                    snapshot_op.sheet_size = static_cast<std::uint32_t>(op.sheet.size());
+                }
+                ops_.push_back(snapshot_op);
+            }
+        }
+
+        item.links_offset = positions_.size();
+        if (item.kind != SnapshotCell::Cleared) {
+            std::vector<Position> refs = cell.GetReferencedCells();
+            item.refs_count = static_cast<std::uint32_t>(refs.size());
+            AddPositions(refs);
+        }
+        std::set<Position> deps = cell.GetDependentCells();
+        item.deps_count = static_cast<std::uint32_t>(deps.size());
+        AddPositions(deps);
+
+        AddValue(item, cell.GetCachedValue());
+        item.is_valid = cell.GetValidity() ? 1 : 0;
+        cells_.push_back(item);
+    }
+
+    void Write(std::ofstream& output, Size size, std::uint64_t journal_sequence) {
+        std::sort(cells_.begin(), cells_.end(), [](const SnapshotCell& lhs, const SnapshotCell& rhs) {
+            return std::tie(lhs.row, lhs.col) < std::tie(rhs.row, rhs.col);
+        });
+
+        SnapshotHeader header{};
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.byte_order = SNAPSHOT_BYTE_ORDER;
+        header.rows = size.rows;
+        header.cols = size.cols;
+        header.journal_sequence = journal_sequence;
+
+        std::uint64_t offset = AlignSize(sizeof(SnapshotHeader));
+        header.cell_count = cells_.size();
+        header.cells_offset = offset;
+        offset += AlignSize(cells_.size() * sizeof(SnapshotCell));
+        header.op_count = ops_.size();
+        header.ops_offset = offset;
+        offset += AlignSize(ops_.size() * sizeof(SnapshotOp));
+        header.position_count = positions_.size();
+        header.positions_offset = offset;
+        offset += AlignSize(positions_.size() * sizeof(SnapshotPosition));
+        header.strings_size = strings_.size();
+        header.strings_offset = offset;
+        offset += AlignSize(strings_.size());
+        header.file_size = offset;
+
+        WriteSection(output, &header, sizeof(header));
+        WriteSection(output, cells_.data(), cells_.size() * sizeof(SnapshotCell));
+        WriteSection(output, ops_.data(), ops_.size() * sizeof(SnapshotOp));
+        WriteSection(output, positions_.data(), positions_.size() * sizeof(SnapshotPosition));
+        WriteSection(output, strings_.data(), strings_.size());
+    }
+
+private:
+    static SnapshotCell::Kind GetKind(const Cell& cell) {
+        if (cell.IsEmptyCell()) {
+            return SnapshotCell::Cleared;
+        }
+        if (cell.GetFormula() != nullptr) {
+            return SnapshotCell::Formula;
+        }
+        return cell.GetText().empty() ? SnapshotCell::Empty : SnapshotCell::Text;
+    }
+
+    std::uint64_t AddString(std::string_view text) {
+        std::uint64_t offset = strings_.size();
+        strings_.append(text);
+        return offset;
+    }
+
+    template <typename Container>
+    void AddPositions(const Container& cells) {
+        for (Position pos : cells) {
+            positions_.push_back(SnapshotPosition{pos.row, pos.col});
+        }
+    }
+
+    void AddValue(SnapshotCell& item, const CellInterface::Value& value) {
+        if (std::holds_alternative<double>(value)) {
+            item.value_type = SnapshotCell::Number;
+            item.number = std::get<double>(value);
+        } else if (std::holds_alternative<FormulaError>(value)) {
+            item.value_type = SnapshotCell::Error;
+            item.error_category = static_cast<std::uint8_t>(std::get<FormulaError>(value).GetCategory());
+        } else {
+            item.value_type = SnapshotCell::String;
+            const std::string& str = std::get<std::string>(value);
+            //значение текстовой ячейки совпадает с концом её текста, поэтому хранится один раз
+            std::string_view text(strings_.data() + item.text_offset, item.text_size);
+            if (str.size() <= text.size() && text.substr(text.size() - str.size()) == str) {
+                item.value_offset = item.text_offset + (text.size() - str.size());
+            } else {
+                item.value_offset = AddString(str);
+            }
+            item.value_size = static_cast<std::uint32_t>(str.size());
+        }
+    }
+
+    std::vector<SnapshotCell> cells_;
+    std::vector<SnapshotOp> ops_;
+    std::vector<SnapshotPosition> positions_;
+    std::string strings_;
+};
+
+} // namespace
+
+void SaveSnapshot(const Sheet& sheet, const std::string& path, std::uint64_t journal_sequence) {
+    //в снимок попадают вычисленные значения, чтобы после восстановления не пересчитывать
+    //лист. Ячейки собираются под блокировкой листа, запись в файл выполняется после неё
+    SnapshotBuilder builder;
+    Size size = sheet.ForEachEvaluatedCell([&builder](Position pos, const Cell& cell) {
+        builder.AddCell(pos, cell);
+    });
+
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    builder.Write(output, size, journal_sequence);
+    output.flush();
+    if (!output) {
+        throw std::runtime_error("Failed to write file: " + path);
+    }
+}
+
+//----------SheetSnapshot------
+
+SheetSnapshot::SheetSnapshot(const std::string& path) {
+    Map(path);
+    try {
+        CheckHeader();
+    } catch (...) {
+        Unmap();
+        throw;
+    }
+}
+
+SheetSnapshot::~SheetSnapshot() {
+    Unmap();
+}
+
+void SheetSnapshot::Map(const std::string& path) {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        throw std::runtime_error("Failed to read file: " + path);
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Failed to map file: " + path);
+    }
+    data_ = static_cast<const char*>(data);
+    size_ = size;
+#else
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    buffer_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+#endif
+}
+
+void SheetSnapshot::Unmap() {
+#ifndef _WIN32
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    buffer_.clear();
+}
+
+void SheetSnapshot::CheckHeader() const {
+    if (size_ < sizeof(SnapshotHeader)) {
+        ThrowInvalidSnapshot("file is too small");
+    }
+    const SnapshotHeader& header = GetHeader();
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        ThrowInvalidSnapshot("wrong signature");
+    }
+    if (header.byte_order != SNAPSHOT_BYTE_ORDER) {
+        ThrowInvalidSnapshot("wrong byte order");
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        ThrowInvalidSnapshot("unsupported version");
+    }
+    if (header.file_size != size_) {
+        ThrowInvalidSnapshot("wrong file size");
+    }
+    if (!IsSectionValid(header.cells_offset, header.cell_count, sizeof(SnapshotCell), size_)
+        || !IsSectionValid(header.ops_offset, header.op_count, sizeof(SnapshotOp), size_)
+        || !IsSectionValid(header.positions_offset, header.position_count, sizeof(SnapshotPosition), size_)
+        || !IsSectionValid(header.strings_offset, header.strings_size, 1, size_)) {
+        ThrowInvalidSnapshot("section is out of file");
+    }
+    if (header.rows < 0 || header.rows > Position::MAX_ROWS || header.cols < 0 || header.cols > Position::MAX_COLS) {
+        ThrowInvalidSnapshot("wrong sheet size");
+    }
+}
+
+Size SheetSnapshot::GetPrintableSize() const {
+    return Size{GetHeader().rows, GetHeader().cols};
+}
+
+size_t SheetSnapshot::GetCellCount() const {
+    return static_cast<size_t>(GetHeader().cell_count);
+}
+
+std::uint64_t SheetSnapshot::GetJournalSequence() const {
+    return GetHeader().journal_sequence;
+}
+
+const SnapshotCell* SheetSnapshot::FindCell(Position pos) const {
+    const SnapshotCell* first = GetCells();
+    const SnapshotCell* last = first + GetCellCount();
+    const SnapshotCell* it = std::lower_bound(first, last, pos, [](const SnapshotCell& cell, Position pos) {
+        return std::tie(cell.row, cell.col) < std::tie(pos.row, pos.col);
+    });
+    if (it == last || it->row != pos.row || it->col != pos.col) {
+        return nullptr;
+    }
+    return it;
+}
+
+std::string_view SheetSnapshot::GetText(Position pos) const {
+    const SnapshotCell* cell = FindCell(pos);
+    if (cell == nullptr) {
+        return {};
+    }
+    return GetString(cell->text_offset, cell->text_size);
+}
+
+CellInterface::Value SheetSnapshot::GetValue(Position pos) const {
+    const SnapshotCell* cell = FindCell(pos);
+    if (cell == nullptr) {
+        return CellInterface::Value();
+    }
+    return GetValue(*cell);
+}
+
+std::vector<Position> SheetSnapshot::GetReferencedCells(Position pos) const {
+    const SnapshotCell* cell = FindCell(pos);
+    if (cell == nullptr) {
+        return {};
+    }
+    return ToPositions(GetLinks(*cell), cell->refs_count);
+}
+
+std::vector<Position> SheetSnapshot::GetDependentCells(Position pos) const {
+    const SnapshotCell* cell = FindCell(pos);
+    if (cell == nullptr) {
+        return {};
+    }
+    return ToPositions(GetLinks(*cell) + cell->refs_count, cell->deps_count);
+}
+
+std::unique_ptr<Sheet> SheetSnapshot::Restore() const {
+    const SnapshotHeader& header = GetHeader();
+    const SnapshotOp* ops = reinterpret_cast<const SnapshotOp*>(data_ + header.ops_offset);
+
+    auto sheet = std::make_unique<Sheet>();
+    FormulaProgram program;
+    std::uint64_t sheet_offset = 0;
+    const SnapshotCell* cells = GetCells();
+    for (size_t i = 0; i < GetCellCount(); ++i) {
+        const SnapshotCell& item = cells[i];
+        Position pos{item.row, item.col};
+        if (!pos.IsValid()) {
+            ThrowInvalidSnapshot("wrong cell position");
+        }
+
+        auto cell = std::make_unique<Cell>(*sheet);
+        switch (item.kind) {
+            case SnapshotCell::Cleared:
+                cell->Clear();
+                break;
+            case SnapshotCell::Empty:
+                break;
+            case SnapshotCell::Text:
+                cell->SetTextCell(std::string(GetString(item.text_offset, item.text_size)));
+                break;
+            case SnapshotCell::Formula:
+                if (item.program_offset > header.op_count || item.program_size > header.op_count - item.program_offset) {
+                    ThrowInvalidSnapshot("formula is out of section");
+                }
+                program.clear();
+                sheet_offset = item.text_offset + item.text_size;
+                for (const SnapshotOp* op = ops + item.program_offset; op != ops + item.program_offset + item.program_size; ++op) {
+                    program.push_back(FormulaOp{static_cast<FormulaOp::Type>(op->type), op->value, Position{op->row, op->col}, {}});
+                    if (op->type == FormulaOp::SheetCell) {
+                        program.back().sheet = GetString(sheet_offset, op->sheet_size);
+                        sheet_offset += op->sheet_size;
+                    }
+                }
+                cell->SetFormula(ParseFormula(program));
+                break;
+            default:
+                ThrowInvalidSnapshot("wrong cell kind");
+        }
+
+        const SnapshotPosition* links = GetLinks(item);
+        for (const SnapshotPosition* link = links; link != links + item.refs_count; ++link) {
+            cell->SetCellTo(Position{link->row, link->col});
+        }
+        for (const SnapshotPosition* link = links + item.refs_count; link != links + item.refs_count + item.deps_count; ++link) {
+            cell->SetCellFrom(Position{link->row, link->col});
+        }
+        cell->SetValue(GetValue(item));
+        cell->SetValidateFlag(item.is_valid != 0);
+
+        sheet->RestoreCell(pos, std::move(cell));
+    }
+    sheet->RestorePrintableSize(GetPrintableSize());
+    return sheet;
+}
+
+const SnapshotHeader& SheetSnapshot::GetHeader() const {
+    return *reinterpret_cast<const SnapshotHeader*>(data_);
+}
+
+const SnapshotCell* SheetSnapshot::GetCells() const {
+    return reinterpret_cast<const SnapshotCell*>(data_ + GetHeader().cells_offset);
+}
+
+std::string_view SheetSnapshot::GetString(std::uint64_t offset, std::uint32_t size) const {
+    const SnapshotHeader& header = GetHeader();
+    if (offset > header.strings_size || size > header.strings_size - offset) {
+        ThrowInvalidSnapshot("string is out of section");
+    }
+    return std::string_view(data_ + header.strings_offset + offset, size);
+}
+
+const SnapshotPosition* SheetSnapshot::GetLinks(const SnapshotCell& cell) const {
+    const SnapshotHeader& header = GetHeader();
+    std::uint64_t count = std::uint64_t(cell.refs_count) + cell.deps_count;
+    if (cell.links_offset > header.position_count || count > header.position_count - cell.links_offset) {
+        ThrowInvalidSnapshot("cell links are out of section");
+    }
+    return reinterpret_cast<const SnapshotPosition*>(data_ + header.positions_offset) + cell.links_offset;
+}
+
+CellInterface::Value SheetSnapshot::GetValue(const SnapshotCell& cell) const {
+    switch (cell.value_type) {
+        case SnapshotCell::Number:
+            return cell.number;
+        case SnapshotCell::Error:
+            if (cell.error_category > static_cast<std::uint8_t>(FormulaError::Category::Div0)) {
+                ThrowInvalidSnapshot("wrong error category");
+            }
+            return FormulaError(static_cast<FormulaError::Category>(cell.error_category));
+        case SnapshotCell::String:
+            return std::string(GetString(cell.value_offset, cell.value_size));
+        default:
+            ThrowInvalidSnapshot("wrong value type");
+    }
+}
+
+std::vector<Position> SheetSnapshot::ToPositions(const SnapshotPosition* first, std::uint32_t count) const {
+    std::vector<Position> result;
+    result.reserve(count);
+    for (const SnapshotPosition* it = first; it != first + count; ++it) {
+        result.push_back(Position{it->row, it->col});
+    }
+    return result;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Sheet;
+
+// Двоичный снимок листа. Файл состоит из заголовка и четырёх секций, на которые
+// заголовок ссылается смещениями от начала файла:
+// * ячейки (SnapshotCell), упорядоченные по строкам, затем по столбцам;
+// * формулы в постфиксной записи (SnapshotOp);
+// * связи ячеек (SnapshotPosition): для каждой ячейки сначала ячейки, на которые
+//   она ссылается, затем ячейки, которые ссылаются на неё;
+// * строки (тексты ячеек и строковые значения) без разделителей. Имена листов в
+//   ссылках формулы на другие листы записываются сразу после текста её ячейки в
+//   порядке операций.
+// Ячейки ссылаются на остальные секции индексами. Все числа записываются в порядке
+// байтов той машины, на которой создан снимок; секции выровнены по 8 байт, поэтому
+// файл можно отобразить в память и читать без разбора.
+
+const char SNAPSHOT_MAGIC[8] = {'S', 'H', 'E', 'E', 'T', 'S', 'N', 'P'};
+const std::uint32_t SNAPSHOT_VERSION = 3;
+const std::uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::int32_t rows;
+    std::int32_t cols;
+    std::uint64_t file_size;
+    //номер последней записи журнала изменений, учтённой в снимке
+    std::uint64_t journal_sequence;
+    std::uint64_t cell_count;
+    std::uint64_t cells_offset;
+    std::uint64_t op_count;
+    std::uint64_t ops_offset;
+    std::uint64_t position_count;
+    std::uint64_t positions_offset;
+    std::uint64_t strings_size;
+    std::uint64_t strings_offset;
+};
+
+struct SnapshotCell {
+    enum Kind : std::uint8_t {
+        Cleared,
+        Empty,
+        Text,
+        Formula,
+    };
+    enum ValueType : std::uint8_t {
+        String,
+        Number,
+        Error,
+    };
+
+    std::int32_t row;
+    std::int32_t col;
+    std::uint64_t text_offset;
+    std::uint64_t program_offset;
+    std::uint64_t links_offset;
+    std::uint64_t value_offset;
+    double number;
+    std::uint32_t text_size;
+    std::uint32_t program_size;
+    std::uint32_t refs_count;
+    std::uint32_t deps_count;
+    std::uint32_t value_size;
+    std::uint8_t kind;
+    std::uint8_t value_type;
+    std::uint8_t error_category;
+    std::uint8_t is_valid;
+};
+
+struct SnapshotOp {
+    double value;
+    std::int32_t row;
+    std::int32_t col;
+    std::uint8_t type;
+    std::uint8_t reserved[3];
+    //длина имени листа для ссылки на другой лист
+    std::uint32_t sheet_size;
+};
+
+struct SnapshotPosition {
+    std::int32_t row;
+    std::int32_t col;
+};
+
+static_assert(sizeof(SnapshotHeader) == 104, "snapshot header layout changed");
+static_assert(sizeof(SnapshotCell) == 72, "snapshot cell layout changed");
+static_assert(sizeof(SnapshotOp) == 24, "snapshot op layout changed");
+static_assert(sizeof(SnapshotPosition) == 8, "snapshot position layout changed");
+
+// Вычисляет все ячейки листа и записывает снимок в файл. Можно вызывать параллельно с
+// изменениями листа: ячейки собираются под блокировкой всего листа.
+void SaveSnapshot(const Sheet& sheet, const std::string& path, std::uint64_t journal_sequence = 0);
+
+// Снимок, отображённый в память. При открытии проверяется только заголовок,
+// поэтому время открытия не зависит от размера листа; ячейка ищется двоичным
+// поиском. Данные ячеек проверяются при обращении к ним; если снимок повреждён,
+// бросается std::runtime_error.
+class SheetSnapshot {
+public:
+    explicit SheetSnapshot(const std::string& path);
+    ~SheetSnapshot();
+
+    SheetSnapshot(const SheetSnapshot&) = delete;
+    SheetSnapshot& operator=(const SheetSnapshot&) = delete;
+
+    Size GetPrintableSize() const;
+    size_t GetCellCount() const;
+    std::uint64_t GetJournalSequence() const;
+
+    //nullptr, если ячейки нет в снимке
+    const SnapshotCell* FindCell(Position pos) const;
+
+    //для отсутствующих и очищенных ячеек возвращают пустой текст и пустую строку
+    std::string_view GetText(Position pos) const;
+    CellInterface::Value GetValue(Position pos) const;
+    std::vector<Position> GetReferencedCells(Position pos) const;
+    std::vector<Position> GetDependentCells(Position pos) const;
+
+    //восстанавливает лист со всеми связями и вычисленными значениями без разбора
+    //текста формул, проверки на цикличные ссылки и пересчёта. Лист восстанавливается
+    //вне книги: связи с другими листами не сохраняются, а ссылки на них при пересчёте
+    //вычисляются в #REF!
+    std::unique_ptr<Sheet> Restore() const;
+
+private:
+    void Map(const std::string& path);
+    void Unmap();
+    void CheckHeader() const;
+
+    const SnapshotHeader& GetHeader() const;
+    const SnapshotCell* GetCells() const;
+    std::string_view GetString(std::uint64_t offset, std::uint32_t size) const;
+    const SnapshotPosition* GetLinks(const SnapshotCell& cell) const;
+    CellInterface::Value GetValue(const SnapshotCell& cell) const;
+    std::vector<Position> ToPositions(const SnapshotPosition* first, std::uint32_t count) const;
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    //если отображение файла в память недоступно, файл читается в буфер
+    std::vector<char> buffer_;
+};
@@ -0,0 +1,119 @@
+#include "statistics.h"
+
+#include <cstdio>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+
+namespace {
+
+struct Metric {
+    const char* name;
+    const char* help;
+    //счётчик растёт только вверх; остальное - текущее значение
+    bool is_counter;
+    std::uint64_t SheetStatistics::*value;
+};
+
+const Metric METRICS[] = {
+    {"formula_evaluations", "Formula evaluations", true, &SheetStatistics::formula_evaluations},
+    {"cache_hits", "Cell::GetValue calls served from the cache", true, &SheetStatistics::cache_hits},
+    {"cache_misses", "Cell::GetValue calls that computed the value", true, &SheetStatistics::cache_misses},
+    {"invalidations", "Cells whose cached value was invalidated", true, &SheetStatistics::invalidations},
+    {"cycle_checks", "Circular reference checks", true, &SheetStatistics::cycle_checks},
+    {"cycle_check_cells", "Cells visited by circular reference checks", true, &SheetStatistics::cycle_check_cells},
+    {"cycle_check_max_cells", "Most cells visited by one circular reference check", false,
+     &SheetStatistics::cycle_check_max_cells},
+    {"parses", "Formula parses", true, &SheetStatistics::parses},
+    {"parse_nanoseconds", "Time spent parsing formulas", true, &SheetStatistics::parse_nanoseconds},
+    {"cells_allocated", "Cells allocated", true, &SheetStatistics::cells_allocated},
+    {"placeholder_cells_allocated", "Empty cells allocated for references", true,
+     &SheetStatistics::placeholder_cells_allocated},
+};
+
+} // namespace
+
+void SheetCounters::AddCycleCheck(std::uint64_t cell_count) {
+    Add(cycle_checks_);
+    Add(cycle_check_cells_, cell_count);
+    std::uint64_t max_cells = cycle_check_max_cells_.load(std::memory_order_relaxed);
+    while (max_cells < cell_count
+           && !cycle_check_max_cells_.compare_exchange_weak(max_cells, cell_count, std::memory_order_relaxed)) {
+    }
+}
+
+SheetStatistics SheetCounters::Get() const {
+    SheetStatistics statistics;
+    for (const Stripe& stripe : stripes_) {
+        statistics.formula_evaluations += stripe.formula_evaluations.load(std::memory_order_relaxed);
+        statistics.cache_hits += stripe.cache_hits.load(std::memory_order_relaxed);
+        statistics.cache_misses += stripe.cache_misses.load(std::memory_order_relaxed);
+        statistics.invalidations += stripe.invalidations.load(std::memory_order_relaxed);
+    }
+    statistics.cycle_checks = cycle_checks_.load(std::memory_order_relaxed);
+    statistics.cycle_check_cells = cycle_check_cells_.load(std::memory_order_relaxed);
+    statistics.cycle_check_max_cells = cycle_check_max_cells_.load(std::memory_order_relaxed);
+    statistics.parses = parses_.load(std::memory_order_relaxed);
+    statistics.parse_nanoseconds = parse_nanoseconds_.load(std::memory_order_relaxed);
+    statistics.cells_allocated = cells_allocated_.load(std::memory_order_relaxed);
+    statistics.placeholder_cells_allocated = placeholder_cells_allocated_.load(std::memory_order_relaxed);
+    return statistics;
+}
+
+void SheetCounters::Reset() {
+    for (Stripe& stripe : stripes_) {
+        for (std::atomic<std::uint64_t>* counter :
+             {&stripe.formula_evaluations, &stripe.cache_hits, &stripe.cache_misses, &stripe.invalidations}) {
+            counter->store(0, std::memory_order_relaxed);
+        }
+    }
+    for (std::atomic<std::uint64_t>* counter : {&cycle_checks_, &cycle_check_cells_, &cycle_check_max_cells_, &parses_,
+                                                &parse_nanoseconds_, &cells_allocated_,
+                                                &placeholder_cells_allocated_}) {
+        counter->store(0, std::memory_order_relaxed);
+    }
+}
+
+void WriteStatistics(std::ostream& output, const SheetStatistics& statistics, StatisticsFormat format) {
+    if (format == StatisticsFormat::Json) {
+        output << '{';
+        bool is_first = true;
+        for (const Metric& metric : METRICS) {
+            output << (is_first ? "" : ", ") << '"' << metric.name << "\": " << statistics.*metric.value;
+            is_first = false;
+        }
+        output << "}\n";
+    } else {
+        using namespace std::literals;
+        //счётчики Prometheus по соглашению оканчиваются на _total
+        for (const Metric& metric : METRICS) {
+            std::string name = "spreadsheet_"s + metric.name + (metric.is_counter ? "_total" : "");
+            output << "# HELP " << name << ' ' << metric.help << '\n'
+                   << "# TYPE " << name << (metric.is_counter ? " counter\n" : " gauge\n")
+                   << name << ' ' << statistics.*metric.value << '\n';
+        }
+    }
+}
+
+void SaveStatistics(const std::string& path, const SheetStatistics& statistics, StatisticsFormat format) {
+    using namespace std::literals;
+    std::string temporary_path = path + ".tmp";
+    {
+        std::ofstream output(temporary_path, std::ios::trunc);
+        if (!output) {
+            throw std::runtime_error("Failed to open file: " + temporary_path);
+        }
+        WriteStatistics(output, statistics, format);
+        output.flush();
+        if (!output) {
+            throw std::runtime_error("Failed to write file: " + temporary_path);
+        }
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        std::remove(temporary_path.c_str());
+        throw std::runtime_error("Failed to replace file: "s + path);
+    }
+}
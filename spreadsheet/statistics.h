@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Значения счётчиков движка листа на момент запроса (см. Sheet::GetStatistics).
+struct SheetStatistics {
+    //вычисления формул (в GetValue и при поблочном вычислении)
+    std::uint64_t formula_evaluations = 0;
+    //вызовы Cell::GetValue, вернувшие значение из кэша и вычислившие (или дождавшиеся) его
+    std::uint64_t cache_hits = 0;
+    std::uint64_t cache_misses = 0;
+    //ячейки, значение которых было сброшено
+    std::uint64_t invalidations = 0;
+    //проверки на цикличные ссылки, число ячеек, обойдённых ими всеми, и наибольшее
+    //число ячеек, обойдённых одной проверкой
+    std::uint64_t cycle_checks = 0;
+    std::uint64_t cycle_check_cells = 0;
+    std::uint64_t cycle_check_max_cells = 0;
+    //разборы формул и их общее время
+    std::uint64_t parses = 0;
+    std::uint64_t parse_nanoseconds = 0;
+    //созданные ячейки, в том числе пустые ячейки, созданные для ссылок на них
+    std::uint64_t cells_allocated = 0;
+    std::uint64_t placeholder_cells_allocated = 0;
+};
+
+// Счётчики движка листа. Увеличиваются атомарно без упорядочивания, поэтому их можно
+// обновлять из любых потоков; значения, прочитанные во время изменений листа,
+// согласованы только приблизительно. Счётчики, которые увеличивает каждый
+// Cell::GetValue, разбиты на части по потокам (как гистограммы LatencyRecorder), чтобы
+// параллельное чтение листа не упиралось в одну строку кэша; Get() суммирует части.
+class SheetCounters {
+public:
+    void AddFormulaEvaluation() {
+        Add(GetStripe().formula_evaluations);
+    }
+    void AddCacheHit() {
+        Add(GetStripe().cache_hits);
+    }
+    void AddCacheMiss() {
+        Add(GetStripe().cache_misses);
+    }
+    void AddInvalidation() {
+        Add(GetStripe().invalidations);
+    }
+    void AddCycleCheck(std::uint64_t cell_count);
+    void AddParse(std::uint64_t nanoseconds) {
+        Add(parses_);
+        Add(parse_nanoseconds_, nanoseconds);
+    }
+    void AddCell() {
+        Add(cells_allocated_);
+    }
+    void AddPlaceholderCell() {
+        Add(placeholder_cells_allocated_);
+    }
+
+    SheetStatistics Get() const;
+    void Reset();
+
+private:
+    static const size_t STRIPE_COUNT = 16;
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    //часть счётчиков чтения; каждая занимает свою строку кэша
+    struct alignas(CACHE_LINE_SIZE) Stripe {
+        std::atomic<std::uint64_t> formula_evaluations{0};
+        std::atomic<std::uint64_t> cache_hits{0};
+        std::atomic<std::uint64_t> cache_misses{0};
+        std::atomic<std::uint64_t> invalidations{0};
+    };
+
+    static void Add(std::atomic<std::uint64_t>& counter, std::uint64_t value = 1) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    //часть, в которую пишет текущий поток; потоки получают части по кругу
+    Stripe& GetStripe() {
+        static std::atomic<size_t> next_stripe{0};
+        //значение без динамической инициализации: обращение к нему не проверяет, создано ли оно
+        thread_local size_t stripe = STRIPE_COUNT;
+        if (stripe == STRIPE_COUNT) {
+            stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % STRIPE_COUNT;
+        }
+        return stripes_[stripe];
+    }
+
+    std::array<Stripe, STRIPE_COUNT> stripes_;
+    std::atomic<std::uint64_t> cycle_checks_{0};
+    std::atomic<std::uint64_t> cycle_check_cells_{0};
+    std::atomic<std::uint64_t> cycle_check_max_cells_{0};
+    std::atomic<std::uint64_t> parses_{0};
+    std::atomic<std::uint64_t> parse_nanoseconds_{0};
+    std::atomic<std::uint64_t> cells_allocated_{0};
+    std::atomic<std::uint64_t> placeholder_cells_allocated_{0};
+};
+
+enum class StatisticsFormat {
+    //один объект {"formula_evaluations": ..., ...}
+    Json,
+    //текстовый формат Prometheus: метрики spreadsheet_*
+    Prometheus,
+};
+
+void WriteStatistics(std::ostream& output, const SheetStatistics& statistics, StatisticsFormat format);
+// Записывает статистику в файл: сначала во временный файл рядом, затем заменяет им
+// path, чтобы читатель файла не увидел его частично записанным. Бросает
+// std::runtime_error, если файл не удалось записать.
+void SaveStatistics(const std::string& path, const SheetStatistics& statistics, StatisticsFormat format);
@@ -1,82 +1,88 @@
-#include "common.h"
-
-#include <cctype>
-#include <sstream>
-#include <algorithm>
-
-const int LETTERS = 26;
-const int MAX_POSITION_LENGTH = 17;
-const int MAX_POS_LETTER_COUNT = 3;
-
-const Position Position::NONE = {-1, -1};
-
-bool Position::operator==(const Position rhs) const {
-    return row == rhs.row && col == rhs.col;
-}
-
-bool Position::operator<(const Position rhs) const {
-    return std::tie(row, col) < std::tie(rhs.row, rhs.col);
-}
-
-bool Position::IsValid() const {
-    return row >= 0 && col >= 0 && row < MAX_ROWS && col < MAX_COLS;
-}
-
-std::string Position::ToString() const {
-    if (!IsValid()) {
-        return "";
-    }
-
-    std::string result;
-    result.reserve(MAX_POSITION_LENGTH);
-    int c = col;
-    while (c >= 0) {
-        result.insert(result.begin(), 'A' + c % LETTERS);
-        c = c / LETTERS - 1;
-    }
-
-    result += std::to_string(row + 1);
-
-    return result;
-}
-
-Position Position::FromString(std::string_view str) {
-    auto it = std::find_if(str.begin(), str.end(), [](const char c) {
-        return !(std::isalpha(c) && std::isupper(c));
-    });
-    auto letters = str.substr(0, it - str.begin());
-    auto digits = str.substr(it - str.begin());
-
-    if (letters.empty() || digits.empty()) {
-        return Position::NONE;
-    }
-    if (letters.size() > MAX_POS_LETTER_COUNT) {
-        return Position::NONE;
-    }
-
-    if (!std::isdigit(digits[0])) {
-        return Position::NONE;
-    }
-
-    int row;
-    std::istringstream row_in{std::string{digits}};
-    if (!(row_in >> row) || !row_in.eof()) {
-        return Position::NONE;
-    }
-
-    int col = 0;
-    for (char ch : letters) {
-        col *= LETTERS;
-        col += ch - 'A' + 1;
-    }
-
-    return {row - 1, col - 1};
-}
-
-bool Size::operator==(Size rhs) const {
-    return cols == rhs.cols && rows == rhs.rows;
-}
-
-std::ostream& operator<<(std::ostream& output, Position pos) {
-      return output << "(" << pos.row << ", " << pos.col << ")";
+#include "common.h"
+
+#include <algorithm>
+#include <limits>
+#include <ostream>
+#include <tuple>
+
+//таблица двузначных чисел для перевода номера строки в текст
+const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+const Position Position::NONE = {-1, -1};
+
+bool Position::operator==(const Position rhs) const {
+    return row == rhs.row && col == rhs.col;
+}
+
+bool Position::operator<(const Position rhs) const {
+    return std::tie(row, col) < std::tie(rhs.row, rhs.col);
+}
+
+bool Position::IsValid() const {
+    return row >= 0 && col >= 0 && row < MAX_ROWS && col < MAX_COLS;
+}
+
+std::string Position::ToString() const {
+    char buffer[MAX_POSITION_LENGTH];
+    return std::string(buffer, ToChars(buffer, buffer + MAX_POSITION_LENGTH));
+}
+
+char* Position::ToChars(char* first, char* last) const {
+    if (!IsValid()) {
+        return first;
+    }
+
+    //буквы столбца получаем в обратном порядке
+    char letters[MAX_POS_LETTER_COUNT];
+    int letter_count = 0;
+    int c = col;
+    while (c >= 0) {
+        letters[letter_count++] = static_cast<char>('A' + c % LETTERS);
+        c = c / LETTERS - 1;
+    }
+
+    //цифры строки получаем с конца, по две за шаг
+    char digits[std::numeric_limits<int>::digits10 + 1];
+    char* digits_end = digits + sizeof(digits);
+    char* digits_begin = digits_end;
+    unsigned int r = static_cast<unsigned int>(row) + 1;
+    while (r >= 100) {
+        const char* pair = DIGIT_PAIRS + (r % 100) * 2;
+        *--digits_begin = pair[1];
+        *--digits_begin = pair[0];
+        r /= 100;
+    }
+    if (r >= 10) {
+        const char* pair = DIGIT_PAIRS + r * 2;
+        *--digits_begin = pair[1];
+        *--digits_begin = pair[0];
+    } else {
+        *--digits_begin = static_cast<char>('0' + r);
+    }
+
+    if (last - first < letter_count + (digits_end - digits_begin)) {
+        return first;
+    }
+    while (letter_count > 0) {
+        *first++ = letters[--letter_count];
+    }
+    return std::copy(digits_begin, digits_end, first);
+}
+
+bool Size::operator==(Size rhs) const {
+    return cols == rhs.cols && rows == rhs.rows;
+}
+
+std::ostream& operator<<(std::ostream& output, Position pos) {
+      return output << "(" << pos.row << ", " << pos.col << ")";
 }
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include "tracing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    const char* name = nullptr;
+    Position pos;
+    std::int64_t start = 0;
+    std::int64_t end = 0;
+};
+
+// Кольцевой буфер событий одного потока. Блокировку буфера берут только его поток
+// и вывод событий, поэтому при записи она всегда свободна.
+struct ThreadBuffer {
+    std::mutex mutex;
+    int thread_id = 0;
+    std::string thread_name;
+    //запуск записи, к которому относятся события буфера
+    std::uint64_t generation = 0;
+    std::vector<TraceEvent> events;
+    //место следующего события; после заполнения буфера новые события заменяют старые
+    size_t next = 0;
+    bool is_full = false;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    int next_thread_id = 1;
+    //номер запуска записи; буферы сверяются с ним при каждом событии
+    std::atomic<std::uint64_t> generation{0};
+    size_t events_per_thread = Tracing::DEFAULT_EVENTS_PER_THREAD;
+    std::int64_t start_time = 0;
+};
+
+Registry& GetRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+//буфер потока создаётся при первом событии и остаётся в реестре после завершения
+//потока, чтобы его события попали в вывод
+ThreadBuffer& GetThreadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer = []() {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        Registry& registry = GetRegistry();
+        std::lock_guard lock(registry.mutex);
+        buffer->thread_id = registry.next_thread_id++;
+        registry.buffers.push_back(buffer);
+        return buffer;
+    }();
+    return *buffer;
+}
+
+//буфер, оставшийся от прошлого запуска записи, очищается при первом обращении
+void PrepareBuffer(ThreadBuffer& buffer) {
+    Registry& registry = GetRegistry();
+    std::lock_guard lock(registry.mutex);
+    if (buffer.generation != registry.generation.load(std::memory_order_relaxed)) {
+        buffer.generation = registry.generation.load(std::memory_order_relaxed);
+        buffer.events.assign(std::max<size_t>(registry.events_per_thread, 1), TraceEvent{});
+        buffer.next = 0;
+        buffer.is_full = false;
+    }
+}
+
+void WriteEscaped(std::ostream& output, const std::string& text) {
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            output << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+            output << code;
+        } else {
+            output << c;
+        }
+    }
+}
+
+//время в микросекундах от начала записи с точностью до наносекунд
+void WriteMicroseconds(std::ostream& output, std::int64_t nanoseconds) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%lld.%03lld", static_cast<long long>(nanoseconds / 1000),
+                  static_cast<long long>(nanoseconds % 1000));
+    output << text;
+}
+
+} // namespace
+
+void Tracing::Start(size_t events_per_thread) {
+    Registry& registry = GetRegistry();
+    {
+        std::lock_guard lock(registry.mutex);
+        ++registry.generation;
+        registry.events_per_thread = events_per_thread;
+        registry.start_time = Now();
+        //буферы завершившихся потоков больше не нужны
+        registry.buffers.erase(std::remove_if(registry.buffers.begin(), registry.buffers.end(),
+                                              [](const std::shared_ptr<ThreadBuffer>& buffer) {
+                                                  return buffer.use_count() == 1;
+                                              }),
+                               registry.buffers.end());
+    }
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracing::Stop() {
+    enabled_.store(false, std::memory_order_relaxed);
+}
+
+void Tracing::SetThreadName(std::string name) {
+    ThreadBuffer& buffer = GetThreadBuffer();
+    std::lock_guard lock(buffer.mutex);
+    buffer.thread_name = std::move(name);
+}
+
+std::int64_t Tracing::Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void Tracing::Record(const char* name, Position pos, std::int64_t start, std::int64_t end) {
+    ThreadBuffer& buffer = GetThreadBuffer();
+    std::lock_guard lock(buffer.mutex);
+    if (buffer.generation != GetRegistry().generation.load(std::memory_order_relaxed)) {
+        PrepareBuffer(buffer);
+    }
+    buffer.events[buffer.next] = TraceEvent{name, pos, start, end};
+    if (++buffer.next == buffer.events.size()) {
+        buffer.next = 0;
+        buffer.is_full = true;
+    }
+}
+
+void Tracing::WriteJson(std::ostream& output) {
+    Registry& registry = GetRegistry();
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::uint64_t generation;
+    std::int64_t start_time;
+    {
+        std::lock_guard lock(registry.mutex);
+        buffers = registry.buffers;
+        generation = registry.generation.load(std::memory_order_relaxed);
+        start_time = registry.start_time;
+    }
+
+    output << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    bool is_first = true;
+    auto begin_event = [&output, &is_first](const char* name, int thread_id) {
+        output << (is_first ? "\n" : ",\n") << "{\"name\": \"" << name << "\", \"pid\": 1, \"tid\": " << thread_id;
+        is_first = false;
+    };
+    for (const std::shared_ptr<ThreadBuffer>& buffer : buffers) {
+        std::lock_guard lock(buffer->mutex);
+        if (!buffer->thread_name.empty()) {
+            begin_event("thread_name", buffer->thread_id);
+            output << ", \"ph\": \"M\", \"args\": {\"name\": \"";
+            WriteEscaped(output, buffer->thread_name);
+            output << "\"}}";
+        }
+        if (buffer->generation != generation) {
+            continue;
+        }
+        //от самого старого события к самому новому
+        size_t count = buffer->is_full ? buffer->events.size() : buffer->next;
+        size_t first = buffer->is_full ? buffer->next : 0;
+        for (size_t i = 0; i < count; ++i) {
+            const TraceEvent& event = buffer->events[(first + i) % buffer->events.size()];
+            //интервалы, начатые до Start, обрезаются началом записи
+            std::int64_t start = std::max(event.start, start_time);
+            begin_event(event.name, buffer->thread_id);
+            output << ", \"cat\": \"spreadsheet\", \"ph\": \"X\", \"ts\": ";
+            WriteMicroseconds(output, start - start_time);
+            output << ", \"dur\": ";
+            WriteMicroseconds(output, std::max<std::int64_t>(event.end - start, 0));
+            if (event.pos.IsValid()) {
+                output << ", \"args\": {\"cell\": \"" << event.pos.ToString() << "\"}";
+            }
+            output << '}';
+        }
+    }
+    output << "\n]}\n";
+}
+
+void Tracing::Save(const std::string& path) {
+    std::ofstream output(path);
+    WriteJson(output);
+    if (!output) {
+        using namespace std::literals;
+        throw std::runtime_error("cannot write "s + path);
+    }
+}
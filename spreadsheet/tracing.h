@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Запись событий движка на временную шкалу в формате Chrome trace-event JSON (его
+// открывают Perfetto и chrome://tracing). Событие - интервал TraceSpan: этапы
+// SetCell (разбор формулы, проверка на цикличные ссылки, связывание ячеек,
+// инвалидация) и вычисления ячеек и блоков в каждом потоке.
+// Каждый поток пишет события в свой кольцевой буфер: при записи не бывает общих
+// блокировок, а при переполнении буфера теряются самые старые события потока.
+// Запись включается для всего процесса; пока она выключена, интервал только
+// проверяет атомарный флаг.
+class Tracing {
+public:
+    static const size_t DEFAULT_EVENTS_PER_THREAD = 1 << 16;
+
+    //включает запись; записанные ранее события отбрасываются
+    static void Start(size_t events_per_thread = DEFAULT_EVENTS_PER_THREAD);
+    static void Stop();
+    static bool IsEnabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    //имя текущего потока на временной шкале
+    static void SetThreadName(std::string name);
+
+    //события всех потоков с момента Start; можно вызывать и во время записи
+    static void WriteJson(std::ostream& output);
+    //записывает события в файл; бросает std::runtime_error, если файл не удалось записать
+    static void Save(const std::string& path);
+
+private:
+    friend class TraceSpan;
+
+    static void Record(const char* name, Position pos, std::int64_t start, std::int64_t end);
+    static std::int64_t Now();
+
+    inline static std::atomic<bool> enabled_{false};
+};
+
+// Интервал на временной шкале текущего потока от создания до удаления объекта.
+// name должен жить до конца записи (обычно это строковый литерал); pos, если задана,
+// выводится в аргументах события.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name, Position pos = Position::NONE)
+        : name_(name)
+        , pos_(pos) {
+        if (Tracing::IsEnabled()) {
+            start_ = Tracing::Now();
+        }
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    ~TraceSpan() {
+        if (start_ >= 0) {
+            Tracing::Record(name_, pos_, start_, Tracing::Now());
+        }
+    }
+
+private:
+    const char* name_;
+    Position pos_;
+    //-1, если запись была выключена при создании интервала
+    std::int64_t start_ = -1;
+};
@@ -0,0 +1,134 @@
+#include "tsv_loader.h"
+#include "sheet.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+const std::uint64_t LOW_BYTES = 0x0101010101010101ULL;
+const std::uint64_t HIGH_BITS = 0x8080808080808080ULL;
+
+//ненулевой результат, если в слове есть нулевой байт; первый такой байт
+//определяется точно, старшие за ним могут давать ложные срабатывания
+std::uint64_t HasZeroByte(std::uint64_t word) {
+    return (word - LOW_BYTES) & ~word & HIGH_BITS;
+}
+
+//ищет первый '\t' или '\n', проверяя по 8 байт за шаг
+const char* FindDelimiter(const char* first, const char* last) {
+    const std::uint64_t tabs = LOW_BYTES * static_cast<unsigned char>('\t');
+    const std::uint64_t newlines = LOW_BYTES * static_cast<unsigned char>('\n');
+    while (last - first >= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, first, sizeof(word));
+        if (HasZeroByte(word ^ tabs) | HasZeroByte(word ^ newlines)) {
+            break;
+        }
+        first += 8;
+    }
+    while (first != last && *first != '\t' && *first != '\n') {
+        ++first;
+    }
+    return first;
+}
+
+} // namespace
+
+double LoadStats::MegabytesPerSecond() const {
+    return seconds > 0.0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+TsvLoader::TsvLoader(Sheet& sheet, size_t chunk_size, size_t batch_size)
+    : sheet_(sheet)
+    , chunk_size_(chunk_size > 0 ? chunk_size : CHUNK_SIZE)
+    , batch_size_(batch_size > 0 ? batch_size : BATCH_SIZE) {
+}
+
+LoadStats TsvLoader::Load(std::istream& input) {
+    auto start = std::chrono::steady_clock::now();
+    pos_ = Position{0, 0};
+    stats_ = LoadStats();
+    batch_.clear();
+
+    std::vector<char> chunk(chunk_size_);
+    //начало ячейки, не поместившейся в предыдущую порцию
+    std::string pending;
+    while (input) {
+        input.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        size_t size = static_cast<size_t>(input.gcount());
+        if (size == 0) {
+            break;
+        }
+        stats_.bytes += size;
+
+        const char* it = chunk.data();
+        const char* end = it + size;
+        while (true) {
+            const char* delimiter = FindDelimiter(it, end);
+            if (delimiter == end) {
+                pending.append(it, end);
+                break;
+            }
+
+            if (pending.empty()) {
+                AddCell(std::string_view(it, delimiter - it));
+            } else {
+                pending.append(it, delimiter);
+                AddCell(pending);
+                pending.clear();
+            }
+
+            if (*delimiter == '\t') {
+                ++pos_.col;
+            } else {
+                ++pos_.row;
+                pos_.col = 0;
+            }
+            it = delimiter + 1;
+        }
+    }
+    //последняя строка может не заканчиваться переводом строки
+    if (!pending.empty()) {
+        AddCell(pending);
+    }
+    FlushBatch();
+
+    stats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats_;
+}
+
+LoadStats TsvLoader::LoadFile(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    return Load(input);
+}
+
+void TsvLoader::AddCell(std::string_view text) {
+    if (text.empty()) {
+        ++stats_.empty_cells;
+        return;
+    }
+    if (text.size() > 1 && text[0] == FORMULA_SIGN) {
+        ++stats_.formula_cells;
+    } else {
+        ++stats_.text_cells;
+    }
+
+    batch_.emplace_back(pos_, std::string(text));
+    if (batch_.size() >= batch_size_) {
+        FlushBatch();
+    }
+}
+
+void TsvLoader::FlushBatch() {
+    if (!batch_.empty()) {
+        sheet_.SetCells(std::move(batch_));
+        batch_.clear();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class Sheet;
+
+// Статистика загрузки таблицы.
+struct LoadStats {
+    size_t bytes = 0;
+    size_t empty_cells = 0;
+    size_t text_cells = 0;
+    size_t formula_cells = 0;
+    double seconds = 0.0;
+
+    double MegabytesPerSecond() const;
+};
+
+// Потоковая загрузка таблицы из текста в формате PrintTexts: ячейки строки
+// разделены табуляцией, строки - переводом строки. Вход читается порциями по
+// chunk_size байт, разделители ищутся по 8 байт за шаг, непустые ячейки
+// передаются в таблицу группами через Sheet::SetCells. Расход памяти ограничен
+// размером порции, размером группы и длиной самой длинной ячейки.
+// Если группа не может быть записана (синтаксическая ошибка или цикличная ссылка),
+// бросается исключение; ранее записанные группы остаются в таблице.
+class TsvLoader {
+public:
+    static const size_t CHUNK_SIZE = 1 << 20;
+    static const size_t BATCH_SIZE = 1 << 14;
+
+    explicit TsvLoader(Sheet& sheet, size_t chunk_size = CHUNK_SIZE, size_t batch_size = BATCH_SIZE);
+
+    LoadStats Load(std::istream& input);
+    LoadStats LoadFile(const std::string& path);
+
+private:
+    void AddCell(std::string_view text);
+    void FlushBatch();
+
+    Sheet& sheet_;
+    size_t chunk_size_;
+    size_t batch_size_;
+
+    Position pos_;
+    LoadStats stats_;
+    std::vector<std::pair<Position, std::string>> batch_;
+};
@@ -0,0 +1,134 @@
+#include "workbook.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+Sheet& Workbook::AddSheet(std::string name) {
+    using namespace std::literals;
+    if (!IsValidSheetName(name)) {
+        throw std::invalid_argument("Invalid sheet name: "s + name);
+    }
+
+    std::unique_lock lock(sheets_mutex_);
+    if (sheet_names_.count(name) != 0) {
+        throw std::invalid_argument("Sheet already exists: "s + name);
+    }
+    auto sheet = std::make_unique<Sheet>(*this);
+    Sheet& result = *sheet;
+    sheet_names_.emplace(name, sheet.get());
+    sheets_.emplace_back(std::move(name), std::move(sheet));
+    return result;
+}
+
+Sheet* Workbook::GetSheet(std::string_view name) {
+    std::shared_lock lock(sheets_mutex_);
+    auto it = sheet_names_.find(name);
+    return it == sheet_names_.end() ? nullptr : it->second;
+}
+
+const Sheet* Workbook::GetSheet(std::string_view name) const {
+    return const_cast<Workbook*>(this)->GetSheet(name);
+}
+
+std::vector<std::string> Workbook::GetSheetNames() const {
+    std::shared_lock lock(sheets_mutex_);
+    std::vector<std::string> names;
+    names.reserve(sheets_.size());
+    for (const auto& [name, sheet] : sheets_) {
+        names.push_back(name);
+    }
+    return names;
+}
+
+void Workbook::Recalculate(size_t thread_count) const {
+    //листы не удаляются, поэтому список можно скопировать и отпустить блокировку
+    std::vector<const Sheet*> sheets;
+    {
+        std::shared_lock lock(sheets_mutex_);
+        for (const auto& [name, sheet] : sheets_) {
+            sheets.push_back(sheet.get());
+        }
+    }
+    if (sheets.empty()) {
+        return void();
+    }
+
+    std::lock_guard lock(structure_mutex_);
+
+    //группы листов, связанных ссылками: система непересекающихся множеств
+    std::unordered_map<const Sheet*, size_t> indexes;
+    for (size_t i = 0; i < sheets.size(); ++i) {
+        indexes[sheets[i]] = i;
+    }
+    std::vector<size_t> parents(sheets.size());
+    std::iota(parents.begin(), parents.end(), 0);
+    auto find_root = [&parents](size_t index) {
+        while (parents[index] != index) {
+            parents[index] = parents[parents[index]];
+            index = parents[index];
+        }
+        return index;
+    };
+    for (size_t i = 0; i < sheets.size(); ++i) {
+        for (const Sheet* referenced_sheet : sheets[i]->referenced_sheets_) {
+            parents[find_root(i)] = find_root(indexes.at(referenced_sheet));
+        }
+    }
+
+    std::vector<std::vector<const Sheet*>> groups;
+    std::unordered_map<size_t, size_t> group_indexes;
+    for (size_t i = 0; i < sheets.size(); ++i) {
+        auto [it, is_new] = group_indexes.emplace(find_root(i), groups.size());
+        if (is_new) {
+            groups.emplace_back();
+        }
+        groups[it->second].push_back(sheets[i]);
+    }
+
+    //группы не ссылаются друг на друга, поэтому потоки вычисляют непересекающиеся
+    //множества ячеек; каждый поток берёт следующую невычисленную группу
+    thread_count = std::clamp<size_t>(thread_count, 1, groups.size());
+    std::atomic<size_t> next_group = 0;
+    std::vector<std::exception_ptr> errors(thread_count);
+    std::vector<std::thread> workers;
+    workers.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers.emplace_back([&groups, &next_group, &errors, i]() {
+            try {
+                for (size_t group = next_group++; group < groups.size(); group = next_group++) {
+                    for (const Sheet* sheet : groups[group]) {
+                        sheet->RecalculateLocked();
+                    }
+                }
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+bool Workbook::IsValidSheetName(std::string_view name) {
+    auto is_letter = [](char c) {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_';
+    };
+    if (name.empty() || !is_letter(name.front())) {
+        return false;
+    }
+    return std::all_of(name.begin(), name.end(), [&is_letter](char c) {
+        return is_letter(c) || (c >= '0' && c <= '9');
+    });
+}
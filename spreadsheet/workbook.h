@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+#include "sheet.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Книга из нескольких листов. Формулы листа книги могут ссылаться на ячейки других
+// листов: Sheet2!A1. Имя листа начинается с латинской буквы или знака подчёркивания
+// и состоит из латинских букв, цифр и знаков подчёркивания.
+// * Ссылка на лист, которого нет в книге, - ошибка формулы (FormulaException).
+// * Зависимости между ячейками разных листов учитываются при инвалидации и при
+//   проверке на цикличные ссылки; пустая ячейка другого листа, как и пустая ячейка
+//   своего листа, трактуется как ноль.
+// * Листы изменяются их собственными методами (SetCell, ClearCell, ...). Изменения
+//   одной области листа выполняются параллельно, изменения, связанные с другими
+//   листами, захватывают всю книгу (см. Sheet).
+// * Снимок листа (Sheet::Snapshot()) делается вместе со снимками листов, на которые
+//   он ссылается, под блокировкой всей книги: ссылки на другие листы в нём
+//   вычисляются по состоянию книги на момент снимка.
+class Workbook {
+public:
+    static const size_t THREAD_COUNT = 4;
+
+    Workbook() = default;
+
+    Workbook(const Workbook&) = delete;
+    Workbook& operator=(const Workbook&) = delete;
+
+    //добавляет пустой лист; бросает std::invalid_argument, если имя некорректно или занято
+    Sheet& AddSheet(std::string name);
+
+    //nullptr, если листа нет
+    Sheet* GetSheet(std::string_view name);
+    const Sheet* GetSheet(std::string_view name) const;
+    //имена листов в порядке добавления
+    std::vector<std::string> GetSheetNames() const;
+
+    //вычисляет невалидные ячейки всех листов. Листы, не связанные ссылками (напрямую
+    //или через другие листы), вычисляются параллельно в thread_count потоках
+    void Recalculate(size_t thread_count = THREAD_COUNT) const;
+
+    static bool IsValidSheetName(std::string_view name);
+
+private:
+    friend class Sheet;
+
+    //общая блокировка листов книги; объявлена до листов, чтобы пережить их
+    mutable std::shared_mutex structure_mutex_;
+
+    //захватывается на запись при добавлении листа
+    mutable std::shared_mutex sheets_mutex_;
+    std::vector<std::pair<std::string, std::unique_ptr<Sheet>>> sheets_;
+    std::map<std::string, Sheet*, std::less<>> sheet_names_;
+};
@@ -0,0 +1,207 @@
+#include "workload_generator.h"
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+//участки для областей с ошибками
+const int AREA_ROWS = 64;
+const int AREA_COLS = 16;
+
+const char* const WORDS[] = {"total", "north", "q3", "pending", "n/a", "west", "draft", "ok"};
+
+//std::mt19937 выдаёт одну и ту же последовательность на всех платформах, а
+//стандартные распределения - нет, поэтому распределения свои
+class Random {
+public:
+    explicit Random(std::uint32_t seed)
+        : engine_(seed) {
+    }
+
+    //число от 0 до bound - 1
+    int Uniform(int bound) {
+        return bound <= 1 ? 0 : static_cast<int>(engine_() % static_cast<std::uint32_t>(bound));
+    }
+
+    bool Chance(double probability) {
+        return engine_() < probability * 4294967296.0;
+    }
+
+private:
+    std::mt19937 engine_;
+};
+
+class Generator {
+public:
+    Generator(SheetInterface& sheet, const WorkloadOptions& options)
+        : sheet_(sheet)
+        , options_(options)
+        , random_(options.seed)
+        , area_cols_((std::max(options.cols, 1) + AREA_COLS - 1) / AREA_COLS) {
+        //области с ошибками выбираются заранее, чтобы не зависеть от порядка обхода
+        int area_rows = (std::max(options.rows, 1) + AREA_ROWS - 1) / AREA_ROWS;
+        error_areas_.resize(size_t(area_rows) * area_cols_);
+        for (size_t i = 0; i < error_areas_.size(); ++i) {
+            error_areas_[i] = random_.Chance(options.error_region_share);
+        }
+    }
+
+    WorkloadStats Generate() {
+        for (int row = 0; row < options_.rows; ++row) {
+            bool is_total_row = options_.total_interval > 1 && row % options_.total_interval == options_.total_interval - 1;
+            for (int col = 0; col < options_.cols; ++col) {
+                Position pos{row, col};
+                if (is_total_row) {
+                    SetFormula(pos, MakeTotal(pos));
+                } else if (col < options_.chain_columns) {
+                    SetChainCell(pos);
+                } else if (random_.Chance(options_.density)) {
+                    SetRandomCell(pos);
+                }
+            }
+        }
+        return stats_;
+    }
+
+private:
+    void SetFormula(Position pos, const std::string& expression) {
+        sheet_.SetCell(pos, FORMULA_SIGN + expression);
+        ++stats_.formulas;
+    }
+
+    std::string MakeNumber() {
+        int value = random_.Uniform(1000);
+        switch (random_.Uniform(4)) {
+        case 0:
+            return std::to_string(value) + ".5";
+        case 1:
+            return std::to_string(value) + ".25";
+        default:
+            return std::to_string(value);
+        }
+    }
+
+    std::string MakeReference(Position pos) {
+        ++stats_.references;
+        return pos.ToString();
+    }
+
+    //ячейка раньше pos в порядке строк; Position::NONE, если таких нет
+    Position PickReferencedCell(Position pos) {
+        if (pos.row == 0 && pos.col == 0) {
+            return Position::NONE;
+        }
+        if (random_.Chance(options_.cross_reference_share)) {
+            int row = random_.Uniform(pos.row + 1);
+            int col = random_.Uniform(row == pos.row ? pos.col : options_.cols);
+            if (row < pos.row || col < pos.col) {
+                return {row, col};
+            }
+        }
+        int locality = std::max(options_.locality, 1);
+        int row = pos.row - random_.Uniform(std::min(locality, pos.row) + 1);
+        if (row == pos.row) {
+            if (pos.col == 0) {
+                return {row - 1, 0};
+            }
+            return {row, pos.col - 1 - random_.Uniform(std::min(locality, pos.col))};
+        }
+        int first_col = std::max(pos.col - locality, 0);
+        int last_col = std::min(pos.col + locality, options_.cols - 1);
+        return {row, first_col + random_.Uniform(last_col - first_col + 1)};
+    }
+
+    std::string MakeExpression(Position pos, int depth) {
+        if (depth <= 0 || random_.Chance(0.3)) {
+            Position referenced = PickReferencedCell(pos);
+            if (referenced.IsValid() && random_.Chance(0.75)) {
+                return MakeReference(referenced);
+            }
+            return MakeNumber();
+        }
+        switch (random_.Uniform(6)) {
+        case 0:
+            return "(" + MakeExpression(pos, depth - 1) + ")";
+        case 1:
+            return "-" + MakeExpression(pos, depth - 1);
+        default: {
+            static const char OPERATIONS[] = {'+', '-', '*', '/'};
+            std::string lhs = MakeExpression(pos, depth - 1);
+            std::string rhs = MakeExpression(pos, depth - 1);
+            return lhs + OPERATIONS[random_.Uniform(4)] + rhs;
+        }
+        }
+    }
+
+    void SetRandomCell(Position pos) {
+        if (random_.Chance(options_.formula_share)) {
+            std::string expression = MakeExpression(pos, 1 + random_.Uniform(std::max(options_.max_depth, 1)));
+            if (IsErrorArea(pos) && random_.Chance(0.5)) {
+                expression = "(" + expression + ")/0";
+            }
+            SetFormula(pos, expression);
+        } else if (random_.Chance(options_.text_share)) {
+            switch (random_.Uniform(4)) {
+            case 0:
+                sheet_.SetCell(pos, MakeNumber());
+                break;
+            case 1:
+                sheet_.SetCell(pos, ESCAPE_SIGN + MakeNumber());
+                break;
+            default: {
+                //порядок вызовов Uniform задан явно: порядок вычисления операндов + не определён
+                std::string word = WORDS[random_.Uniform(static_cast<int>(std::size(WORDS)))];
+                sheet_.SetCell(pos, word + " " + std::to_string(random_.Uniform(100)));
+            }
+            }
+            ++stats_.texts;
+        } else {
+            sheet_.SetCell(pos, MakeNumber());
+            ++stats_.numbers;
+        }
+    }
+
+    void SetChainCell(Position pos) {
+        int chain_length = std::max(options_.chain_length, 1);
+        if (pos.row % chain_length == 0) {
+            sheet_.SetCell(pos, MakeNumber());
+            ++stats_.numbers;
+            return void();
+        }
+        static const char* const STEPS[] = {"+1", "*1.01", "-0.5", "/1.5"};
+        SetFormula(pos, MakeReference({pos.row - 1, pos.col}) + STEPS[random_.Uniform(4)]);
+    }
+
+    //сумма столбца от предыдущей строки итогов
+    std::string MakeTotal(Position pos) {
+        std::string expression;
+        for (int row = pos.row - options_.total_interval + 1; row < pos.row; ++row) {
+            if (!expression.empty()) {
+                expression += '+';
+            }
+            expression += MakeReference({row, pos.col});
+        }
+        return expression.empty() ? "0" : expression;
+    }
+
+    bool IsErrorArea(Position pos) const {
+        return error_areas_[size_t(pos.row / AREA_ROWS) * area_cols_ + pos.col / AREA_COLS];
+    }
+
+    SheetInterface& sheet_;
+    const WorkloadOptions& options_;
+    Random random_;
+    int area_cols_;
+    std::vector<bool> error_areas_;
+    WorkloadStats stats_;
+};
+
+} // namespace
+
+WorkloadStats GenerateWorkload(SheetInterface& sheet, const WorkloadOptions& options) {
+    return Generator(sheet, options).Generate();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+
+// Параметры синтетической таблицы (см. GenerateWorkload).
+struct WorkloadOptions {
+    std::uint32_t seed = 1;
+    int rows = 1000;
+    int cols = 26;
+    //доля непустых ячеек
+    double density = 0.6;
+    //доли формул и текста среди непустых ячеек, остальное - числа. Текст наполовину
+    //состоит из чисел ("12.5", "'7"), наполовину из слов
+    double formula_share = 0.4;
+    double text_share = 0.15;
+    //наибольшая глубина вложенности операций в формуле
+    int max_depth = 3;
+    //ссылки формул ведут не дальше чем на locality строк вверх и столбцов в стороны
+    int locality = 8;
+    //доля ссылок на произвольную ячейку выше по листу
+    double cross_reference_share = 0.02;
+    //первые chain_columns столбцов - цепочки: ячейка ссылается на ячейку над собой;
+    //цепочка начинается заново каждые chain_length строк
+    int chain_columns = 1;
+    int chain_length = 200;
+    //каждая total_interval-я строка - итоги: сумма столбца за предыдущие строки (0 - без итогов)
+    int total_interval = 50;
+    //доля участков 64 x 16, в которых половина формул делит на ноль
+    double error_region_share = 0.05;
+};
+
+// Что было создано генератором.
+struct WorkloadStats {
+    size_t numbers = 0;
+    size_t texts = 0;
+    size_t formulas = 0;
+    size_t references = 0;
+};
+
+// Заполняет пустую таблицу ячейками, похожими на реальные таблицы: длинные цепочки,
+// строки итогов с большим числом ссылок, локальные и редкие дальние ссылки, участки
+// с ошибками вычисления, смесь чисел и текста. Формулы ссылаются только на ячейки,
+// идущие раньше в порядке строк, поэтому циклов нет. Таблица определяется
+// параметрами полностью: один и тот же seed даёт одну и ту же таблицу на любой
+// платформе. Ячейки записываются через SheetInterface::SetCell в порядке строк.
+WorkloadStats GenerateWorkload(SheetInterface& sheet, const WorkloadOptions& options);